@@ -14,6 +14,7 @@
 #include "broker/controller.h"
 #include "broker/main.h"
 #include "bus/bus.h"
+#include "bus/groups.h"
 #include "dbus/connection.h"
 #include "dbus/message.h"
 #include "util/dispatch.h"
@@ -38,7 +39,13 @@ static int broker_dispatch_signals(DispatchFile *file) {
         return DISPATCH_E_EXIT;
 }
 
-int broker_new(Broker **brokerp, const char *machine_id, int log_fd, int controller_fd, uint64_t max_bytes, uint64_t max_fds, uint64_t max_matches, uint64_t max_objects) {
+static int broker_request_groups(GroupCache *cache, uid_t uid) {
+        Broker *broker = c_container_of(cache, Broker, bus.groups);
+
+        return error_fold(controller_request_groups(&broker->controller, uid));
+}
+
+int broker_new(Broker **brokerp, const char *machine_id, int log_fd, int controller_fd, uint64_t max_bytes, uint64_t max_fds, uint64_t max_matches, uint64_t max_objects, bool lazy_validation, uint64_t cut_through, bool flow_control, unsigned int broadcast_overflow, uint64_t reply_timeout) {
         _c_cleanup_(broker_freep) Broker *broker = NULL;
         struct ucred ucred;
         socklen_t z;
@@ -80,7 +87,7 @@ int broker_new(Broker **brokerp, const char *machine_id, int log_fd, int control
         /* XXX: make this run-time optional */
         log_set_lossy(&broker->log, true);
 
-        r = bus_init(&broker->bus, &broker->log, machine_id, max_bytes, max_fds, max_matches, max_objects);
+        r = bus_init(&broker->bus, &broker->log, machine_id, max_bytes, max_fds, max_matches, max_objects, lazy_validation, cut_through, flow_control, broadcast_overflow, reply_timeout);
         if (r)
                 return error_fold(r);
 
@@ -112,6 +119,11 @@ int broker_new(Broker **brokerp, const char *machine_id, int log_fd, int control
         if (r)
                 return error_fold(r);
 
+        broker->bus.dispatcher = &broker->dispatcher;
+        dispatch_defer_init(&broker->bus.peers.goodbye, &broker->dispatcher, peer_registry_dispatch_goodbye);
+        dispatch_defer_init(&broker->bus.peers.resume, &broker->dispatcher, peer_registry_dispatch_resume);
+        group_cache_init(&broker->bus.groups, broker_request_groups);
+
         sigemptyset(&sigmask);
         sigaddset(&sigmask, SIGTERM);
         sigaddset(&sigmask, SIGINT);
@@ -33,7 +33,7 @@ struct Broker {
 
 /* broker */
 
-int broker_new(Broker **brokerp, const char *machine_id, int log_fd, int controller_fd, uint64_t max_bytes, uint64_t max_fds, uint64_t max_matches, uint64_t max_objects);
+int broker_new(Broker **brokerp, const char *machine_id, int log_fd, int controller_fd, uint64_t max_bytes, uint64_t max_fds, uint64_t max_matches, uint64_t max_objects, bool lazy_validation, uint64_t cut_through, bool flow_control, unsigned int broadcast_overflow, uint64_t reply_timeout);
 Broker *broker_free(Broker *broker);
 
 int broker_run(Broker *broker);
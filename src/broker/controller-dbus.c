@@ -79,6 +79,15 @@ static const CDVarType controller_type_in_osu[] = {
                 )
         )
 };
+static const CDVarType controller_type_reply_au[] = {
+        C_DVAR_T_INIT(
+                C_DVAR_T_TUPLE1(
+                        C_DVAR_T_ARRAY(
+                                C_DVAR_T_u
+                        )
+                )
+        )
+};
 static const CDVarType controller_type_out_unit[] = {
         C_DVAR_T_INIT(
                 CONTROLLER_T_MESSAGE(
@@ -508,10 +517,54 @@ static int controller_dispatch_object(Controller *controller, uint32_t serial, c
         return CONTROLLER_E_UNEXPECTED_PATH;
 }
 
+static int controller_dispatch_reply_groups(ControllerGroups *groups, const char *signature, Message *message) {
+        _c_cleanup_(c_dvar_deinit) CDVar var = C_DVAR_INIT;
+        _c_cleanup_(c_freep) uint32_t *gids = NULL;
+        size_t n_gids = 0;
+        uint32_t gid;
+        int r;
+
+        if (strcmp(signature, "au"))
+                return CONTROLLER_E_UNEXPECTED_SIGNATURE;
+
+        /* the array length prefix and each gid take 4 bytes of the body */
+        gids = malloc(c_max(message->n_body / sizeof(*gids), (size_t)1) * sizeof(*gids));
+        if (!gids)
+                return error_origin(-ENOMEM);
+
+        c_dvar_begin_read(&var, message->big_endian, controller_type_reply_au, 1, message->body, message->n_body);
+        c_dvar_read(&var, "([");
+
+        while (c_dvar_more(&var)) {
+                c_dvar_read(&var, "u", &gid);
+                if (n_gids < message->n_body / sizeof(*gids))
+                        gids[n_gids++] = gid;
+        }
+
+        c_dvar_read(&var, "])");
+
+        r = controller_end_read(&var);
+        if (r)
+                return error_trace(r);
+
+        r = controller_groups_resolved(groups, gids, n_gids);
+        if (r)
+                return error_trace(r);
+
+        controller_groups_free(groups);
+
+        return 0;
+}
+
 static int controller_dispatch_reply(Controller *controller, uint32_t serial, const char *signature, Message *message) {
         ControllerReload *reload;
+        ControllerGroups *groups;
         int r;
 
+        groups = controller_find_groups(controller, serial);
+        if (groups)
+                return controller_dispatch_reply_groups(groups, signature, message);
+
         reload = controller_find_reload(controller, serial);
         if (!reload)
                 return CONTROLLER_E_UNEXPECTED_REPLY;
@@ -530,8 +583,27 @@ static int controller_dispatch_reply(Controller *controller, uint32_t serial, co
 
 static int controller_dispatch_error(Controller *controller, uint32_t serial, const char *error_name, Message *message) {
         ControllerReload *reload;
+        ControllerGroups *groups;
         int r;
 
+        groups = controller_find_groups(controller, serial);
+        if (groups) {
+                /*
+                 * The controller could not resolve the groups, or does not
+                 * support resolving them at all. Refuse the connections of
+                 * the user, since continuing without its auxiliary groups
+                 * would bypass group policies. Nothing is cached, so later
+                 * connections ask again.
+                 */
+                r = controller_groups_failed(groups);
+                if (r)
+                        return error_trace(r);
+
+                controller_groups_free(groups);
+
+                return 0;
+        }
+
         reload = controller_find_reload(controller, serial);
         if (!reload)
                 return CONTROLLER_E_UNEXPECTED_REPLY;
@@ -769,3 +841,47 @@ int controller_dbus_send_reload(Controller *controller, User *user, uint32_t ser
 
         return 0;
 }
+
+/**
+ * controller_dbus_send_groups() - XXX
+ */
+int controller_dbus_send_groups(Controller *controller, uid_t uid, uint32_t serial) {
+        static const CDVarType type[] = {
+                C_DVAR_T_INIT(
+                        CONTROLLER_T_MESSAGE(
+                                C_DVAR_T_TUPLE1(
+                                        C_DVAR_T_u
+                                )
+                        )
+                )
+        };
+        _c_cleanup_(c_dvar_deinit) CDVar var = C_DVAR_INIT;
+        _c_cleanup_(message_unrefp) Message *message = NULL;
+        _c_cleanup_(c_freep) void *data = NULL;
+        size_t n_data;
+        int r;
+
+        c_dvar_begin_write(&var, (__BYTE_ORDER == __BIG_ENDIAN), type, 1);
+        c_dvar_write(&var, "((yyyyuu[(y<o>)(y<s>)(y<s>)(y<g>)])(u))",
+                     c_dvar_is_big_endian(&var) ? 'B' : 'l', DBUS_MESSAGE_TYPE_METHOD_CALL, 0, 1, 0, serial,
+                     DBUS_MESSAGE_FIELD_PATH, c_dvar_type_o, "/org/bus1/DBus/Controller",
+                     DBUS_MESSAGE_FIELD_INTERFACE, c_dvar_type_s, "org.bus1.DBus.Controller",
+                     DBUS_MESSAGE_FIELD_MEMBER, c_dvar_type_s, "ResolveGroups",
+                     DBUS_MESSAGE_FIELD_SIGNATURE, c_dvar_type_g, "u",
+                     (uint32_t)uid);
+
+        r = c_dvar_end_write(&var, &data, &n_data);
+        if (r)
+                return error_origin(r);
+
+        r = message_new_outgoing(&message, data, n_data);
+        if (r)
+                return error_fold(r);
+        data = NULL;
+
+        r = connection_queue(&controller->connection, NULL, message);
+        if (r)
+                return error_fold(r);
+
+        return 0;
+}
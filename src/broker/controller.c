@@ -10,6 +10,7 @@
 #include "bus/activation.h"
 #include "bus/bus.h"
 #include "bus/driver.h"
+#include "bus/groups.h"
 #include "bus/listener.h"
 #include "bus/policy.h"
 #include "dbus/connection.h"
@@ -105,24 +106,37 @@ ControllerReload *controller_reload_free(ControllerReload *reload) {
         return NULL;
 }
 
-static int controller_reload_new(ControllerReload **reloadp, User *user, Controller *controller) {
-        CRBNode **slot, *parent;
-        ControllerReload *reload;
+static int controller_next_serial(Controller *controller, uint32_t *serialp) {
         uint32_t serial;
-        int r;
 
+        /* serials are shared by all calls to the controller */
         for (uint32_t i = 0; i < UINT32_MAX; i++) {
                 serial = ++controller->serial;
 
-                if (!serial)
+                if (!serial ||
+                    controller_find_reload(controller, serial) ||
+                    controller_find_groups(controller, serial))
                         continue;
 
-                slot = c_rbtree_find_slot(&controller->reload_tree, controller_reload_compare, &serial, &parent);
-                if (slot)
-                        break;
+                *serialp = serial;
+                return 0;
         }
-        if (!slot)
-                return CONTROLLER_E_SERIAL_EXHAUSTED;
+
+        return CONTROLLER_E_SERIAL_EXHAUSTED;
+}
+
+static int controller_reload_new(ControllerReload **reloadp, User *user, Controller *controller) {
+        CRBNode **slot, *parent;
+        ControllerReload *reload;
+        uint32_t serial;
+        int r;
+
+        r = controller_next_serial(controller, &serial);
+        if (r)
+                return error_trace(r);
+
+        slot = c_rbtree_find_slot(&controller->reload_tree, controller_reload_compare, &serial, &parent);
+        assert(slot);
 
         reload = calloc(1, sizeof(*reload));
         if (!reload)
@@ -155,6 +169,72 @@ int controller_reload_invalid(ControllerReload *reload) {
         return error_fold(driver_reload_config_invalid(&reload->controller->broker->bus, reload->sender_id, reload->sender_serial));
 }
 
+static int controller_groups_compare(CRBTree *t, void *k, CRBNode *rb) {
+        ControllerGroups *groups = c_container_of(rb, ControllerGroups, controller_node);
+        uint32_t serial = *(uint32_t *)k;
+
+        if (serial < groups->serial)
+                return -1;
+        if (serial > groups->serial)
+                return 1;
+
+        return 0;
+}
+
+/**
+ * controller_groups_free() - XXX
+ */
+ControllerGroups *controller_groups_free(ControllerGroups *groups) {
+        if (!groups)
+                return NULL;
+
+        c_rbnode_unlink(&groups->controller_node);
+        free(groups);
+
+        return NULL;
+}
+
+static int controller_groups_new(ControllerGroups **groupsp, Controller *controller, uid_t uid) {
+        CRBNode **slot, *parent;
+        ControllerGroups *groups;
+        uint32_t serial;
+        int r;
+
+        r = controller_next_serial(controller, &serial);
+        if (r)
+                return error_trace(r);
+
+        slot = c_rbtree_find_slot(&controller->groups_tree, controller_groups_compare, &serial, &parent);
+        assert(slot);
+
+        groups = calloc(1, sizeof(*groups));
+        if (!groups)
+                return error_origin(-ENOMEM);
+
+        *groups = (ControllerGroups)CONTROLLER_GROUPS_NULL(*groups);
+        groups->controller = controller;
+        groups->serial = serial;
+        groups->uid = uid;
+
+        c_rbtree_add(&controller->groups_tree, parent, slot, &groups->controller_node);
+        *groupsp = groups;
+        return 0;
+}
+
+/**
+ * controller_groups_resolved() - XXX
+ */
+int controller_groups_resolved(ControllerGroups *groups, const uint32_t *gids, size_t n_gids) {
+        return error_fold(group_cache_resolve(&groups->controller->broker->bus.groups, groups->uid, gids, n_gids));
+}
+
+/**
+ * controller_groups_failed() - XXX
+ */
+int controller_groups_failed(ControllerGroups *groups) {
+        return error_fold(group_cache_fail(&groups->controller->broker->bus.groups, groups->uid));
+}
+
 static int controller_listener_compare(CRBTree *t, void *k, CRBNode *rb) {
         ControllerListener *listener = c_container_of(rb, ControllerListener, controller_node);
 
@@ -271,6 +351,10 @@ void controller_deinit(Controller *controller) {
         ControllerListener *listener, *listener_safe;
         ControllerName *name, *name_safe;
         ControllerReload *reload, *reload_safe;
+        ControllerGroups *groups, *groups_safe;
+
+        c_rbtree_for_each_entry_safe_postorder_unlink(groups, groups_safe, &controller->groups_tree, controller_node)
+                controller_groups_free(groups);
 
         c_rbtree_for_each_entry_safe_postorder_unlink(reload, reload_safe, &controller->reload_tree, controller_node)
                 controller_reload_free(reload);
@@ -372,6 +456,25 @@ int controller_request_reload(Controller *controller,
         return 0;
 }
 
+/**
+ * controller_request_groups() - XXX
+ */
+int controller_request_groups(Controller *controller, uid_t uid) {
+        _c_cleanup_(controller_groups_freep) ControllerGroups *groups = NULL;
+        int r;
+
+        r = controller_groups_new(&groups, controller, uid);
+        if (r)
+                return error_trace(r);
+
+        r = controller_dbus_send_groups(controller, uid, groups->serial);
+        if (r)
+                return error_trace(r);
+
+        groups = NULL;
+        return 0;
+}
+
 /**
  * controller_find_name() - XXX
  */
@@ -404,3 +507,14 @@ ControllerReload *controller_find_reload(Controller *controller, uint32_t serial
                               ControllerReload,
                               controller_node);
 }
+
+/**
+ * controller_find_groups() - XXX
+ */
+ControllerGroups *controller_find_groups(Controller *controller, uint32_t serial) {
+        return c_container_of(c_rbtree_find_node(&controller->groups_tree,
+                                                 controller_groups_compare,
+                                                 &serial),
+                              ControllerGroups,
+                              controller_node);
+}
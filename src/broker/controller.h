@@ -17,6 +17,7 @@
 typedef struct Broker Broker;
 typedef struct Bus Bus;
 typedef struct Controller Controller;
+typedef struct ControllerGroups ControllerGroups;
 typedef struct ControllerName ControllerName;
 typedef struct ControllerListener ControllerListener;
 typedef struct ControllerReload ControllerReload;
@@ -82,12 +83,24 @@ struct ControllerReload {
                 .sender_id = ADDRESS_ID_INVALID,                                        \
         }
 
+struct ControllerGroups {
+        Controller *controller;
+        CRBNode controller_node;
+        uint32_t serial;
+        uid_t uid;
+};
+
+#define CONTROLLER_GROUPS_NULL(_x) {                                                    \
+                .controller_node = (CRBNode)C_RBNODE_INIT((_x).controller_node),        \
+        }
+
 struct Controller {
         Broker *broker;
         Connection connection;
         CRBTree name_tree;
         CRBTree listener_tree;
         CRBTree reload_tree;
+        CRBTree groups_tree;
         uint32_t serial;
 };
 
@@ -96,6 +109,7 @@ struct Controller {
                 .name_tree = C_RBTREE_INIT,                                     \
                 .listener_tree = C_RBTREE_INIT,                                 \
                 .reload_tree = C_RBTREE_INIT,                                   \
+                .groups_tree = C_RBTREE_INIT,                                   \
         }
 
 /* names */
@@ -120,6 +134,13 @@ int controller_reload_invalid(ControllerReload *reload);
 
 C_DEFINE_CLEANUP(ControllerReload *, controller_reload_free);
 
+/* groups */
+ControllerGroups *controller_groups_free(ControllerGroups *groups);
+int controller_groups_resolved(ControllerGroups *groups, const uint32_t *gids, size_t n_gids);
+int controller_groups_failed(ControllerGroups *groups);
+
+C_DEFINE_CLEANUP(ControllerGroups *, controller_groups_free);
+
 /* controller */
 
 int controller_init(Controller *controller, Broker *broker, int controller_fd);
@@ -139,14 +160,17 @@ int controller_request_reload(Controller *controller,
                               User *user,
                               uint64_t sender_id,
                               uint32_t sender_serial);
+int controller_request_groups(Controller *controller, uid_t uid);
 ControllerName *controller_find_name(Controller *controller, const char *path);
 ControllerListener *controller_find_listener(Controller *controller, const char *path);
 ControllerReload *controller_find_reload(Controller *controller, uint32_t serial);
+ControllerGroups *controller_find_groups(Controller *controller, uint32_t serial);
 
 int controller_dbus_dispatch(Controller *controller, Message *message);
 int controller_dbus_send_activation(Controller *controller, const char *path);
 int controller_dbus_send_reload(Controller *controller, User *user, uint32_t serial);
 int controller_dbus_send_environment(Controller *controller, const char * const *env, size_t n_env);
+int controller_dbus_send_groups(Controller *controller, uid_t uid, uint32_t serial);
 
 C_DEFINE_CLEANUP(Controller *, controller_deinit);
 
@@ -6,23 +6,32 @@
 #include <getopt.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include "broker/broker.h"
 #include "broker/main.h"
+#include "bus/bus.h"
+#include "dbus/message.h"
 #include "util/audit.h"
 #include "util/error.h"
+#include "util/misc.h"
 #include "util/selinux.h"
 #include "util/string.h"
 
 bool main_arg_audit = false;
+unsigned int main_arg_broadcast_overflow = BUS_OVERFLOW_DISCONNECT;
 int main_arg_controller = 3;
+uint64_t main_arg_cut_through = 0;
+bool main_arg_flow_control = false;
+bool main_arg_lazy_validation = false;
 int main_arg_log = -1;
 const char *main_arg_machine_id = NULL;
 uint64_t main_arg_max_bytes = 512 * 1024 * 1024;
 uint64_t main_arg_max_fds = 128;
 uint64_t main_arg_max_matches = 16 * 1024;
 uint64_t main_arg_max_objects = 16 * 1024 * 1024;
+uint64_t main_arg_reply_timeout = 0;
 
 static void help(void) {
         printf("%s [GLOBALS...] ...\n\n"
@@ -30,13 +39,18 @@ static void help(void) {
                "  -h --help                     Show this help\n"
                "     --version                  Show package version\n"
                "     --audit                    Log to the audit subsystem\n"
+               "     --broadcast-overflow MODE  Handle subscribers out of quota: disconnect, coalesce, or drop\n"
                "     --controller FD            Specify controller file-descriptor\n"
+               "     --cut-through BYTES        Forward unicast messages of at least this size while they are received\n"
+               "     --flow-control             Pause senders rather than failing their calls if receivers are congested\n"
+               "     --lazy-validation          Do not fully validate message bodies\n"
                "     --log FD                   Provide logging socket\n"
                "     --machine-id MACHINE_ID    Machine ID of the current machine\n"
                "     --max-bytes BYTES          Maximum number of bytes each user may allocate in the broker\n"
                "     --max-fds FDS              Maximum number of file descriptors each user may allocate in the broker\n"
                "     --max-matches MATCHES      Maximum number of match rules each user may allocate in the broker\n"
                "     --max-objects OBJECTS      Maximum total number of names, peers, pending replies, etc each user may allocate in the broker\n"
+               "     --reply-timeout MSECS      Maximum time a method call may wait for its reply\n"
                , program_invocation_short_name);
 }
 
@@ -44,25 +58,35 @@ static int parse_argv(int argc, char *argv[]) {
         enum {
                 ARG_VERSION = 0x100,
                 ARG_AUDIT,
+                ARG_BROADCAST_OVERFLOW,
                 ARG_CONTROLLER,
+                ARG_CUT_THROUGH,
+                ARG_FLOW_CONTROL,
+                ARG_LAZY_VALIDATION,
                 ARG_LOG,
                 ARG_MACHINE_ID,
                 ARG_MAX_BYTES,
                 ARG_MAX_FDS,
                 ARG_MAX_MATCHES,
                 ARG_MAX_OBJECTS,
+                ARG_REPLY_TIMEOUT,
         };
         static const struct option options[] = {
                 { "help",               no_argument,            NULL,   'h'                     },
                 { "version",            no_argument,            NULL,   ARG_VERSION             },
                 { "audit",              no_argument,            NULL,   ARG_AUDIT               },
+                { "broadcast-overflow", required_argument,      NULL,   ARG_BROADCAST_OVERFLOW  },
                 { "controller",         required_argument,      NULL,   ARG_CONTROLLER          },
+                { "cut-through",        required_argument,      NULL,   ARG_CUT_THROUGH         },
+                { "flow-control",       no_argument,            NULL,   ARG_FLOW_CONTROL        },
+                { "lazy-validation",    no_argument,            NULL,   ARG_LAZY_VALIDATION     },
                 { "log",                required_argument,      NULL,   ARG_LOG                 },
                 { "machine-id",         required_argument,      NULL,   ARG_MACHINE_ID          },
                 { "max-bytes",          required_argument,      NULL,   ARG_MAX_BYTES           },
                 { "max-fds",            required_argument,      NULL,   ARG_MAX_FDS             },
                 { "max-matches",        required_argument,      NULL,   ARG_MAX_MATCHES         },
                 { "max-objects",        required_argument,      NULL,   ARG_MAX_OBJECTS         },
+                { "reply-timeout",      required_argument,      NULL,   ARG_REPLY_TIMEOUT       },
                 {}
         };
         int r, c;
@@ -81,6 +105,20 @@ static int parse_argv(int argc, char *argv[]) {
                         main_arg_audit = true;
                         break;
 
+                case ARG_BROADCAST_OVERFLOW:
+                        if (!strcmp(optarg, "disconnect")) {
+                                main_arg_broadcast_overflow = BUS_OVERFLOW_DISCONNECT;
+                        } else if (!strcmp(optarg, "coalesce")) {
+                                main_arg_broadcast_overflow = BUS_OVERFLOW_COALESCE;
+                        } else if (!strcmp(optarg, "drop")) {
+                                main_arg_broadcast_overflow = BUS_OVERFLOW_DROP;
+                        } else {
+                                fprintf(stderr, "%s: invalid broadcast overflow policy -- '%s'\n", program_invocation_name, optarg);
+                                return MAIN_FAILED;
+                        }
+
+                        break;
+
                 case ARG_CONTROLLER: {
                         unsigned long vul;
                         char *end;
@@ -96,6 +134,23 @@ static int parse_argv(int argc, char *argv[]) {
                         break;
                 }
 
+                case ARG_CUT_THROUGH:
+                        r = util_strtou64(&main_arg_cut_through, optarg);
+                        if (r) {
+                                fprintf(stderr, "%s: invalid cut-through threshold -- '%s'\n", program_invocation_name, optarg);
+                                return MAIN_FAILED;
+                        }
+
+                        break;
+
+                case ARG_FLOW_CONTROL:
+                        main_arg_flow_control = true;
+                        break;
+
+                case ARG_LAZY_VALIDATION:
+                        main_arg_lazy_validation = true;
+                        break;
+
                 case ARG_LOG: {
                         unsigned long vul;
                         char *end;
@@ -157,6 +212,15 @@ static int parse_argv(int argc, char *argv[]) {
 
                         break;
 
+                case ARG_REPLY_TIMEOUT:
+                        r = util_strtou64(&main_arg_reply_timeout, optarg);
+                        if (r) {
+                                fprintf(stderr, "%s: invalid reply timeout -- '%s'\n", program_invocation_name, optarg);
+                                return MAIN_FAILED;
+                        }
+
+                        break;
+
                 case '?':
                         /* getopt_long() prints warning */
                         return MAIN_FAILED;
@@ -237,7 +301,7 @@ static int run(void) {
         _c_cleanup_(broker_freep) Broker *broker = NULL;
         int r;
 
-        r = broker_new(&broker, main_arg_machine_id, main_arg_log, main_arg_controller, main_arg_max_bytes, main_arg_max_fds, main_arg_max_matches, main_arg_max_objects);
+        r = broker_new(&broker, main_arg_machine_id, main_arg_log, main_arg_controller, main_arg_max_bytes, main_arg_max_fds, main_arg_max_matches, main_arg_max_objects, main_arg_lazy_validation, main_arg_cut_through, main_arg_flow_control, main_arg_broadcast_overflow, util_umul64_saturating(main_arg_reply_timeout, 1000ULL * 1000ULL));
         if (!r)
                 r = broker_run(broker);
 
@@ -264,6 +328,7 @@ int main(int argc, char **argv) {
         r = run();
 
 exit:
+        message_deinit_global();
         bus_selinux_deinit_global();
         util_audit_deinit_global();
 
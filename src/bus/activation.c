@@ -59,6 +59,7 @@ int activation_init(Activation *a, Name *name, User *user) {
         activation->user = user_ref(user);
 
         name->activation = activation;
+        ++name->registry->generation;
         activation = NULL;
         return 0;
 }
@@ -80,6 +81,7 @@ void activation_deinit(Activation *activation) {
 
         if (activation->name) {
                 activation->name->activation = NULL;
+                ++activation->name->registry->generation;
                 activation->name = name_unref(activation->name);
         }
 }
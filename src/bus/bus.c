@@ -5,6 +5,7 @@
 #include <c-macro.h>
 #include <stdlib.h>
 #include <sys/auxv.h>
+#include <sys/random.h>
 #include <sys/socket.h>
 #include "bus/bus.h"
 #include "bus/driver.h"
@@ -21,7 +22,12 @@ int bus_init(Bus *bus,
              unsigned int max_bytes,
              unsigned int max_fds,
              unsigned int max_matches,
-             unsigned int max_objects) {
+             unsigned int max_objects,
+             bool lazy_validation,
+             uint64_t cut_through,
+             bool flow_control,
+             unsigned int broadcast_overflow,
+             uint64_t reply_timeout) {
         unsigned int maxima[] = { max_bytes, max_fds, max_matches, max_objects };
         void *random;
         int r;
@@ -31,6 +37,12 @@ int bus_init(Bus *bus,
 
         *bus = (Bus)BUS_NULL(*bus);
         bus->log = log;
+        bus->lazy_validation = lazy_validation;
+        /* bodies cannot be verified before they are forwarded */
+        bus->cut_through = lazy_validation ? cut_through : 0;
+        bus->flow_control = flow_control;
+        bus->broadcast_overflow = broadcast_overflow;
+        bus->reply_timeout = reply_timeout;
 
         memcpy(bus->machine_id, machine_id, sizeof(bus->machine_id));
 
@@ -38,6 +50,15 @@ int bus_init(Bus *bus,
         assert(random);
         memcpy(bus->guid, random, sizeof(bus->guid));
 
+        /*
+         * Seed the name hash, so clients cannot predict which names collide.
+         * The guid is public, so it cannot be used. This must never block,
+         * since the broker might be started before the entropy pool is
+         * initialized. In that case, the seed stays unset.
+         */
+        if (getrandom(&bus->names.seed, sizeof(bus->names.seed), GRND_NONBLOCK) != sizeof(bus->names.seed))
+                bus->names.seed = 0;
+
         static_assert(_USER_SLOT_N == C_ARRAY_SIZE(maxima),
                       "User accounting slot mismatch");
 
@@ -49,12 +70,17 @@ int bus_init(Bus *bus,
 }
 
 void bus_deinit(Bus *bus) {
+        bus->list_activatable_names.body = c_free(bus->list_activatable_names.body);
+        bus->list_names.body = c_free(bus->list_names.body);
         bus->n_seclabel = 0;
         bus->seclabel = c_free(bus->seclabel);
         bus->pid = 0;
         bus->user = user_unref(bus->user);
+        bus->dispatcher = NULL;
+        metrics_deinit(&bus->policy_metrics);
         metrics_deinit(&bus->metrics);
         peer_registry_deinit(&bus->peers);
+        group_cache_deinit(&bus->groups);
         user_registry_deinit(&bus->users);
         name_registry_deinit(&bus->names);
         match_registry_deinit(&bus->sender_matches);
@@ -133,6 +159,42 @@ void bus_get_broadcast_destinations(Bus *bus, CList *destinations, MatchRegistry
         }
 }
 
+/**
+ * bus_get_broadcast_n_args() - number of arguments needed to match a broadcast
+ * @bus:                        bus to operate on
+ * @matches:                    additional match registry, or NULL
+ * @sender:                     sending peer, or NULL if sent by the driver
+ *
+ * This returns the number of leading message arguments that must be available
+ * in the message metadata to evaluate all match rules that
+ * bus_get_broadcast_destinations() would consult for the same parameters.
+ *
+ * Return: Number of arguments referenced by the involved match rules.
+ */
+size_t bus_get_broadcast_n_args(Bus *bus, MatchRegistry *matches, Peer *sender) {
+        size_t n_args;
+
+        n_args = match_registry_get_n_args(&bus->wildcard_matches);
+
+        if (matches)
+                n_args = c_max(n_args, match_registry_get_n_args(matches));
+
+        if (sender) {
+                NameOwnership *ownership;
+
+                c_rbtree_for_each_entry(ownership, &sender->owned_names.ownership_tree, owner_node) {
+                        if (!name_ownership_is_primary(ownership))
+                                continue;
+
+                        n_args = c_max(n_args, match_registry_get_n_args(&ownership->name->sender_matches));
+                }
+        } else {
+                n_args = c_max(n_args, match_registry_get_n_args(&bus->sender_matches));
+        }
+
+        return n_args;
+}
+
 
 void bus_log_append_transaction(Bus *bus, uint64_t sender_id, uint64_t receiver_id,
                                 NameSet *sender_names, NameSet *receiver_names, const char *sender_label, const char *receiver_label,
@@ -7,6 +7,7 @@
 #include <c-macro.h>
 #include <c-rbtree.h>
 #include <stdlib.h>
+#include "bus/groups.h"
 #include "bus/listener.h"
 #include "bus/match.h"
 #include "bus/name.h"
@@ -25,13 +26,31 @@ enum {
         BUS_LOG_POLICY_TYPE_SELINUX,
 };
 
+/* what to do if a subscriber is out of quota to receive a broadcast */
+enum {
+        BUS_OVERFLOW_DISCONNECT,
+        BUS_OVERFLOW_COALESCE,
+        BUS_OVERFLOW_DROP,
+};
+
 typedef struct Bus Bus;
+typedef struct BusReplyCache BusReplyCache;
+typedef struct DispatchContext DispatchContext;
 typedef struct Log Log;
 typedef struct Message Message;
 typedef struct User User;
 
+struct BusReplyCache {
+        uint64_t generation;
+        void *body;
+        size_t n_body;
+};
+
+#define BUS_REPLY_CACHE_NULL {}
+
 struct Bus {
         Log *log;
+        DispatchContext *dispatcher;
         User *user;
         pid_t pid;
         char *seclabel;
@@ -44,11 +63,24 @@ struct Bus {
         MatchRegistry wildcard_matches;
         MatchRegistry sender_matches;
         PeerRegistry peers;
+        GroupCache groups;
+
+        BusReplyCache list_names;
+        BusReplyCache list_activatable_names;
 
         uint64_t n_monitors;
         uint64_t listener_ids;
+        uint64_t cut_through;
+        uint64_t reply_timeout;
+        unsigned int broadcast_overflow;
+        uint64_t n_broadcasts_coalesced;
+        uint64_t n_broadcasts_dropped;
+
+        bool lazy_validation : 1;
+        bool flow_control : 1;
 
         Metrics metrics;
+        Metrics policy_metrics;
 };
 
 #define BUS_NULL(_x) {                                                          \
@@ -56,8 +88,12 @@ struct Bus {
                 .names = NAME_REGISTRY_INIT,                                    \
                 .wildcard_matches = MATCH_REGISTRY_INIT((_x).wildcard_matches), \
                 .sender_matches = MATCH_REGISTRY_INIT((_x).sender_matches),     \
-                .peers = PEER_REGISTRY_INIT,                                    \
+                .peers = PEER_REGISTRY_INIT((_x).peers),                        \
+                .groups = GROUP_CACHE_NULL((_x).groups),                        \
+                .list_names = BUS_REPLY_CACHE_NULL,                             \
+                .list_activatable_names = BUS_REPLY_CACHE_NULL,                 \
                 .metrics = METRICS_INIT(CLOCK_THREAD_CPUTIME_ID),               \
+                .policy_metrics = METRICS_INIT(CLOCK_MONOTONIC),                \
         }
 
 int bus_init(Bus *bus,
@@ -66,12 +102,18 @@ int bus_init(Bus *bus,
              unsigned int max_bytes,
              unsigned int max_fds,
              unsigned int max_matches,
-             unsigned int max_objects);
+             unsigned int max_objects,
+             bool lazy_validation,
+             uint64_t cut_through,
+             bool flow_control,
+             unsigned int broadcast_overflow,
+             uint64_t reply_timeout);
 void bus_deinit(Bus *bus);
 
 Peer *bus_find_peer_by_name(Bus *bus, Name **namep, const char *name);
 void bus_get_monitor_destinations(Bus *bus, CList *destinations, Peer *sender, MessageMetadata *metadata);
 void bus_get_broadcast_destinations(Bus *bus, CList *destinations, MatchRegistry *matches, Peer *sender, MessageMetadata *metadata);
+size_t bus_get_broadcast_n_args(Bus *bus, MatchRegistry *matches, Peer *sender);
 
 void bus_log_append_transaction(Bus *bus, uint64_t sender_id, uint64_t receiver_id, NameSet *sender_names, NameSet *receiver_names, const char *sender_label, const char *receiver_label, Message *message);
 void bus_log_append_policy_send(Bus *bus, int policy_type, uint64_t sender_id, uint64_t receiver_id, NameSet *sender_names, NameSet *receiver_names, const char *sender_label, const char *receiver_label, Message *message);
@@ -6,7 +6,9 @@
 #include <c-dvar-type.h>
 #include <c-macro.h>
 #include <c-string.h>
+#include <malloc.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/epoll.h>
 #include "broker/broker.h"
 #include "bus/activation.h"
@@ -21,8 +23,11 @@
 #include "util/error.h"
 #include "util/selinux.h"
 
+typedef struct DriverEntry DriverEntry;
 typedef struct DriverInterface DriverInterface;
+typedef struct DriverLookup DriverLookup;
 typedef struct DriverMethod DriverMethod;
+typedef struct DriverTemplate DriverTemplate;
 typedef int (*DriverMethodFn) (Peer *peer, const char *path, CDVar *var_in, uint32_t serial, CDVar *var_out);
 
 struct DriverMethod {
@@ -39,6 +44,61 @@ struct DriverInterface {
         const DriverMethod *methods;
 };
 
+/* max length of an input signature of a driver method, including NUL */
+#define DRIVER_SIGNATURE_MAX (16)
+/* max number of entries in the method lookup table */
+#define DRIVER_LOOKUP_MAX (96)
+/* number of slots in the method lookup table, in bits */
+#define DRIVER_LOOKUP_BITS (12)
+
+struct DriverEntry {
+        const char *interface;
+        const DriverMethod *method;
+        char signature[DRIVER_SIGNATURE_MAX];
+};
+
+/*
+ * All driver methods are resolved via a single perfect hash table, keyed on
+ * the interface and member name. Every method is entered once with its
+ * interface, and once with the empty interface, to serve calls that do not
+ * specify an interface. The seed of the hash is chosen such that no two keys
+ * share a slot, so a lookup is a single hash computation and comparison.
+ */
+struct DriverLookup {
+        uint32_t seed;
+        size_t n_entries;
+        DriverEntry entries[DRIVER_LOOKUP_MAX];
+        uint8_t slots[1U << DRIVER_LOOKUP_BITS];
+};
+
+static_assert(DRIVER_LOOKUP_MAX < UINT8_MAX,
+              "Lookup entries must be indexable by their slots");
+
+/* max size of the constant part of a template header */
+#define DRIVER_TEMPLATE_MAX (256)
+
+/*
+ * Driver messages are generated at high rates (in particular NameOwnerChanged
+ * and friends, during connection storms). Rather than marshalling them via
+ * c-dvar every time, their constant header fields are serialized once into a
+ * template, and messages are generated by copying the template, appending the
+ * variable fields, and writing the string arguments.
+ */
+struct DriverTemplate {
+        uint8_t type;
+        const char *member;
+        const char *signature;
+        size_t n_header;
+        size_t n_fields;
+        _Alignas(8) uint8_t header[DRIVER_TEMPLATE_MAX];
+};
+
+#define DRIVER_TEMPLATE_INIT(_type, _member, _signature) {      \
+                .type = (_type),                                \
+                .member = (_member),                            \
+                .signature = (_signature),                      \
+        }
+
 /*
  * This macro defines a c-dvar type for DBus Messages. It evaluates to:
  *
@@ -241,20 +301,6 @@ static void driver_dvar_write_signature_out(CDVar *var, const CDVarType *type) {
         c_dvar_write(var, "g", signature);
 }
 
-static int driver_dvar_verify_signature_in(const CDVarType *type, const char *signature) {
-        if (type->length != strlen(signature) + 2)
-                return DRIVER_E_UNEXPECTED_SIGNATURE;
-
-        assert(type[0].element == '(');
-        assert(type[type->length - 1].element == ')');
-
-        for (unsigned int i = 1; i + 1 < type->length; i++)
-                if (signature[i - 1] != type[i].element)
-                        return DRIVER_E_UNEXPECTED_SIGNATURE;
-
-        return 0;
-}
-
 static void driver_write_reply_header(CDVar *var, Peer *peer, uint32_t serial, const CDVarType *type) {
         c_dvar_write(var, "(yyyyuu[(y<u>)(y<s>)(y<",
                      c_dvar_is_big_endian(var) ? 'B' : 'l', DBUS_MESSAGE_TYPE_METHOD_RETURN, DBUS_HEADER_FLAG_NO_REPLY_EXPECTED, 1, 0, (uint32_t)-1,
@@ -268,22 +314,224 @@ static void driver_write_reply_header(CDVar *var, Peer *peer, uint32_t serial, c
         c_dvar_write(var, ">)])");
 }
 
-static void driver_write_signal_header(CDVar *var, Peer *peer, const char *member, const char *signature) {
-        c_dvar_write(var, "(yyyyuu[(y<s>)",
-                     c_dvar_is_big_endian(var) ? 'B' : 'l', DBUS_MESSAGE_TYPE_SIGNAL, DBUS_HEADER_FLAG_NO_REPLY_EXPECTED, 1, 0, (uint32_t)-1,
-                     DBUS_MESSAGE_FIELD_SENDER, c_dvar_type_s, "org.freedesktop.DBus");
+static size_t driver_template_write_field(uint8_t *data, size_t pos, uint8_t code, char type, const char *value) {
+        size_t n = strlen(value);
+
+        /*
+         * Write a `(yv)' header field with a string, object path or
+         * signature at @pos, which must be 8-byte aligned. Returns the end
+         * of the field, without trailing padding.
+         */
+        data[pos++] = code;
+        data[pos++] = 1;
+        data[pos++] = type;
+        data[pos++] = 0;
 
-        if (peer) {
-                c_dvar_write(var, "(y<", DBUS_MESSAGE_FIELD_DESTINATION, c_dvar_type_s);
-                driver_dvar_write_unique_name(var, peer);
-                c_dvar_write(var, ">)");
+        if (type == 'g') {
+                data[pos++] = n;
+        } else {
+                memcpy(data + pos, &(uint32_t){ n }, sizeof(uint32_t));
+                pos += sizeof(uint32_t);
+        }
+
+        memcpy(data + pos, value, n + 1);
+        return pos + n + 1;
+}
+
+static size_t driver_template_write_u32(uint8_t *data, size_t pos, uint8_t code, uint32_t value) {
+        data[pos++] = code;
+        data[pos++] = 1;
+        data[pos++] = 'u';
+        data[pos++] = 0;
+        memcpy(data + pos, &value, sizeof(value));
+        return pos + sizeof(value);
+}
+
+static size_t driver_template_pad(uint8_t *data, size_t pos) {
+        size_t end = c_align8(pos);
+
+        memset(data + pos, 0, end - pos);
+        return end;
+}
+
+static size_t driver_template_write_string(uint8_t *data, size_t pos, const char *value) {
+        size_t n = strlen(value), start = C_ALIGN_TO(pos, 4);
+
+        /*
+         * Write a string body argument at @pos, or only compute its end if
+         * @data is NULL. Returns the end of the string.
+         */
+        if (data) {
+                memset(data + pos, 0, start - pos);
+                memcpy(data + start, &(uint32_t){ n }, sizeof(uint32_t));
+                memcpy(data + start + sizeof(uint32_t), value, n + 1);
         }
 
-        c_dvar_write(var, "(y<o>)(y<s>)(y<s>)(y<g>)])",
-                     DBUS_MESSAGE_FIELD_PATH, c_dvar_type_o, "/org/freedesktop/DBus",
-                     DBUS_MESSAGE_FIELD_INTERFACE, c_dvar_type_s, "org.freedesktop.DBus",
-                     DBUS_MESSAGE_FIELD_MEMBER, c_dvar_type_s, member,
-                     DBUS_MESSAGE_FIELD_SIGNATURE, c_dvar_type_g, signature);
+        return start + sizeof(uint32_t) + n + 1;
+}
+
+static DriverTemplate *driver_template_get(DriverTemplate *template) {
+        MessageHeader *header = (void *)template->header;
+        size_t pos;
+
+        if (_c_likely_(template->n_header))
+                return template;
+
+        /*
+         * Serialize the fixed header and all header fields that are constant
+         * for this kind of message. The template is always padded to 8
+         * bytes, so further fields can be appended. Field order is
+         * irrelevant to D-Bus.
+         */
+        *header = (MessageHeader){
+                .endian = (__BYTE_ORDER == __BIG_ENDIAN) ? 'B' : 'l',
+                .type = template->type,
+                .flags = DBUS_HEADER_FLAG_NO_REPLY_EXPECTED,
+                .version = 1,
+                .serial = (uint32_t)-1,
+        };
+        pos = sizeof(*header);
+
+        pos = driver_template_write_field(template->header, pos, DBUS_MESSAGE_FIELD_SENDER, 's', "org.freedesktop.DBus");
+        pos = driver_template_pad(template->header, pos);
+
+        if (template->member) {
+                pos = driver_template_write_field(template->header, pos, DBUS_MESSAGE_FIELD_PATH, 'o', "/org/freedesktop/DBus");
+                pos = driver_template_pad(template->header, pos);
+                pos = driver_template_write_field(template->header, pos, DBUS_MESSAGE_FIELD_INTERFACE, 's', "org.freedesktop.DBus");
+                pos = driver_template_pad(template->header, pos);
+                pos = driver_template_write_field(template->header, pos, DBUS_MESSAGE_FIELD_MEMBER, 's', template->member);
+                pos = driver_template_pad(template->header, pos);
+        }
+
+        pos = driver_template_write_field(template->header, pos, DBUS_MESSAGE_FIELD_SIGNATURE, 'g', template->signature);
+        template->n_fields = pos - sizeof(*header);
+        pos = driver_template_pad(template->header, pos);
+
+        assert(pos <= sizeof(template->header));
+        template->n_header = pos;
+        return template;
+}
+
+/**
+ * driver_template_new_data() - instantiate template
+ * @datap:                      output argument for the message data
+ * @n_headerp:                  output argument for the header size
+ * @template:                   template to use
+ * @destination:                destination peer, or NULL
+ * @reply_serial:               reply serial, or 0
+ * @error_name:                 error name, or NULL
+ * @n_body:                     size of the body
+ *
+ * This allocates the data of a new outgoing message with a body of @n_body
+ * bytes, and writes the header based on @template, appending the given
+ * variable header fields. The body is left for the caller to fill in, it
+ * starts right after the header, whose size is returned in @n_headerp.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+static int driver_template_new_data(uint8_t **datap,
+                                    size_t *n_headerp,
+                                    DriverTemplate *template,
+                                    Peer *destination,
+                                    uint32_t reply_serial,
+                                    const char *error_name,
+                                    size_t n_body) {
+        const char *unique_name = NULL;
+        MessageHeader *header;
+        Address address;
+        size_t pos, end;
+        uint8_t *data;
+
+        template = driver_template_get(template);
+
+        pos = template->n_header;
+        if (destination) {
+                address = (Address)ADDRESS_INIT_ID(destination->id);
+                unique_name = address_to_string(&address);
+                pos += c_align8(8 + strlen(unique_name) + 1);
+        }
+        if (reply_serial)
+                pos += 8;
+        if (error_name)
+                pos += c_align8(8 + strlen(error_name) + 1);
+
+        data = malloc(c_align8(pos + n_body));
+        if (!data)
+                return error_origin(-ENOMEM);
+
+        memcpy(data, template->header, template->n_header);
+        pos = template->n_header;
+        end = sizeof(*header) + template->n_fields;
+
+        if (destination) {
+                pos = end = driver_template_write_field(data, pos, DBUS_MESSAGE_FIELD_DESTINATION, 's', unique_name);
+                pos = driver_template_pad(data, pos);
+        }
+        if (reply_serial) {
+                pos = end = driver_template_write_u32(data, pos, DBUS_MESSAGE_FIELD_REPLY_SERIAL, reply_serial);
+                pos = driver_template_pad(data, pos);
+        }
+        if (error_name) {
+                pos = end = driver_template_write_field(data, pos, DBUS_MESSAGE_FIELD_ERROR_NAME, 's', error_name);
+                pos = driver_template_pad(data, pos);
+        }
+
+        /* the header length excludes the padding of the last field */
+        header = (void *)data;
+        header->n_fields = end - sizeof(*header);
+
+        *datap = data;
+        *n_headerp = pos;
+        return 0;
+}
+
+/**
+ * driver_template_new_message() - generate message from template
+ * @messagep:                   output argument for the new message
+ * @template:                   template to use
+ * @destination:                destination peer, or NULL
+ * @reply_serial:               reply serial, or 0
+ * @error_name:                 error name, or NULL
+ * @args:                       string arguments
+ * @n_args:                     number of string arguments
+ *
+ * This generates a new outgoing message from @template, appending the given
+ * variable header fields, and the string arguments as body. The number of
+ * arguments must match the signature of the template.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+static int driver_template_new_message(Message **messagep,
+                                       DriverTemplate *template,
+                                       Peer *destination,
+                                       uint32_t reply_serial,
+                                       const char *error_name,
+                                       const char * const *args,
+                                       size_t n_args) {
+        _c_cleanup_(c_freep) uint8_t *data = NULL;
+        size_t i, n_body = 0, pos;
+        int r;
+
+        assert(n_args == strlen(template->signature));
+
+        /* the body is 8-byte aligned, so alignment is relative to it */
+        for (i = 0; i < n_args; ++i)
+                n_body = driver_template_write_string(NULL, n_body, args[i]);
+
+        r = driver_template_new_data(&data, &pos, template, destination, reply_serial, error_name, n_body);
+        if (r)
+                return error_trace(r);
+
+        for (i = 0; i < n_args; ++i)
+                pos = driver_template_write_string(data, pos, args[i]);
+
+        r = message_new_outgoing(messagep, data, pos);
+        if (r)
+                return error_fold(r);
+        data = NULL;
+
+        return 0;
 }
 
 static const char *driver_error_to_string(int r) {
@@ -335,8 +583,17 @@ static int driver_monitor(Bus *bus, Peer *sender, Message *message) {
         if (!bus->n_monitors)
                 return 0;
 
+        /*
+         * Monitors may match on arbitrary arguments, so make sure the message
+         * is fully parsed, even if it was only lazily parsed so far, and that
+         * all its arguments are cached.
+         */
         r = message_parse_metadata(message);
-        if (r)
+        if (!r)
+                r = message_parse_metadata_lazy(message, MESSAGE_N_ARGS_MAX);
+        if (r > 0)
+                return DRIVER_E_PROTOCOL_VIOLATION;
+        else if (r < 0)
                 return error_fold(r);
 
         bus_get_monitor_destinations(bus, &destinations, sender, &message->metadata);
@@ -400,44 +657,18 @@ static int driver_send_unicast(Peer *receiver, Message *message) {
 }
 
 static int driver_send_error(Peer *receiver, uint32_t serial, const char *error, const char *error_message) {
-        static const CDVarType type[] = {
-                C_DVAR_T_INIT(
-                        DRIVER_T_MESSAGE(
-                                C_DVAR_T_TUPLE1(
-                                        C_DVAR_T_s
-                                )
-                        )
-                )
-        };
-        _c_cleanup_(c_dvar_deinit) CDVar var = C_DVAR_INIT;
+        static DriverTemplate template = DRIVER_TEMPLATE_INIT(DBUS_MESSAGE_TYPE_ERROR, NULL, "s");
         _c_cleanup_(message_unrefp) Message *message = NULL;
-        _c_cleanup_(c_freep) void *data = NULL;
-        size_t n_data;
         int r;
 
         /* If no reply was expected, never send an error. */
         if (!serial)
                 return 0;
 
-        c_dvar_begin_write(&var, (__BYTE_ORDER == __BIG_ENDIAN), type, 1);
-        c_dvar_write(&var, "((yyyyuu[(y<u>)(y<s>)(y<s>)(y<g>)(y<",
-                     c_dvar_is_big_endian(&var) ? 'B' : 'l', DBUS_MESSAGE_TYPE_ERROR, DBUS_HEADER_FLAG_NO_REPLY_EXPECTED, 1, 0, (uint32_t)-1,
-                     DBUS_MESSAGE_FIELD_REPLY_SERIAL, c_dvar_type_u, serial,
-                     DBUS_MESSAGE_FIELD_SENDER, c_dvar_type_s, "org.freedesktop.DBus",
-                     DBUS_MESSAGE_FIELD_ERROR_NAME, c_dvar_type_s, error,
-                     DBUS_MESSAGE_FIELD_SIGNATURE, c_dvar_type_g, "s",
-                     DBUS_MESSAGE_FIELD_DESTINATION, c_dvar_type_s);
-        driver_dvar_write_unique_name(&var, receiver);
-        c_dvar_write(&var, ">)])(s))", error_message);
-
-        r = c_dvar_end_write(&var, &data, &n_data);
+        r = driver_template_new_message(&message, &template, receiver, serial, error,
+                                        (const char *[]){ error_message }, 1);
         if (r)
-                return error_origin(r);
-
-        r = message_new_outgoing(&message, data, n_data);
-        if (r)
-                return error_fold(r);
-        data = NULL;
+                return error_trace(r);
 
         r = driver_send_unicast(receiver, message);
         if (r)
@@ -481,32 +712,24 @@ static int driver_send_reply(Peer *peer, CDVar *var, uint32_t serial) {
         return 0;
 }
 
-static int driver_notify_name_acquired(Peer *peer, const char *name) {
-        static const CDVarType type[] = {
-                C_DVAR_T_INIT(
-                        DRIVER_T_MESSAGE(
-                                C_DVAR_T_TUPLE1(
-                                        C_DVAR_T_s
-                                )
-                        )
-                )
-        };
-        _c_cleanup_(c_dvar_deinit) CDVar var = C_DVAR_INIT;
+static int driver_send_cached_reply(Peer *peer, uint32_t serial, BusReplyCache *cache) {
+        static DriverTemplate template = DRIVER_TEMPLATE_INIT(DBUS_MESSAGE_TYPE_METHOD_RETURN, NULL, "as");
         _c_cleanup_(message_unrefp) Message *message = NULL;
-        _c_cleanup_(c_freep) void *data = NULL;
-        size_t n_data;
+        _c_cleanup_(c_freep) uint8_t *data = NULL;
+        size_t n_header;
         int r;
 
-        c_dvar_begin_write(&var, (__BYTE_ORDER == __BIG_ENDIAN), type, 1);
-        c_dvar_write(&var, "(");
-        driver_write_signal_header(&var, peer, "NameAcquired", "s");
-        c_dvar_write(&var, "(s)", name);
-        c_dvar_write(&var, ")");
-        r = c_dvar_end_write(&var, &data, &n_data);
+        /* If no reply was expected, there is nothing to send. */
+        if (!serial)
+                return 0;
+
+        r = driver_template_new_data(&data, &n_header, &template, peer, serial, NULL, cache->n_body);
         if (r)
-                return error_origin(r);
+                return error_trace(r);
 
-        r = message_new_outgoing(&message, data, n_data);
+        memcpy(data + n_header, cache->body, cache->n_body);
+
+        r = message_new_outgoing(&message, data, n_header + cache->n_body);
         if (r)
                 return error_fold(r);
         data = NULL;
@@ -518,35 +741,30 @@ static int driver_notify_name_acquired(Peer *peer, const char *name) {
         return 0;
 }
 
-static int driver_notify_name_lost(Peer *peer, const char *name) {
-        static const CDVarType type[] = {
-                C_DVAR_T_INIT(
-                        DRIVER_T_MESSAGE(
-                                C_DVAR_T_TUPLE1(
-                                        C_DVAR_T_s
-                                )
-                        )
-                )
-        };
-        _c_cleanup_(c_dvar_deinit) CDVar var = C_DVAR_INIT;
+static int driver_notify_name_acquired(Peer *peer, const char *name) {
+        static DriverTemplate template = DRIVER_TEMPLATE_INIT(DBUS_MESSAGE_TYPE_SIGNAL, "NameAcquired", "s");
         _c_cleanup_(message_unrefp) Message *message = NULL;
-        _c_cleanup_(c_freep) void *data = NULL;
-        size_t n_data;
         int r;
 
-        c_dvar_begin_write(&var, (__BYTE_ORDER == __BIG_ENDIAN), type, 1);
-        c_dvar_write(&var, "(");
-        driver_write_signal_header(&var, peer, "NameLost", "s");
-        c_dvar_write(&var, "(s)", name);
-        c_dvar_write(&var, ")");
-        r = c_dvar_end_write(&var, &data, &n_data);
+        r = driver_template_new_message(&message, &template, peer, 0, NULL, (const char *[]){ name }, 1);
         if (r)
-                return error_origin(r);
+                return error_trace(r);
 
-        r = message_new_outgoing(&message, data, n_data);
+        r = driver_send_unicast(peer, message);
         if (r)
-                return error_fold(r);
-        data = NULL;
+                return error_trace(r);
+
+        return 0;
+}
+
+static int driver_notify_name_lost(Peer *peer, const char *name) {
+        static DriverTemplate template = DRIVER_TEMPLATE_INIT(DBUS_MESSAGE_TYPE_SIGNAL, "NameLost", "s");
+        _c_cleanup_(message_unrefp) Message *message = NULL;
+        int r;
+
+        r = driver_template_new_message(&message, &template, peer, 0, NULL, (const char *[]){ name }, 1);
+        if (r)
+                return error_trace(r);
 
         r = driver_send_unicast(peer, message);
         if (r)
@@ -567,7 +785,7 @@ static int driver_notify_name_owner_changed(Bus *bus, MatchRegistry *matches, co
                         .interface = "org.freedesktop.DBus",
                         .member = "NameOwnerChanged",
                 },
-                .args = {
+                .args = (MessageArg[]){
                         {
                                 .value = name,
                                 .element = 's',
@@ -589,36 +807,14 @@ static int driver_notify_name_owner_changed(Bus *bus, MatchRegistry *matches, co
         bus_get_broadcast_destinations(bus, &destinations, matches, NULL, &metadata);
 
         if (!c_list_is_empty(&destinations)) {
-                static const CDVarType type[] = {
-                        C_DVAR_T_INIT(
-                                DRIVER_T_MESSAGE(
-                                        C_DVAR_T_TUPLE3(
-                                                C_DVAR_T_s,
-                                                C_DVAR_T_s,
-                                                C_DVAR_T_s
-                                        )
-                                )
-                        )
-                };
-                _c_cleanup_(c_dvar_deinit) CDVar var = C_DVAR_INIT;
+                static DriverTemplate template = DRIVER_TEMPLATE_INIT(DBUS_MESSAGE_TYPE_SIGNAL, "NameOwnerChanged", "sss");
                 _c_cleanup_(message_unrefp) Message *message = NULL;
-                _c_cleanup_(c_freep) void *data = NULL;
                 MatchOwner *match_owner;
-                size_t n_data;
 
-                c_dvar_begin_write(&var, (__BYTE_ORDER == __BIG_ENDIAN), type, 1);
-                c_dvar_write(&var, "(");
-                driver_write_signal_header(&var, NULL, "NameOwnerChanged", "sss");
-                c_dvar_write(&var, "(sss)", name, old_owner, new_owner);
-                c_dvar_write(&var, ")");
-                r = c_dvar_end_write(&var, &data, &n_data);
+                r = driver_template_new_message(&message, &template, NULL, 0, NULL,
+                                                (const char *[]){ name, old_owner, new_owner }, 3);
                 if (r)
-                        return error_origin(r);
-
-                r = message_new_outgoing(&message, data, n_data);
-                if (r)
-                        return error_fold(r);
-                data = NULL;
+                        return error_trace(r);
 
                 while ((match_owner = c_list_first_entry(&destinations, MatchOwner, destinations_link))) {
                         Peer *receiver = c_container_of(match_owner, Peer, owned_matches);
@@ -772,6 +968,7 @@ static int driver_name_activated(Activation *activation, Peer *receiver) {
                 if (r) {
                         switch (r) {
                         case PEER_E_QUOTA:
+                        case PEER_E_CONNECTION_QUOTA:
                                 if (sender)
                                         r = driver_send_error(sender, message_read_serial(message->message),
                                                               "org.freedesktop.DBus.Error.LimitsExceeded",
@@ -1009,34 +1206,108 @@ static int driver_method_list_queued_owners(Peer *peer, const char *path, CDVar
         return 0;
 }
 
-static int driver_method_list_names(Peer *peer, const char *path, CDVar *in_v, uint32_t serial, CDVar *out_v) {
-        Peer *p;
+static size_t driver_write_list_names(Bus *bus, uint8_t *body) {
+        Address address;
+        size_t pos = sizeof(uint32_t);
+        Peer *peer;
         Name *name;
-        int r;
 
-        c_dvar_read(in_v, "()");
-
-        r = driver_end_read(in_v);
-        if (r)
-                return error_trace(r);
-
-        c_dvar_write(out_v, "([");
-        c_dvar_write(out_v, "s", "org.freedesktop.DBus");
-        c_rbtree_for_each_entry(p, &peer->bus->peers.peer_tree, registry_node) {
-                if (!peer_is_registered(p))
+        pos = driver_template_write_string(body, pos, "org.freedesktop.DBus");
+        c_rbtree_for_each_entry(peer, &bus->peers.peer_tree, registry_node) {
+                if (!peer_is_registered(peer))
                         continue;
 
-                driver_dvar_write_unique_name(out_v, p);
+                address = (Address)ADDRESS_INIT_ID(peer->id);
+                pos = driver_template_write_string(body, pos, address_to_string(&address));
         }
-        c_rbtree_for_each_entry(name, &peer->bus->names.name_tree, registry_node) {
+        c_rbtree_for_each_entry(name, &bus->names.name_tree, registry_node) {
                 if (!name_primary(name))
                         continue;
 
-                c_dvar_write(out_v, "s", name->name);
+                pos = driver_template_write_string(body, pos, name->name);
         }
-        c_dvar_write(out_v, "])");
 
-        r = driver_send_reply(peer, out_v, serial);
+        if (body)
+                memcpy(body, &(uint32_t){ pos - sizeof(uint32_t) }, sizeof(uint32_t));
+
+        return pos;
+}
+
+static size_t driver_write_list_activatable_names(Bus *bus, uint8_t *body) {
+        size_t pos = sizeof(uint32_t);
+        Name *name;
+
+        pos = driver_template_write_string(body, pos, "org.freedesktop.DBus");
+        c_rbtree_for_each_entry(name, &bus->names.name_tree, registry_node) {
+                if (!name->activation)
+                        continue;
+
+                pos = driver_template_write_string(body, pos, name->name);
+        }
+
+        if (body)
+                memcpy(body, &(uint32_t){ pos - sizeof(uint32_t) }, sizeof(uint32_t));
+
+        return pos;
+}
+
+/**
+ * driver_update_cache() - update reply cache
+ * @bus:                        bus to operate on
+ * @cache:                      cache to update
+ * @generation:                 current generation of the cached data
+ * @write_fn:                   function to marshal the reply body
+ *
+ * This re-marshals the reply body cached in @cache, unless it was already
+ * marshalled at @generation. @write_fn is called twice, first with a NULL
+ * buffer to compute the size of the body, then to write it.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+static int driver_update_cache(Bus *bus, BusReplyCache *cache, uint64_t generation, size_t (*write_fn)(Bus *bus, uint8_t *body)) {
+        uint8_t *body;
+        size_t n_body;
+
+        if (cache->body && cache->generation == generation)
+                return 0;
+
+        n_body = write_fn(bus, NULL);
+
+        body = malloc(n_body);
+        if (!body)
+                return error_origin(-ENOMEM);
+
+        write_fn(bus, body);
+
+        free(cache->body);
+        cache->body = body;
+        cache->n_body = n_body;
+        cache->generation = generation;
+        return 0;
+}
+
+static int driver_method_list_names(Peer *peer, const char *path, CDVar *in_v, uint32_t serial, CDVar *out_v) {
+        Bus *bus = peer->bus;
+        int r;
+
+        c_dvar_read(in_v, "()");
+
+        r = driver_end_read(in_v);
+        if (r)
+                return error_trace(r);
+
+        /*
+         * The reply lists registered peers and primary names. Both
+         * generation counters only ever increase, so their sum changes
+         * whenever either of them does.
+         */
+        r = driver_update_cache(bus, &bus->list_names,
+                                bus->names.generation + bus->peers.generation,
+                                driver_write_list_names);
+        if (r)
+                return error_trace(r);
+
+        r = driver_send_cached_reply(peer, serial, &bus->list_names);
         if (r)
                 return error_trace(r);
 
@@ -1044,7 +1315,7 @@ static int driver_method_list_names(Peer *peer, const char *path, CDVar *in_v, u
 }
 
 static int driver_method_list_activatable_names(Peer *peer, const char *path, CDVar *in_v, uint32_t serial, CDVar *out_v) {
-        Name *name;
+        Bus *bus = peer->bus;
         int r;
 
         c_dvar_read(in_v, "()");
@@ -1053,17 +1324,13 @@ static int driver_method_list_activatable_names(Peer *peer, const char *path, CD
         if (r)
                 return error_trace(r);
 
-        c_dvar_write(out_v, "([");
-        c_dvar_write(out_v, "s", "org.freedesktop.DBus");
-        c_rbtree_for_each_entry(name, &peer->bus->names.name_tree, registry_node) {
-                if (!name->activation)
-                        continue;
-
-                c_dvar_write(out_v, "s", name->name);
-        }
-        c_dvar_write(out_v, "])");
+        r = driver_update_cache(bus, &bus->list_activatable_names,
+                                bus->names.generation,
+                                driver_write_list_activatable_names);
+        if (r)
+                return error_trace(r);
 
-        r = driver_send_reply(peer, out_v, serial);
+        r = driver_send_cached_reply(peer, serial, &bus->list_activatable_names);
         if (r)
                 return error_trace(r);
 
@@ -1660,6 +1927,11 @@ static int driver_method_introspect(Peer *peer, const char *path, CDVar *in_v, u
                 "      <arg direction=\"in\" type=\"u\"/>\n"
                 "    </method>\n"
                 "  </interface>\n"
+                "  <interface name=\"org.freedesktop.DBus.Debug.Stats\">\n"
+                "    <method name=\"GetStats\">\n"
+                "      <arg direction=\"out\" type=\"a{sv}\"/>\n"
+                "    </method>\n"
+                "  </interface>\n"
                 "  <interface name=\"org.freedesktop.DBus.Peer\">\n"
                 "    <method name=\"GetMachineId\">\n"
                 "      <arg direction=\"out\" type=\"s\"/>\n"
@@ -1820,6 +2092,53 @@ static int driver_method_ping(Peer *peer, const char *path, CDVar *in_v, uint32_
         return 0;
 }
 
+static void driver_write_heap_stats(CDVar *var) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+        struct mallinfo2 info = mallinfo2();
+
+        c_dvar_write(var, "{s<t>}{s<t>}{s<t>}",
+                     "HeapBytes", c_dvar_type_t, (uint64_t)info.arena,
+                     "HeapAllocatedBytes", c_dvar_type_t, (uint64_t)info.uordblks,
+                     "HeapFreeBytes", c_dvar_type_t, (uint64_t)info.fordblks);
+#endif
+}
+
+static int driver_method_get_stats(Peer *peer, const char *path, CDVar *in_v, uint32_t serial, CDVar *out_v) {
+        MessageStats stats;
+        int r;
+
+        c_dvar_read(in_v, "()");
+
+        r = driver_end_read(in_v);
+        if (r)
+                return error_trace(r);
+
+        message_get_stats(&stats);
+
+        c_dvar_write(out_v, "([");
+
+        /* the heap layout of the broker is none of the business of other users */
+        if (peer_is_privileged(peer))
+                driver_write_heap_stats(out_v);
+
+        c_dvar_write(out_v, "{s<t>}{s<t>}{s<t>}{s<t>}{s<t>}{s<t>}{s<t>}{s<t>}{s<t>}])",
+                     "LargeMessages", c_dvar_type_t, stats.n_mapped,
+                     "LargeMessageBytes", c_dvar_type_t, stats.n_mapped_bytes,
+                     "PeakLargeMessageBytes", c_dvar_type_t, stats.n_mapped_bytes_peak,
+                     "TotalLargeMessages", c_dvar_type_t, stats.n_mapped_total,
+                     "PolicyReloads", c_dvar_type_t, peer->bus->policy_metrics.count,
+                     "AveragePolicyReloadNsec", c_dvar_type_t, peer->bus->policy_metrics.average,
+                     "PeakPolicyReloadNsec", c_dvar_type_t, peer->bus->policy_metrics.maximum,
+                     "CoalescedSignals", c_dvar_type_t, peer->bus->n_broadcasts_coalesced,
+                     "DroppedSignals", c_dvar_type_t, peer->bus->n_broadcasts_dropped);
+
+        r = driver_send_reply(peer, out_v, serial);
+        if (r)
+                return error_trace(r);
+
+        return 0;
+}
+
 static int driver_method_get_machine_id(Peer *peer, const char *path, CDVar *in_v, uint32_t serial, CDVar *out_v) {
         int r;
 
@@ -1949,8 +2268,9 @@ static int driver_method_get_all(Peer *peer, const char *path, CDVar *in_v, uint
         return 0;
 }
 
-static int driver_handle_method(const DriverMethod *method, Peer *peer, const char *path, uint32_t serial, const char *signature_in, Message *message_in) {
+static int driver_handle_method(const DriverEntry *entry, Peer *peer, const char *path, uint32_t serial, const char *signature_in, Message *message_in) {
         _c_cleanup_(c_dvar_deinit) CDVar var_in = C_DVAR_INIT, var_out = C_DVAR_INIT;
+        const DriverMethod *method = entry->method;
         int r;
 
         /*
@@ -1961,9 +2281,8 @@ static int driver_handle_method(const DriverMethod *method, Peer *peer, const ch
         if (method->path && strcmp(path, method->path) != 0)
                 return DRIVER_E_UNEXPECTED_PATH;
 
-        r = driver_dvar_verify_signature_in(method->in, signature_in);
-        if (r)
-                return error_trace(r);
+        if (strcmp(signature_in, entry->signature) != 0)
+                return DRIVER_E_UNEXPECTED_SIGNATURE;
 
         c_dvar_begin_read(&var_in, message_in->big_endian, method->in, 1, message_in->body, message_in->n_body);
         c_dvar_begin_write(&var_out, (__BYTE_ORDER == __BIG_ENDIAN), method->out, 1);
@@ -2013,6 +2332,11 @@ static const DriverMethod monitoring_methods[] = {
         { },
 };
 
+static const DriverMethod stats_methods[] = {
+        { "GetStats",                                   true,   "/org/freedesktop/DBus",        driver_method_get_stats,                                        c_dvar_type_unit,       driver_type_out_apsv },
+        { },
+};
+
 static const DriverMethod introspectable_methods[] = {
         { "Introspect",                                 true,   NULL,                           driver_method_introspect,                                       c_dvar_type_unit,       driver_type_out_s },
         { },
@@ -2028,28 +2352,160 @@ static const DriverMethod properties_methods[] = {
         { "Get",                                        true,   "/org/freedesktop/DBus",        driver_method_get,                                              driver_type_in_ss,      driver_type_out_v },
         { "Set",                                        true,   "/org/freedesktop/DBus",        driver_method_set,                                              driver_type_in_ssv,     driver_type_out_unit },
         { "GetAll",                                     true,   "/org/freedesktop/DBus",        driver_method_get_all,                                          driver_type_in_s,       driver_type_out_apsv },
+        { },
 };
 
-static int driver_dispatch_method(Peer *peer, const DriverMethod *methods, uint32_t serial, const char *method, const char *path, const char *signature, Message *message) {
-        for (size_t i = 0; methods[i].name; i++) {
-                if (strcmp(methods[i].name, method) != 0)
-                        continue;
+static const DriverInterface driver_interfaces[] = {
+        { "org.freedesktop.DBus", driver_methods },
+        { "org.freedesktop.DBus.Monitoring", monitoring_methods },
+        { "org.freedesktop.DBus.Debug.Stats", stats_methods },
+        { "org.freedesktop.DBus.Introspectable", introspectable_methods },
+        { "org.freedesktop.DBus.Peer", peer_methods },
+        { "org.freedesktop.DBus.Properties", properties_methods },
+};
+
+static uint32_t driver_lookup_hash(uint32_t seed, const char *interface, const char *member) {
+        uint32_t hash = 2166136261U ^ seed;
+        const char *p;
+
+        /* FNV-1a over "interface\0member", followed by a murmur3 finalizer */
+        for (p = interface; *p; ++p)
+                hash = (hash ^ (uint8_t)*p) * 16777619U;
+        hash *= 16777619U;
+        for (p = member; *p; ++p)
+                hash = (hash ^ (uint8_t)*p) * 16777619U;
+
+        hash ^= hash >> 16;
+        hash *= 0x85ebca6bU;
+        hash ^= hash >> 13;
+        hash *= 0xc2b2ae35U;
+        hash ^= hash >> 16;
+
+        return hash >> (32 - DRIVER_LOOKUP_BITS);
+}
 
-                if (_c_likely_(peer_is_registered(peer)) || !methods[i].needs_registration)
-                        return driver_handle_method(methods + i, peer, path, serial, signature, message);
+static void driver_lookup_add(DriverLookup *lookup, const char *interface, const DriverMethod *method) {
+        DriverEntry *entry;
+        size_t i, n;
+
+        assert(lookup->n_entries < C_ARRAY_SIZE(lookup->entries));
+
+        entry = &lookup->entries[lookup->n_entries++];
+        entry->interface = interface;
+        entry->method = method;
+
+        /* the input type is a tuple, its members form the signature */
+        n = method->in->length - 2;
+        assert(n < sizeof(entry->signature));
+        for (i = 0; i < n; ++i)
+                entry->signature[i] = method->in[i + 1].element;
+        entry->signature[n] = '\0';
+}
+
+static bool driver_lookup_seed(DriverLookup *lookup, uint32_t seed) {
+        uint32_t slot;
+        size_t i;
+
+        memset(lookup->slots, 0, sizeof(lookup->slots));
+
+        for (i = 0; i < lookup->n_entries; ++i) {
+                slot = driver_lookup_hash(seed, lookup->entries[i].interface, lookup->entries[i].method->name);
+                if (lookup->slots[slot])
+                        return false;
+
+                lookup->slots[slot] = i + 1;
         }
 
-        return DRIVER_E_UNEXPECTED_METHOD;
+        lookup->seed = seed;
+        return true;
+}
+
+static int driver_lookup_get(const DriverLookup **lookupp) {
+        static DriverLookup lookup;
+        const DriverMethod *method;
+        uint32_t seed;
+        size_t i;
+
+        if (_c_likely_(lookup.n_entries)) {
+                *lookupp = &lookup;
+                return 0;
+        }
+
+        /*
+         * Method names are unique across all interfaces, hence the entries
+         * with the empty interface are unambiguous.
+         */
+        for (i = 0; i < C_ARRAY_SIZE(driver_interfaces); ++i) {
+                for (method = driver_interfaces[i].methods; method->name; ++method) {
+                        driver_lookup_add(&lookup, driver_interfaces[i].name, method);
+                        driver_lookup_add(&lookup, "", method);
+                }
+        }
+
+        for (seed = 0; seed <= UINT16_MAX; ++seed) {
+                if (driver_lookup_seed(&lookup, seed)) {
+                        *lookupp = &lookup;
+                        return 0;
+                }
+        }
+
+        /* the table is too crowded, this needs a larger DRIVER_LOOKUP_BITS */
+        lookup.n_entries = 0;
+        return error_origin(-ENOTRECOVERABLE);
+}
+
+static int driver_lookup(const DriverEntry **entryp, const char *interface, const char *member) {
+        const DriverLookup *lookup;
+        const DriverEntry *entry;
+        uint8_t slot;
+        int r;
+
+        r = driver_lookup_get(&lookup);
+        if (r)
+                return error_trace(r);
+
+        interface = interface ?: "";
+        *entryp = NULL;
+
+        slot = lookup->slots[driver_lookup_hash(lookup->seed, interface, member)];
+        if (!slot)
+                return 0;
+
+        entry = &lookup->entries[slot - 1];
+        if (strcmp(entry->method->name, member) != 0 || strcmp(entry->interface, interface) != 0)
+                return 0;
+
+        *entryp = entry;
+        return 0;
+}
+
+static int driver_dispatch_method(Peer *peer, uint32_t serial, const char *interface, const char *member, const char *path, const char *signature, Message *message) {
+        const DriverEntry *entry;
+        int r;
+
+        r = driver_lookup(&entry, interface, member);
+        if (r)
+                return error_trace(r);
+
+        if (!entry) {
+                if (interface) {
+                        for (size_t i = 0; i < C_ARRAY_SIZE(driver_interfaces); ++i)
+                                if (strcmp(driver_interfaces[i].name, interface) == 0)
+                                        return DRIVER_E_UNEXPECTED_METHOD;
+
+                        return DRIVER_E_UNEXPECTED_INTERFACE;
+                }
+
+                return DRIVER_E_UNEXPECTED_METHOD;
+        }
+
+        if (_c_unlikely_(!peer_is_registered(peer)) && entry->method->needs_registration)
+                return DRIVER_E_UNEXPECTED_METHOD;
+
+        return error_trace(driver_handle_method(entry, peer, path, serial, signature, message));
 }
 
 static int driver_dispatch_interface(Peer *peer, uint32_t serial, const char *interface, const char *member, const char *path, const char *signature, Message *message) {
-        static const DriverInterface interfaces[] = {
-                { "org.freedesktop.DBus", driver_methods },
-                { "org.freedesktop.DBus.Monitoring", monitoring_methods },
-                { "org.freedesktop.DBus.Introspectable", introspectable_methods },
-                { "org.freedesktop.DBus.Peer", peer_methods },
-                { "org.freedesktop.DBus.Properties", properties_methods },
-        };
         int r;
 
         if (message->header->type != DBUS_MESSAGE_TYPE_METHOD_CALL)
@@ -2076,26 +2532,29 @@ static int driver_dispatch_interface(Peer *peer, uint32_t serial, const char *in
                 return error_fold(r);
         }
 
-        if (interface) {
-                for (size_t i = 0; i < C_ARRAY_SIZE(interfaces); ++i) {
-                        if (strcmp(interfaces[i].name, interface) != 0)
-                                continue;
+        return error_trace(driver_dispatch_method(peer, serial, interface, member, path, signature, message));
+}
 
-                        return error_trace(driver_dispatch_method(peer, interfaces[i].methods, serial, member, path, signature, message));
-                }
+/**
+ * driver_hangup() - detach a peer from the bus traffic
+ * @peer:               peer that hung up
+ *
+ * This drops everything that makes @peer receive messages from others: its
+ * match rules, the pending replies it waits for, and the match rules others
+ * installed on it as sender. It never sends anything, so it is cheap to call
+ * as soon as a peer hangs up, even if driver_goodbye() is only called later.
+ * Until then, peers that hung up do not show up as destinations of any
+ * broadcast, nor are they sent errors for the calls they made.
+ */
+void driver_hangup(Peer *peer) {
+        ReplySlot *reply, *reply_safe;
 
-                return DRIVER_E_UNEXPECTED_INTERFACE;
-        } else {
-                for (size_t i = 0; i < C_ARRAY_SIZE(interfaces); ++i) {
-                        r = driver_dispatch_method(peer, interfaces[i].methods, serial, member, path, signature, message);
-                        if (r == DRIVER_E_UNEXPECTED_METHOD)
-                                continue;
+        peer_flush_matches(peer);
 
-                        return error_trace(r);
-                }
+        c_list_for_each_entry_safe(reply, reply_safe, &peer->owned_replies.reply_list, owner_link)
+                reply_slot_free(reply);
 
-                return DRIVER_E_UNEXPECTED_METHOD;
-        }
+        match_registry_flush(&peer->sender_matches);
 }
 
 int driver_goodbye(Peer *peer, bool silent) {
@@ -2103,12 +2562,7 @@ int driver_goodbye(Peer *peer, bool silent) {
         NameOwnership *ownership, *ownership_safe;
         int r;
 
-        peer_flush_matches(peer);
-
-        c_list_for_each_entry_safe(reply, reply_safe, &peer->owned_replies.reply_list, owner_link)
-                reply_slot_free(reply);
-
-        match_registry_flush(&peer->sender_matches);
+        driver_hangup(peer);
 
         c_rbtree_for_each_entry_safe_postorder_unlink(ownership, ownership_safe, &peer->owned_names.ownership_tree, owner_node) {
                 NameChange change;
@@ -2141,7 +2595,7 @@ int driver_goodbye(Peer *peer, bool silent) {
 
         match_registry_flush(&peer->name_owner_changed_matches);
 
-        c_rbtree_for_each_entry_safe_postorder_unlink(reply, reply_safe, &peer->replies.reply_tree, registry_node) {
+        c_list_for_each_entry_safe(reply, reply_safe, &peer->replies.reply_list, registry_link) {
                 Peer *sender = c_container_of(reply->owner, Peer, owned_replies);
 
                 if (!silent) {
@@ -2156,6 +2610,31 @@ int driver_goodbye(Peer *peer, bool silent) {
         return 0;
 }
 
+/**
+ * driver_reply_timeout() - expire a pending reply
+ * @slot:               reply slot that timed out
+ *
+ * This is called when the reply timeout of a pending method call elapsed
+ * without the callee replying. The caller is sent a NoReply error in place
+ * of the reply, and the slot is released. A late reply from the callee is
+ * then treated like any other unexpected reply.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+int driver_reply_timeout(ReplySlot *slot) {
+        Peer *sender = c_container_of(slot->owner, Peer, owned_replies);
+        uint32_t serial = slot->serial;
+        int r;
+
+        reply_slot_free(slot);
+
+        r = driver_send_error(sender, serial, "org.freedesktop.DBus.Error.NoReply", "Reply timeout expired");
+        if (r)
+                return error_trace(r);
+
+        return 0;
+}
+
 static int driver_forward_unicast(Peer *sender, const char *destination, Message *message) {
         NameSet sender_names = NAME_SET_INIT_FROM_OWNER(&sender->owned_names);
         Peer *receiver;
@@ -2186,6 +2665,8 @@ static int driver_forward_unicast(Peer *sender, const char *destination, Message
                         return DRIVER_E_EXPECTED_REPLY_EXISTS;
                 else if (r == PEER_E_QUOTA)
                         return DRIVER_E_QUOTA;
+                else if (r == PEER_E_CONNECTION_QUOTA)
+                        return peer_stall(sender, receiver, message) ? DRIVER_E_QUOTA : 0;
                 else if (r == PEER_E_SEND_DENIED)
                         return DRIVER_E_SEND_DENIED;
                 else if (r == PEER_E_RECEIVE_DENIED)
@@ -2194,15 +2675,123 @@ static int driver_forward_unicast(Peer *sender, const char *destination, Message
                         return error_fold(r);
         }
 
+        if (_c_unlikely_(message->incomplete)) {
+                /* the remainder is forwarded as it arrives, see socket_dequeue() */
+                message->cut_through = true;
+                sender->cut_through_id = receiver->id;
+        }
+
         return 0;
 }
 
+static bool driver_broadcast_is_droppable(Message *queued, void *userdata) {
+        /*
+         * Only signals forwarded on behalf of a peer may be dropped. Signals
+         * of the driver itself (e.g., NameOwnerChanged) are never parsed nor
+         * stitched, and are always delivered.
+         */
+        return queued->parsed_header &&
+               queued->metadata.sender_id != ADDRESS_ID_INVALID &&
+               queued->metadata.header.type == DBUS_MESSAGE_TYPE_SIGNAL &&
+               !queued->metadata.fields.destination;
+}
+
+static bool driver_broadcast_supersedes(Message *queued, void *userdata) {
+        Message *message = userdata;
+        MessageArg *a, *b;
+
+        if (!driver_broadcast_is_droppable(queued, NULL))
+                return false;
+
+        if (queued->metadata.sender_id != message->metadata.sender_id ||
+            !c_string_equal(queued->metadata.fields.path, message->metadata.fields.path) ||
+            !c_string_equal(queued->metadata.fields.interface, message->metadata.fields.interface) ||
+            !c_string_equal(queued->metadata.fields.member, message->metadata.fields.member) ||
+            !c_string_equal(queued->metadata.fields.signature, message->metadata.fields.signature))
+                return false;
+
+        /* signals without payload are superseded by any later one */
+        if (!message->metadata.fields.signature || !*message->metadata.fields.signature)
+                return true;
+
+        /* otherwise, both must carry the same string as first argument */
+        if (queued->metadata.n_args < 1 || message->metadata.n_args < 1)
+                return false;
+
+        a = &queued->metadata.args[0];
+        b = &message->metadata.args[0];
+
+        return a->value && b->value && !strcmp(a->value, b->value);
+}
+
+static int driver_queue_broadcast(Peer *sender, Peer *receiver, Message *message) {
+        Bus *bus = sender->bus;
+        size_t n_dropped;
+        int r;
+
+        r = connection_queue(&receiver->connection, NULL, message);
+        if (r != CONNECTION_E_QUOTA)
+                return r;
+
+        /*
+         * The receiver cannot keep up with its subscriptions. Rather than
+         * disconnecting it, make room by removing queued signals that are
+         * superseded by the new one, or, if requested, the oldest queued
+         * signals at all. If removing signals cannot make room, nothing is
+         * removed and the caller falls back to disconnecting it.
+         */
+        if (connection_can_drop(&receiver->connection, message, driver_broadcast_supersedes, message)) {
+                n_dropped = connection_drop(&receiver->connection, message, driver_broadcast_supersedes, message);
+                bus->n_broadcasts_coalesced += n_dropped;
+
+                return connection_queue(&receiver->connection, NULL, message);
+        }
+
+        if (bus->broadcast_overflow != BUS_OVERFLOW_DROP ||
+            !connection_can_drop(&receiver->connection, message, driver_broadcast_is_droppable, NULL))
+                return r;
+
+        /* superseded signals go first, then the oldest ones */
+        n_dropped = connection_drop(&receiver->connection, message, driver_broadcast_supersedes, message);
+        bus->n_broadcasts_coalesced += n_dropped;
+
+        n_dropped = connection_drop(&receiver->connection, message, driver_broadcast_is_droppable, NULL);
+        if (n_dropped) {
+                bus->n_broadcasts_dropped += n_dropped;
+
+                if (!receiver->dropped_broadcasts) {
+                        receiver->dropped_broadcasts = true;
+
+                        log_append_here(bus->log, LOG_WARNING, 0);
+                        r = log_commitf(bus->log, "Peer :1.%llu does not have the resources to receive all signals it subscribed to, dropping the oldest ones.", receiver->id);
+                        if (r)
+                                return error_fold(r);
+                }
+        }
+
+        return connection_queue(&receiver->connection, NULL, message);
+}
+
 static int driver_forward_broadcast(Peer *sender, Message *message) {
         _c_cleanup_(c_list_flush) CList destinations = C_LIST_INIT(destinations);
         NameSet sender_names = NAME_SET_INIT_FROM_OWNER(&sender->owned_names);
         MatchOwner *match_owner;
         int r;
 
+        if (sender->bus->lazy_validation) {
+                /*
+                 * Only extract as many arguments as the involved match
+                 * rules reference. In strict mode, the message was already
+                 * fully parsed in driver_dispatch().
+                 */
+                r = message_parse_metadata_lazy(message, c_max(bus_get_broadcast_n_args(sender->bus, &sender->sender_matches, sender),
+                                                               (size_t)(sender->bus->broadcast_overflow != BUS_OVERFLOW_DISCONNECT)));
+                if (r > 0)
+                        return DRIVER_E_PROTOCOL_VIOLATION;
+                else if (r < 0)
+                        return error_fold(r);
+        }
+
         bus_get_broadcast_destinations(sender->bus, &destinations, &sender->sender_matches, sender, &message->metadata);
 
         while ((match_owner = c_list_first_entry(&destinations, MatchOwner, destinations_link))) {
@@ -2212,7 +2801,7 @@ static int driver_forward_broadcast(Peer *sender, Message *message) {
                 c_list_unlink(&match_owner->destinations_link);
 
                 r = policy_snapshot_check_send(sender->policy,
-                                               receiver->seclabel,
+                                               receiver->policy->sid,
                                                &receiver_names,
                                                message->metadata.fields.interface,
                                                message->metadata.fields.member,
@@ -2242,7 +2831,10 @@ static int driver_forward_broadcast(Peer *sender, Message *message) {
                         return error_fold(r);
                 }
 
-                r = connection_queue(&receiver->connection, NULL, message);
+                if (sender->bus->broadcast_overflow == BUS_OVERFLOW_DISCONNECT)
+                        r = connection_queue(&receiver->connection, NULL, message);
+                else
+                        r = driver_queue_broadcast(sender, receiver, message);
                 if (r) {
                         if (r == CONNECTION_E_QUOTA) {
                                 connection_shutdown(&receiver->connection);
@@ -2281,8 +2873,8 @@ static int driver_dispatch_internal(Peer *peer, Message *message) {
                         return DRIVER_E_UNEXPECTED_METHOD;
 
                 return error_trace(driver_dispatch_method(peer,
-                                                          peer_methods,
                                                           message_read_serial(message),
+                                                          "org.freedesktop.DBus.Peer",
                                                           message->metadata.fields.member,
                                                           message->metadata.fields.path,
                                                           message->metadata.fields.signature,
@@ -2345,21 +2937,36 @@ static int driver_dispatch_internal(Peer *peer, Message *message) {
         }
 }
 
-int driver_dispatch(Peer *peer, Message *message) {
+static bool driver_cut_through(Peer *peer, Message *message) {
         int r;
 
-        if (peer_is_monitor(peer))
-                return DRIVER_E_PROTOCOL_VIOLATION;
+        /*
+         * Large messages might be offered by the socket layer before they
+         * were fully received. Only unicasts to connected peers, which
+         * neither carry FDs nor are subject to monitoring, are forwarded
+         * right away. Anything else is dispatched once complete, which
+         * includes reporting any errors in the header. The message is only
+         * marked as cut-through once it was queued on its receiver, see
+         * driver_forward_unicast().
+         */
+        if (peer->bus->n_monitors || !peer_is_registered(peer))
+                return false;
 
-        r = message_parse_metadata(message);
-        if (r > 0)
-                return DRIVER_E_PROTOCOL_VIOLATION;
-        else if (r < 0)
-                return error_fold(r);
+        r = message_parse_metadata_lazy(message, 0);
+        if (r)
+                return false;
 
-        message_stitch_sender(message, peer->id);
+        if (message->metadata.fields.unix_fds ||
+            (message->metadata.header.type != DBUS_MESSAGE_TYPE_METHOD_CALL &&
+             message->metadata.header.type != DBUS_MESSAGE_TYPE_SIGNAL) ||
+            !message->metadata.fields.destination ||
+            c_string_equal(message->metadata.fields.destination, "org.freedesktop.DBus"))
+                return false;
 
-        r = driver_dispatch_internal(peer, message);
+        return !!bus_find_peer_by_name(peer->bus, NULL, message->metadata.fields.destination);
+}
+
+static int driver_dispatch_result(Peer *peer, Message *message, int r) {
         switch (r) {
         case DRIVER_E_PEER_NOT_REGISTERED:
         case DRIVER_E_INVALID_MESSAGE:
@@ -2429,3 +3036,60 @@ int driver_dispatch(Peer *peer, Message *message) {
 
         return error_trace(r);
 }
+
+int driver_dispatch(Peer *peer, Message *message) {
+        int r;
+
+        if (_c_unlikely_(message->incomplete) && !driver_cut_through(peer, message))
+                return 0;
+
+        if (peer_is_monitor(peer))
+                return DRIVER_E_PROTOCOL_VIOLATION;
+
+        /*
+         * In strict mode, every message is fully verified, to be compatible
+         * to dbus-daemon(1). In lazy mode, only the header is parsed here,
+         * and arguments are extracted on-demand for broadcasts. Bodies of
+         * messages to the driver are verified by the method dispatcher.
+         */
+        if (peer->bus->lazy_validation)
+                r = message_parse_metadata_lazy(message, 0);
+        else
+                r = message_parse_metadata(message);
+        if (r > 0)
+                return DRIVER_E_PROTOCOL_VIOLATION;
+        else if (r < 0)
+                return error_fold(r);
+
+        message_stitch_sender(message, peer->id);
+
+        r = driver_dispatch_internal(peer, message);
+
+        /*
+         * If an incomplete message could not be forwarded right away, it is
+         * dispatched again once complete, and any error is reported then.
+         */
+        if (_c_unlikely_(message->incomplete && !message->cut_through))
+                return (r < 0) ? error_trace(r) : 0;
+
+        return error_trace(driver_dispatch_result(peer, message, r));
+}
+
+/**
+ * driver_resume() - retry a message that was held back
+ * @peer:               peer that sent @message
+ * @message:            message to retry
+ *
+ * This retries forwarding @message, after its receiver drained the queue it
+ * was held back on, see peer_stall(). The message was already dispatched
+ * otherwise, including monitoring. Hence, only its forwarding is repeated.
+ * Failures are reported to @peer, just like driver_dispatch() does.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+int driver_resume(Peer *peer, Message *message) {
+        int r;
+
+        r = driver_forward_unicast(peer, message->metadata.fields.destination, message);
+        return error_trace(driver_dispatch_result(peer, message, r));
+}
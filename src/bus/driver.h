@@ -10,6 +10,7 @@ typedef struct Bus Bus;
 typedef struct MatchOwner MatchOwner;
 typedef struct Message Message;
 typedef struct Peer Peer;
+typedef struct ReplySlot ReplySlot;
 typedef struct User User;
 
 enum {
@@ -69,4 +70,7 @@ int driver_reload_config_completed(Bus *bus, uint64_t sender_id, uint32_t reply_
 int driver_reload_config_invalid(Bus *bus, uint64_t sender_id, uint32_t reply_serial);
 
 int driver_dispatch(Peer *peer, Message *message);
+int driver_resume(Peer *peer, Message *message);
+void driver_hangup(Peer *peer);
 int driver_goodbye(Peer *peer, bool silent);
+int driver_reply_timeout(ReplySlot *slot);
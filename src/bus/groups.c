@@ -0,0 +1,352 @@
+/*
+ * Auxiliary Group Cache
+ *
+ * Group policies need the auxiliary groups of a peer. Usually, the kernel
+ * provides them via SO_PEERGROUPS. On kernels without support for it, they
+ * must be resolved through the user database instead, which might block for
+ * an arbitrary amount of time (e.g., when backed by the network). The broker
+ * never does that itself, but asks its controller to resolve them.
+ *
+ * This cache remembers the groups resolved for each uid. While a request is
+ * in flight, connections of that uid wait on the entry and are resumed once
+ * the answer arrives. Resolved groups are used for a limited time only. Once
+ * expired, they are still handed out, but a new request is sent to refresh
+ * them, so no connection has to wait for a user that is already known.
+ * Expired entries nobody asked for are released eventually.
+ *
+ * If a request fails, the entry is dropped and its waiters are told so. They
+ * must not continue without the groups, since group policies would silently
+ * not apply to them otherwise.
+ */
+
+#include <c-list.h>
+#include <c-macro.h>
+#include <c-rbtree.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bus/groups.h"
+#include "util/error.h"
+
+static uint64_t group_cache_now(void) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(CLOCK_MONOTONIC, &ts);
+        assert(r >= 0);
+
+        return ts.tv_sec * 1000ULL * 1000ULL * 1000ULL + ts.tv_nsec;
+}
+
+static int group_entry_compare(CRBTree *t, void *k, CRBNode *rb) {
+        GroupEntry *entry = c_container_of(rb, GroupEntry, cache_node);
+        uid_t uid = *(uid_t *)k;
+
+        if (uid < entry->uid)
+                return -1;
+        if (uid > entry->uid)
+                return 1;
+
+        return 0;
+}
+
+static GroupEntry *group_entry_free(GroupEntry *entry) {
+        if (!entry)
+                return NULL;
+
+        assert(c_list_is_empty(&entry->waiter_list));
+
+        c_list_unlink(&entry->expiry_link);
+        c_rbnode_unlink(&entry->cache_node);
+        free(entry->gids);
+        free(entry);
+
+        return NULL;
+}
+
+C_DEFINE_CLEANUP(GroupEntry *, group_entry_free);
+
+static int group_cache_ref_entry(GroupCache *cache, GroupEntry **entryp, uid_t uid) {
+        _c_cleanup_(group_entry_freep) GroupEntry *entry = NULL;
+        CRBNode **slot, *parent;
+
+        slot = c_rbtree_find_slot(&cache->entry_tree, group_entry_compare, &uid, &parent);
+        if (!slot) {
+                *entryp = c_container_of(parent, GroupEntry, cache_node);
+                return 0;
+        }
+
+        entry = calloc(1, sizeof(*entry));
+        if (!entry)
+                return error_origin(-ENOMEM);
+
+        entry->cache = cache;
+        entry->cache_node = (CRBNode)C_RBNODE_INIT(entry->cache_node);
+        entry->expiry_link = (CList)C_LIST_INIT(entry->expiry_link);
+        entry->uid = uid;
+        entry->waiter_list = (CList)C_LIST_INIT(entry->waiter_list);
+
+        c_rbtree_add(&cache->entry_tree, parent, slot, &entry->cache_node);
+        *entryp = entry;
+        entry = NULL;
+        return 0;
+}
+
+static int group_entry_request(GroupEntry *entry) {
+        int r;
+
+        if (entry->pending)
+                return 0;
+
+        r = entry->cache->request_fn(entry->cache, entry->uid);
+        if (r)
+                return error_trace(r);
+
+        /* entries are only released while no request is in flight */
+        c_list_unlink(&entry->expiry_link);
+        entry->pending = true;
+        return 0;
+}
+
+static GroupEntry *group_cache_find_entry(GroupCache *cache, uid_t uid) {
+        return c_container_of(c_rbtree_find_node(&cache->entry_tree, group_entry_compare, &uid),
+                              GroupEntry,
+                              cache_node);
+}
+
+static void group_cache_prune(GroupCache *cache) {
+        GroupEntry *entry;
+        uint64_t now;
+
+        /*
+         * The expiry list only contains resolved entries without a request in
+         * flight, and hence without waiters. They are ordered by expiry, so
+         * stop at the first one that is still valid.
+         */
+        now = group_cache_now();
+        while ((entry = c_list_first_entry(&cache->expiry_list, GroupEntry, expiry_link))) {
+                if (now < entry->expiry)
+                        break;
+
+                group_entry_free(entry);
+        }
+}
+
+/**
+ * group_waiter_init() - initialize waiter
+ * @waiter:             waiter to operate on
+ * @fn:                 function to call once the groups are resolved
+ */
+void group_waiter_init(GroupWaiter *waiter, GroupWaiterFn fn) {
+        *waiter = (GroupWaiter)GROUP_WAITER_NULL(*waiter);
+        waiter->fn = fn;
+}
+
+/**
+ * group_waiter_deinit() - deinitialize waiter
+ * @waiter:             waiter to operate on
+ *
+ * This stops @waiter from waiting, if it still does. The request it waited
+ * on stays in flight, its answer is cached regardless.
+ */
+void group_waiter_deinit(GroupWaiter *waiter) {
+        c_list_unlink(&waiter->entry_link);
+        waiter->entry = NULL;
+        waiter->fn = NULL;
+}
+
+/**
+ * group_cache_init() - initialize group cache
+ * @cache:              cache to operate on
+ * @fn:                 function to request the groups of a uid with
+ *
+ * This initializes a new, empty group cache. Whenever the groups of a uid are
+ * needed, but not known, @fn is called to request them. Its caller must
+ * eventually answer each request via group_cache_resolve() or
+ * group_cache_fail().
+ */
+void group_cache_init(GroupCache *cache, GroupCacheRequestFn fn) {
+        *cache = (GroupCache)GROUP_CACHE_NULL(*cache);
+        cache->request_fn = fn;
+}
+
+/**
+ * group_cache_deinit() - deinitialize group cache
+ * @cache:              cache to operate on
+ *
+ * This releases all entries of @cache. No waiter must be left.
+ */
+void group_cache_deinit(GroupCache *cache) {
+        GroupEntry *entry, *safe;
+
+        c_rbtree_for_each_entry_safe_postorder_unlink(entry, safe, &cache->entry_tree, cache_node)
+                group_entry_free(entry);
+
+        cache->request_fn = NULL;
+}
+
+/**
+ * group_cache_get() - look up groups of a uid
+ * @cache:              cache to operate on
+ * @uid:                uid to look up
+ * @gidsp:              output argument for the groups
+ * @n_gidsp:            output argument for the number of groups
+ *
+ * This looks up the groups of @uid. If they are not known, yet, they are
+ * requested, unless a request is already in flight. In that case, the caller
+ * should use group_cache_wait() to get notified once they are resolved. If
+ * the groups are known but expired, they are returned regardless, and a
+ * request to refresh them is sent.
+ *
+ * Expired entries of other uids, which nobody asked for since, are released
+ * on the way. The returned array stays valid until the next call into
+ * @cache.
+ *
+ * Return: 0 on success, GROUP_E_PENDING if the groups are not known, yet,
+ *         negative error code on failure.
+ */
+int group_cache_get(GroupCache *cache, uid_t uid, const uint32_t **gidsp, size_t *n_gidsp) {
+        GroupEntry *entry;
+        int r;
+
+        r = group_cache_ref_entry(cache, &entry, uid);
+        if (r)
+                return error_trace(r);
+
+        if (!entry->expiry || group_cache_now() >= entry->expiry) {
+                r = group_entry_request(entry);
+                if (r)
+                        return error_trace(r);
+
+                if (!entry->expiry)
+                        return GROUP_E_PENDING;
+        }
+
+        *gidsp = entry->gids;
+        *n_gidsp = entry->n_gids;
+
+        group_cache_prune(cache);
+        return 0;
+}
+
+/**
+ * group_cache_wait() - wait for groups of a uid
+ * @cache:              cache to operate on
+ * @waiter:             waiter to queue
+ * @uid:                uid to wait for
+ *
+ * This queues @waiter on the groups of @uid. Once the request is answered,
+ * @waiter is dequeued and its callback is invoked, telling whether the groups
+ * were resolved. The caller must only wait for groups that group_cache_get()
+ * reported as pending.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+int group_cache_wait(GroupCache *cache, GroupWaiter *waiter, uid_t uid) {
+        GroupEntry *entry;
+        int r;
+
+        assert(!group_waiter_is_waiting(waiter));
+
+        r = group_cache_ref_entry(cache, &entry, uid);
+        if (r)
+                return error_trace(r);
+
+        r = group_entry_request(entry);
+        if (r)
+                return error_trace(r);
+
+        waiter->entry = entry;
+        c_list_link_tail(&entry->waiter_list, &waiter->entry_link);
+        return 0;
+}
+
+/**
+ * group_cache_resolve() - answer a request
+ * @cache:              cache to operate on
+ * @uid:                uid the groups were requested for
+ * @gids:               auxiliary groups of @uid
+ * @n_gids:             number of groups
+ *
+ * This stores @gids as the groups of @uid and wakes up everyone waiting for
+ * them. If they could not be resolved, group_cache_fail() must be used
+ * instead.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+int group_cache_resolve(GroupCache *cache, uid_t uid, const uint32_t *gids, size_t n_gids) {
+        GroupEntry *entry;
+        GroupWaiter *waiter;
+        uint32_t *copy = NULL;
+        int r;
+
+        entry = group_cache_find_entry(cache, uid);
+        if (!entry)
+                return 0;
+
+        if (n_gids) {
+                copy = malloc(n_gids * sizeof(*copy));
+                if (!copy)
+                        return error_origin(-ENOMEM);
+
+                memcpy(copy, gids, n_gids * sizeof(*copy));
+        }
+
+        free(entry->gids);
+        entry->gids = copy;
+        entry->n_gids = n_gids;
+        entry->pending = false;
+        entry->expiry = group_cache_now() + cache->ttl;
+        c_list_unlink(&entry->expiry_link);
+        c_list_link_tail(&cache->expiry_list, &entry->expiry_link);
+
+        while ((waiter = c_list_first_entry(&entry->waiter_list, GroupWaiter, entry_link))) {
+                c_list_unlink(&waiter->entry_link);
+                waiter->entry = NULL;
+
+                r = waiter->fn(waiter, true);
+                if (r)
+                        return error_trace(r);
+        }
+
+        return 0;
+}
+
+/**
+ * group_cache_fail() - fail a request
+ * @cache:              cache to operate on
+ * @uid:                uid the groups were requested for
+ *
+ * This tells everyone waiting for the groups of @uid that they could not be
+ * resolved, and forgets about @uid, including any groups resolved for it
+ * earlier. Nothing is cached, so the next lookup sends a new request.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+int group_cache_fail(GroupCache *cache, uid_t uid) {
+        GroupEntry *entry;
+        GroupWaiter *waiter;
+        int r;
+
+        entry = group_cache_find_entry(cache, uid);
+        if (!entry)
+                return 0;
+
+        entry->pending = false;
+        entry->expiry = 0;
+
+        while ((waiter = c_list_first_entry(&entry->waiter_list, GroupWaiter, entry_link))) {
+                c_list_unlink(&waiter->entry_link);
+                waiter->entry = NULL;
+
+                r = waiter->fn(waiter, false);
+                if (r)
+                        return error_trace(r);
+        }
+
+        /* a waiter might have asked again, in which case the entry stays */
+        if (!entry->pending && c_list_is_empty(&entry->waiter_list))
+                group_entry_free(entry);
+
+        return 0;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+/*
+ * Auxiliary Group Cache
+ */
+
+#include <c-list.h>
+#include <c-macro.h>
+#include <c-rbtree.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+typedef struct GroupCache GroupCache;
+typedef struct GroupEntry GroupEntry;
+typedef struct GroupWaiter GroupWaiter;
+
+typedef int (*GroupCacheRequestFn) (GroupCache *cache, uid_t uid);
+typedef int (*GroupWaiterFn) (GroupWaiter *waiter, bool resolved);
+
+enum {
+        _GROUP_E_SUCCESS,
+
+        GROUP_E_PENDING,
+};
+
+/* time in nanoseconds resolved groups are used without refreshing them */
+#define GROUP_CACHE_TTL_DEFAULT (60ULL * 1000ULL * 1000ULL * 1000ULL)
+
+struct GroupWaiter {
+        GroupEntry *entry;
+        CList entry_link;
+        GroupWaiterFn fn;
+};
+
+#define GROUP_WAITER_NULL(_x) {                                         \
+                .entry_link = C_LIST_INIT((_x).entry_link),             \
+        }
+
+struct GroupEntry {
+        GroupCache *cache;
+        CRBNode cache_node;
+        CList expiry_link;
+        uid_t uid;
+        bool pending : 1;
+        uint64_t expiry;
+        CList waiter_list;
+        size_t n_gids;
+        uint32_t *gids;
+};
+
+struct GroupCache {
+        CRBTree entry_tree;
+        CList expiry_list;
+        GroupCacheRequestFn request_fn;
+        uint64_t ttl;
+};
+
+#define GROUP_CACHE_NULL(_x) {                                          \
+                .entry_tree = C_RBTREE_INIT,                            \
+                .expiry_list = C_LIST_INIT((_x).expiry_list),           \
+                .ttl = GROUP_CACHE_TTL_DEFAULT,                         \
+        }
+
+/* waiters */
+
+void group_waiter_init(GroupWaiter *waiter, GroupWaiterFn fn);
+void group_waiter_deinit(GroupWaiter *waiter);
+
+/* cache */
+
+void group_cache_init(GroupCache *cache, GroupCacheRequestFn fn);
+void group_cache_deinit(GroupCache *cache);
+
+int group_cache_get(GroupCache *cache, uid_t uid, const uint32_t **gidsp, size_t *n_gidsp);
+int group_cache_wait(GroupCache *cache, GroupWaiter *waiter, uid_t uid);
+int group_cache_resolve(GroupCache *cache, uid_t uid, const uint32_t *gids, size_t n_gids);
+int group_cache_fail(GroupCache *cache, uid_t uid);
+
+C_DEFINE_CLEANUP(GroupCache *, group_cache_deinit);
+
+/* inline helpers */
+
+static inline bool group_waiter_is_waiting(GroupWaiter *waiter) {
+        return !!waiter->entry;
+}
@@ -6,51 +6,135 @@
 #include <c-macro.h>
 #include <stdlib.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include "bus/bus.h"
+#include "bus/groups.h"
 #include "bus/listener.h"
 #include "bus/peer.h"
 #include "bus/policy.h"
 #include "util/dispatch.h"
 #include "util/error.h"
+#include "util/metrics.h"
+#include "util/user.h"
 
-static int listener_dispatch(DispatchFile *file) {
-        Listener *listener = c_container_of(file, Listener, socket_file);
-        _c_cleanup_(peer_freep) Peer *peer = NULL;
-        _c_cleanup_(c_closep) int fd = -1;
-        int r;
+/*
+ * A connection whose peer cannot be created, yet, since the auxiliary groups
+ * of its user are still being resolved. The file descriptor is accounted on
+ * the user, so nobody can queue up connections without bounds.
+ */
+struct ListenerPending {
+        Listener *listener;
+        CList listener_link;
+        GroupWaiter waiter;
+        User *user;
+        UserCharge charge;
+        int fd;
+};
 
-        if (!(dispatch_file_events(file) & EPOLLIN))
-                return 0;
+static int listener_accept(Listener *listener, DispatchContext *dispatcher, int fd_in);
 
-        fd = accept4(listener->socket_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
-        if (fd < 0) {
-                if (errno == EAGAIN) {
-                        /*
-                         * EAGAIN implies there are no pending incoming
-                         * connections. Catch this, clear EPOLLIN and tell the
-                         * caller about it.
-                         */
-                        dispatch_file_clear(&listener->socket_file, EPOLLIN);
-                        return 0;
-                } else {
-                        /*
-                         * The linux UDS layer does not return pending errors
-                         * on the child socket (unlike the TCP layer). Hence,
-                         * there are no known errors to check for.
-                         */
-                        return error_origin(-errno);
-                }
+static ListenerPending *listener_pending_free(ListenerPending *pending) {
+        if (!pending)
+                return NULL;
+
+        c_close(pending->fd);
+        user_charge_deinit(&pending->charge);
+        user_unref(pending->user);
+        group_waiter_deinit(&pending->waiter);
+        c_list_unlink(&pending->listener_link);
+        free(pending);
+
+        return NULL;
+}
+
+C_DEFINE_CLEANUP(ListenerPending *, listener_pending_free);
+
+static int listener_pending_resume(GroupWaiter *waiter, bool resolved) {
+        ListenerPending *pending = c_container_of(waiter, ListenerPending, waiter);
+        Listener *listener = pending->listener;
+        int fd = pending->fd;
+
+        if (!resolved) {
+                /* the groups of the user are unknown, refuse the connection */
+                listener_pending_free(pending);
+                return 0;
         }
 
-        r = peer_new_with_fd(&peer, listener->bus, listener->policy, listener->guid, file->context, fd);
+        pending->fd = -1;
+        listener_pending_free(pending);
+
+        return error_trace(listener_accept(listener, listener->socket_file.context, fd));
+}
+
+static int listener_pending_new(Listener *listener, int fd_in) {
+        _c_cleanup_(listener_pending_freep) ListenerPending *pending = NULL;
+        _c_cleanup_(c_closep) int fd = fd_in;
+        struct ucred ucred;
+        socklen_t socklen = sizeof(ucred);
+        int r;
+
+        r = getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &ucred, &socklen);
+        if (r < 0)
+                return error_origin(-errno);
+
+        pending = calloc(1, sizeof(*pending));
+        if (!pending)
+                return error_origin(-ENOMEM);
+
+        pending->listener = listener;
+        pending->listener_link = (CList)C_LIST_INIT(pending->listener_link);
+        group_waiter_init(&pending->waiter, listener_pending_resume);
+        user_charge_init(&pending->charge);
+        pending->fd = fd;
+        fd = -1;
+
+        r = user_registry_ref_user(&listener->bus->users, &pending->user, ucred.uid);
+        if (r)
+                return error_fold(r);
+
+        r = user_charge(pending->user, &pending->charge, NULL, USER_SLOT_FDS, 1);
+        if (r)
+                /* the user has too many open connections, drop this one */
+                return (r == USER_E_QUOTA) ? 0 : error_fold(r);
+
+        r = group_cache_wait(&listener->bus->groups, &pending->waiter, ucred.uid);
+        if (r)
+                return error_fold(r);
+
+        c_list_link_tail(&listener->pending_list, &pending->listener_link);
+        pending = NULL;
+        return 0;
+}
+
+static int listener_accept(Listener *listener, DispatchContext *dispatcher, int fd_in) {
+        _c_cleanup_(peer_freep) Peer *peer = NULL;
+        _c_cleanup_(c_closep) int fd = fd_in;
+        Peer *template;
+        int r;
+
+        /*
+         * All peers on @peer_list use a snapshot of the current policy, so
+         * the most recently accepted one can serve as template for the next.
+         */
+        template = c_list_last_entry(&listener->peer_list, Peer, listener_link);
+
+        r = peer_new_with_fd(&peer, listener->bus, listener->policy, template, listener->guid, dispatcher, fd);
         if (r == PEER_E_QUOTA || r == PEER_E_CONNECTION_REFUSED)
                 /*
                  * The user has too many open connections, or a policy disallows it to
                  * connect. Simply drop this.
                  */
                 return 0;
-        else if (r)
+        else if (r == PEER_E_GROUPS_PENDING) {
+                /*
+                 * The groups of the user are being resolved. Park the
+                 * connection until they are known, then try again.
+                 */
+                r = listener_pending_new(listener, fd);
+                fd = -1; /* consume fd */
+                return error_trace(r);
+        } else if (r)
                 return error_fold(r);
         fd = -1; /* consume fd */
 
@@ -65,6 +149,100 @@ static int listener_dispatch(DispatchFile *file) {
         return error_fold(r);
 }
 
+static int listener_dispatch(DispatchFile *file) {
+        Listener *listener = c_container_of(file, Listener, socket_file);
+        size_t i;
+        int r, fd;
+
+        if (!(dispatch_file_events(file) & EPOLLIN))
+                return 0;
+
+        /*
+         * Accept a bounded number of connections per dispatch iteration. This
+         * drains bursts of connection attempts quickly, without starving the
+         * peers that are already connected. If the budget is exhausted, EPOLLIN
+         * stays pending and we are called again on the next iteration.
+         */
+        for (i = 0; i < LISTENER_ACCEPT_MAX; ++i) {
+                fd = accept4(listener->socket_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+                if (fd < 0) {
+                        if (errno == EAGAIN) {
+                                /*
+                                 * EAGAIN implies there are no pending incoming
+                                 * connections. Catch this, clear EPOLLIN and tell the
+                                 * caller about it.
+                                 */
+                                dispatch_file_clear(&listener->socket_file, EPOLLIN);
+                                return 0;
+                        } else {
+                                /*
+                                 * The linux UDS layer does not return pending errors
+                                 * on the child socket (unlike the TCP layer). Hence,
+                                 * there are no known errors to check for.
+                                 */
+                                return error_origin(-errno);
+                        }
+                }
+
+                r = listener_accept(listener, file->context, fd);
+                if (r)
+                        return error_trace(r);
+        }
+
+        return 0;
+}
+
+static int listener_dispatch_policy(DispatchFile *file) {
+        Listener *listener = c_container_of(file, Listener, policy_file);
+        eventfd_t value;
+        Peer *peer;
+        size_t i;
+        int r;
+
+        if (!(dispatch_file_events(file) & EPOLLIN))
+                return 0;
+
+        /*
+         * Peers on @policy_list still use a snapshot of a previous policy. We
+         * regenerate a bounded number of them per dispatch iteration, so a
+         * policy reload never stalls the bus for longer than that. The event
+         * is kept pending until the list is drained, which makes the
+         * dispatcher call us again on its next iteration.
+         */
+        for (i = 0; i < LISTENER_POLICY_UPDATES_MAX; ++i) {
+                PolicySnapshot *policy;
+
+                peer = c_list_first_entry(&listener->policy_list, Peer, listener_link);
+                if (!peer)
+                        break;
+
+                r = policy_snapshot_new(&policy, listener->policy, peer->seclabel, peer->user->uid, peer->gids, peer->n_gids);
+                if (r)
+                        return error_fold(r);
+
+                policy_snapshot_free(peer->policy);
+                peer->policy = policy;
+
+                c_list_unlink(&peer->listener_link);
+                c_list_link_tail(&listener->peer_list, &peer->listener_link);
+        }
+
+        if (c_list_is_empty(&listener->policy_list)) {
+                r = eventfd_read(listener->policy_fd, &value);
+                if (r < 0 && errno != EAGAIN)
+                        return error_origin(-errno);
+
+                dispatch_file_clear(file, EPOLLIN);
+
+                if (listener->policy_timestamp) {
+                        metrics_sample_add(&listener->bus->policy_metrics, listener->policy_timestamp);
+                        listener->policy_timestamp = 0;
+                }
+        }
+
+        return 0;
+}
+
 /**
  * listener_init_with_fd() - XXX
  */
@@ -103,6 +281,21 @@ int listener_init_with_fd(Listener *l,
 
         dispatch_file_select(&listener->socket_file, EPOLLIN);
 
+        listener->policy_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (listener->policy_fd < 0)
+                return error_origin(-errno);
+
+        r = dispatch_file_init(&listener->policy_file,
+                               dispatcher,
+                               listener_dispatch_policy,
+                               listener->policy_fd,
+                               EPOLLIN,
+                               0);
+        if (r)
+                return error_fold(r);
+
+        dispatch_file_select(&listener->policy_file, EPOLLIN);
+
         listener->socket_fd = socket_fd;
         listener->policy = policy;
         listener = NULL;
@@ -113,8 +306,16 @@ int listener_init_with_fd(Listener *l,
  * listener_deinit() - XXX
  */
 void listener_deinit(Listener *listener) {
+        ListenerPending *pending;
+
         assert(c_list_is_empty(&listener->peer_list));
+        assert(c_list_is_empty(&listener->policy_list));
 
+        while ((pending = c_list_first_entry(&listener->pending_list, ListenerPending, listener_link)))
+                listener_pending_free(pending);
+
+        dispatch_file_deinit(&listener->policy_file);
+        listener->policy_fd = c_close(listener->policy_fd);
         policy_registry_free(listener->policy);
         dispatch_file_deinit(&listener->socket_file);
         listener->socket_fd = c_close(listener->socket_fd);
@@ -122,21 +323,53 @@ void listener_deinit(Listener *listener) {
 }
 
 /**
- * listener_set_policy() - XXX
+ * listener_set_policy() - install new policy
+ * @listener:           listener to operate on
+ * @registry:           new policy registry
+ *
+ * This installs @registry as new policy of @listener, taking over ownership.
+ * Any peer connecting from now on will be subject to @registry. Existing peers
+ * are updated as well, though not necessarily right away.
+ *
+ * The new registry is compared to the previous one first. Batches that did not
+ * change are shared between both, hence peers whose uid, uid-range, and gid
+ * batches (or the default batch, respectively) are all unchanged keep their
+ * snapshots, which are updated in place. Only the remaining peers are queued
+ * for a regeneration of their snapshot, which is spread over several dispatch
+ * iterations. The time it takes to update all peers is recorded in the policy
+ * metrics of the bus.
+ *
+ * Return: 0 on success, negative error code on failure.
  */
 int listener_set_policy(Listener *listener, PolicyRegistry *registry) {
-        Peer *peer;
+        Metrics *metrics = &listener->bus->policy_metrics;
+        Peer *peer, *safe;
         int r;
 
-        c_list_for_each_entry(peer, &listener->peer_list, listener_link) {
-                PolicySnapshot *policy;
+        if (!policy_registry_diff(registry, listener->policy)) {
+                c_list_for_each_entry(peer, &listener->peer_list, listener_link)
+                        policy_snapshot_set_selinux(peer->policy, registry->selinux);
+        } else {
+                c_list_for_each_entry_safe(peer, safe, &listener->peer_list, listener_link) {
+                        if (policy_snapshot_is_current(peer->policy, registry, peer->user->uid, peer->gids, peer->n_gids)) {
+                                policy_snapshot_set_selinux(peer->policy, registry->selinux);
+                        } else {
+                                c_list_unlink(&peer->listener_link);
+                                c_list_link_tail(&listener->policy_list, &peer->listener_link);
+                        }
+                }
+        }
 
-                r = policy_snapshot_new(&policy, registry, peer->seclabel, peer->user->uid, peer->gids, peer->n_gids);
-                if (r)
-                        return error_fold(r);
+        if (!listener->policy_timestamp) {
+                if (c_list_is_empty(&listener->policy_list)) {
+                        metrics_sample_add(metrics, metrics_get_time(metrics));
+                } else {
+                        listener->policy_timestamp = metrics_get_time(metrics);
 
-                policy_snapshot_free(peer->policy);
-                peer->policy = policy;
+                        r = eventfd_write(listener->policy_fd, 1);
+                        if (r < 0)
+                                return error_origin(-errno);
+                }
         }
 
         policy_registry_free(listener->policy);
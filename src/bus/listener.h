@@ -13,6 +13,13 @@
 typedef struct Bus Bus;
 typedef struct DispatchContext DispatchContext;
 typedef struct Listener Listener;
+typedef struct ListenerPending ListenerPending;
+
+/* maximum number of connections accepted per dispatch iteration */
+#define LISTENER_ACCEPT_MAX (64)
+
+/* maximum number of peer snapshots regenerated per dispatch iteration */
+#define LISTENER_POLICY_UPDATES_MAX (256)
 
 struct Listener {
         Bus *bus;
@@ -21,12 +28,22 @@ struct Listener {
         DispatchFile socket_file;
         PolicyRegistry *policy;
         CList peer_list;
+        CList pending_list;
+
+        int policy_fd;
+        DispatchFile policy_file;
+        CList policy_list;
+        uint64_t policy_timestamp;
 };
 
 #define LISTENER_NULL(_x) {                                                     \
                 .socket_fd = -1,                                                \
                 .socket_file = DISPATCH_FILE_NULL((_x).socket_file),            \
                 .peer_list = C_LIST_INIT((_x).peer_list),                       \
+                .pending_list = C_LIST_INIT((_x).pending_list),                 \
+                .policy_fd = -1,                                                \
+                .policy_file = DISPATCH_FILE_NULL((_x).policy_file),            \
+                .policy_list = C_LIST_INIT((_x).policy_list),                   \
         }
 
 int listener_init_with_fd(Listener *listener,
@@ -405,7 +405,7 @@ static bool match_keys_match_metadata(MatchKeys *keys, MessageMetadata *metadata
         if (keys->path_namespace && !match_string_prefix(metadata->fields.path, keys->path_namespace, '/', false))
                 return false;
 
-        if (keys->arg0namespace && !(metadata->args[0].element == 's' && match_string_prefix(metadata->args[0].value, keys->arg0namespace, '.', false)))
+        if (keys->arg0namespace && !(metadata->n_args > 0 && metadata->args[0].element == 's' && match_string_prefix(metadata->args[0].value, keys->arg0namespace, '.', false)))
                 return false;
 
         for (unsigned int i = 0; i < keys->filter.n_args || i < keys->filter.n_argpaths; i ++) {
@@ -697,6 +697,22 @@ static void match_registry_by_keys_link(MatchRegistryByKeys *registry, MatchRegi
         registry->registry_by_member = match_registry_by_member_ref(registry_by_member);
 }
 
+static size_t match_keys_n_args(MatchKeys *keys) {
+        size_t n_args;
+
+        /*
+         * Returns the number of leading message arguments that must be
+         * extracted to evaluate these keys. Note that arg0namespace is
+         * evaluated against the first argument, regardless of the filter.
+         */
+
+        n_args = c_max(keys->filter.n_args, keys->filter.n_argpaths);
+        if (keys->arg0namespace)
+                n_args = c_max(n_args, (size_t)1);
+
+        return n_args;
+}
+
 static int match_rule_compare(CRBTree *tree, void *k, CRBNode *rb) {
         MatchRule *rule = c_container_of(rb, MatchRule, owner_node);
         MatchKeys *key1 = k, *key2 = &rule->keys;
@@ -892,6 +908,11 @@ int match_rule_link(MatchRule *rule, MatchRegistry *registry, bool monitor) {
                 return error_trace(r);
         rule->registry = registry;
 
+        if (match_keys_n_args(&rule->keys)) {
+                ++registry->n_arg_rules;
+                registry->n_args = c_max(registry->n_args, match_keys_n_args(&rule->keys));
+        }
+
         return 0;
 }
 
@@ -900,6 +921,14 @@ int match_rule_link(MatchRule *rule, MatchRegistry *registry, bool monitor) {
  */
 void match_rule_unlink(MatchRule *rule) {
         if (rule->registry) {
+                /*
+                 * The registry only tracks an upper bound of the arguments
+                 * referenced by its rules. It is reset once the last rule
+                 * referencing arguments is gone, but never lowered otherwise.
+                 */
+                if (match_keys_n_args(&rule->keys) && !--rule->registry->n_arg_rules)
+                        rule->registry->n_args = 0;
+
                 c_list_unlink(&rule->registry_link);
                 rule->registry_by_keys = match_registry_by_keys_unref(rule->registry_by_keys);
                 rule->registry = NULL;
@@ -1062,6 +1091,20 @@ void match_registry_get_monitors(MatchRegistry *registry, CList *destinations, M
         match_registry_get_destinations(&registry->monitor_tree, destinations, metadata);
 }
 
+/**
+ * match_registry_get_n_args() - number of arguments referenced by rules
+ * @registry:                   registry to query
+ *
+ * This returns an upper bound of the number of leading message arguments the
+ * rules linked into @registry reference. Messages matched against @registry
+ * need no arguments extracted beyond this.
+ *
+ * Return: Upper bound of referenced arguments.
+ */
+size_t match_registry_get_n_args(MatchRegistry *registry) {
+        return registry->n_args;
+}
+
 static void match_registry_by_keys_flush(MatchRegistryByKeys *registry) {
         MatchRule *rule, *rule_safe;
 
@@ -153,6 +153,8 @@ struct MatchRegistryByPath {
 struct MatchRegistry {
         CRBTree subscription_tree;
         CRBTree monitor_tree;
+        size_t n_arg_rules;
+        size_t n_args;
 };
 
 #define MATCH_REGISTRY_INIT(_x) {                       \
@@ -186,5 +188,6 @@ void match_registry_deinit(MatchRegistry *registry);
 
 void match_registry_get_subscribers(MatchRegistry *matches, CList *destinations, MessageMetadata *metadata);
 void match_registry_get_monitors(MatchRegistry *matches, CList *destinations, MessageMetadata *metadata);
+size_t match_registry_get_n_args(MatchRegistry *registry);
 
 void match_registry_flush(MatchRegistry *registry);
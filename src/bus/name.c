@@ -125,6 +125,7 @@ void name_ownership_release(NameOwnership *ownership, NameChange *change) {
 
         if (ownership == primary) {
                 primary = name_primary(ownership->name);
+                ++ownership->name->registry->generation;
 
                 change->name = name_ref(ownership->name);
                 change->old_owner = ownership->owner;
@@ -148,6 +149,7 @@ static int name_ownership_update(NameOwnership *ownership, uint32_t flags, NameC
 
         if (!primary) {
                 /* there is no primary owner */
+                ++name->registry->generation;
                 change->name = name_ref(name);
                 change->old_owner = NULL;
                 change->new_owner = ownership->owner;
@@ -163,6 +165,7 @@ static int name_ownership_update(NameOwnership *ownership, uint32_t flags, NameC
         } else if ((ownership->flags & DBUS_NAME_FLAG_REPLACE_EXISTING) &&
                    (primary->flags & DBUS_NAME_FLAG_ALLOW_REPLACEMENT)) {
                 /* we replace the primary owner */
+                ++name->registry->generation;
                 change->name = name_ref(name);
                 change->old_owner = primary->owner;
                 change->new_owner = ownership->owner;
@@ -197,10 +200,61 @@ static int name_compare(CRBTree *tree, void *k, CRBNode *rb) {
         return strcmp(k, name->name);
 }
 
-static void name_link(Name *name, CRBNode *parent, CRBNode **slot) {
+static uint64_t name_hash(uint64_t seed, const char *name_str) {
+        uint64_t hash = 0xcbf29ce484222325ULL ^ seed;
+
+        /* FNV-1a, followed by the splitmix64 finalizer to mix the low bits */
+        for ( ; *name_str; ++name_str)
+                hash = (hash ^ (uint8_t)*name_str) * 0x100000001b3ULL;
+
+        hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+        return hash ^ (hash >> 31);
+}
+
+static int name_registry_resize(NameRegistry *registry, size_t n_buckets) {
+        CList *buckets;
+        Name *name;
+        size_t i;
+
+        buckets = malloc(n_buckets * sizeof(*buckets));
+        if (!buckets)
+                return error_origin(-ENOMEM);
+
+        for (i = 0; i < n_buckets; ++i)
+                c_list_init(&buckets[i]);
+
+        /* the old buckets are discarded, so just relink all names */
+        c_rbtree_for_each_entry(name, &registry->name_tree, registry_node)
+                c_list_link_tail(&buckets[name->hash & (n_buckets - 1)], &name->hash_link);
+
+        free(registry->buckets);
+        registry->buckets = buckets;
+        registry->n_buckets = n_buckets;
+        return 0;
+}
+
+static int name_link(Name *name, CRBNode *parent, CRBNode **slot) {
+        NameRegistry *registry = name->registry;
+        int r;
+
         assert(!c_rbnode_is_linked(&name->registry_node));
 
-        c_rbtree_add(&name->registry->name_tree, parent, slot, &name->registry_node);
+        if (registry->n_names >= registry->n_buckets) {
+                r = name_registry_resize(registry, registry->n_buckets ? registry->n_buckets * 2 : NAME_REGISTRY_BUCKETS_MIN);
+                if (r)
+                        return error_trace(r);
+        }
+
+        /*
+         * The tree orders the names for iteration, all lookups go through
+         * the hash table, though.
+         */
+        c_rbtree_add(&registry->name_tree, parent, slot, &name->registry_node);
+        c_list_link_tail(&registry->buckets[name->hash & (registry->n_buckets - 1)], &name->hash_link);
+        ++registry->n_names;
+
+        return 0;
 }
 
 static int name_new(Name **namep, NameRegistry *registry, const char *name_str) {
@@ -214,6 +268,7 @@ static int name_new(Name **namep, NameRegistry *registry, const char *name_str)
 
         *name = (Name)NAME_INIT(*name);
         name->registry = registry;
+        name->hash = name_hash(registry->seed, name_str);
         memcpy(name->name, name_str, n_name + 1);
 
         *namep = name;
@@ -229,6 +284,12 @@ void name_free(_Atomic unsigned long *n_refs, void *userdata) {
 
         match_registry_deinit(&name->name_owner_changed_matches);
         match_registry_deinit(&name->sender_matches);
+
+        if (c_list_is_linked(&name->hash_link)) {
+                c_list_unlink(&name->hash_link);
+                --name->registry->n_names;
+        }
+
         c_rbnode_unlink(&name->registry_node);
         free(name);
 }
@@ -273,6 +334,10 @@ void name_registry_init(NameRegistry *registry) {
  */
 void name_registry_deinit(NameRegistry *registry) {
         assert(c_rbtree_is_empty(&registry->name_tree));
+        assert(!registry->n_names);
+
+        registry->buckets = c_free(registry->buckets);
+        registry->n_buckets = 0;
 }
 
 /**
@@ -289,20 +354,30 @@ void name_registry_deinit(NameRegistry *registry) {
  * Return: 0 on success, negative error code on failure.
  */
 int name_registry_ref_name(NameRegistry *registry, Name **namep, const char *name_str) {
+        _c_cleanup_(name_unrefp) Name *name = NULL;
         CRBNode **slot, *parent;
         int r;
 
+        name = name_registry_find_name(registry, name_str);
+        if (name) {
+                *namep = name_ref(name);
+                name = NULL;
+                return 0;
+        }
+
+        r = name_new(&name, registry, name_str);
+        if (r)
+                return error_trace(r);
+
         slot = c_rbtree_find_slot(&registry->name_tree, name_compare, name_str, &parent);
-        if (!slot) {
-                *namep = name_ref(c_container_of(parent, Name, registry_node));
-        } else {
-                r = name_new(namep, registry, name_str);
-                if (r)
-                        return error_trace(r);
+        assert(slot); /* the name is not registered, yet */
 
-                name_link(*namep, parent, slot);
-        }
+        r = name_link(name, parent, slot);
+        if (r)
+                return error_trace(r);
 
+        *namep = name;
+        name = NULL;
         return 0;
 }
 
@@ -316,7 +391,19 @@ int name_registry_ref_name(NameRegistry *registry, Name **namep, const char *nam
  * Return: Pointer to name-entry, or NULL if not found.
  */
 Name *name_registry_find_name(NameRegistry *registry, const char *name_str) {
-        return c_rbtree_find_entry(&registry->name_tree, name_compare, name_str, Name, registry_node);
+        uint64_t hash;
+        Name *name;
+
+        if (!registry->n_names)
+                return NULL;
+
+        hash = name_hash(registry->seed, name_str);
+
+        c_list_for_each_entry(name, &registry->buckets[hash & (registry->n_buckets - 1)], hash_link)
+                if (name->hash == hash && !strcmp(name->name, name_str))
+                        return name;
+
+        return NULL;
 }
 
 /**
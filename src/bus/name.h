@@ -58,6 +58,8 @@ struct Name {
         _Atomic unsigned long n_refs;
         NameRegistry *registry;
         CRBNode registry_node;
+        CList hash_link;
+        uint64_t hash;
 
         Activation *activation;
         MatchRegistry sender_matches;
@@ -70,6 +72,7 @@ struct Name {
 #define NAME_INIT(_x) {                                                                                 \
                 .n_refs = C_REF_INIT,                                                                   \
                 .registry_node = C_RBNODE_INIT((_x).registry_node),                                     \
+                .hash_link = C_LIST_INIT((_x).hash_link),                                               \
                 .sender_matches = MATCH_REGISTRY_INIT((_x).sender_matches),                             \
                 .name_owner_changed_matches = MATCH_REGISTRY_INIT((_x).name_owner_changed_matches),     \
                 .ownership_list = C_LIST_INIT((_x).ownership_list),                                     \
@@ -83,8 +86,17 @@ struct NameOwner {
                 .ownership_tree = C_RBTREE_INIT,                                \
         }
 
+/* minimum number of hash buckets of a name registry */
+#define NAME_REGISTRY_BUCKETS_MIN (64)
+
 struct NameRegistry {
         CRBTree name_tree;
+        uint64_t generation;
+
+        uint64_t seed;
+        CList *buckets;
+        size_t n_buckets;
+        size_t n_names;
 };
 
 #define NAME_REGISTRY_INIT {                                                    \
@@ -5,11 +5,13 @@
 #include <c-macro.h>
 #include <c-rbtree.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include "bus/bus.h"
 #include "bus/driver.h"
+#include "bus/groups.h"
 #include "bus/match.h"
 #include "bus/name.h"
 #include "bus/peer.h"
@@ -27,17 +29,118 @@
 #include "util/sockopt.h"
 #include "util/user.h"
 
-static int peer_dispatch_connection(Peer *peer, uint32_t events) {
+static int peer_compare(CRBTree *tree, void *k, CRBNode *rb) {
+        Peer *peer = c_container_of(rb, Peer, registry_node);
+        uint64_t id = *(uint64_t*)k;
+
+        if (id < peer->id)
+                return -1;
+        if (id > peer->id)
+                return 1;
+
+        return 0;
+}
+
+static void peer_registry_index(PeerRegistry *registry, Peer *peer) {
+        Peer **slot = &registry->slots[peer->id & (registry->n_slots - 1)];
+
+        if (*slot)
+                ++registry->n_overflow;
+        else
+                *slot = peer;
+}
+
+static int peer_registry_resize(PeerRegistry *registry, size_t n_peers) {
+        size_t n_slots = PEER_REGISTRY_SLOTS_MIN;
+        Peer **slots, *peer;
+
+        /*
+         * Peer ids are handed out sequentially, hence live peers mostly map
+         * to distinct slots if the index is reasonably larger than the number
+         * of peers. Long-lived peers can still collide with newer ones, those
+         * are not indexed, but looked up via the tree.
+         */
+        while (n_slots < 4 * n_peers)
+                n_slots <<= 1;
+        if (n_slots <= registry->n_slots && registry->n_overflow > registry->n_slots / 16)
+                n_slots = registry->n_slots << 1;
+
+        slots = calloc(n_slots, sizeof(*slots));
+        if (!slots)
+                return error_origin(-ENOMEM);
+
+        free(registry->slots);
+        registry->slots = slots;
+        registry->n_slots = n_slots;
+        registry->n_overflow = 0;
+
+        c_rbtree_for_each_entry(peer, &registry->peer_tree, registry_node)
+                peer_registry_index(registry, peer);
+
+        return 0;
+}
+
+static int peer_registry_link(PeerRegistry *registry, Peer *peer) {
+        CRBNode **slot, *parent;
         int r;
 
-        if (!events)
-                return 0;
+        if (registry->n_peers * 2 >= registry->n_slots ||
+            registry->n_overflow > registry->n_slots / 16) {
+                r = peer_registry_resize(registry, registry->n_peers + 1);
+                if (r)
+                        return error_trace(r);
+        }
 
-        r = connection_dispatch(&peer->connection, events);
-        if (r)
-                return error_fold(r);
+        slot = c_rbtree_find_slot(&registry->peer_tree, peer_compare, &peer->id, &parent);
+        assert(slot); /* peer->id is guaranteed to be unique */
+        c_rbtree_add(&registry->peer_tree, parent, slot, &peer->registry_node);
+
+        ++registry->n_peers;
+        peer_registry_index(registry, peer);
+
+        return 0;
+}
+
+static void peer_registry_unlink(PeerRegistry *registry, Peer *peer) {
+        Peer **slot;
+
+        if (!c_rbnode_is_linked(&peer->registry_node))
+                return;
 
-        for (;;) {
+        c_rbnode_unlink(&peer->registry_node);
+        --registry->n_peers;
+
+        slot = &registry->slots[peer->id & (registry->n_slots - 1)];
+        if (*slot == peer)
+                *slot = NULL;
+        else
+                --registry->n_overflow;
+
+        /* shrinking is best-effort, the index stays valid on failure */
+        if (registry->n_slots > PEER_REGISTRY_SLOTS_MIN && registry->n_peers * 32 < registry->n_slots)
+                (void)peer_registry_resize(registry, registry->n_peers);
+}
+
+static Peer *peer_registry_find(PeerRegistry *registry, uint64_t id) {
+        Peer *peer;
+
+        if (_c_likely_(registry->n_slots)) {
+                peer = registry->slots[id & (registry->n_slots - 1)];
+                if (peer && peer->id == id)
+                        return peer;
+        }
+
+        /* only peers that collided in the index need a tree lookup */
+        if (!registry->n_overflow)
+                return NULL;
+
+        return c_rbtree_find_entry(&registry->peer_tree, peer_compare, &id, Peer, registry_node);
+}
+
+static int peer_dispatch_messages(Peer *peer) {
+        int r;
+
+        while (!peer_is_stalled(peer)) {
                 _c_cleanup_(message_unrefp) Message *m = NULL;
 
                 r = connection_dequeue(&peer->connection, &m);
@@ -64,6 +167,98 @@ static int peer_dispatch_connection(Peer *peer, uint32_t events) {
         return 0;
 }
 
+static int peer_dispatch_connection(Peer *peer, uint32_t events) {
+        int r;
+
+        if (!events)
+                return 0;
+
+        r = connection_dispatch(&peer->connection, events);
+        if (r)
+                return error_fold(r);
+
+        return error_trace(peer_dispatch_messages(peer));
+}
+
+static void peer_flush_cut_through(Peer *peer) {
+        Peer *receiver;
+
+        if (_c_likely_(peer->cut_through_id == ADDRESS_ID_INVALID))
+                return;
+
+        /*
+         * A message of this peer is forwarded while it is still being
+         * received. Wake up its receiver, as more of the message might be
+         * available, or the message might have been aborted. Once the message
+         * is no longer in flight, we are done.
+         */
+        receiver = peer_registry_find(&peer->bus->peers, peer->cut_through_id);
+        if (receiver)
+                dispatch_file_select(&receiver->connection.socket_file, EPOLLOUT);
+
+        if (!socket_is_cutting_through(&peer->connection.socket))
+                peer->cut_through_id = ADDRESS_ID_INVALID;
+}
+
+static void peer_unstall(Peer *peer) {
+        c_list_unlink(&peer->stalled_link);
+        peer->stalled_on = NULL;
+        peer->stalled = message_unref(peer->stalled);
+}
+
+static void peer_resume_stalled(Peer *peer) {
+        PeerRegistry *registry = &peer->bus->peers;
+        Peer *sender;
+
+        if (c_list_is_empty(&peer->stalled_list))
+                return;
+
+        while ((sender = c_list_first_entry(&peer->stalled_list, Peer, stalled_link))) {
+                c_list_unlink(&sender->stalled_link);
+                c_list_link_tail(&registry->resume_list, &sender->stalled_link);
+                sender->stalled_on = NULL;
+        }
+
+        dispatch_defer_schedule(&registry->resume);
+}
+
+static void peer_hangup(Peer *peer) {
+        PeerRegistry *registry = &peer->bus->peers;
+
+        if (c_list_is_linked(&peer->goodbye_link))
+                return;
+
+        /* whoever waits for this peer to drain retries right away */
+        peer_resume_stalled(peer);
+        peer_unstall(peer);
+
+        /*
+         * The peer is detached from all traffic right away, but saying
+         * goodbye to the other peers is deferred to the end of the dispatch
+         * round. This way, peers hanging up together are not notified of each
+         * other, which turns a mass-disconnect from quadratic into linear work.
+         */
+        driver_hangup(peer);
+
+        c_list_link_tail(&registry->goodbye_list, &peer->goodbye_link);
+        dispatch_defer_schedule(&registry->goodbye);
+}
+
+static int peer_dispatch_result(Peer *peer, int r) {
+        if (r) {
+                if (r == PEER_E_QUOTA ||
+                    r == PEER_E_PROTOCOL_VIOLATION)
+                        connection_close(&peer->connection);
+                else if (r != PEER_E_EOF)
+                        return error_fold(r);
+
+                peer_hangup(peer);
+        }
+
+        peer_flush_cut_through(peer);
+        return 0;
+}
+
 int peer_dispatch(DispatchFile *file) {
         Peer *peer = c_container_of(file, Peer, connection.socket_file);
         static const uint32_t interest[] = { EPOLLIN | EPOLLHUP, EPOLLOUT };
@@ -105,55 +300,111 @@ int peer_dispatch(DispatchFile *file) {
                         break;
         }
 
-        if (r) {
-                if (r == PEER_E_EOF) {
-                        metrics_sample_start(&peer->bus->metrics);
-                        r = driver_goodbye(peer, false);
-                        metrics_sample_end(&peer->bus->metrics);
-                        if (r)
-                                return error_fold(r);
+        /*
+         * Senders stalled on this peer are resumed once its outgoing queue
+         * was fully handed to the kernel. The socket buffer of the kernel
+         * still holds enough data to keep the peer busy until they refilled
+         * the queue, so this serves as low watermark.
+         */
+        if (!connection_has_output(&peer->connection))
+                peer_resume_stalled(peer);
 
-                        connection_shutdown(&peer->connection);
-                } else if (r == PEER_E_QUOTA ||
-                           r == PEER_E_PROTOCOL_VIOLATION) {
-                        connection_close(&peer->connection);
+        return error_trace(peer_dispatch_result(peer, r));
+}
 
-                        metrics_sample_start(&peer->bus->metrics);
-                        r = driver_goodbye(peer, false);
-                        metrics_sample_end(&peer->bus->metrics);
-                        if (r)
-                                return error_fold(r);
-                } else {
-                        return error_fold(r);
-                }
+static int peer_get_groups(Bus *bus, int fd, struct ucred *ucred, gid_t **gidsp, size_t *n_gidsp) {
+        const uint32_t *aux;
+        size_t n_aux;
+        gid_t *gids;
+        int r;
 
-                if (!connection_is_running(&peer->connection))
-                        peer_free(peer);
-        }
+        r = sockopt_get_peergroups(fd, ucred->gid, gidsp, n_gidsp);
+        if (r != SOCKOPT_E_UNSUPPORTED)
+                return error_trace(r);
 
-        /* Careful: @peer might be deallocated here */
+        /*
+         * Without SO_PEERGROUPS, the auxiliary groups have to be resolved
+         * through the user database. This is racy, incomplete, and in no way
+         * consistent with the credentials associated with the used resources.
+         * Furthermore, it might block, so the controller does it for us and
+         * the result is cached per uid. Until it is known, the connection
+         * cannot be set up.
+         */
+        {
+                static bool warned;
+
+                if (!warned) {
+                        warned = true;
+                        log_append_here(bus->log, LOG_ERR, 0);
+                        log_commitf(bus->log, "Falling back to resolving auxiliary "
+                                              "groups via the controller, this is "
+                                              "racy. Update to a kernel with "
+                                              "SO_PEERGROUPS support.\n");
+                }
+        }
 
-        return 0;
-}
+        r = group_cache_get(&bus->groups, ucred->uid, &aux, &n_aux);
+        if (r)
+                return (r == GROUP_E_PENDING) ? PEER_E_GROUPS_PENDING : error_fold(r);
 
-static int peer_compare(CRBTree *tree, void *k, CRBNode *rb) {
-        Peer *peer = c_container_of(rb, Peer, registry_node);
-        uint64_t id = *(uint64_t*)k;
+        gids = malloc((1 + n_aux) * sizeof(*gids));
+        if (!gids)
+                return error_origin(-ENOMEM);
 
-        if (id < peer->id)
-                return -1;
-        if (id > peer->id)
-                return 1;
+        gids[0] = ucred->gid;
+        memcpy(gids + 1, aux, n_aux * sizeof(*gids));
 
+        *gidsp = gids;
+        *n_gidsp = 1 + n_aux;
         return 0;
 }
 
+static bool peer_has_credentials(Peer *peer,
+                                 uid_t uid,
+                                 const gid_t *gids,
+                                 size_t n_gids,
+                                 const char *seclabel,
+                                 size_t n_seclabel) {
+        return peer->user->uid == uid &&
+               peer->n_gids == n_gids &&
+               !memcmp(peer->gids, gids, n_gids * sizeof(*gids)) &&
+               peer->n_seclabel == n_seclabel &&
+               !memcmp(peer->seclabel, seclabel, n_seclabel);
+}
+
 /**
- * peer_new() - XXX
+ * peer_new_with_fd() - create peer for an accepted connection
+ * @peerp:              output argument for the new peer
+ * @bus:                bus to link the peer on
+ * @policy:             policy registry to apply
+ * @template:           peer recently created from @policy, or NULL
+ * @guid:               guid of the listener
+ * @dispatcher:         dispatch context to use
+ * @fd:                 connection to take over
+ *
+ * This creates a new peer for the connection @fd. Its credentials are queried
+ * from the kernel, and a policy snapshot of @policy is created for them.
+ *
+ * Connection storms usually come from a handful of users, so consecutive
+ * peers tend to carry identical credentials. If @template is given, its
+ * group count is used to size the group query, and if its credentials match
+ * exactly, its policy snapshot is duplicated instead of being regenerated.
+ * @template must use a snapshot of @policy.
+ *
+ * If the auxiliary groups of the peer cannot be queried from the kernel and
+ * are not cached, yet, they are requested from the controller and
+ * PEER_E_GROUPS_PENDING is returned. The caller should retry once they are
+ * resolved, see group_cache_wait().
+ *
+ * Return: 0 on success, PEER_E_QUOTA if the user is out of quota,
+ *         PEER_E_CONNECTION_REFUSED if the policy denies the connection,
+ *         PEER_E_GROUPS_PENDING if the groups of the peer are not known, yet,
+ *         negative error code on failure.
  */
 int peer_new_with_fd(Peer **peerp,
                      Bus *bus,
                      PolicyRegistry *policy,
+                     Peer *template,
                      const char guid[],
                      DispatchContext *dispatcher,
                      int fd) {
@@ -161,8 +412,7 @@ int peer_new_with_fd(Peer **peerp,
         _c_cleanup_(user_unrefp) User *user = NULL;
         _c_cleanup_(c_freep) gid_t *gids = NULL;
         _c_cleanup_(c_freep) char *seclabel = NULL;
-        CRBNode **slot, *parent;
-        size_t n_seclabel, n_gids = 0;
+        size_t n_seclabel, n_gids = template ? template->n_gids : 0;
         struct ucred ucred;
         socklen_t socklen = sizeof(ucred);
         int r;
@@ -179,7 +429,7 @@ int peer_new_with_fd(Peer **peerp,
         if (r < 0)
                 return error_trace(r);
 
-        r = sockopt_get_peergroups(fd, bus->log, ucred.uid, ucred.gid, &gids, &n_gids);
+        r = peer_get_groups(bus, fd, &ucred, &gids, &n_gids);
         if (r)
                 return error_trace(r);
 
@@ -209,7 +459,10 @@ int peer_new_with_fd(Peer **peerp,
                 return error_fold(r);
         }
 
-        r = policy_snapshot_new(&peer->policy, policy, peer->seclabel, ucred.uid, peer->gids, peer->n_gids);
+        if (template && peer_has_credentials(template, ucred.uid, peer->gids, peer->n_gids, peer->seclabel, peer->n_seclabel))
+                r = policy_snapshot_dup(template->policy, &peer->policy);
+        else
+                r = policy_snapshot_new(&peer->policy, policy, peer->seclabel, ucred.uid, peer->gids, peer->n_gids);
         if (r)
                 return error_fold(r);
 
@@ -226,10 +479,12 @@ int peer_new_with_fd(Peer **peerp,
         if (r < 0)
                 return error_fold(r);
 
+        peer->connection.socket.in.cut_through = bus->cut_through;
+
         peer->id = bus->peers.ids++;
-        slot = c_rbtree_find_slot(&bus->peers.peer_tree, peer_compare, &peer->id, &parent);
-        assert(slot); /* peer->id is guaranteed to be unique */
-        c_rbtree_add(&bus->peers.peer_tree, parent, slot, &peer->registry_node);
+        r = peer_registry_link(&bus->peers, peer);
+        if (r)
+                return error_trace(r);
 
         *peerp = peer;
         peer = NULL;
@@ -247,8 +502,11 @@ Peer *peer_free(Peer *peer) {
 
         assert(!peer->registered);
 
-        c_rbnode_unlink(&peer->registry_node);
+        peer_resume_stalled(peer);
+        peer_unstall(peer);
+        peer_registry_unlink(&peer->bus->peers, peer);
         c_list_unlink(&peer->listener_link);
+        c_list_unlink(&peer->goodbye_link);
 
         fd = peer->connection.socket.fd;
 
@@ -260,6 +518,7 @@ Peer *peer_free(Peer *peer) {
         name_owner_deinit(&peer->owned_names);
         policy_snapshot_free(peer->policy);
         connection_deinit(&peer->connection);
+        peer_flush_cut_through(peer);
         user_unref(peer->user);
         user_charge_deinit(&peer->charges[2]);
         user_charge_deinit(&peer->charges[1]);
@@ -282,6 +541,7 @@ void peer_register(Peer *peer) {
         assert(!peer->monitor);
 
         peer->registered = true;
+        ++peer->bus->peers.generation;
 }
 
 void peer_unregister(Peer *peer) {
@@ -289,6 +549,7 @@ void peer_unregister(Peer *peer) {
         assert(!peer->monitor);
 
         peer->registered = false;
+        ++peer->bus->peers.generation;
 }
 
 bool peer_is_privileged(Peer *peer) {
@@ -611,6 +872,17 @@ void peer_flush_matches(Peer *peer) {
         }
 }
 
+static int peer_dispatch_reply_timeout(DispatchTimer *timer) {
+        ReplySlot *slot = c_container_of(timer, ReplySlot, timeout);
+        int r;
+
+        r = driver_reply_timeout(slot);
+        if (r)
+                return error_fold(r);
+
+        return 0;
+}
+
 int peer_queue_unicast(PolicySnapshot *sender_policy, NameSet *sender_names, ReplyOwner *sender_replies, User *sender_user, uint64_t sender_id, Peer *receiver, Message *message) {
         _c_cleanup_(reply_slot_freep) ReplySlot *slot = NULL;
         NameSet receiver_names = NAME_SET_INIT_FROM_OWNER(&receiver->owned_names);
@@ -657,7 +929,7 @@ int peer_queue_unicast(PolicySnapshot *sender_policy, NameSet *sender_names, Rep
         }
 
         r = policy_snapshot_check_send(sender_policy,
-                                       receiver->seclabel,
+                                       receiver->policy->sid,
                                        &receiver_names,
                                        message->metadata.fields.interface,
                                        message->metadata.fields.member,
@@ -688,12 +960,23 @@ int peer_queue_unicast(PolicySnapshot *sender_policy, NameSet *sender_names, Rep
 
         r = connection_queue(&receiver->connection, sender_user, message);
         if (r) {
+                /*
+                 * Unlike the quota on reply slots, the receiver can free up
+                 * queue space by reading, so report this separately.
+                 */
                 if (r == CONNECTION_E_QUOTA)
-                        return PEER_E_QUOTA;
+                        return PEER_E_CONNECTION_QUOTA;
 
                 return error_fold(r);
         }
 
+        if (slot && receiver->bus->reply_timeout) {
+                dispatch_timer_init(&slot->timeout, receiver->bus->dispatcher, peer_dispatch_reply_timeout);
+                r = dispatch_timer_arm(&slot->timeout, receiver->bus->reply_timeout);
+                if (r)
+                        return error_fold(r);
+        }
+
         slot = NULL;
         return 0;
 }
@@ -737,30 +1020,188 @@ int peer_queue_reply(Peer *sender, const char *destination, uint32_t reply_seria
         return 0;
 }
 
+/**
+ * peer_stall() - hold back a message until its receiver drained
+ * @peer:               peer that sent @message
+ * @receiver:           receiver that is out of quota
+ * @message:            message to hold back
+ *
+ * With flow-control enabled, a unicast that exceeds the quota of its receiver
+ * does not fail. Instead, @message is held back and @peer stops reading
+ * further input. Once @receiver drained its outgoing queue, @message is
+ * retried and @peer resumed, see peer_registry_dispatch_resume().
+ *
+ * Incomplete messages are never held back, since they are dispatched again
+ * once complete anyway.
+ *
+ * This is only done if @receiver has queued output, since otherwise it would
+ * never drain. Furthermore, if @receiver waits for @peer to drain, directly
+ * or via other stalled peers, neither would ever be resumed. Such cycles are
+ * detected by following the peers each receiver waits for.
+ *
+ * Return: 0 if @peer was stalled, PEER_E_QUOTA if it cannot wait.
+ */
+int peer_stall(Peer *peer, Peer *receiver, Message *message) {
+        Peer *p;
+
+        assert(!peer_is_stalled(peer));
+
+        if (!peer->bus->flow_control || message->incomplete)
+                return PEER_E_QUOTA;
+
+        if (!connection_is_running(&receiver->connection) ||
+            c_list_is_linked(&receiver->goodbye_link) ||
+            !connection_has_output(&receiver->connection))
+                return PEER_E_QUOTA;
+
+        for (p = receiver; p; p = p->stalled_on)
+                if (p == peer)
+                        return PEER_E_QUOTA;
+
+        peer->stalled = message_ref(message);
+        peer->stalled_on = receiver;
+        c_list_link_tail(&receiver->stalled_list, &peer->stalled_link);
+        dispatch_file_deselect(&peer->connection.socket_file, EPOLLIN);
+
+        return 0;
+}
+
 void peer_registry_init(PeerRegistry *registry) {
-        *registry = (PeerRegistry)PEER_REGISTRY_INIT;
+        *registry = (PeerRegistry)PEER_REGISTRY_INIT(*registry);
 }
 
 void peer_registry_deinit(PeerRegistry *registry) {
         assert(c_rbtree_is_empty(&registry->peer_tree));
+        assert(!registry->n_peers);
+        registry->slots = c_free(registry->slots);
+        registry->n_slots = 0;
         registry->ids = 0;
 }
 
 void peer_registry_flush(PeerRegistry *registry) {
-        Peer *peer, *safe;
+        Peer *peer;
         int r;
 
-        c_rbtree_for_each_entry_safe_postorder_unlink(peer, safe, &registry->peer_tree, registry_node) {
+        while ((peer = c_rbnode_entry(c_rbtree_first(&registry->peer_tree), Peer, registry_node))) {
                 r = driver_goodbye(peer, true);
                 assert(!r); /* can not fail in silent mode */
                 peer_free(peer);
         }
+
+        dispatch_defer_cancel(&registry->goodbye);
+        dispatch_defer_cancel(&registry->resume);
 }
 
+/**
+ * peer_registry_dispatch_goodbye() - say goodbye to peers that hung up
+ * @defer:              goodbye work of the peer registry
+ *
+ * This is run once per dispatch round if any peer hung up. Peers that hung up
+ * were already detached from the bus traffic by peer_hangup(). Here, their
+ * names are released and the remaining peers are notified, at most
+ * PEER_REGISTRY_GOODBYE_MAX peers per round, so a mass-disconnect does not
+ * stall the bus. Peers are freed only after the whole batch was handled.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+int peer_registry_dispatch_goodbye(DispatchDefer *defer) {
+        PeerRegistry *registry = c_container_of(defer, PeerRegistry, goodbye);
+        CList batch = C_LIST_INIT(batch);
+        Peer *peer;
+        size_t i;
+        int r;
+
+        for (i = 0; i < PEER_REGISTRY_GOODBYE_MAX; ++i) {
+                peer = c_list_first_entry(&registry->goodbye_list, Peer, goodbye_link);
+                if (!peer)
+                        break;
+
+                c_list_unlink(&peer->goodbye_link);
+                c_list_link_tail(&batch, &peer->goodbye_link);
+        }
+
+        if (!c_list_is_empty(&registry->goodbye_list))
+                dispatch_defer_schedule(defer);
+
+        c_list_for_each_entry(peer, &batch, goodbye_link) {
+                metrics_sample_start(&peer->bus->metrics);
+                r = driver_goodbye(peer, false);
+                metrics_sample_end(&peer->bus->metrics);
+                if (r) {
+                        c_list_splice(&registry->goodbye_list, &batch);
+                        return error_fold(r);
+                }
+
+                connection_shutdown(&peer->connection);
+        }
+
+        while ((peer = c_list_first_entry(&batch, Peer, goodbye_link))) {
+                c_list_unlink(&peer->goodbye_link);
+
+                /* peers with pending output hang up again once it is flushed */
+                if (!connection_is_running(&peer->connection))
+                        peer_free(peer);
+        }
+
+        return 0;
+}
+
+/**
+ * peer_registry_dispatch_resume() - resume stalled peers
+ * @defer:              resume work of the peer registry
+ *
+ * This is run once per dispatch round if a receiver that peers were stalled
+ * on drained its outgoing queue, or went away. The held back message of each
+ * such peer is retried. If it is queued now, the peer continues reading its
+ * input, starting with what was already buffered before it was stalled.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+int peer_registry_dispatch_resume(DispatchDefer *defer) {
+        PeerRegistry *registry = c_container_of(defer, PeerRegistry, resume);
+        Peer *peer;
+        int r;
+
+        while ((peer = c_list_first_entry(&registry->resume_list, Peer, stalled_link))) {
+                _c_cleanup_(message_unrefp) Message *message = peer->stalled;
+
+                c_list_unlink(&peer->stalled_link);
+                peer->stalled = NULL;
+
+                metrics_sample_start(&peer->bus->metrics);
+                r = driver_resume(peer, message);
+                metrics_sample_end(&peer->bus->metrics);
+                if (r)
+                        return error_fold(r);
+
+                if (!peer_is_stalled(peer)) {
+                        dispatch_file_select(&peer->connection.socket_file, EPOLLIN);
+                        r = peer_dispatch_messages(peer);
+                }
+
+                r = peer_dispatch_result(peer, r);
+                if (r)
+                        return error_trace(r);
+        }
+
+        return 0;
+}
+
+/**
+ * peer_registry_find_peer() - find registered peer by id
+ * @registry:           registry to operate on
+ * @id:                 id of the peer
+ *
+ * This looks up the registered peer with the given id. Peers are indexed by
+ * their id in a direct-mapped table, so this does not need to search the
+ * peer tree, unless peers collided in the table.
+ *
+ * Return: The peer, or NULL if no registered peer with the given id exists.
+ */
 Peer *peer_registry_find_peer(PeerRegistry *registry, uint64_t id) {
         Peer *peer;
 
-        peer = c_rbtree_find_entry(&registry->peer_tree, peer_compare, &id, Peer, registry_node);
+        peer = peer_registry_find(registry, id);
 
         return peer && peer->registered ? peer : NULL;
 }
@@ -25,8 +25,10 @@ enum {
         _PEER_E_SUCCESS,
 
         PEER_E_QUOTA,
+        PEER_E_CONNECTION_QUOTA,
 
         PEER_E_CONNECTION_REFUSED,
+        PEER_E_GROUPS_PENDING,
 
         PEER_E_EOF,
         PEER_E_PROTOCOL_VIOLATION,
@@ -61,12 +63,20 @@ struct Peer {
         UserCharge charges[3];
 
         uint64_t id;
+        uint64_t cut_through_id;
         CRBNode registry_node;
         CList listener_link;
+        CList goodbye_link;
+
+        Peer *stalled_on;
+        CList stalled_link;
+        CList stalled_list;
+        Message *stalled;
 
         Connection connection;
         bool registered : 1;
         bool monitor : 1;
+        bool dropped_broadcasts : 1;
 
         PolicySnapshot *policy;
         NameOwner owned_names;
@@ -81,25 +91,51 @@ struct Peer {
                 .charges[0] = USER_CHARGE_INIT,                                                         \
                 .charges[1] = USER_CHARGE_INIT,                                                         \
                 .charges[2] = USER_CHARGE_INIT,                                                         \
+                .cut_through_id = ADDRESS_ID_INVALID,                                                   \
                 .registry_node = C_RBNODE_INIT((_x).registry_node),                                     \
                 .listener_link = C_LIST_INIT((_x).listener_link),                                       \
+                .goodbye_link = C_LIST_INIT((_x).goodbye_link),                                         \
+                .stalled_link = C_LIST_INIT((_x).stalled_link),                                         \
+                .stalled_list = C_LIST_INIT((_x).stalled_list),                                         \
                 .connection = CONNECTION_NULL((_x).connection),                                         \
                 .owned_names = NAME_OWNER_INIT,                                                         \
                 .sender_matches = MATCH_REGISTRY_INIT((_x).sender_matches),                             \
                 .name_owner_changed_matches = MATCH_REGISTRY_INIT((_x).name_owner_changed_matches),     \
                 .owned_matches = MATCH_OWNER_INIT((_x).owned_matches),                                  \
-                .replies = REPLY_REGISTRY_INIT,                                                         \
+                .replies = REPLY_REGISTRY_INIT((_x).replies),                                           \
                 .owned_replies = REPLY_OWNER_INIT((_x).owned_replies),                                  \
         }
 
+/* minimum number of slots of the peer index */
+#define PEER_REGISTRY_SLOTS_MIN (64)
+/* maximum number of peers to say goodbye to in a single dispatch round */
+#define PEER_REGISTRY_GOODBYE_MAX (128)
+
 struct PeerRegistry {
         CRBTree peer_tree;
         uint64_t ids;
+        uint64_t generation;
+
+        Peer **slots;
+        size_t n_slots;
+        size_t n_peers;
+        size_t n_overflow;
+
+        CList goodbye_list;
+        DispatchDefer goodbye;
+
+        CList resume_list;
+        DispatchDefer resume;
 };
 
-#define PEER_REGISTRY_INIT {}
+#define PEER_REGISTRY_INIT(_x) {                                                \
+                .goodbye_list = C_LIST_INIT((_x).goodbye_list),                 \
+                .goodbye = DISPATCH_DEFER_NULL((_x).goodbye),                   \
+                .resume_list = C_LIST_INIT((_x).resume_list),                   \
+                .resume = DISPATCH_DEFER_NULL((_x).resume),                     \
+        }
 
-int peer_new_with_fd(Peer **peerp, Bus *bus, PolicyRegistry *policy, const char guid[], DispatchContext *dispatcher, int fd);
+int peer_new_with_fd(Peer **peerp, Bus *bus, PolicyRegistry *policy, Peer *template, const char guid[], DispatchContext *dispatcher, int fd);
 Peer *peer_free(Peer *peer);
 
 int peer_dispatch(DispatchFile *file);
@@ -122,10 +158,13 @@ void peer_flush_matches(Peer *peer);
 
 int peer_queue_unicast(PolicySnapshot *sender_policy, NameSet *sender_names, ReplyOwner *sender_replies, User *sender_user, uint64_t sender_id, Peer *receiver, Message *message);
 int peer_queue_reply(Peer *sender, const char *destination, uint32_t reply_serial, Message *message);
+int peer_stall(Peer *peer, Peer *receiver, Message *message);
 
 void peer_registry_init(PeerRegistry *registry);
 void peer_registry_deinit(PeerRegistry *registry);
 void peer_registry_flush(PeerRegistry *registry);
+int peer_registry_dispatch_goodbye(DispatchDefer *defer);
+int peer_registry_dispatch_resume(DispatchDefer *defer);
 Peer *peer_registry_find_peer(PeerRegistry *registry, uint64_t id);
 
 static inline bool peer_is_registered(Peer *peer) {
@@ -136,4 +175,8 @@ static inline bool peer_is_monitor(Peer *peer) {
         return peer->monitor;
 }
 
+static inline bool peer_is_stalled(Peer *peer) {
+        return !!peer->stalled;
+}
+
 C_DEFINE_CLEANUP(Peer *, peer_free);
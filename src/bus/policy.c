@@ -6,6 +6,7 @@
 #include <c-list.h>
 #include <c-macro.h>
 #include <c-rbtree.h>
+#include <c-string.h>
 #include <stdlib.h>
 #include "bus/name.h"
 #include "bus/policy.h"
@@ -160,6 +161,16 @@ static int policy_batch_at_name(PolicyBatch *batch, PolicyBatchName **namep, con
                         return error_trace(r);
 
                 c_rbtree_add(&name->batch->name_tree, parent, slot, &name->batch_node);
+
+                /*
+                 * The catch-all entry and the entry of the driver are needed
+                 * for nearly every policy decision, so remember them right
+                 * away rather than looking them up on every message.
+                 */
+                if (!*name_str)
+                        batch->name_all = name;
+                else if (!strcmp(name_str, "org.freedesktop.DBus"))
+                        batch->name_driver = name;
         } else {
                 name = c_container_of(parent, PolicyBatchName, batch_node);
         }
@@ -233,6 +244,7 @@ static int policy_batch_add_send(PolicyBatch *batch,
                 return error_trace(r);
 
         c_list_link_tail(&name->send_unindexed, &xmit->batch_link);
+        ++batch->n_send;
         xmit = NULL;
         return 0;
 }
@@ -262,6 +274,7 @@ static int policy_batch_add_recv(PolicyBatch *batch,
                 return error_trace(r);
 
         c_list_link_tail(&name->recv_unindexed, &xmit->batch_link);
+        ++batch->n_recv;
         xmit = NULL;
         return 0;
 }
@@ -358,6 +371,7 @@ PolicyRegistry *policy_registry_free(PolicyRegistry *registry) {
         c_rbtree_for_each_entry_safe_postorder_unlink(node, t_node, &registry->uid_range_tree, registry_node)
                 policy_registry_node_free(node);
 
+        free(registry->uid_range_segments);
         policy_batch_unref(registry->default_batch);
         bus_selinux_registry_unref(registry->selinux);
         free(registry);
@@ -391,6 +405,23 @@ static PolicyRegistryNode *policy_registry_find_gid(PolicyRegistry *registry, ui
                                    registry_node);
 }
 
+static PolicyRegistrySegment *policy_registry_find_uid_range_segment(PolicyRegistry *registry, uint32_t uid) {
+        PolicyRegistrySegment *segment;
+        size_t lower = 0, upper = registry->n_uid_range_segments;
+
+        while (lower < upper) {
+                segment = registry->uid_range_segments + lower + (upper - lower) / 2;
+                if (uid < segment->uid_start)
+                        upper = segment - registry->uid_range_segments;
+                else if (uid > segment->uid_end)
+                        lower = segment - registry->uid_range_segments + 1;
+                else
+                        return segment;
+        }
+
+        return NULL;
+}
+
 static int policy_registry_at_uidgid(CRBTree *tree, PolicyRegistryNode **nodep, uint32_t uidgid_start, uint32_t uidgid_end) {
         CRBNode *parent, **slot;
         PolicyRegistryNode *node;
@@ -530,6 +561,284 @@ static int policy_registry_import_batch(PolicyRegistry *registry,
         return 0;
 }
 
+static bool policy_xmit_equal(PolicyXmit *a, PolicyXmit *b) {
+        return a->verdict.verdict == b->verdict.verdict &&
+               a->verdict.priority == b->verdict.priority &&
+               a->type == b->type &&
+               a->broadcast == b->broadcast &&
+               a->min_fds == b->min_fds &&
+               a->max_fds == b->max_fds &&
+               c_string_equal(a->path, b->path) &&
+               c_string_equal(a->interface, b->interface) &&
+               c_string_equal(a->member, b->member);
+}
+
+static bool policy_xmit_list_equal(CList *a, CList *b) {
+        CList *i, *j;
+
+        for (i = a->next, j = b->next; i != a && j != b; i = i->next, j = j->next)
+                if (!policy_xmit_equal(c_list_entry(i, PolicyXmit, batch_link),
+                                       c_list_entry(j, PolicyXmit, batch_link)))
+                        return false;
+
+        return i == a && j == b;
+}
+
+static bool policy_batch_name_equal(PolicyBatchName *a, PolicyBatchName *b) {
+        return !strcmp(a->name, b->name) &&
+               a->own_verdict.verdict == b->own_verdict.verdict &&
+               a->own_verdict.priority == b->own_verdict.priority &&
+               a->own_prefix_verdict.verdict == b->own_prefix_verdict.verdict &&
+               a->own_prefix_verdict.priority == b->own_prefix_verdict.priority &&
+               policy_xmit_list_equal(&a->send_unindexed, &b->send_unindexed) &&
+               policy_xmit_list_equal(&a->recv_unindexed, &b->recv_unindexed);
+}
+
+static bool policy_batch_equal(PolicyBatch *a, PolicyBatch *b) {
+        CRBNode *i, *j;
+
+        if (a == b)
+                return true;
+
+        if (a->connect_verdict.verdict != b->connect_verdict.verdict ||
+            a->connect_verdict.priority != b->connect_verdict.priority)
+                return false;
+
+        for (i = c_rbtree_first(&a->name_tree), j = c_rbtree_first(&b->name_tree);
+             i && j;
+             i = c_rbnode_next(i), j = c_rbnode_next(j))
+                if (!policy_batch_name_equal(c_container_of(i, PolicyBatchName, batch_node),
+                                             c_container_of(j, PolicyBatchName, batch_node)))
+                        return false;
+
+        return !i && !j;
+}
+
+static uint64_t policy_hash_u64(uint64_t hash, uint64_t value) {
+        size_t i;
+
+        /* FNV-1a over the bytes of @value */
+        for (i = 0; i < sizeof(value); ++i, value >>= 8)
+                hash = (hash ^ (value & 0xff)) * 0x100000001b3ULL;
+
+        return hash;
+}
+
+static uint64_t policy_hash_string(uint64_t hash, const char *string) {
+        if (!string)
+                return policy_hash_u64(hash, UINT64_MAX);
+
+        for ( ; *string; ++string)
+                hash = (hash ^ (uint8_t)*string) * 0x100000001b3ULL;
+
+        return hash * 0x100000001b3ULL;
+}
+
+static uint64_t policy_hash_verdict(uint64_t hash, PolicyVerdict *verdict) {
+        hash = policy_hash_u64(hash, verdict->verdict);
+        return policy_hash_u64(hash, verdict->priority);
+}
+
+static uint64_t policy_hash_xmit_list(uint64_t hash, CList *list) {
+        PolicyXmit *xmit;
+
+        c_list_for_each_entry(xmit, list, batch_link) {
+                hash = policy_hash_verdict(hash, &xmit->verdict);
+                hash = policy_hash_u64(hash, xmit->type);
+                hash = policy_hash_u64(hash, xmit->broadcast);
+                hash = policy_hash_u64(hash, xmit->min_fds);
+                hash = policy_hash_u64(hash, xmit->max_fds);
+                hash = policy_hash_string(hash, xmit->path);
+                hash = policy_hash_string(hash, xmit->interface);
+                hash = policy_hash_string(hash, xmit->member);
+        }
+
+        /* separate consecutive lists */
+        return policy_hash_u64(hash, UINT64_MAX);
+}
+
+static uint64_t policy_batch_hash(PolicyBatch *batch) {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        PolicyBatchName *name;
+
+        /* covers exactly what policy_batch_equal() compares */
+        hash = policy_hash_verdict(hash, &batch->connect_verdict);
+
+        c_rbtree_for_each_entry(name, &batch->name_tree, batch_node) {
+                hash = policy_hash_string(hash, name->name);
+                hash = policy_hash_verdict(hash, &name->own_verdict);
+                hash = policy_hash_verdict(hash, &name->own_prefix_verdict);
+                hash = policy_hash_xmit_list(hash, &name->send_unindexed);
+                hash = policy_hash_xmit_list(hash, &name->recv_unindexed);
+        }
+
+        return hash;
+}
+
+typedef struct PolicyRegistryShare {
+        uint64_t hash;
+        size_t position;
+        PolicyRegistryNode *node;
+} PolicyRegistryShare;
+
+static int policy_registry_share_compare(const void *_a, const void *_b) {
+        const PolicyRegistryShare *a = _a, *b = _b;
+
+        if (a->hash != b->hash)
+                return (a->hash > b->hash) - (a->hash < b->hash);
+
+        return (a->position > b->position) - (a->position < b->position);
+}
+
+static int policy_registry_share_tree(CRBTree *tree) {
+        _c_cleanup_(c_freep) PolicyRegistryShare *shares = NULL;
+        PolicyRegistryNode *node;
+        size_t i, j, from, n_shares = 0;
+
+        /*
+         * Nodes with identical content share a single batch. This keeps the
+         * memory footprint of a registry with many similar uid/gid entries
+         * low, and makes their batches compare equal by pointer. To avoid
+         * comparing every batch with every other batch, the batches are
+         * sorted by a hash of their content, and only batches with the same
+         * hash are compared. Ties are ordered by tree position, so each batch
+         * is shared with the first equal node in the tree.
+         */
+
+        c_rbtree_for_each_entry(node, tree, registry_node)
+                ++n_shares;
+
+        if (n_shares < 2)
+                return 0;
+
+        shares = malloc(n_shares * sizeof(*shares));
+        if (!shares)
+                return error_origin(-ENOMEM);
+
+        i = 0;
+        c_rbtree_for_each_entry(node, tree, registry_node) {
+                shares[i].hash = policy_batch_hash(node->batch);
+                shares[i].position = i;
+                shares[i].node = node;
+                ++i;
+        }
+
+        qsort(shares, n_shares, sizeof(*shares), policy_registry_share_compare);
+
+        for (from = 0; from < n_shares; from = i) {
+                for (i = from + 1; i < n_shares && shares[i].hash == shares[from].hash; ++i) {
+                        for (j = from; j < i; ++j) {
+                                if (policy_batch_equal(shares[i].node->batch, shares[j].node->batch)) {
+                                        policy_batch_unref(shares[i].node->batch);
+                                        shares[i].node->batch = policy_batch_ref(shares[j].node->batch);
+                                        break;
+                                }
+                        }
+                }
+        }
+
+        return 0;
+}
+
+static int policy_registry_bound_compare(const void *_a, const void *_b) {
+        uint64_t a = *(const uint64_t *)_a, b = *(const uint64_t *)_b;
+
+        if (a < b)
+                return -1;
+        if (a > b)
+                return 1;
+
+        return 0;
+}
+
+static int policy_registry_index_uid_ranges(PolicyRegistry *registry) {
+        _c_cleanup_(c_freep) uint64_t *bounds = NULL;
+        PolicyRegistrySegment *segments, *segment;
+        PolicyRegistryNode *node, **nodes;
+        size_t i, n, n_ranges = 0, n_bounds = 0, n_segments = 0, n_nodes = 0;
+
+        /*
+         * The uid-range policies might overlap arbitrarily, hence we cannot
+         * simply search the tree for the range a uid belongs to. Instead, we
+         * split the uid space at all range boundaries into disjoint segments,
+         * and remember for each segment all ranges covering it. Looking up the
+         * ranges of a uid is then a binary search over the segments. The
+         * index is built once when the policy is loaded.
+         */
+
+        assert(!registry->uid_range_segments);
+
+        c_rbtree_for_each_entry(node, &registry->uid_range_tree, registry_node)
+                ++n_ranges;
+
+        if (!n_ranges)
+                return 0;
+
+        bounds = malloc(2 * n_ranges * sizeof(*bounds));
+        if (!bounds)
+                return error_origin(-ENOMEM);
+
+        c_rbtree_for_each_entry(node, &registry->uid_range_tree, registry_node) {
+                bounds[n_bounds++] = node->index.uidgid_start;
+                bounds[n_bounds++] = (uint64_t)node->index.uidgid_end + 1;
+        }
+
+        qsort(bounds, n_bounds, sizeof(*bounds), policy_registry_bound_compare);
+
+        /* drop duplicate boundaries */
+        for (i = 1, n = 1; i < n_bounds; ++i)
+                if (bounds[i] != bounds[n - 1])
+                        bounds[n++] = bounds[i];
+        n_bounds = n;
+
+        /* count the non-empty segments and their nodes */
+        for (i = 0; i + 1 < n_bounds; ++i) {
+                n = 0;
+                c_rbtree_for_each_entry(node, &registry->uid_range_tree, registry_node) {
+                        if (node->index.uidgid_start > bounds[i])
+                                break;
+                        if (node->index.uidgid_end >= bounds[i])
+                                ++n;
+                }
+
+                if (n) {
+                        ++n_segments;
+                        n_nodes += n;
+                }
+        }
+
+        segments = malloc(n_segments * sizeof(*segments) + n_nodes * sizeof(*nodes));
+        if (!segments)
+                return error_origin(-ENOMEM);
+
+        segment = segments;
+        nodes = (PolicyRegistryNode **)(segments + n_segments);
+
+        for (i = 0; i + 1 < n_bounds; ++i) {
+                *segment = (PolicyRegistrySegment){
+                        .uid_start = bounds[i],
+                        .uid_end = bounds[i + 1] - 1,
+                        .nodes = nodes,
+                };
+
+                c_rbtree_for_each_entry(node, &registry->uid_range_tree, registry_node) {
+                        if (node->index.uidgid_start > bounds[i])
+                                break;
+                        if (node->index.uidgid_end >= bounds[i])
+                                segment->nodes[segment->n_nodes++] = node;
+                }
+
+                if (segment->n_nodes) {
+                        nodes += segment->n_nodes;
+                        ++segment;
+                }
+        }
+
+        registry->uid_range_segments = segments;
+        registry->n_uid_range_segments = n_segments;
+        return 0;
+}
+
 /**
  * policy_registry_import() - XXX
  */
@@ -615,9 +924,89 @@ int policy_registry_import(PolicyRegistry *registry, CDVar *v) {
         if (r)
                 return POLICY_E_INVALID;
 
+        r = policy_registry_share_tree(&registry->uid_tree);
+        if (r)
+                return error_trace(r);
+
+        r = policy_registry_share_tree(&registry->gid_tree);
+        if (r)
+                return error_trace(r);
+
+        r = policy_registry_share_tree(&registry->uid_range_tree);
+        if (r)
+                return error_trace(r);
+
+        r = policy_registry_index_uid_ranges(registry);
+        if (r)
+                return error_trace(r);
+
         return 0;
 }
 
+static size_t policy_registry_diff_tree(CRBTree *tree, CRBTree *old_tree) {
+        PolicyRegistryNode *node, *old_node;
+        size_t n_changed = 0, n_old = 0, n_kept = 0;
+
+        c_rbtree_for_each_entry(old_node, old_tree, registry_node)
+                ++n_old;
+
+        c_rbtree_for_each_entry(node, tree, registry_node) {
+                old_node = c_rbtree_find_entry(old_tree,
+                                               policy_registry_node_compare,
+                                               &node->index,
+                                               PolicyRegistryNode,
+                                               registry_node);
+                if (!old_node) {
+                        ++n_changed;
+                        continue;
+                }
+
+                ++n_kept;
+
+                if (!policy_batch_equal(node->batch, old_node->batch)) {
+                        ++n_changed;
+                        continue;
+                }
+
+                policy_batch_unref(node->batch);
+                node->batch = policy_batch_ref(old_node->batch);
+        }
+
+        return n_changed + (n_old - n_kept);
+}
+
+/**
+ * policy_registry_diff() - compare registry against its predecessor
+ * @registry:           freshly imported registry
+ * @old:                registry that is about to be replaced, or NULL
+ *
+ * This compares all batches of @registry with the batches of @old. Any batch
+ * with unchanged content is dropped from @registry and replaced by a reference
+ * to the batch of @old. Hence, snapshots taken from either registry share the
+ * same batch objects for everything that did not change.
+ *
+ * Return: The number of batches that were added, removed, or modified.
+ */
+size_t policy_registry_diff(PolicyRegistry *registry, PolicyRegistry *old) {
+        size_t n_changed = 0;
+
+        if (!old)
+                return SIZE_MAX;
+
+        if (policy_batch_equal(registry->default_batch, old->default_batch)) {
+                policy_batch_unref(registry->default_batch);
+                registry->default_batch = policy_batch_ref(old->default_batch);
+        } else {
+                ++n_changed;
+        }
+
+        n_changed += policy_registry_diff_tree(&registry->uid_tree, &old->uid_tree);
+        n_changed += policy_registry_diff_tree(&registry->gid_tree, &old->gid_tree);
+        n_changed += policy_registry_diff_tree(&registry->uid_range_tree, &old->uid_range_tree);
+
+        return n_changed;
+}
+
 /**
  * policy_snapshot_new() - XXX
  */
@@ -628,17 +1017,14 @@ int policy_snapshot_new(PolicySnapshot **snapshotp,
                         const uint32_t *gids,
                         size_t n_gids) {
         _c_cleanup_(policy_snapshot_freep) PolicySnapshot *snapshot = NULL;
+        PolicyRegistrySegment *segment;
         PolicyRegistryNode *node;
-        size_t n_batches = 1 + n_gids;
-
-        c_rbtree_for_each_entry(node, &registry->uid_range_tree, registry_node) {
-                if (node->index.uidgid_start > uid)
-                        continue;
-                if (node->index.uidgid_end < uid)
-                        continue;
+        size_t i, n_batches = 1 + n_gids;
+        int r;
 
-                ++n_batches;
-        }
+        segment = policy_registry_find_uid_range_segment(registry, uid);
+        if (segment)
+                n_batches += segment->n_nodes;
 
         snapshot = calloc(1, sizeof(*snapshot) + n_batches * sizeof(*snapshot->batches));
         if (!snapshot)
@@ -652,6 +1038,10 @@ int policy_snapshot_new(PolicySnapshot **snapshotp,
         if (!snapshot->seclabel)
                 return error_origin(-ENOMEM);
 
+        r = bus_selinux_id_init(&snapshot->sid, snapshot->seclabel);
+        if (r)
+                return error_fold(r);
+
         /* fetch matching uid policy */
         node = policy_registry_find_uid(registry, uid);
         if (node)
@@ -660,14 +1050,8 @@ int policy_snapshot_new(PolicySnapshot **snapshotp,
                 snapshot->batches[snapshot->n_batches++] = policy_batch_ref(registry->default_batch);
 
         /* fetch all matching uid-range policies */
-        c_rbtree_for_each_entry(node, &registry->uid_range_tree, registry_node) {
-                if (node->index.uidgid_start > uid)
-                        continue;
-                if (node->index.uidgid_end < uid)
-                        continue;
-
-                snapshot->batches[snapshot->n_batches++] = policy_batch_ref(node->batch);
-        }
+        for (i = 0; segment && i < segment->n_nodes; ++i)
+                snapshot->batches[snapshot->n_batches++] = policy_batch_ref(segment->nodes[i]->batch);
 
         /* fetch all matching gid policies */
         while (n_gids-- > 0) {
@@ -683,6 +1067,51 @@ int policy_snapshot_new(PolicySnapshot **snapshotp,
         return 0;
 }
 
+/**
+ * policy_snapshot_is_current() - check whether snapshot matches registry
+ * @snapshot:           snapshot to check
+ * @registry:           registry to check against
+ * @uid:                uid the snapshot was created for
+ * @gids:               gids the snapshot was created for
+ * @n_gids:             number of gids
+ *
+ * This checks whether a snapshot created via policy_snapshot_new() from
+ * @registry would reference exactly the same batches as @snapshot. This is
+ * only meaningful after policy_registry_diff() made @registry share all its
+ * unchanged batches with the registry @snapshot was created from. In that
+ * case, @snapshot does not have to be regenerated.
+ *
+ * Return: True if @snapshot is up-to-date, false if not.
+ */
+bool policy_snapshot_is_current(PolicySnapshot *snapshot,
+                                PolicyRegistry *registry,
+                                uint32_t uid,
+                                const uint32_t *gids,
+                                size_t n_gids) {
+        PolicyRegistrySegment *segment;
+        PolicyRegistryNode *node;
+        size_t i, n_batches = 0;
+
+        node = policy_registry_find_uid(registry, uid);
+        if (snapshot->batches[n_batches++] != (node ? node->batch : registry->default_batch))
+                return false;
+
+        segment = policy_registry_find_uid_range_segment(registry, uid);
+        for (i = 0; segment && i < segment->n_nodes; ++i)
+                if (n_batches >= snapshot->n_batches ||
+                    snapshot->batches[n_batches++] != segment->nodes[i]->batch)
+                        return false;
+
+        while (n_gids-- > 0) {
+                node = policy_registry_find_gid(registry, gids[n_gids]);
+                if (node && (n_batches >= snapshot->n_batches ||
+                             snapshot->batches[n_batches++] != node->batch))
+                        return false;
+        }
+
+        return n_batches == snapshot->n_batches;
+}
+
 /**
  * policy_snapshot_free() - XXX
  */
@@ -699,6 +1128,21 @@ PolicySnapshot *policy_snapshot_free(PolicySnapshot *snapshot) {
         return NULL;
 }
 
+/**
+ * policy_snapshot_set_selinux() - replace SELinux registry of snapshot
+ * @snapshot:           snapshot to operate on
+ * @selinux:            new SELinux registry to use
+ *
+ * This makes @snapshot use @selinux for its SELinux checks. This is used when a
+ * new policy registry is installed, but the batches of @snapshot did not
+ * change, so there is no need to regenerate the snapshot.
+ */
+void policy_snapshot_set_selinux(PolicySnapshot *snapshot, BusSELinuxRegistry *selinux) {
+        bus_selinux_registry_ref(selinux);
+        bus_selinux_registry_unref(snapshot->selinux);
+        snapshot->selinux = selinux;
+}
+
 /**
  * policy_snapshot_dup() - XXX
  */
@@ -714,6 +1158,7 @@ int policy_snapshot_dup(PolicySnapshot *snapshot, PolicySnapshot **newp) {
 
         new->selinux = bus_selinux_registry_ref(snapshot->selinux);
 
+        new->sid = snapshot->sid;
         new->seclabel = strdup(snapshot->seclabel);
         if (!new->seclabel)
                 return error_origin(-ENOMEM);
@@ -796,21 +1241,18 @@ int policy_snapshot_check_own(PolicySnapshot *snapshot, const char *name_str) {
         return verdict.verdict ? 0 : POLICY_E_ACCESS_DENIED;
 }
 
-static void policy_snapshot_check_xmit_name(PolicyBatch *batch,
+static void policy_snapshot_check_xmit_name(PolicyBatchName *name,
                                             bool is_send,
                                             PolicyVerdict *verdict,
-                                            const char *name_str,
                                             const char *interface,
                                             const char *member,
                                             const char *path,
                                             unsigned int type,
                                             bool broadcast,
                                             size_t n_fds) {
-        PolicyBatchName *name;
         PolicyXmit *xmit;
         CList *list;
 
-        name = policy_batch_find_name(batch, name_str);
         if (!name)
                 return;
 
@@ -870,18 +1312,20 @@ static void policy_snapshot_check_xmit(PolicyBatch *batch,
         NameOwnership *ownership;
         size_t i;
 
+        /*
+         * Skip batches without any rules for this direction right away. This
+         * is the common case for uid-range and gid batches.
+         */
+        if (!(is_send ? batch->n_send : batch->n_recv))
+                return;
+
         /*
          * The empty name is a catch-all entry. Always check it for every
          * policy decision.
-         *
-         * XXX: Maybe we should cache the pointer to the catch-all entry, since
-         *      doing the lookup on all messages seems rather expensive just
-         *      for the sake of simplicity.
          */
-        policy_snapshot_check_xmit_name(batch,
+        policy_snapshot_check_xmit_name(batch->name_all,
                                         is_send,
                                         verdict,
-                                        "",
                                         interface,
                                         method,
                                         path,
@@ -895,10 +1339,9 @@ static void policy_snapshot_check_xmit(PolicyBatch *batch,
                  * Hence, hard-code its name, since the driver owns it
                  * unconditionally, and just that name.
                  */
-                policy_snapshot_check_xmit_name(batch,
+                policy_snapshot_check_xmit_name(batch->name_driver,
                                                 is_send,
                                                 verdict,
-                                                "org.freedesktop.DBus",
                                                 interface,
                                                 method,
                                                 path,
@@ -914,10 +1357,9 @@ static void policy_snapshot_check_xmit(PolicyBatch *batch,
                 c_rbtree_for_each_entry(ownership,
                                         &nameset->owner->ownership_tree,
                                         owner_node)
-                        policy_snapshot_check_xmit_name(batch,
+                        policy_snapshot_check_xmit_name(policy_batch_find_name(batch, ownership->name->name),
                                                         is_send,
                                                         verdict,
-                                                        ownership->name->name,
                                                         interface,
                                                         method,
                                                         path,
@@ -931,10 +1373,9 @@ static void policy_snapshot_check_xmit(PolicyBatch *batch,
                  * queued names as well, since the policy matches on it.
                  */
                 for (i = 0; i < nameset->snapshot->n_names; ++i)
-                        policy_snapshot_check_xmit_name(batch,
+                        policy_snapshot_check_xmit_name(policy_batch_find_name(batch, nameset->snapshot->names[i]->name),
                                                         is_send,
                                                         verdict,
-                                                        nameset->snapshot->names[i]->name,
                                                         interface,
                                                         method,
                                                         path,
@@ -950,7 +1391,7 @@ static void policy_snapshot_check_xmit(PolicyBatch *batch,
  * policy_snapshot_check_send() - XXX
  */
 int policy_snapshot_check_send(PolicySnapshot *snapshot,
-                               const char *subject_seclabel,
+                               BusSELinuxID *subject_sid,
                                NameSet *subject,
                                const char *interface,
                                const char *method,
@@ -962,7 +1403,7 @@ int policy_snapshot_check_send(PolicySnapshot *snapshot,
         size_t i;
         int r;
 
-        r = bus_selinux_check_send(snapshot->selinux, snapshot->seclabel, subject_seclabel);
+        r = bus_selinux_check_send(snapshot->selinux, snapshot->sid, subject_sid);
         if (r) {
                 if (r == SELINUX_E_DENIED)
                         return POLICY_E_SELINUX_ACCESS_DENIED;
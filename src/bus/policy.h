@@ -12,6 +12,7 @@
 #include <stdlib.h>
 #include "dbus/protocol.h"
 
+typedef struct BusSELinuxID BusSELinuxID;
 typedef struct BusSELinuxRegistry BusSELinuxRegistry;
 typedef struct NameSet NameSet;
 typedef struct PolicyBatch PolicyBatch;
@@ -19,6 +20,7 @@ typedef struct PolicyBatchName PolicyBatchName;
 typedef struct PolicyRegistry PolicyRegistry;
 typedef struct PolicyRegistryNode PolicyRegistryNode;
 typedef struct PolicyRegistryNodeIndex PolicyRegistryNodeIndex;
+typedef struct PolicyRegistrySegment PolicyRegistrySegment;
 typedef struct PolicySnapshot PolicySnapshot;
 typedef struct PolicyVerdict PolicyVerdict;
 typedef struct PolicyXmit PolicyXmit;
@@ -80,6 +82,10 @@ struct PolicyBatch {
         _Atomic unsigned long n_refs;
         PolicyVerdict connect_verdict;
         CRBTree name_tree;
+        PolicyBatchName *name_all;
+        PolicyBatchName *name_driver;
+        size_t n_send;
+        size_t n_recv;
 };
 
 #define POLICY_BATCH_NULL(_x) {                                                 \
@@ -110,12 +116,22 @@ struct PolicyRegistryNode {
                 .registry_node = C_RBNODE_INIT((_x).registry_node),             \
         }
 
+struct PolicyRegistrySegment {
+        uint32_t uid_start;
+        uint32_t uid_end;
+        size_t n_nodes;
+        PolicyRegistryNode **nodes;
+};
+
 struct PolicyRegistry {
         BusSELinuxRegistry *selinux;
         PolicyBatch *default_batch;
         CRBTree uid_range_tree;
         CRBTree uid_tree;
         CRBTree gid_tree;
+
+        size_t n_uid_range_segments;
+        PolicyRegistrySegment *uid_range_segments;
 };
 
 #define POLICY_REGISTRY_NULL {                                                  \
@@ -126,6 +142,7 @@ struct PolicyRegistry {
 
 struct PolicySnapshot {
         BusSELinuxRegistry *selinux;
+        BusSELinuxID *sid;
         char *seclabel;
         size_t n_batches;
         PolicyBatch *batches[];
@@ -144,6 +161,7 @@ int policy_registry_new(PolicyRegistry **registryp, const char *fallback_seclabe
 PolicyRegistry *policy_registry_free(PolicyRegistry *registry);
 
 int policy_registry_import(PolicyRegistry *registry, CDVar *v);
+size_t policy_registry_diff(PolicyRegistry *registry, PolicyRegistry *old);
 
 C_DEFINE_CLEANUP(PolicyRegistry *, policy_registry_free);
 
@@ -156,13 +174,19 @@ int policy_snapshot_new(PolicySnapshot **snapshotp,
                         const uint32_t *gids,
                         size_t n_gids);
 PolicySnapshot *policy_snapshot_free(PolicySnapshot *snapshot);
+bool policy_snapshot_is_current(PolicySnapshot *snapshot,
+                                PolicyRegistry *registry,
+                                uint32_t uid,
+                                const uint32_t *gids,
+                                size_t n_gids);
 
 int policy_snapshot_dup(PolicySnapshot *snapshot, PolicySnapshot **newp);
+void policy_snapshot_set_selinux(PolicySnapshot *snapshot, BusSELinuxRegistry *selinux);
 
 int policy_snapshot_check_connect(PolicySnapshot *snapshot);
 int policy_snapshot_check_own(PolicySnapshot *snapshot, const char *name);
 int policy_snapshot_check_send(PolicySnapshot *snapshot,
-                               const char *subject_context,
+                               BusSELinuxID *subject_sid,
                                NameSet *subject,
                                const char *interface,
                                const char *method,
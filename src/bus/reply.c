@@ -1,69 +1,170 @@
 /*
  * Reply Registry
+ *
+ * Every peer tracks the replies it owes to other peers in a reply registry,
+ * keyed by the id of the peer expecting the reply and the serial of the
+ * method call. Every unicast method call inserts a slot, and every reply
+ * looks one up and removes it again. Hence, the registry is an open
+ * addressing hash table with linear probing. Removals shift the following
+ * entries of the same probe sequence backwards, so no tombstones are ever
+ * left behind and lookups never degrade over the lifetime of a peer.
+ *
+ * The slots themselves are carved out of slabs owned by the registry. Released
+ * slots are put on a free-list and are reused by the next call, so a peer in
+ * steady state does not hit the allocator at all. Slabs grow geometrically
+ * and are only released together with the registry. Since every slot is
+ * accounted on the user, the number of slabs is bounded by the quota.
  */
 
 #include <c-list.h>
 #include <c-macro.h>
-#include <c-rbtree.h>
 #include <stdlib.h>
 #include "bus/reply.h"
+#include "util/dispatch.h"
 #include "util/error.h"
 #include "util/user.h"
 
-typedef struct ReplySlotKey ReplySlotKey;
+#define REPLY_SLAB_MIN (4)
+#define REPLY_SLAB_MAX (256)
 
-struct ReplySlotKey {
-        uint64_t id;
-        uint32_t serial;
+struct ReplySlab {
+        ReplySlab *next;
+        size_t n_slots;
+        ReplySlot slots[];
 };
 
-static int reply_slot_compare(CRBTree *tree, void *k, CRBNode *rb) {
-        ReplySlot *slot = c_container_of(rb, ReplySlot, registry_node);
-        ReplySlotKey *key = k;
+static size_t reply_slot_hash(uint64_t id, uint32_t serial) {
+        uint64_t hash = id * 0x9e3779b97f4a7c15ULL + serial;
 
-        if (key->id < slot->id)
-                return -1;
-        if (key->id > slot->id)
-                return 1;
+        hash ^= hash >> 30;
+        hash *= 0xbf58476d1ce4e5b9ULL;
+        hash ^= hash >> 27;
+        hash *= 0x94d049bb133111ebULL;
+        hash ^= hash >> 31;
 
-        if (key->serial < slot->serial)
-                return -1;
-        if (key->serial > slot->serial)
-                return 1;
+        return hash;
+}
+
+/*
+ * Return the index of the entry for @id and @serial, or the index of the
+ * empty slot that terminates its probe sequence. The table must be allocated
+ * and must never be full.
+ */
+static size_t reply_registry_probe(ReplyRegistry *registry, uint64_t id, uint32_t serial) {
+        size_t mask = registry->n_slots - 1, i;
+        ReplySlot *slot;
+
+        for (i = reply_slot_hash(id, serial) & mask; (slot = registry->slots[i]); i = (i + 1) & mask)
+                if (slot->id == id && slot->serial == serial)
+                        break;
+
+        return i;
+}
+
+static int reply_registry_resize(ReplyRegistry *registry, size_t n_slots) {
+        ReplySlot **slots, *slot;
+
+        slots = calloc(n_slots, sizeof(*slots));
+        if (!slots)
+                return error_origin(-ENOMEM);
+
+        free(registry->slots);
+        registry->slots = slots;
+        registry->n_slots = n_slots;
+
+        c_list_for_each_entry(slot, &registry->reply_list, registry_link)
+                registry->slots[reply_registry_probe(registry, slot->id, slot->serial)] = slot;
 
         return 0;
 }
 
+static void reply_registry_remove(ReplyRegistry *registry, size_t i) {
+        size_t mask = registry->n_slots - 1, j, home;
+        ReplySlot *slot;
+
+        registry->slots[i] = NULL;
+
+        /*
+         * Close the hole at @i by moving back every following entry of the
+         * cluster, whose home slot lies cyclically outside of (@i, @j].
+         * Otherwise, its probe sequence would be cut short by the hole.
+         */
+        for (j = (i + 1) & mask; (slot = registry->slots[j]); j = (j + 1) & mask) {
+                home = reply_slot_hash(slot->id, slot->serial) & mask;
+                if (((j - home) & mask) >= ((j - i) & mask)) {
+                        registry->slots[i] = slot;
+                        registry->slots[j] = NULL;
+                        i = j;
+                }
+        }
+}
+
+static ReplySlot *reply_registry_alloc(ReplyRegistry *registry) {
+        ReplySlot *slot;
+        ReplySlab *slab;
+        size_t i, n;
+
+        if (c_list_is_empty(&registry->free_list)) {
+                n = registry->slabs ? c_min(registry->slabs->n_slots * 2, (size_t)REPLY_SLAB_MAX) : REPLY_SLAB_MIN;
+
+                slab = malloc(sizeof(*slab) + n * sizeof(*slab->slots));
+                if (!slab)
+                        return NULL;
+
+                slab->next = registry->slabs;
+                slab->n_slots = n;
+                registry->slabs = slab;
+
+                for (i = 0; i < n; ++i)
+                        c_list_link_tail(&registry->free_list, &slab->slots[i].registry_link);
+        }
+
+        slot = c_list_first_entry(&registry->free_list, ReplySlot, registry_link);
+        c_list_unlink(&slot->registry_link);
+        return slot;
+}
+
+static void reply_registry_release(ReplyRegistry *registry, ReplySlot *slot) {
+        /* reuse the most recently released slot first, it is likely cached */
+        c_list_link_front(&registry->free_list, &slot->registry_link);
+}
+
 int reply_slot_new(ReplySlot **replyp, ReplyRegistry *registry, ReplyOwner *owner, User *user, User *actor, uint64_t id, uint32_t serial) {
         ReplySlot *reply;
-        CRBNode **slot, *parent;
-        ReplySlotKey key = {
-                .id = id,
-                .serial = serial,
-        };
+        size_t i;
         int r;
 
-        slot = c_rbtree_find_slot(&registry->reply_tree, reply_slot_compare, &key, &parent);
-        if (!slot)
+        if ((registry->n_replies + 1) * 2 > registry->n_slots) {
+                r = reply_registry_resize(registry, c_max(registry->n_slots * 2, (size_t)REPLY_REGISTRY_SLOTS_MIN));
+                if (r)
+                        return error_trace(r);
+        }
+
+        i = reply_registry_probe(registry, id, serial);
+        if (registry->slots[i])
                 return REPLY_E_EXISTS;
 
-        reply = calloc(1, sizeof(*reply));
+        reply = reply_registry_alloc(registry);
         if (!reply)
                 return error_origin(-ENOMEM);
 
         reply->registry = registry;
         reply->owner = owner;
         reply->charge = (UserCharge)USER_CHARGE_INIT;
-        reply->registry_node = (CRBNode)C_RBNODE_INIT(reply->registry_node);
         reply->owner_link = (CList)C_LIST_INIT(reply->owner_link);
+        reply->timeout = (DispatchTimer)DISPATCH_TIMER_NULL(reply->timeout);
         reply->id = id;
         reply->serial = serial;
 
         r = user_charge(user, &reply->charge, actor, USER_SLOT_OBJECTS, 1);
-        if (r)
+        if (r) {
+                reply_registry_release(registry, reply);
                 return (r == USER_E_QUOTA) ? REPLY_E_QUOTA : error_fold(r);
+        }
 
-        c_rbtree_add(&registry->reply_tree, parent, slot, &reply->registry_node);
+        registry->slots[i] = reply;
+        ++registry->n_replies;
+        c_list_link_tail(&registry->reply_list, &reply->registry_link);
         c_list_link_tail(&owner->reply_list, &reply->owner_link);
 
         *replyp = reply;
@@ -72,33 +173,51 @@ int reply_slot_new(ReplySlot **replyp, ReplyRegistry *registry, ReplyOwner *owne
 }
 
 ReplySlot *reply_slot_free(ReplySlot *slot) {
+        ReplyRegistry *registry;
+
         if (!slot)
                 return NULL;
 
+        registry = slot->registry;
+
+        dispatch_timer_deinit(&slot->timeout);
         user_charge_deinit(&slot->charge);
         c_list_unlink(&slot->owner_link);
-        c_rbnode_unlink(&slot->registry_node);
+        c_list_unlink(&slot->registry_link);
+
+        reply_registry_remove(registry, reply_registry_probe(registry, slot->id, slot->serial));
+        --registry->n_replies;
 
-        free(slot);
+        reply_registry_release(registry, slot);
 
         return NULL;
 }
 
 ReplySlot *reply_slot_get_by_id(ReplyRegistry *registry, uint64_t id, uint32_t serial) {
-        ReplySlotKey key = {
-                .id = id,
-                .serial = serial,
-        };
+        if (!registry->n_replies)
+                return NULL;
 
-        return c_rbtree_find_entry(&registry->reply_tree, reply_slot_compare, &key, ReplySlot, registry_node);
+        return registry->slots[reply_registry_probe(registry, id, serial)];
 }
 
 void reply_registry_init(ReplyRegistry *registry) {
-        *registry = (ReplyRegistry)REPLY_REGISTRY_INIT;
+        *registry = (ReplyRegistry)REPLY_REGISTRY_INIT(*registry);
 }
 
 void reply_registry_deinit(ReplyRegistry *registry) {
-        assert(c_rbtree_is_empty(&registry->reply_tree));
+        ReplySlab *slab;
+
+        assert(c_list_is_empty(&registry->reply_list));
+        assert(!registry->n_replies);
+
+        while ((slab = registry->slabs)) {
+                registry->slabs = slab->next;
+                free(slab);
+        }
+
+        registry->free_list = (CList)C_LIST_INIT(registry->free_list);
+        registry->slots = c_free(registry->slots);
+        registry->n_slots = 0;
 }
 
 void reply_owner_init(ReplyOwner *owner) {
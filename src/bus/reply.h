@@ -6,10 +6,11 @@
 
 #include <c-list.h>
 #include <c-macro.h>
-#include <c-rbtree.h>
 #include <stdlib.h>
+#include "util/dispatch.h"
 #include "util/user.h"
 
+typedef struct ReplySlab ReplySlab;
 typedef struct ReplySlot ReplySlot;
 typedef struct ReplyRegistry ReplyRegistry;
 typedef struct ReplyOwner ReplyOwner;
@@ -27,16 +28,25 @@ struct ReplySlot {
         UserCharge charge;
         uint64_t id;
         uint32_t serial;
-        CRBNode registry_node;
+        CList registry_link;
         CList owner_link;
+        DispatchTimer timeout;
 };
 
+#define REPLY_REGISTRY_SLOTS_MIN (16)
+
 struct ReplyRegistry {
-        CRBTree reply_tree;
+        CList reply_list;
+        CList free_list;
+        ReplySlab *slabs;
+        ReplySlot **slots;
+        size_t n_slots;
+        size_t n_replies;
 };
 
-#define REPLY_REGISTRY_INIT {                   \
-                .reply_tree = C_RBTREE_INIT,    \
+#define REPLY_REGISTRY_INIT(_x) {                                       \
+                .reply_list = C_LIST_INIT((_x).reply_list),             \
+                .free_list = C_LIST_INIT((_x).free_list),               \
         }
 
 struct ReplyOwner {
@@ -0,0 +1,240 @@
+/*
+ * Test Auxiliary Group Cache
+ */
+
+#include <c-macro.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include "bus/groups.h"
+
+static size_t test_n_requests;
+static size_t test_n_wakeups;
+static size_t test_n_failures;
+
+static int test_request_fn(GroupCache *cache, uid_t uid) {
+        ++test_n_requests;
+        return 0;
+}
+
+static int test_waiter_fn(GroupWaiter *waiter, bool resolved) {
+        assert(!group_waiter_is_waiting(waiter));
+        if (resolved)
+                ++test_n_wakeups;
+        else
+                ++test_n_failures;
+        return 0;
+}
+
+static void test_basic(void) {
+        static const uint32_t groups[] = { 10, 20, 30 };
+        GroupWaiter waiter1, waiter2;
+        GroupCache cache;
+        const uint32_t *gids;
+        size_t n_gids;
+        int r;
+
+        test_n_requests = 0;
+        test_n_wakeups = 0;
+
+        group_cache_init(&cache, test_request_fn);
+        group_waiter_init(&waiter1, test_waiter_fn);
+        group_waiter_init(&waiter2, test_waiter_fn);
+
+        /* unknown uids are requested exactly once */
+        r = group_cache_get(&cache, 1, &gids, &n_gids);
+        assert(r == GROUP_E_PENDING);
+        r = group_cache_get(&cache, 1, &gids, &n_gids);
+        assert(r == GROUP_E_PENDING);
+        assert(test_n_requests == 1);
+
+        r = group_cache_wait(&cache, &waiter1, 1);
+        assert(!r);
+        r = group_cache_wait(&cache, &waiter2, 1);
+        assert(!r);
+        assert(test_n_requests == 1);
+        assert(group_waiter_is_waiting(&waiter1));
+        assert(group_waiter_is_waiting(&waiter2));
+
+        /* answers for other uids do not wake anyone */
+        r = group_cache_resolve(&cache, 2, groups, C_ARRAY_SIZE(groups));
+        assert(!r);
+        assert(!test_n_wakeups);
+
+        r = group_cache_resolve(&cache, 1, groups, C_ARRAY_SIZE(groups));
+        assert(!r);
+        assert(test_n_wakeups == 2);
+        assert(!group_waiter_is_waiting(&waiter1));
+        assert(!group_waiter_is_waiting(&waiter2));
+
+        r = group_cache_get(&cache, 1, &gids, &n_gids);
+        assert(!r);
+        assert(n_gids == C_ARRAY_SIZE(groups));
+        assert(gids[0] == 10 && gids[1] == 20 && gids[2] == 30);
+        assert(test_n_requests == 1);
+
+        group_waiter_deinit(&waiter2);
+        group_waiter_deinit(&waiter1);
+        group_cache_deinit(&cache);
+}
+
+static void test_expiry(void) {
+        static const uint32_t groups[] = { 10 };
+        GroupWaiter waiter;
+        GroupCache cache;
+        const uint32_t *gids;
+        size_t n_gids;
+        int r;
+
+        test_n_requests = 0;
+        test_n_wakeups = 0;
+
+        group_cache_init(&cache, test_request_fn);
+        group_waiter_init(&waiter, test_waiter_fn);
+        cache.ttl = 0;
+
+        r = group_cache_get(&cache, 1, &gids, &n_gids);
+        assert(r == GROUP_E_PENDING);
+        r = group_cache_resolve(&cache, 1, NULL, 0);
+        assert(!r);
+
+        /* expired groups are still returned, but refreshed once */
+        r = group_cache_get(&cache, 1, &gids, &n_gids);
+        assert(!r);
+        assert(!n_gids);
+        r = group_cache_get(&cache, 1, &gids, &n_gids);
+        assert(!r);
+        assert(test_n_requests == 2);
+
+        r = group_cache_resolve(&cache, 1, groups, C_ARRAY_SIZE(groups));
+        assert(!r);
+
+        r = group_cache_get(&cache, 1, &gids, &n_gids);
+        assert(!r);
+        assert(n_gids == 1 && gids[0] == 10);
+        assert(test_n_requests == 3);
+
+        /* waiters that gave up are not woken up */
+        r = group_cache_wait(&cache, &waiter, 1);
+        assert(!r);
+        group_waiter_deinit(&waiter);
+        r = group_cache_resolve(&cache, 1, groups, C_ARRAY_SIZE(groups));
+        assert(!r);
+        assert(!test_n_wakeups);
+
+        group_cache_deinit(&cache);
+}
+
+static void test_fail(void) {
+        static const uint32_t groups[] = { 10 };
+        GroupWaiter waiter1, waiter2;
+        GroupCache cache;
+        const uint32_t *gids;
+        size_t n_gids;
+        int r;
+
+        test_n_requests = 0;
+        test_n_wakeups = 0;
+        test_n_failures = 0;
+
+        group_cache_init(&cache, test_request_fn);
+        group_waiter_init(&waiter1, test_waiter_fn);
+        group_waiter_init(&waiter2, test_waiter_fn);
+
+        r = group_cache_wait(&cache, &waiter1, 1);
+        assert(!r);
+        r = group_cache_wait(&cache, &waiter2, 1);
+        assert(!r);
+        assert(test_n_requests == 1);
+
+        /* waiters are told about failures, nothing is cached */
+        r = group_cache_fail(&cache, 1);
+        assert(!r);
+        assert(!test_n_wakeups);
+        assert(test_n_failures == 2);
+        assert(!group_waiter_is_waiting(&waiter1));
+        assert(!group_waiter_is_waiting(&waiter2));
+        assert(c_rbtree_is_empty(&cache.entry_tree));
+
+        r = group_cache_get(&cache, 1, &gids, &n_gids);
+        assert(r == GROUP_E_PENDING);
+        assert(test_n_requests == 2);
+
+        /* a failed refresh drops the groups resolved earlier */
+        r = group_cache_resolve(&cache, 1, groups, C_ARRAY_SIZE(groups));
+        assert(!r);
+        cache.ttl = 0;
+        r = group_cache_resolve(&cache, 1, groups, C_ARRAY_SIZE(groups));
+        assert(!r);
+        r = group_cache_get(&cache, 1, &gids, &n_gids);
+        assert(!r);
+        assert(test_n_requests == 3);
+
+        r = group_cache_fail(&cache, 1);
+        assert(!r);
+        r = group_cache_get(&cache, 1, &gids, &n_gids);
+        assert(r == GROUP_E_PENDING);
+        assert(test_n_requests == 4);
+
+        group_waiter_deinit(&waiter2);
+        group_waiter_deinit(&waiter1);
+        group_cache_deinit(&cache);
+}
+
+static void test_prune(void) {
+        static const uint32_t groups[] = { 10 };
+        GroupWaiter waiter;
+        GroupCache cache;
+        const uint32_t *gids;
+        size_t n_gids;
+        int r;
+
+        test_n_requests = 0;
+        test_n_wakeups = 0;
+
+        group_cache_init(&cache, test_request_fn);
+        group_waiter_init(&waiter, test_waiter_fn);
+        cache.ttl = 0;
+
+        /* expired entries are released once another uid is looked up */
+        r = group_cache_get(&cache, 1, &gids, &n_gids);
+        assert(r == GROUP_E_PENDING);
+        r = group_cache_resolve(&cache, 1, groups, C_ARRAY_SIZE(groups));
+        assert(!r);
+
+        cache.ttl = GROUP_CACHE_TTL_DEFAULT;
+        r = group_cache_get(&cache, 2, &gids, &n_gids);
+        assert(r == GROUP_E_PENDING);
+        r = group_cache_resolve(&cache, 2, groups, C_ARRAY_SIZE(groups));
+        assert(!r);
+        r = group_cache_get(&cache, 2, &gids, &n_gids);
+        assert(!r);
+        assert(c_rbtree_first(&cache.entry_tree) == c_rbtree_last(&cache.entry_tree));
+
+        r = group_cache_get(&cache, 1, &gids, &n_gids);
+        assert(r == GROUP_E_PENDING);
+        assert(test_n_requests == 3);
+
+        /* entries with a request in flight, or waiters, are kept */
+        cache.ttl = 0;
+        r = group_cache_wait(&cache, &waiter, 1);
+        assert(!r);
+        r = group_cache_resolve(&cache, 2, groups, C_ARRAY_SIZE(groups));
+        assert(!r);
+        r = group_cache_get(&cache, 2, &gids, &n_gids);
+        assert(!r);
+        r = group_cache_resolve(&cache, 1, groups, C_ARRAY_SIZE(groups));
+        assert(!r);
+        assert(test_n_wakeups == 1);
+        assert(test_n_requests == 4);
+
+        group_waiter_deinit(&waiter);
+        group_cache_deinit(&cache);
+}
+
+int main(int argc, char **argv) {
+        test_basic();
+        test_expiry();
+        test_fail();
+        test_prune();
+        return 0;
+}
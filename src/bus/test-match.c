@@ -145,6 +145,7 @@ static bool test_match(const char *match_string, MessageMetadata *metadata) {
 
 static void test_individual_matches(void) {
         MessageMetadata metadata = MESSAGE_METADATA_INIT;
+        MessageArg args[1] = {};
 
         assert(test_match("", &metadata));
 
@@ -199,6 +200,7 @@ static void test_individual_matches(void) {
         /* arg0 */
         metadata = (MessageMetadata)MESSAGE_METADATA_INIT;
         assert(!test_match("arg0=/com/example/foo/", &metadata));
+        metadata.args = args;
         metadata.args[0].value = "/com/example/foo/";
         metadata.args[0].element = 's';
         metadata.n_args = 1;
@@ -224,6 +226,7 @@ static void test_individual_matches(void) {
         /* arg0path - parent */
         metadata = (MessageMetadata)MESSAGE_METADATA_INIT;
         assert(!test_match("arg0path=/com/example/foo/", &metadata));
+        metadata.args = args;
         metadata.args[0].value = "/com/example/foo/";
         metadata.args[0].element = 'o';
         metadata.n_args = 1;
@@ -236,6 +239,7 @@ static void test_individual_matches(void) {
         /* arg0path - child */
         metadata = (MessageMetadata)MESSAGE_METADATA_INIT;
         assert(!test_match("arg0path=/com/example/foo", &metadata));
+        metadata.args = args;
         metadata.args[0].value = "/com/example/foo";
         metadata.args[0].element = 'o';
         metadata.n_args = 1;
@@ -248,6 +252,7 @@ static void test_individual_matches(void) {
         /* arg0namespace */
         metadata = (MessageMetadata)MESSAGE_METADATA_INIT;
         assert(!test_match("arg0namespace=com.example.foo", &metadata));
+        metadata.args = args;
         metadata.args[0].value = "com.example.foo";
         metadata.args[0].element = 's';
         metadata.n_args = 1;
@@ -314,6 +319,46 @@ static void test_iterator(void) {
 
 }
 
+static void test_n_args(void) {
+        MatchRegistry registry = MATCH_REGISTRY_INIT(registry);
+        MatchOwner owner;
+        MatchRule *rule1, *rule2, *rule3;
+        int r;
+
+        match_owner_init(&owner);
+
+        assert(match_registry_get_n_args(&registry) == 0);
+
+        r = match_owner_ref_rule(&owner, &rule1, NULL, "member=Foo");
+        assert(!r);
+        r = match_rule_link(rule1, &registry, false);
+        assert(!r);
+        assert(match_registry_get_n_args(&registry) == 0);
+
+        r = match_owner_ref_rule(&owner, &rule2, NULL, "arg0namespace=org.example");
+        assert(!r);
+        r = match_rule_link(rule2, &registry, false);
+        assert(!r);
+        assert(match_registry_get_n_args(&registry) == 1);
+
+        r = match_owner_ref_rule(&owner, &rule3, NULL, "arg4path=/org/example/");
+        assert(!r);
+        r = match_rule_link(rule3, &registry, false);
+        assert(!r);
+        assert(match_registry_get_n_args(&registry) == 5);
+
+        /* the bound is only reset once no rule references arguments */
+        match_rule_user_unref(rule3);
+        assert(match_registry_get_n_args(&registry) == 5);
+        match_rule_user_unref(rule2);
+        assert(match_registry_get_n_args(&registry) == 0);
+        match_rule_user_unref(rule1);
+        assert(match_registry_get_n_args(&registry) == 0);
+
+        match_owner_deinit(&owner);
+        match_registry_deinit(&registry);
+}
+
 int main(int argc, char **argv) {
         MatchOwner owner = MATCH_OWNER_INIT(owner);
 
@@ -326,6 +371,7 @@ int main(int argc, char **argv) {
         test_individual_matches();
 
         test_iterator();
+        test_n_args();
 
         match_owner_deinit(&owner);
         return 0;
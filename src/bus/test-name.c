@@ -3,6 +3,7 @@
  */
 
 #include <c-macro.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <sys/socket.h>
 #include "bus/name.h"
@@ -219,9 +220,50 @@ static void test_queue(void) {
         name_registry_deinit(&registry);
 }
 
+static void test_many(void) {
+        NameRegistry registry;
+        NameOwner owner;
+        NameChange change;
+        char name_str[64];
+        unsigned int i;
+        int r;
+
+        name_registry_init(&registry);
+        name_owner_init(&owner);
+        name_change_init(&change);
+
+        /* acquire enough names to grow the hash table a few times */
+        for (i = 0; i < 4096; ++i) {
+                sprintf(name_str, "com.example.foo%u", i);
+                r = name_registry_request_name(&registry, &owner, NULL, name_str, 0, &change);
+                assert(!r);
+                name_change_deinit(&change);
+        }
+
+        for (i = 0; i < 4096; ++i) {
+                sprintf(name_str, "com.example.foo%u", i);
+                assert(resolve_owner(&registry, name_str) == &owner);
+        }
+
+        assert(!name_registry_find_name(&registry, "com.example.foo4096"));
+        assert(!name_registry_find_name(&registry, "com.example.foo"));
+
+        for (i = 0; i < 4096; ++i) {
+                sprintf(name_str, "com.example.foo%u", i);
+                r = name_registry_release_name(&registry, &owner, name_str, &change);
+                assert(!r);
+                name_change_deinit(&change);
+                assert(!name_registry_find_name(&registry, name_str));
+        }
+
+        name_owner_deinit(&owner);
+        name_registry_deinit(&registry);
+}
+
 int main(int argc, char **argv) {
         test_setup();
         test_release();
         test_queue();
+        test_many();
         return 0;
 }
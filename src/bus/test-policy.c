@@ -0,0 +1,139 @@
+/*
+ * Test Policy Registry
+ */
+
+#include <c-dvar.h>
+#include <c-dvar-type.h>
+#include <c-macro.h>
+#include <c-rbtree.h>
+#include <endian.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bus/policy.h"
+
+#define TEST_N_RANGES (64)
+#define TEST_UID_MAX (1024)
+
+static const char test_policy_signature[] =
+        "("
+                "a(u(bta(btbs)a(btssssuutt)a(btssssuutt)))"
+                "a(buu(bta(btbs)a(btssssuutt)a(btssssuutt)))"
+                "a(ss)"
+                "b"
+        ")";
+
+static void test_write_batch(CDVar *var, uint64_t priority) {
+        /* a distinct connect verdict keeps batches from being shared */
+        c_dvar_write(var, "(bt[][][])", true, priority);
+}
+
+static void test_import(PolicyRegistry *registry, const uint32_t (*ranges)[2], size_t n_ranges) {
+        _c_cleanup_(c_dvar_deinit) CDVar var_out = C_DVAR_INIT, var_in = C_DVAR_INIT;
+        _c_cleanup_(c_freep) void *data = NULL;
+        CDVarType *type;
+        size_t i, n_data;
+        int r;
+
+        r = c_dvar_type_new_from_signature(&type, test_policy_signature, strlen(test_policy_signature));
+        assert(!r);
+
+        c_dvar_begin_write(&var_out, (__BYTE_ORDER == __BIG_ENDIAN), c_dvar_type_v, 1);
+        c_dvar_write(&var_out, "<([][", type);
+
+        for (i = 0; i < n_ranges; ++i) {
+                c_dvar_write(&var_out, "(buu", false, ranges[i][0], ranges[i][1]);
+                test_write_batch(&var_out, i + 1);
+                c_dvar_write(&var_out, ")");
+        }
+
+        c_dvar_write(&var_out, "][]b)>", false);
+
+        r = c_dvar_end_write(&var_out, &data, &n_data);
+        assert(!r);
+
+        c_dvar_type_free(type);
+
+        c_dvar_begin_read(&var_in, (__BYTE_ORDER == __BIG_ENDIAN), c_dvar_type_v, 1, data, n_data);
+
+        r = policy_registry_import(registry, &var_in);
+        assert(!r);
+
+        r = c_dvar_end_read(&var_in);
+        assert(!r);
+}
+
+static void test_check_uid(PolicyRegistry *registry, uint32_t uid) {
+        _c_cleanup_(policy_snapshot_freep) PolicySnapshot *snapshot = NULL;
+        PolicyRegistryNode *node;
+        size_t n_batches = 1;
+        int r;
+
+        r = policy_snapshot_new(&snapshot, registry, "test", uid, NULL, 0);
+        assert(!r);
+
+        /* the index must find exactly what a linear scan of the tree finds */
+        c_rbtree_for_each_entry(node, &registry->uid_range_tree, registry_node) {
+                if (uid < node->index.uidgid_start || uid > node->index.uidgid_end)
+                        continue;
+
+                assert(n_batches < snapshot->n_batches);
+                assert(snapshot->batches[n_batches] == node->batch);
+                ++n_batches;
+        }
+
+        assert(n_batches == snapshot->n_batches);
+}
+
+static void test_uid_ranges(void) {
+        _c_cleanup_(policy_registry_freep) PolicyRegistry *registry = NULL;
+        uint32_t ranges[TEST_N_RANGES][2], seed = 1;
+        size_t i;
+        uint32_t uid;
+        int r;
+
+        /* nested, overlapping, adjacent, single-uid and full ranges */
+        ranges[0][0] = 0; ranges[0][1] = (uint32_t)-2;
+        ranges[1][0] = 100; ranges[1][1] = 199;
+        ranges[2][0] = 120; ranges[2][1] = 149;
+        ranges[3][0] = 130; ranges[3][1] = 130;
+        ranges[4][0] = 150; ranges[4][1] = 249;
+        ranges[5][0] = 200; ranges[5][1] = 299;
+        ranges[6][0] = 100; ranges[6][1] = 299;
+
+        for (i = 7; i < TEST_N_RANGES; ++i) {
+                seed = seed * 1103515245 + 12345;
+                ranges[i][0] = (seed >> 8) % TEST_UID_MAX;
+                seed = seed * 1103515245 + 12345;
+                ranges[i][1] = ranges[i][0] + (seed >> 8) % (TEST_UID_MAX / 4);
+        }
+
+        r = policy_registry_new(&registry, "test");
+        assert(!r);
+
+        test_import(registry, (const uint32_t (*)[2])ranges, C_ARRAY_SIZE(ranges));
+
+        for (uid = 0; uid < TEST_UID_MAX + TEST_UID_MAX / 4; ++uid)
+                test_check_uid(registry, uid);
+
+        test_check_uid(registry, (uint32_t)-2);
+        test_check_uid(registry, (uint32_t)-1);
+}
+
+static void test_no_uid_ranges(void) {
+        _c_cleanup_(policy_registry_freep) PolicyRegistry *registry = NULL;
+        int r;
+
+        r = policy_registry_new(&registry, "test");
+        assert(!r);
+
+        test_import(registry, NULL, 0);
+
+        test_check_uid(registry, 0);
+        test_check_uid(registry, 1000);
+}
+
+int main(int argc, char **argv) {
+        test_uid_ranges();
+        test_no_uid_ranges();
+        return 0;
+}
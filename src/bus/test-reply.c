@@ -37,8 +37,63 @@ static void test_basic(void) {
         reply_registry_deinit(&registry);
 }
 
+static void test_many(void) {
+        ReplyRegistry registry;
+        ReplyOwner owner;
+        ReplySlot *slots[1024], *slot;
+        size_t i;
+        int r;
+
+        reply_registry_init(&registry);
+        reply_owner_init(&owner);
+
+        /* spread the slots over few ids and serials, to provoke collisions */
+        for (i = 0; i < C_ARRAY_SIZE(slots); ++i) {
+                r = reply_slot_new(&slots[i], &registry, &owner, NULL, NULL, i % 7, i);
+                assert(!r);
+        }
+
+        for (i = 0; i < C_ARRAY_SIZE(slots); ++i) {
+                slot = reply_slot_get_by_id(&registry, i % 7, i);
+                assert(slot == slots[i]);
+                slot = reply_slot_get_by_id(&registry, i % 7 + 7, i);
+                assert(!slot);
+        }
+
+        /* drop every other slot and verify the remaining ones are found */
+        for (i = 0; i < C_ARRAY_SIZE(slots); i += 2)
+                slots[i] = reply_slot_free(slots[i]);
+
+        for (i = 0; i < C_ARRAY_SIZE(slots); ++i) {
+                slot = reply_slot_get_by_id(&registry, i % 7, i);
+                assert(slot == slots[i]);
+        }
+
+        /* re-insert the dropped slots, reusing released memory */
+        for (i = 0; i < C_ARRAY_SIZE(slots); i += 2) {
+                r = reply_slot_new(&slots[i], &registry, &owner, NULL, NULL, i % 7, i);
+                assert(!r);
+        }
+
+        for (i = 0; i < C_ARRAY_SIZE(slots); ++i) {
+                r = reply_slot_new(&slot, &registry, &owner, NULL, NULL, i % 7, i);
+                assert(r == REPLY_E_EXISTS);
+                slot = reply_slot_get_by_id(&registry, i % 7, i);
+                assert(slot == slots[i]);
+        }
+
+        for (i = 0; i < C_ARRAY_SIZE(slots); ++i)
+                reply_slot_free(slots[i]);
+
+        assert(!reply_slot_get_by_id(&registry, 0, 0));
+
+        reply_owner_deinit(&owner);
+        reply_registry_deinit(&registry);
+}
+
 int main(int argc, char **argv) {
         test_basic();
+        test_many();
 
         return 0;
 }
@@ -67,21 +67,35 @@ void address_init_from_name(Address *address, const char *name) {
  * the validity of the name.
  */
 void address_from_string(Address *address, const char *string) {
-        uint64_t id;
-        char *end;
+        uint64_t id = 0;
+        unsigned int digit;
 
         address->type = ADDRESS_TYPE_OTHER;
 
         if (!string[0]) {
                 return;
         } else if (string[0] == ':') {
-                if (strncmp(string, ":1.", strlen(":1.")))
+                if (string[1] != '1' || string[2] != '.')
                         return;
 
+                /*
+                 * Unique names are looked up for almost every unicast, so
+                 * parse the decimal id inline rather than via strtoull(),
+                 * which also accepts whitespace and signs.
+                 */
                 string += strlen(":1.");
-                errno = 0;
-                id = strtoull(string, &end, 10);
-                if (end == string || *end || errno || id == ULLONG_MAX)
+                if (!*string)
+                        return;
+
+                do {
+                        digit = (unsigned int)*string - '0';
+                        if (digit > 9 || id > (UINT64_MAX - digit) / 10)
+                                return;
+
+                        id = id * 10 + digit;
+                } while (*++string);
+
+                if (id == ADDRESS_ID_INVALID)
                         return;
 
                 address->type = ADDRESS_TYPE_ID;
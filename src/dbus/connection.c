@@ -267,3 +267,17 @@ int connection_queue(Connection *connection, User *user, Message *message) {
         dispatch_file_select(&connection->socket_file, EPOLLOUT);
         return 0;
 }
+
+/**
+ * connection_can_drop() - XXX
+ */
+bool connection_can_drop(Connection *connection, Message *message, SocketDropFn fn, void *userdata) {
+        return socket_can_drop(&connection->socket, message, fn, userdata);
+}
+
+/**
+ * connection_drop() - XXX
+ */
+size_t connection_drop(Connection *connection, Message *message, SocketDropFn fn, void *userdata) {
+        return socket_drop(&connection->socket, message, fn, userdata);
+}
@@ -59,6 +59,8 @@ int connection_dispatch(Connection *connection, uint32_t events);
 
 int connection_dequeue(Connection *connection, Message **messagep);
 int connection_queue(Connection *connection, User *user, Message *message);
+bool connection_can_drop(Connection *connection, Message *message, SocketDropFn fn, void *userdata);
+size_t connection_drop(Connection *connection, Message *message, SocketDropFn fn, void *userdata);
 
 C_DEFINE_CLEANUP(Connection *, connection_deinit);
 
@@ -67,3 +69,7 @@ C_DEFINE_CLEANUP(Connection *, connection_deinit);
 static inline bool connection_is_running(Connection *connection) {
         return socket_is_running(&connection->socket);
 }
+
+static inline bool connection_has_output(Connection *connection) {
+        return socket_has_output(&connection->socket);
+}
@@ -8,6 +8,8 @@
 #include <c-ref.h>
 #include <endian.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include "dbus/message.h"
 #include "dbus/protocol.h"
 #include "util/error.h"
@@ -16,17 +18,116 @@
 
 static_assert(_DBUS_MESSAGE_FIELD_N <= 8 * sizeof(unsigned int), "Header fields exceed bitmap");
 
+/* number of slots in the body-signature cache; must be a power of 2 */
+#define MESSAGE_SIGNATURE_CACHE_SIZE (512)
+
+/* number of argument blocks kept for reuse */
+#define MESSAGE_ARGS_POOL_SIZE (256)
+
+typedef struct MessageSignature MessageSignature;
+
+struct MessageSignature {
+        size_t n_signature;
+        char *signature;
+        size_t n_types;
+        size_t n_args;
+        uint64_t args;
+        CDVarType types[];
+};
+
+static_assert(MESSAGE_N_ARGS_MAX <= 8 * sizeof(uint64_t), "Arguments exceed bitmap");
+
+static MessageSignature *message_signature_cache[MESSAGE_SIGNATURE_CACHE_SIZE];
+static MessageArg *message_args_pool[MESSAGE_ARGS_POOL_SIZE];
+static size_t message_args_n_pool;
+static MessageStats message_stats;
+
+static int message_args_new(MessageArg **argsp) {
+        MessageArg *args;
+
+        /*
+         * The cached arguments are only needed for messages that are matched
+         * against match rules, so rather than embedding them in every
+         * message, they are allocated on demand. Since broadcasts come in
+         * bursts, released blocks are kept in a small process-wide pool, just
+         * like the signature cache.
+         */
+
+        if (message_args_n_pool) {
+                args = message_args_pool[--message_args_n_pool];
+        } else {
+                args = malloc(MESSAGE_N_ARGS_MAX * sizeof(*args));
+                if (!args)
+                        return error_origin(-ENOMEM);
+        }
+
+        *argsp = args;
+        return 0;
+}
+
+static MessageArg *message_args_free(MessageArg *args) {
+        if (!args)
+                return NULL;
+
+        if (message_args_n_pool < MESSAGE_ARGS_POOL_SIZE)
+                message_args_pool[message_args_n_pool++] = args;
+        else
+                free(args);
+
+        return NULL;
+}
+
+static Message *message_map(size_t n_extra, size_t *n_mappedp) {
+        size_t n_mapped;
+        void *p;
+
+        /*
+         * Large messages get a dedicated anonymous mapping, which is returned
+         * to the kernel as soon as the message is freed. If they were
+         * allocated from the heap, a burst of large messages would raise the
+         * malloc thresholds and leave the heap inflated long after the
+         * messages were released.
+         */
+        n_mapped = sizeof(Message) + c_align8(n_extra);
+        n_mapped = C_ALIGN_TO(n_mapped, (size_t)sysconf(_SC_PAGESIZE));
+
+        p = mmap(NULL, n_mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+                return NULL;
+
+        ++message_stats.n_mapped;
+        ++message_stats.n_mapped_total;
+        message_stats.n_mapped_bytes += n_mapped;
+        message_stats.n_mapped_bytes_peak = c_max(message_stats.n_mapped_bytes_peak,
+                                                  message_stats.n_mapped_bytes);
+
+        *n_mappedp = n_mapped;
+        return p;
+}
+
+static void message_unmap(Message *message) {
+        --message_stats.n_mapped;
+        message_stats.n_mapped_bytes -= message->n_mapped;
+
+        munmap(message, message->n_mapped);
+}
+
 static int message_new(Message **messagep, bool big_endian, size_t n_extra) {
         _c_cleanup_(message_unrefp) Message *message = NULL;
+        size_t n_mapped = 0;
 
         static_assert(alignof(message->extra) >= 8,
                       "Message payload has insufficient alignment");
 
-        message = malloc(sizeof(*message) + c_align8(n_extra));
+        if (n_extra >= MESSAGE_MAP_MIN)
+                message = message_map(n_extra, &n_mapped);
+        else
+                message = malloc(sizeof(*message) + c_align8(n_extra));
         if (!message)
                 return error_origin(-ENOMEM);
 
         *message = (Message)MESSAGE_INIT(big_endian);
+        message->n_mapped = n_mapped;
 
         *messagep = message;
         message = NULL;
@@ -125,8 +226,289 @@ void message_free(_Atomic unsigned long *n_refs, void *userdata) {
 
         if (message->allocated_data)
                 free(message->data);
+        message_args_free(message->metadata.args);
         fdlist_free(message->fds);
-        free(message);
+
+        if (message->n_mapped)
+                message_unmap(message);
+        else
+                free(message);
+}
+
+/**
+ * message_get_stats() - query statistics on message allocations
+ * @stats:                      output argument for the statistics
+ *
+ * This returns the current statistics on messages backed by dedicated memory
+ * mappings (see MESSAGE_MAP_MIN) in @stats.
+ */
+void message_get_stats(MessageStats *stats) {
+        *stats = message_stats;
+}
+
+/**
+ * message_deinit_global() - release process-wide message caches
+ *
+ * This frees all entries of the signature cache and the pooled argument
+ * blocks. It must only be called once no message is in use anymore.
+ */
+void message_deinit_global(void) {
+        size_t i;
+
+        for (i = 0; i < MESSAGE_SIGNATURE_CACHE_SIZE; ++i)
+                message_signature_cache[i] = c_free(message_signature_cache[i]);
+
+        while (message_args_n_pool)
+                free(message_args_pool[--message_args_n_pool]);
+}
+
+static const char *message_parse_header_fast_string(const uint8_t *data, size_t *ip, size_t end, bool small) {
+        size_t i = *ip, n;
+
+        /*
+         * Read a string ('s' / 'o') or signature ('g') at @ip. This must not
+         * extend beyond @end, must be zero-terminated, and must not contain
+         * any embedded zero bytes.
+         */
+
+        if (small) {
+                if (end - i < 1)
+                        return NULL;
+
+                n = data[i];
+                i += 1;
+        } else {
+                if (end - i < 4)
+                        return NULL;
+
+                n = le32toh(*(const uint32_t *)(data + i));
+                i += 4;
+        }
+
+        if (n >= end - i || data[i + n] || memchr(data + i, 0, n))
+                return NULL;
+
+        *ip = i + n + 1;
+        return (const char *)data + i;
+}
+
+static bool message_parse_header_fast_u32(const uint8_t *data, size_t *ip, size_t end, uint32_t *valuep) {
+        if (end - *ip < 4)
+                return false;
+
+        *valuep = le32toh(*(const uint32_t *)(data + *ip));
+        *ip += 4;
+        return true;
+}
+
+static bool message_parse_header_fast_signature(const char *signature) {
+        /*
+         * We only accept signatures made of single-character complete types.
+         * Anything else is left to the generic parser to validate.
+         */
+        return strspn(signature, "ybnqiuxtdsoghv") == strlen(signature);
+}
+
+/*
+ * This is a specialized parser for the common case of message headers: little
+ * endian, only known header fields, and each field carrying its standard type.
+ * It does a single pass over the header fields, and validates them the same
+ * way message_parse_header() does. It never rejects a message, though.
+ * Instead, whenever something is out of the ordinary (including any invalid
+ * input), it returns false and the caller must fall back to the generic
+ * parser, which then decides about the message. Hence, the fast-path only
+ * ever accepts messages that the generic parser would accept, and it
+ * extracts the same metadata from them.
+ */
+static bool message_parse_header_fast(Message *message, MessageMetadata *metadata) {
+        const uint8_t *data = (const void *)message->header;
+        size_t i, end;
+        unsigned int mask;
+        uint8_t field, element;
+
+        if (message->big_endian)
+                return false;
+
+        metadata->header.type = message->header->type;
+        metadata->header.flags = message->header->flags;
+        metadata->header.version = message->header->version;
+        metadata->header.serial = le32toh(message->header->serial);
+
+        if (metadata->header.type == DBUS_MESSAGE_TYPE_INVALID ||
+            metadata->header.version != 1 ||
+            !metadata->header.serial)
+                return false;
+
+        end = sizeof(MessageHeader) + le32toh(message->header->n_fields);
+        if (end != message->n_header || end - sizeof(MessageHeader) > (1U << 26))
+                return false;
+
+        for (i = sizeof(MessageHeader); i < end; ) {
+                /*
+                 * Every field is 8-byte aligned and starts with the field code
+                 * followed by a single-character variant signature. This
+                 * leaves the value 4-byte aligned, without any padding.
+                 */
+                if (end - i < 4 || data[i + 1] != 1 || data[i + 3])
+                        return false;
+
+                field = data[i];
+                element = data[i + 2];
+                i += 4;
+
+                if (field == DBUS_MESSAGE_FIELD_INVALID || field >= _DBUS_MESSAGE_FIELD_N)
+                        return false;
+                if (metadata->fields.available & (1U << field))
+                        return false;
+
+                metadata->fields.available |= 1U << field;
+
+                switch (field) {
+                case DBUS_MESSAGE_FIELD_PATH:
+                        if (element != 'o')
+                                return false;
+
+                        metadata->fields.path = message_parse_header_fast_string(data, &i, end, false);
+                        if (!metadata->fields.path ||
+                            !dbus_validate_path(metadata->fields.path, strlen(metadata->fields.path)) ||
+                            !strcmp(metadata->fields.path, "/org/freedesktop/DBus/Local"))
+                                return false;
+
+                        break;
+
+                case DBUS_MESSAGE_FIELD_INTERFACE:
+                        if (element != 's')
+                                return false;
+
+                        metadata->fields.interface = message_parse_header_fast_string(data, &i, end, false);
+                        if (!metadata->fields.interface ||
+                            !strcmp(metadata->fields.interface, "org.freedesktop.DBus.Local") ||
+                            !dbus_validate_interface(metadata->fields.interface, strlen(metadata->fields.interface)))
+                                return false;
+
+                        break;
+
+                case DBUS_MESSAGE_FIELD_MEMBER:
+                        if (element != 's')
+                                return false;
+
+                        metadata->fields.member = message_parse_header_fast_string(data, &i, end, false);
+                        if (!metadata->fields.member ||
+                            !dbus_validate_member(metadata->fields.member, strlen(metadata->fields.member)))
+                                return false;
+
+                        break;
+
+                case DBUS_MESSAGE_FIELD_ERROR_NAME:
+                        if (element != 's')
+                                return false;
+
+                        metadata->fields.error_name = message_parse_header_fast_string(data, &i, end, false);
+                        if (!metadata->fields.error_name ||
+                            !dbus_validate_error_name(metadata->fields.error_name, strlen(metadata->fields.error_name)))
+                                return false;
+
+                        break;
+
+                case DBUS_MESSAGE_FIELD_REPLY_SERIAL:
+                        if (element != 'u' ||
+                            !message_parse_header_fast_u32(data, &i, end, &metadata->fields.reply_serial) ||
+                            !metadata->fields.reply_serial)
+                                return false;
+
+                        break;
+
+                case DBUS_MESSAGE_FIELD_DESTINATION:
+                        if (element != 's')
+                                return false;
+
+                        metadata->fields.destination = message_parse_header_fast_string(data, &i, end, false);
+                        if (!metadata->fields.destination ||
+                            !dbus_validate_name(metadata->fields.destination, strlen(metadata->fields.destination)))
+                                return false;
+
+                        break;
+
+                case DBUS_MESSAGE_FIELD_SENDER:
+                        if (element != 's')
+                                return false;
+
+                        metadata->fields.sender = message_parse_header_fast_string(data, &i, end, false);
+                        if (!metadata->fields.sender ||
+                            !dbus_validate_name(metadata->fields.sender, strlen(metadata->fields.sender)))
+                                return false;
+
+                        break;
+
+                case DBUS_MESSAGE_FIELD_SIGNATURE:
+                        if (element != 'g')
+                                return false;
+
+                        metadata->fields.signature = message_parse_header_fast_string(data, &i, end, true);
+                        if (!metadata->fields.signature ||
+                            !message_parse_header_fast_signature(metadata->fields.signature))
+                                return false;
+
+                        break;
+
+                case DBUS_MESSAGE_FIELD_UNIX_FDS:
+                        if (element != 'u' ||
+                            !message_parse_header_fast_u32(data, &i, end, &metadata->fields.unix_fds) ||
+                            metadata->fields.unix_fds > fdlist_count(message->fds))
+                                return false;
+
+                        break;
+
+                default:
+                        return false;
+                }
+
+                /*
+                 * If more data follows, skip the zero-padding to the next
+                 * field. The padding must be followed by another field,
+                 * though, since arrays never end in padding.
+                 */
+                if (i < end) {
+                        while (i & 7) {
+                                if (i >= end || data[i])
+                                        return false;
+
+                                ++i;
+                        }
+
+                        if (i >= end)
+                                return false;
+                }
+        }
+
+        switch (metadata->header.type) {
+        case DBUS_MESSAGE_TYPE_METHOD_CALL:
+                mask = (1U << DBUS_MESSAGE_FIELD_PATH) |
+                       (1U << DBUS_MESSAGE_FIELD_MEMBER);
+                break;
+        case DBUS_MESSAGE_TYPE_METHOD_RETURN:
+                mask = (1U << DBUS_MESSAGE_FIELD_REPLY_SERIAL);
+                break;
+        case DBUS_MESSAGE_TYPE_ERROR:
+                mask = (1U << DBUS_MESSAGE_FIELD_ERROR_NAME) |
+                       (1U << DBUS_MESSAGE_FIELD_REPLY_SERIAL);
+                break;
+        case DBUS_MESSAGE_TYPE_SIGNAL:
+                mask = (1U << DBUS_MESSAGE_FIELD_PATH) |
+                       (1U << DBUS_MESSAGE_FIELD_INTERFACE) |
+                       (1U << DBUS_MESSAGE_FIELD_MEMBER);
+                break;
+        default:
+                mask = 0;
+                break;
+        }
+
+        if ((metadata->fields.available & mask) != mask)
+                return false;
+
+        metadata->fields.signature = metadata->fields.signature ?: "";
+        message->original_sender = (void *)metadata->fields.sender;
+        return true;
 }
 
 static int message_parse_header(Message *message, MessageMetadata *metadata) {
@@ -153,6 +535,17 @@ static int message_parse_header(Message *message, MessageMetadata *metadata) {
         uint8_t field;
         int r;
 
+        if (_c_likely_(message_parse_header_fast(message, metadata)))
+                return 0;
+
+        /*
+         * The fast-path could not handle this message. Drop anything it might
+         * have extracted and let the generic parser decide.
+         */
+        memset(&metadata->header, 0, sizeof(metadata->header));
+        memset(&metadata->fields, 0, sizeof(metadata->fields));
+        message->original_sender = NULL;
+
         c_dvar_begin_read(&v, message->big_endian, type, 1, message->header, message->n_header);
 
         /*
@@ -342,55 +735,117 @@ static int message_parse_header(Message *message, MessageMetadata *metadata) {
         return 0;
 }
 
-static int message_parse_body(Message *message, MessageMetadata *metadata) {
-        _c_cleanup_(c_dvar_deinit) CDVar v = C_DVAR_INIT;
-        const char *signature = metadata->fields.signature;
-        size_t i, n_signature, n_types;
-        CDVarType *t, *types;
+static int message_signature_new(MessageSignature **signaturep, const char *signature, size_t n_signature) {
+        _c_cleanup_(c_freep) MessageSignature *sig = NULL;
+        CDVarType *t;
+        size_t i;
         int r;
 
         /*
-         * Parse body-signature into CDVarType array. We use a single array
-         * with all the argument-types concatenated.
+         * Parse the body-signature into a CDVarType array, with all the
+         * argument-types concatenated. While at it, remember which of the
+         * arguments are strings or paths, since those are cached in the
+         * message metadata for match-rule processing.
          */
 
-        n_signature = strlen(signature);
-        assert(n_signature < 256);
-        types = alloca(n_signature * sizeof(CDVarType));
-        n_types = 0;
+        sig = malloc(sizeof(*sig) + n_signature * sizeof(*sig->types) + n_signature + 1);
+        if (!sig)
+                return error_origin(-ENOMEM);
+
+        sig->n_signature = n_signature;
+        sig->signature = (char *)(sig->types + n_signature);
+        sig->n_types = 0;
+        sig->n_args = 0;
+        sig->args = 0;
+        memcpy(sig->signature, signature, n_signature + 1);
 
-        for (i = 0; i < n_signature; i += types[i].length) {
-                t = types + i;
+        for (i = 0; i < n_signature; i += sig->types[i].length) {
+                t = sig->types + i;
                 r = c_dvar_type_new_from_signature(&t, signature + i, n_signature - i);
                 if (r)
                         return r < 0 ? error_origin(r) : MESSAGE_E_INVALID_HEADER;
 
-                ++n_types;
+                if ((t->element == 's' || t->element == 'o') && sig->n_types < 8 * sizeof(sig->args)) {
+                        sig->args |= UINT64_C(1) << sig->n_types;
+                        sig->n_args = sig->n_types + 1;
+                }
+
+                ++sig->n_types;
+        }
+
+        *signaturep = sig;
+        sig = NULL;
+        return 0;
+}
+
+static int message_signature_lookup(MessageSignature **signaturep, const char *signature) {
+        MessageSignature **slot;
+        size_t n_signature;
+        uint32_t hash = 2166136261U;
+        int r;
+
+        /*
+         * A bus usually sees only a small set of distinct body-signatures, so
+         * we keep the parsed signatures in a direct-mapped cache, indexed by
+         * an FNV-1a hash of the signature. On collision, the old entry is
+         * replaced. The cache is process-wide, which is fine since the broker
+         * is single-threaded.
+         */
+
+        for (n_signature = 0; signature[n_signature]; ++n_signature)
+                hash = (hash ^ (uint8_t)signature[n_signature]) * 16777619U;
+
+        slot = &message_signature_cache[hash & (MESSAGE_SIGNATURE_CACHE_SIZE - 1)];
+        if (*slot && (*slot)->n_signature == n_signature && !memcmp((*slot)->signature, signature, n_signature)) {
+                *signaturep = *slot;
+                return 0;
+        }
+
+        assert(n_signature < 256);
+
+        r = message_signature_new(signaturep, signature, n_signature);
+        if (r)
+                return error_trace(r);
+
+        free(*slot);
+        *slot = *signaturep;
+        return 0;
+}
+
+static int message_parse_body(Message *message, MessageMetadata *metadata, bool extract) {
+        _c_cleanup_(c_dvar_deinit) CDVar v = C_DVAR_INIT;
+        MessageSignature *signature;
+        const CDVarType *t;
+        size_t i;
+        int r;
+
+        r = message_signature_lookup(&signature, metadata->fields.signature);
+        if (r)
+                return error_trace(r);
+
+        if (extract && signature->n_args && !metadata->args) {
+                r = message_args_new(&metadata->args);
+                if (r)
+                        return error_trace(r);
         }
 
         /*
          * Now that we know the argument types, use c_dvar_skip() to verify
-         * them. While at it, cache all the string/path arguments, so the match
-         * rule processing can access them directly.
+         * them. If requested, cache all the string/path arguments while at
+         * it, so the match rule processing can access them directly.
          */
 
-        c_dvar_begin_read(&v, message->big_endian, types, n_types, message->body, message->n_body);
-
-        for (i = 0, t = types; i < n_types; ++i, t += t->length) {
-                switch (t->element) {
-                case 's':
-                case 'o':
-                        if (i < C_ARRAY_SIZE(metadata->args)) {
-                                metadata->args[i].element = t->element;
-                                c_dvar_read(&v, (char[2]){ t->element, 0 }, &metadata->args[i].value);
-                                metadata->n_args = i + 1;
-                                break;
-                        }
+        c_dvar_begin_read(&v, message->big_endian, signature->types, signature->n_types, message->body, message->n_body);
 
-                        /* fallthrough */
-                default:
+        for (i = 0, t = signature->types; i < signature->n_types; ++i, t += t->length) {
+                if (!extract || i >= signature->n_args) {
+                        c_dvar_skip(&v, "*");
+                } else if (signature->args & (UINT64_C(1) << i)) {
+                        metadata->args[i].element = t->element;
+                        c_dvar_read(&v, (char[2]){ t->element, 0 }, &metadata->args[i].value);
+                } else {
+                        metadata->args[i] = (MessageArg){};
                         c_dvar_skip(&v, "*");
-                        break;
                 }
         }
 
@@ -398,44 +853,89 @@ static int message_parse_body(Message *message, MessageMetadata *metadata) {
         if (r)
                 return r < 0 ? error_origin(r) : MESSAGE_E_INVALID_BODY;
 
+        if (extract) {
+                metadata->n_args = signature->n_args;
+                message->parsed_args = true;
+        }
+
         return 0;
 }
 
-/**
- * message_parse_metadata() - XXX
- */
-int message_parse_metadata(Message *message) {
-        void *p;
+static int message_parse_args(Message *message, MessageMetadata *metadata, size_t n_args) {
+        _c_cleanup_(c_dvar_deinit) CDVar v = C_DVAR_INIT;
+        MessageSignature *signature;
+        const CDVarType *t;
+        size_t i;
         int r;
 
-        if (message->parsed)
-                return 0;
-
-        /*
-         * As first step, parse the static header and the dynamic header
-         * fields. Any error there is fatal.
-         */
-        r = message_parse_header(message, &message->metadata);
+        r = message_signature_lookup(&signature, metadata->fields.signature);
         if (r)
                 return error_trace(r);
 
         /*
-         * Validate the padding between the header and body. Those must be 0!
-         * We usually wouldn't care but must be compatible to dbus-daemon(1),
-         * so lets verify them.
+         * Unlike message_parse_body(), this only walks the body up to the
+         * last string/path argument among the first @n_args arguments. Those
+         * are fully verified, but anything following them is left untouched.
          */
-        for (p = (void *)message->header + message->n_header; p < message->body; ++p)
-                if (*(const uint8_t *)p)
-                        return MESSAGE_E_INVALID_HEADER;
 
-        /*
-         * Now that the header is validated, we read through the message body.
-         * Again, this is required for compatibility with dbus-daemon(1), but
-         * also to fetch the arguments for match-filters used by broadcasts.
-         */
-        r = message_parse_body(message, &message->metadata);
+        n_args = c_min(n_args, signature->n_args);
+        if (!n_args) {
+                metadata->n_args = 0;
+                message->parsed_args = !signature->n_args;
+                return 0;
+        }
+
+        if (!metadata->args) {
+                r = message_args_new(&metadata->args);
+                if (r)
+                        return error_trace(r);
+        }
+
+        c_dvar_begin_read(&v, message->big_endian, signature->types, signature->n_types, message->body, message->n_body);
+
+        for (i = 0, t = signature->types; i < n_args; ++i, t += t->length) {
+                if (signature->args & (UINT64_C(1) << i)) {
+                        metadata->args[i].element = t->element;
+                        c_dvar_read(&v, (char[2]){ t->element, 0 }, &metadata->args[i].value);
+                } else {
+                        metadata->args[i] = (MessageArg){};
+                        c_dvar_skip(&v, "*");
+                }
+        }
+
+        r = c_dvar_get_poison(&v);
         if (r)
-                return error_trace(r);
+                return r < 0 ? error_origin(r) : MESSAGE_E_INVALID_BODY;
+
+        metadata->n_args = n_args;
+        message->parsed_args = (n_args == signature->n_args);
+        return 0;
+}
+
+static int message_parse_metadata_header(Message *message) {
+        void *p;
+        int r;
+
+        if (!message->parsed_header) {
+                /*
+                 * As first step, parse the static header and the dynamic
+                 * header fields. Any error there is fatal.
+                 */
+                r = message_parse_header(message, &message->metadata);
+                if (r)
+                        return error_trace(r);
+
+                /*
+                 * Validate the padding between the header and body. Those
+                 * must be 0! We usually wouldn't care but must be compatible
+                 * to dbus-daemon(1), so lets verify them.
+                 */
+                for (p = (void *)message->header + message->n_header; p < message->body; ++p)
+                        if (*(const uint8_t *)p)
+                                return MESSAGE_E_INVALID_HEADER;
+
+                message->parsed_header = true;
+        }
 
         /*
          * dbus-daemon(1) only ever fetches the correct number of FDs from its
@@ -444,14 +944,93 @@ int message_parse_metadata(Message *message) {
          * we try to stick to dbus-daemon(1) behavior as close as possible, by
          * rejecting if the requested count exceeds the passed count. However,
          * we always discard any remaining FDs silently.
+         * This is done on every call, since the header of an incomplete
+         * message might have been parsed before its FDs arrived.
          */
         if (message->fds)
                 fdlist_truncate(message->fds, message->metadata.fields.unix_fds);
 
+        return 0;
+}
+
+/**
+ * message_parse_metadata() - parse and verify message metadata
+ * @message:                    message to operate on
+ *
+ * This parses the header of @message and verifies its entire body against the
+ * body-signature. This is the strict mode, compatible with dbus-daemon(1).
+ * Once successful, any further call is a no-op.
+ *
+ * If @message has no destination, and thus is subject to match rules, all
+ * string/path arguments are cached in the metadata as well. For any other
+ * message, this must be explicitly requested via
+ * message_parse_metadata_lazy().
+ *
+ * Return: 0 on success, MESSAGE_E_INVALID_HEADER or MESSAGE_E_INVALID_BODY if
+ *         the message is malformed, negative error code on failure.
+ */
+int message_parse_metadata(Message *message) {
+        int r;
+
+        if (message->parsed)
+                return 0;
+
+        r = message_parse_metadata_header(message);
+        if (r)
+                return error_trace(r);
+
+        /*
+         * Now that the header is validated, we read through the message body.
+         * Again, this is required for compatibility with dbus-daemon(1), but
+         * also to fetch the arguments for match-filters used by broadcasts.
+         */
+        r = message_parse_body(message,
+                               &message->metadata,
+                               !message->parsed_args && !message->metadata.fields.destination);
+        if (r)
+                return error_trace(r);
+
         message->parsed = true;
         return 0;
 }
 
+/**
+ * message_parse_metadata_lazy() - parse message metadata without full body
+ * @message:                    message to operate on
+ * @n_args:                     number of leading arguments to extract
+ *
+ * This is the lazy variant of message_parse_metadata(). The header is parsed
+ * and verified just the same, but of the body only the first @n_args
+ * arguments are walked, verified, and cached (if they are strings or paths).
+ * The remainder of the body is passed through unverified. The metadata will
+ * never report more than @n_args arguments.
+ *
+ * This can be called multiple times with different values for @n_args, and
+ * can be followed by message_parse_metadata() to verify the entire message,
+ * if required. Similarly, it can be called after message_parse_metadata() to
+ * extract arguments that were not cached by it. Once all arguments have been
+ * cached, this is a no-op.
+ *
+ * Return: 0 on success, MESSAGE_E_INVALID_HEADER or MESSAGE_E_INVALID_BODY if
+ *         the message is malformed, negative error code on failure.
+ */
+int message_parse_metadata_lazy(Message *message, size_t n_args) {
+        int r;
+
+        if (message->parsed_args)
+                return 0;
+
+        r = message_parse_metadata_header(message);
+        if (r)
+                return error_trace(r);
+
+        r = message_parse_args(message, &message->metadata, n_args);
+        if (r)
+                return error_trace(r);
+
+        return 0;
+}
+
 /**
  * message_stitch_sender() - stitch in new sender field
  * @message:                    message to operate on
@@ -479,11 +1058,18 @@ void message_stitch_sender(Message *message, uint64_t sender_id) {
         void *end, *field;
 
         /*
-         * Must not be called more than once. We reserve the 2 iovecs between
-         * the original header and body to stitch the sender field. The caller
-         * must have parsed the metadata before.
+         * We reserve the 2 iovecs between the original header and body to
+         * stitch the sender field. The caller must have parsed the metadata
+         * before. An incomplete message might be dispatched again once
+         * complete, so stitching the same sender again is a no-op.
          */
-        assert(message->parsed);
+        assert(message->parsed_header);
+
+        if (message->vecs[2].iov_base) {
+                assert(message->metadata.sender_id == sender_id);
+                return;
+        }
+
         assert(!message->vecs[1].iov_base && !message->vecs[1].iov_len);
         assert(!message->vecs[2].iov_base && !message->vecs[2].iov_len);
 
@@ -13,12 +13,20 @@
 typedef struct FDList FDList;
 typedef struct Log Log;
 typedef struct Message Message;
+typedef struct MessageArg MessageArg;
 typedef struct MessageHeader MessageHeader;
 typedef struct MessageMetadata MessageMetadata;
+typedef struct MessageStats MessageStats;
 
 /* max message size; taken from spec */
 #define MESSAGE_SIZE_MAX (128UL * 1024UL * 1024UL)
 
+/* min message size to be backed by a dedicated memory mapping */
+#define MESSAGE_MAP_MIN (128UL * 1024UL)
+
+/* max number of arguments cached in the metadata */
+#define MESSAGE_N_ARGS_MAX (64)
+
 /* max patch buffer size; see message_stitch_sender() */
 #define MESSAGE_PATCH_MAX (C_ALIGN_TO(1 + 3 + 4 + ADDRESS_ID_STRING_MAX + 1, 8))
 
@@ -31,6 +39,18 @@ enum {
         MESSAGE_E_INVALID_BODY,
 };
 
+struct MessageArg {
+        char element;
+        const void *value;
+};
+
+struct MessageStats {
+        uint64_t n_mapped;
+        uint64_t n_mapped_bytes;
+        uint64_t n_mapped_bytes_peak;
+        uint64_t n_mapped_total;
+};
+
 struct MessageMetadata {
         struct {
                 uint8_t type;
@@ -54,10 +74,7 @@ struct MessageMetadata {
                 uint32_t unix_fds;
         } fields;
 
-        struct {
-                char element;
-                const void *value;
-        } args[64];
+        MessageArg *args;
         size_t n_args;
 };
 
@@ -70,10 +87,16 @@ struct Message {
 
         bool big_endian : 1;
         bool allocated_data : 1;
+        bool parsed_header : 1;
+        bool parsed_args : 1;
         bool parsed : 1;
+        bool incomplete : 1;
+        bool cut_through : 1;
+        bool aborted : 1;
 
         FDList *fds;
 
+        size_t n_mapped;
         size_t n_data;
         size_t n_copied;
         size_t n_header;
@@ -109,8 +132,11 @@ struct MessageHeader {
 int message_new_incoming(Message **messagep, MessageHeader header);
 int message_new_outgoing(Message **messagep, void *data, size_t n_data);
 void message_free(_Atomic unsigned long *n_refs, void *userdata);
+void message_get_stats(MessageStats *stats);
+void message_deinit_global(void);
 
 int message_parse_metadata(Message *message);
+int message_parse_metadata_lazy(Message *message, size_t n_args);
 void message_stitch_sender(Message *message, uint64_t sender_id);
 
 void message_log_append(Message *message, Log *log);
@@ -4,11 +4,187 @@
 
 #include <c-macro.h>
 #include <stdlib.h>
+#include <string.h>
 #include "dbus/protocol.h"
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+typedef struct DBusCharMasks DBusCharMasks;
+
+/*
+ * Character classes of up to 64 consecutive bytes, one bit per byte. Bits
+ * beyond the classified length are always cleared.
+ */
+struct DBusCharMasks {
+        uint64_t word;          /* [A-Za-z_] */
+        uint64_t digit;         /* [0-9] */
+        uint64_t dot;           /* '.' */
+        uint64_t dash;          /* '-' */
+        uint64_t slash;         /* '/' */
+};
+
+static void dbus_classify_scalar(DBusCharMasks *masks, const char *str, size_t n_str) {
+        uint64_t bit;
+        size_t i;
+
+        *masks = (DBusCharMasks){};
+
+        for (i = 0; i < n_str; ++i) {
+                bit = UINT64_C(1) << i;
+
+                if ((str[i] >= 'a' && str[i] <= 'z') ||
+                    (str[i] >= 'A' && str[i] <= 'Z') ||
+                    str[i] == '_')
+                        masks->word |= bit;
+                else if (str[i] >= '0' && str[i] <= '9')
+                        masks->digit |= bit;
+                else if (str[i] == '.')
+                        masks->dot |= bit;
+                else if (str[i] == '-')
+                        masks->dash |= bit;
+                else if (str[i] == '/')
+                        masks->slash |= bit;
+        }
+}
+
+#if defined(__x86_64__)
+
+/*
+ * The vectorized classifiers work on signed bytes, hence anything outside of
+ * the ASCII range is negative and never part of any class. The letter-check
+ * folds case via `c | 0x20', which maps '@' and '[' onto the bytes directly
+ * adjacent to the lower-case range, and thus does not create false hits.
+ * Tails shorter than a vector are copied into a zeroed buffer, since the
+ * zero byte is not part of any class either.
+ */
+
+__attribute__((__target__("sse2")))
+static void dbus_classify_sse2_chunk(DBusCharMasks *masks, const char *str, unsigned int shift) {
+        __m128i c, l;
+
+        c = _mm_loadu_si128((const __m128i *)str);
+        l = _mm_or_si128(c, _mm_set1_epi8(0x20));
+
+        masks->word |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+                _mm_or_si128(_mm_and_si128(_mm_cmpgt_epi8(l, _mm_set1_epi8('a' - 1)),
+                                           _mm_cmplt_epi8(l, _mm_set1_epi8('z' + 1))),
+                             _mm_cmpeq_epi8(c, _mm_set1_epi8('_')))) << shift;
+        masks->digit |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+                              _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)))) << shift;
+        masks->dot |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('.'))) << shift;
+        masks->dash |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('-'))) << shift;
+        masks->slash |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('/'))) << shift;
+}
+
+__attribute__((__target__("sse2")))
+static void dbus_classify_sse2(DBusCharMasks *masks, const char *str, size_t n_str) {
+        alignas(16) char tail[16] = {};
+        size_t i;
+
+        *masks = (DBusCharMasks){};
+
+        for (i = 0; i + 16 <= n_str; i += 16)
+                dbus_classify_sse2_chunk(masks, str + i, i);
+
+        if (i < n_str) {
+                memcpy(tail, str + i, n_str - i);
+                dbus_classify_sse2_chunk(masks, tail, i);
+        }
+}
+
+__attribute__((__target__("avx2")))
+static void dbus_classify_avx2_chunk(DBusCharMasks *masks, const char *str, unsigned int shift) {
+        __m256i c, l;
+
+        c = _mm256_loadu_si256((const __m256i *)str);
+        l = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+
+        masks->word |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+                _mm256_or_si256(_mm256_and_si256(_mm256_cmpgt_epi8(l, _mm256_set1_epi8('a' - 1)),
+                                                 _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), l)),
+                                _mm256_cmpeq_epi8(c, _mm256_set1_epi8('_')))) << shift;
+        masks->digit |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)),
+                                 _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c))) << shift;
+        masks->dot |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('.'))) << shift;
+        masks->dash |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('-'))) << shift;
+        masks->slash |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('/'))) << shift;
+}
+
+__attribute__((__target__("avx2")))
+static void dbus_classify_avx2(DBusCharMasks *masks, const char *str, size_t n_str) {
+        alignas(32) char tail[32] = {};
+        size_t i;
+
+        *masks = (DBusCharMasks){};
+
+        for (i = 0; i + 32 <= n_str; i += 32)
+                dbus_classify_avx2_chunk(masks, str + i, i);
+
+        if (i < n_str) {
+                memcpy(tail, str + i, n_str - i);
+                dbus_classify_avx2_chunk(masks, tail, i);
+        }
+}
+
+#endif
+
+static void (*dbus_classify_fn)(DBusCharMasks *masks, const char *str, size_t n_str);
+
+/**
+ * dbus_protocol_select_simd() - select vectorized validators
+ * @simd:               highest instruction set to use
+ *
+ * The validators of names, interfaces, members and paths classify their
+ * input in chunks, using the widest vector instructions the CPU supports.
+ * This is detected at runtime on first use. This function allows limiting
+ * the used instruction set to @simd, which is mostly useful to test the
+ * different implementations against each other.
+ *
+ * Return: The instruction set that is actually used.
+ */
+unsigned int dbus_protocol_select_simd(unsigned int simd) {
+#if defined(__x86_64__)
+        __builtin_cpu_init();
+
+        if (simd >= DBUS_PROTOCOL_SIMD_AVX2 && __builtin_cpu_supports("avx2")) {
+                dbus_classify_fn = dbus_classify_avx2;
+                return DBUS_PROTOCOL_SIMD_AVX2;
+        }
+
+        if (simd >= DBUS_PROTOCOL_SIMD_SSE2) {
+                dbus_classify_fn = dbus_classify_sse2;
+                return DBUS_PROTOCOL_SIMD_SSE2;
+        }
+#endif
+
+        dbus_classify_fn = dbus_classify_scalar;
+        return DBUS_PROTOCOL_SIMD_NONE;
+}
+
+static void dbus_classify(DBusCharMasks *masks, const char *str, size_t n_str) {
+        if (_c_unlikely_(!dbus_classify_fn))
+                dbus_protocol_select_simd(_DBUS_PROTOCOL_SIMD_N);
+
+        dbus_classify_fn(masks, str, n_str);
+}
+
+/*
+ * The validators below classify their input in chunks of 64 bytes and check
+ * the grammar on the resulting bitmasks. For each chunk, @start has a bit set
+ * for each byte that starts an element, which is the very first byte, as well
+ * as any byte following a separator. The state is carried over between chunks
+ * in the lowest bit of @start.
+ */
+
 static bool dbus_validate_name_common(const char *name, size_t n_name, bool namespace) {
         bool has_dot = false, dot = true, unique = false;
-        size_t i;
+        DBusCharMasks masks;
+        uint64_t all, start = 1;
+        size_t i, n;
 
         if (n_name > 255)
                 return false;
@@ -19,22 +195,23 @@ static bool dbus_validate_name_common(const char *name, size_t n_name, bool name
                 unique = true;
         }
 
-        for (i = 0; i < n_name; ++i) {
-                if (name[i] == '.') {
-                        if (dot)
-                                return false;
-
-                        has_dot = true;
-                        dot = true;
-                } else if (_c_unlikely_(!((name[i] >= 'a' && name[i] <= 'z') ||
-                                          (name[i] >= 'A' && name[i] <= 'Z') ||
-                                          (name[i] >= '0' && name[i] <= '9' && (!dot || unique)) ||
-                                          name[i] == '_' ||
-                                          name[i] == '-'))) {
+        for (i = 0; i < n_name; i += n) {
+                n = c_min(n_name - i, (size_t)64);
+                all = (n < 64) ? (UINT64_C(1) << n) - 1 : ~UINT64_C(0);
+
+                dbus_classify(&masks, name + i, n);
+                start |= masks.dot << 1;
+
+                if ((masks.word | masks.digit | masks.dot | masks.dash) != all)
+                        return false;
+                if (masks.dot & start)
+                        return false;
+                if (!unique && (masks.digit & start))
                         return false;
-                } else {
-                        dot = false;
-                }
+
+                has_dot = has_dot || masks.dot;
+                dot = masks.dot >> (n - 1) & 1;
+                start = dot;
         }
 
         return (has_dot || namespace) && !dot;
@@ -77,26 +254,28 @@ bool dbus_validate_namespace(const char *namespace, size_t n_namespace) {
  */
 bool dbus_validate_interface(const char *interface, size_t n_interface) {
         bool has_dot = false, dot = true;
-        size_t i;
+        DBusCharMasks masks;
+        uint64_t all, start = 1;
+        size_t i, n;
 
         if (n_interface > 255)
                 return false;
 
-        for (i = 0; i < n_interface; ++i) {
-                if (interface[i] == '.') {
-                        if (dot)
-                                return false;
-
-                        has_dot = true;
-                        dot = true;
-                } else if (_c_unlikely_(!((interface[i] >= 'a' && interface[i] <= 'z') ||
-                                          (interface[i] >= 'A' && interface[i] <= 'Z') ||
-                                          (interface[i] >= '0' && interface[i] <= '9' && !dot) ||
-                                          interface[i] == '_'))) {
+        for (i = 0; i < n_interface; i += n) {
+                n = c_min(n_interface - i, (size_t)64);
+                all = (n < 64) ? (UINT64_C(1) << n) - 1 : ~UINT64_C(0);
+
+                dbus_classify(&masks, interface + i, n);
+                start |= masks.dot << 1;
+
+                if ((masks.word | masks.digit | masks.dot) != all)
+                        return false;
+                if ((masks.dot | masks.digit) & start)
                         return false;
-                } else {
-                        dot = false;
-                }
+
+                has_dot = has_dot || masks.dot;
+                dot = masks.dot >> (n - 1) & 1;
+                start = dot;
         }
 
         return has_dot && !dot;
@@ -112,22 +291,69 @@ bool dbus_validate_interface(const char *interface, size_t n_interface) {
  * Return: True if @member is a valid member, false otherwise.
  */
 bool dbus_validate_member(const char *member, size_t n_member) {
-        bool first = true;
-        size_t i;
+        DBusCharMasks masks;
+        uint64_t all, start = 1;
+        size_t i, n;
+
+        if (n_member > 255 || n_member == 0)
+                return false;
+
+        for (i = 0; i < n_member; i += n) {
+                n = c_min(n_member - i, (size_t)64);
+                all = (n < 64) ? (UINT64_C(1) << n) - 1 : ~UINT64_C(0);
+
+                dbus_classify(&masks, member + i, n);
+
+                if ((masks.word | masks.digit) != all)
+                        return false;
+                if (masks.digit & start)
+                        return false;
+
+                start = 0;
+        }
 
-        if (n_member > 255)
+        return true;
+}
+
+/**
+ * dbus_validate_path() - verify validity of object path
+ * @path:               object path
+ * @n_path:             length of object path
+ *
+ * This verifies the validity of the passed object path. That is, it must
+ * start with a slash, followed by non-empty segments of [A-Za-z0-9_],
+ * separated by single slashes. Only the root path may end in a slash.
+ *
+ * Return: True if @path is a valid object path, false otherwise.
+ */
+bool dbus_validate_path(const char *path, size_t n_path) {
+        DBusCharMasks masks;
+        uint64_t all, start = 0;
+        bool slash = false;
+        size_t i, n;
+
+        if (n_path == 0 || path[0] != '/')
                 return false;
+        if (n_path == 1)
+                return true;
+
+        for (i = 0; i < n_path; i += n) {
+                n = c_min(n_path - i, (size_t)64);
+                all = (n < 64) ? (UINT64_C(1) << n) - 1 : ~UINT64_C(0);
+
+                dbus_classify(&masks, path + i, n);
+                start |= masks.slash << 1;
 
-        for (i = 0; i < n_member; ++i) {
-                if (_c_unlikely_(!((member[i] >= 'a' && member[i] <= 'z') ||
-                                   (member[i] >= 'A' && member[i] <= 'Z') ||
-                                   (member[i] >= '0' && member[i] <= '9' && !first) ||
-                                   member[i] == '_')))
+                if ((masks.word | masks.digit | masks.slash) != all)
                         return false;
-                first = false;
+                if (masks.slash & start)
+                        return false;
+
+                slash = masks.slash >> (n - 1) & 1;
+                start = slash;
         }
 
-        return !first;
+        return !slash;
 }
 
 /**
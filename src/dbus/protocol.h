@@ -60,8 +60,18 @@ enum {
     DBUS_HEADER_FLAG_ALLOW_INTERACTIVE_AUTHORIZATION = (1UL << 2),
 };
 
+enum {
+    DBUS_PROTOCOL_SIMD_NONE,
+    DBUS_PROTOCOL_SIMD_SSE2,
+    DBUS_PROTOCOL_SIMD_AVX2,
+    _DBUS_PROTOCOL_SIMD_N,
+};
+
+unsigned int dbus_protocol_select_simd(unsigned int simd);
+
 bool dbus_validate_name(const char *name, size_t n_name);
 bool dbus_validate_namespace(const char *namespace, size_t n_namespace);
 bool dbus_validate_interface(const char *interface, size_t n_interface);
 bool dbus_validate_member(const char *memebr, size_t n_member);
 bool dbus_validate_error_name(const char *name, size_t n_name);
+bool dbus_validate_path(const char *path, size_t n_path);
@@ -103,6 +103,10 @@ static int socket_buffer_new_line(SocketBuffer **bufferp,
         return 0;
 }
 
+static size_t socket_buffer_get_message_charge(Message *message) {
+        return sizeof(SocketBuffer) + sizeof(Message) + message->n_data;
+}
+
 static int socket_buffer_new_message(SocketBuffer **bufferp,
                                      Socket *socket,
                                      User *user,
@@ -117,19 +121,21 @@ static int socket_buffer_new_message(SocketBuffer **bufferp,
         buffer->message = message_ref(message);
         memcpy(buffer->vecs, message->vecs, sizeof(message->vecs));
 
-        r = user_charge(socket->user,
-                        &buffer->charges[0],
-                        user,
-                        USER_SLOT_BYTES,
-                        sizeof(SocketBuffer) + sizeof(Message) + message->n_data);
+        r = user_charge_cached(socket->user,
+                               &buffer->charges[0],
+                               &socket->out.cache,
+                               user,
+                               USER_SLOT_BYTES,
+                               socket_buffer_get_message_charge(message));
         if (r)
                 return (r == USER_E_QUOTA) ? SOCKET_E_QUOTA : error_fold(r);
 
-        r = user_charge(socket->user,
-                        &buffer->charges[1],
-                        user,
-                        USER_SLOT_FDS,
-                        fdlist_count(buffer->message->fds));
+        r = user_charge_cached(socket->user,
+                               &buffer->charges[1],
+                               &socket->out.cache,
+                               user,
+                               USER_SLOT_FDS,
+                               fdlist_count(buffer->message->fds));
         if (r)
                 return (r == USER_E_QUOTA) ? SOCKET_E_QUOTA : error_fold(r);
 
@@ -185,7 +191,44 @@ static bool socket_buffer_consume(SocketBuffer *buffer, size_t n) {
         return socket_buffer_is_consumed(buffer);
 }
 
+static size_t socket_buffer_clip(SocketBuffer *buffer, struct iovec *vecs) {
+        uint8_t *data = buffer->message->data, *end;
+        size_t i, n = 0;
+
+        /*
+         * The message of @buffer is still being received. Copy the vectors
+         * of @buffer into @vecs, but clip them to the data that is available
+         * so far. The patch buffer of the message is always available, and
+         * the vectors are ordered by their position in the message, so the
+         * clipped vectors always describe a prefix of the message. Return the
+         * number of bytes that can be written.
+         */
+        end = data + buffer->message->n_copied;
+
+        for (i = 0; i < buffer->n_vecs; ++i) {
+                vecs[i] = buffer->vecs[i];
+
+                if ((uint8_t *)vecs[i].iov_base >= data) {
+                        if ((uint8_t *)vecs[i].iov_base >= end)
+                                vecs[i].iov_len = 0;
+                        else
+                                vecs[i].iov_len = c_min(vecs[i].iov_len, (size_t)(end - (uint8_t *)vecs[i].iov_base));
+                }
+
+                n += vecs[i].iov_len;
+        }
+
+        return n;
+}
+
 static void socket_discard_input(Socket *socket) {
+        /*
+         * If the pending message is already being forwarded, its receivers
+         * must learn that the remainder will never arrive.
+         */
+        if (socket->in.message && socket->in.message->cut_through)
+                socket->in.message->aborted = true;
+
         iqueue_flush(&socket->in.queue);
         socket->in.message = message_unref(socket->in.message);
 }
@@ -242,6 +285,7 @@ void socket_deinit(Socket *socket) {
         assert(!socket->in.message);
 
         iqueue_deinit(&socket->in.queue);
+        user_cache_deinit(&socket->out.cache);
         socket->fd = -1;
         socket->user = user_unref(socket->user);
 }
@@ -345,6 +389,20 @@ int socket_dequeue_line(Socket *socket, const char **linep, size_t *np) {
         return 0;
 }
 
+static bool socket_might_cut_through(Socket *socket, Message *message) {
+        /*
+         * A message is offered for cut-through forwarding at most once, and
+         * only if it exceeds the configured threshold, its entire header
+         * (including padding) was received, and it did not carry any FDs so
+         * far.
+         */
+        return socket->in.cut_through &&
+               !message->incomplete &&
+               message->n_data >= socket->in.cut_through &&
+               message->n_copied >= (size_t)((uint8_t *)message->body - (uint8_t *)message->data) &&
+               !socket->in.queue.pending.fds;
+}
+
 /**
  * socket_dequeue() - fetch message from input buffer
  * @socket:             socket to operate on
@@ -359,6 +417,13 @@ int socket_dequeue_line(Socket *socket, const char **linep, size_t *np) {
  * If the input stream was shutdown, SOCKET_E_EOF is returned and no further
  * data can be read.
  *
+ * If cut-through forwarding is enabled on @socket, a message larger than the
+ * configured threshold might be returned before it was fully received. In that
+ * case, the message is marked as incomplete and @message->n_copied tells how
+ * much of it is available. If the caller marks the message as cut-through, it
+ * is never returned again, but continuously filled in by the socket, until it
+ * is complete or aborted. Otherwise, it is returned again once complete.
+ *
  * Return: On success, 0 is returned and @messagep will point to the read
  *         message (now owned by the caller). If no more messages can be
  *         fetched, NULL is put into @messagep.
@@ -411,10 +476,25 @@ int socket_dequeue(Socket *socket, Message **messagep) {
                 socket->in.message = message;
         }
 
-        assert(socket->in.message);
+        message = socket->in.message;
+        assert(message);
 
-        r = iqueue_pop_data(&socket->in.queue, &socket->in.message->fds);
+        r = iqueue_pop_data(&socket->in.queue, &message->fds);
         if (r == IQUEUE_E_PENDING) {
+                message->n_copied = sizeof(socket->in.header) + socket->in.queue.pending.n_copied;
+
+                if (_c_unlikely_(socket_might_cut_through(socket, message))) {
+                        /*
+                         * Offer the incomplete message to the caller. If it
+                         * decides to forward it right away, it marks it as
+                         * cut-through. Otherwise, it will be handed out
+                         * again once complete.
+                         */
+                        message->incomplete = true;
+                        *messagep = message_ref(message);
+                        return 0;
+                }
+
                 goto nodata;
         } else if (r == IQUEUE_E_VIOLATION) {
                 socket_close(socket);
@@ -423,8 +503,25 @@ int socket_dequeue(Socket *socket, Message **messagep) {
                 return error_fold(r);
         }
 
-        *messagep = socket->in.message;
         socket->in.message = NULL;
+        message->n_copied = (uint8_t *)message->body - (uint8_t *)message->data + message->n_body;
+        message->incomplete = false;
+
+        if (_c_unlikely_(message->cut_through)) {
+                /*
+                 * The message was already dispatched before it was fully
+                 * received. Its receivers now see it complete, so release it
+                 * and continue with the next one. Cut-through is only done
+                 * for messages without FDs in their header, so any FDs that
+                 * arrived late are discarded, just like
+                 * message_parse_metadata() would.
+                 */
+                message->fds = fdlist_free(message->fds);
+                message_unref(message);
+                return error_trace(socket_dequeue(socket, messagep));
+        }
+
+        *messagep = message;
         return 0;
 
 nodata:
@@ -509,6 +606,92 @@ int socket_queue(Socket *socket, User *user, Message *message) {
         return 0;
 }
 
+/**
+ * socket_can_drop() - check whether dropping messages makes room
+ * @socket:             socket to operate on
+ * @message:            message that exceeded the quota
+ * @fn:                 callback selecting the messages to drop
+ * @userdata:           userdata to pass to @fn
+ *
+ * Dropping queued messages via socket_drop() only makes room for the bytes of
+ * a message, charged to the user of @socket itself. This checks whether
+ * dropping all the messages socket_drop() would consider, given the same @fn,
+ * is sufficient to queue @message on its own behalf. Its file descriptors must
+ * fit as is. Nothing is dropped.
+ *
+ * Return: True if socket_drop() makes room for @message, false if not.
+ */
+bool socket_can_drop(Socket *socket, Message *message, SocketDropFn fn, void *userdata) {
+        SocketBuffer *buffer;
+        size_t n_charge, n_free;
+
+        if (!socket->user)
+                return false;
+
+        if (fdlist_count(message->fds) > socket->user->slots[USER_SLOT_FDS].n)
+                return false;
+
+        n_charge = socket_buffer_get_message_charge(message);
+        n_free = socket->user->slots[USER_SLOT_BYTES].n;
+
+        c_list_for_each_entry(buffer, &socket->out.queue, link) {
+                if (n_free >= n_charge)
+                        break;
+
+                if (!buffer->message ||
+                    buffer->message->incomplete ||
+                    !socket_buffer_is_uncomsumed(buffer))
+                        continue;
+
+                if (fn(buffer->message, userdata))
+                        n_free += buffer->charges[0].charge;
+        }
+
+        return n_free >= n_charge;
+}
+
+/**
+ * socket_drop() - drop queued messages to make room
+ * @socket:             socket to operate on
+ * @message:            message to make room for
+ * @fn:                 callback selecting the messages to drop
+ * @userdata:           userdata to pass to @fn
+ *
+ * This walks the outgoing queue of @socket once, oldest message first, and
+ * drops the messages selected by @fn, until the user of @socket has enough
+ * bytes left to queue @message on its own behalf. Only messages that were not
+ * written at all, yet, are considered, so the stream stays intact. The
+ * resources charged for the messages are released right away.
+ *
+ * Return: The number of dropped messages.
+ */
+size_t socket_drop(Socket *socket, Message *message, SocketDropFn fn, void *userdata) {
+        SocketBuffer *buffer, *safe;
+        size_t n_charge, n_dropped = 0;
+
+        if (!socket->user)
+                return 0;
+
+        n_charge = socket_buffer_get_message_charge(message);
+
+        c_list_for_each_entry_safe(buffer, safe, &socket->out.queue, link) {
+                if (socket->user->slots[USER_SLOT_BYTES].n >= n_charge)
+                        break;
+
+                if (!buffer->message ||
+                    buffer->message->incomplete ||
+                    !socket_buffer_is_uncomsumed(buffer))
+                        continue;
+
+                if (fn(buffer->message, userdata)) {
+                        socket_buffer_free(buffer);
+                        ++n_dropped;
+                }
+        }
+
+        return n_dropped;
+}
+
 static int socket_recvmsg(Socket *socket,
                           void *buffer,
                           size_t *from,
@@ -709,10 +892,34 @@ static int socket_dispatch_read(Socket *socket) {
                               charge_fds);
 }
 
+static SocketBuffer *socket_buffer_get_mergeable(Socket *socket, SocketBuffer *buffer) {
+        SocketBuffer *next;
+
+        /*
+         * SASL replies are queued as lines, and with pipelining clients the
+         * reply to Hello() is queued right behind them. Rather than writing
+         * them as separate chunks, and thus waking up the client for each,
+         * we write a line buffer together with the following message, as
+         * long as the message is complete and carries no FDs.
+         */
+        if (buffer->message || buffer->link.next == &socket->out.queue)
+                return NULL;
+
+        next = c_list_entry(buffer->link.next, SocketBuffer, link);
+        if (!next->message || next->message->incomplete || next->message->fds)
+                return NULL;
+
+        return next;
+}
+
 static int socket_dispatch_write(Socket *socket) {
-        SocketBuffer *buffer, *safe;
+        SocketBuffer *buffer, *safe, *next;
         struct mmsghdr msgs[SOCKET_MMSG_MAX];
+        struct iovec clipped[C_ARRAY_SIZE(((Message *)NULL)->vecs)];
+        struct iovec merged[1 + C_ARRAY_SIZE(((Message *)NULL)->vecs)];
+        struct mmsghdr *msg_clipped = NULL, *msg_merged = NULL;
         struct msghdr *msg;
+        size_t n_clipped = 0, n;
         int r, i, v, n_msgs;
 
         if (!c_list_is_empty(&socket->out.pending)) {
@@ -733,13 +940,51 @@ static int socket_dispatch_write(Socket *socket) {
                 return SOCKET_E_LOST_INTEREST;
 
         n_msgs = 0;
-        c_list_for_each_entry(buffer, &socket->out.queue, link) {
+        c_list_for_each_entry_safe(buffer, safe, &socket->out.queue, link) {
+                if (_c_unlikely_(buffer->message && buffer->message->incomplete)) {
+                        if (buffer->message->aborted) {
+                                /*
+                                 * The sender of this message vanished before
+                                 * it was fully received. If we did not write
+                                 * any of it, yet, we simply drop it.
+                                 * Otherwise, the stream to the receiver is
+                                 * corrupted, and all we can do is
+                                 * disconnect it.
+                                 */
+                                if (!socket_buffer_is_uncomsumed(buffer)) {
+                                        socket_close(socket);
+                                        socket_shutdown_now(socket);
+                                        return SOCKET_E_LOST_INTEREST;
+                                }
+
+                                socket_buffer_free(buffer);
+                                continue;
+                        }
+
+                        n_clipped = socket_buffer_clip(buffer, clipped);
+                        if (!n_clipped)
+                                break;
+                }
+
                 msg = &msgs[n_msgs].msg_hdr;
 
                 msg->msg_name = NULL;
                 msg->msg_namelen = 0;
-                msg->msg_iov = buffer->vecs;
+                msg->msg_iov = n_clipped ? clipped : buffer->vecs;
                 msg->msg_iovlen = buffer->n_vecs;
+
+                if (!msg_merged && (next = socket_buffer_get_mergeable(socket, buffer))) {
+                        merged[0] = buffer->vecs[0];
+                        memcpy(merged + 1, next->vecs, next->n_vecs * sizeof(*next->vecs));
+                        msg->msg_iov = merged;
+                        msg->msg_iovlen = 1 + next->n_vecs;
+                        msg_merged = &msgs[n_msgs];
+
+                        /* skip @next, it is written as part of this chunk */
+                        buffer = next;
+                        safe = c_list_entry(next->link.next, SocketBuffer, link);
+                }
+
                 if (buffer->message &&
                     buffer->message->fds &&
                     socket_buffer_is_uncomsumed(buffer)) {
@@ -751,6 +996,15 @@ static int socket_dispatch_write(Socket *socket) {
                 }
                 msg->msg_flags = 0;
 
+                /*
+                 * If a message is written while it is still being received,
+                 * nothing beyond the data received so far can be written.
+                 */
+                if (n_clipped) {
+                        msg_clipped = &msgs[n_msgs++];
+                        break;
+                }
+
                 if (++n_msgs >= (ssize_t)C_ARRAY_SIZE(msgs))
                         break;
 
@@ -776,8 +1030,12 @@ static int socket_dispatch_write(Socket *socket) {
                         break;
         }
 
-        if (!n_msgs)
+        if (!n_msgs) {
+                if (c_list_is_empty(&socket->out.queue) && _c_unlikely_(socket->shutdown))
+                        socket_shutdown_now(socket);
+
                 return SOCKET_E_LOST_INTEREST;
+        }
 
         n_msgs = sendmmsg(socket->fd, msgs, n_msgs, MSG_DONTWAIT | MSG_NOSIGNAL);
         if (n_msgs < 0) {
@@ -840,6 +1098,15 @@ static int socket_dispatch_write(Socket *socket) {
                 if (i >= n_msgs)
                         break;
 
+                if (&msgs[i] == msg_merged && !buffer->message) {
+                        /* split the chunk between the line and its message */
+                        n = c_min((size_t)msgs[i].msg_len, buffer->vecs[0].iov_len);
+                        msgs[i].msg_len -= n;
+                        if (socket_buffer_consume(buffer, n))
+                                socket_buffer_free(buffer);
+                        continue;
+                }
+
                 if (socket_buffer_consume(buffer, msgs[i].msg_len)) {
                         if (buffer->message && buffer->message->fds) {
                                 c_list_unlink(&buffer->link);
@@ -853,6 +1120,15 @@ static int socket_dispatch_write(Socket *socket) {
         }
         assert(i == n_msgs);
 
+        /*
+         * If everything available of a message that is still being received
+         * was written, we have to wait for more data, rather than for the
+         * socket to become writable. The caller is woken up once more data
+         * is available.
+         */
+        if (msg_clipped && msg_clipped < msgs + n_msgs && msg_clipped->msg_len == n_clipped)
+                return SOCKET_E_LOST_INTEREST;
+
         if (c_list_is_empty(&socket->out.queue)) {
                 if (_c_unlikely_(socket->shutdown))
                         socket_shutdown_now(socket);
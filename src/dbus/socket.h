@@ -15,6 +15,8 @@ typedef struct FDList FDList;
 typedef struct Socket Socket;
 typedef struct SocketBuffer SocketBuffer;
 
+typedef bool (*SocketDropFn) (Message *message, void *userdata);
+
 #define SOCKET_LINE_PREALLOC (64UL) /* fits the longest sane SASL exchange */
 #define SOCKET_FD_MAX (253UL) /* taken from kernel SCM_MAX_FD */
 #define SOCKET_MMSG_MAX (16) /* randomly picked, no tuning done so far */
@@ -47,11 +49,13 @@ struct Socket {
                 IQueue queue;
                 MessageHeader header;
                 Message *message;
+                size_t cut_through;
         } in;
 
         struct SocketOut {
                 CList queue;
                 CList pending;
+                UserCache cache;
         } out;
 };
 
@@ -60,6 +64,7 @@ struct Socket {
                 .in.queue = IQUEUE_NULL((_x).in.queue),                 \
                 .out.queue = C_LIST_INIT((_x).out.queue),               \
                 .out.pending = C_LIST_INIT((_x).out.pending),           \
+                .out.cache = USER_CACHE_INIT,                           \
         }
 
 void socket_init(Socket *socket, User *user, int fd);
@@ -70,6 +75,8 @@ int socket_dequeue(Socket *socket, Message **messagep);
 
 int socket_queue_line(Socket *socket, User *user, const char *line, size_t n);
 int socket_queue(Socket *socket, User *user, Message *message);
+bool socket_can_drop(Socket *socket, Message *message, SocketDropFn fn, void *userdata);
+size_t socket_drop(Socket *socket, Message *message, SocketDropFn fn, void *userdata);
 
 int socket_dispatch(Socket *socket, uint32_t event);
 void socket_shutdown(Socket *socket);
@@ -82,3 +89,11 @@ C_DEFINE_CLEANUP(Socket *, socket_deinit);
 static inline bool socket_is_running(Socket *socket) {
         return !socket->reset;
 }
+
+static inline bool socket_is_cutting_through(Socket *socket) {
+        return socket->in.message && socket->in.message->cut_through;
+}
+
+static inline bool socket_has_output(Socket *socket) {
+        return !c_list_is_empty(&socket->out.queue);
+}
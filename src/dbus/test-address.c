@@ -33,6 +33,22 @@ static void test_basic(void) {
         address_from_string(&addr, ":1.184467440737095516a0");
         assert(addr.type == ADDRESS_TYPE_OTHER);
 
+        /* Signs, whitespace and missing digits must be rejected. */
+        address_from_string(&addr, ":1.+1");
+        assert(addr.type == ADDRESS_TYPE_OTHER);
+        address_from_string(&addr, ":1.-1");
+        assert(addr.type == ADDRESS_TYPE_OTHER);
+        address_from_string(&addr, ":1. 1");
+        assert(addr.type == ADDRESS_TYPE_OTHER);
+        address_from_string(&addr, ":1.");
+        assert(addr.type == ADDRESS_TYPE_OTHER);
+        address_from_string(&addr, ":1");
+        assert(addr.type == ADDRESS_TYPE_OTHER);
+
+        address_from_string(&addr, ":1.18446744073709551614");
+        assert(addr.type == ADDRESS_TYPE_ID);
+        assert(addr.id == ADDRESS_ID_INVALID - 1);
+
         /* Empty addresses are invalid. */
         address_from_string(&addr, "");
         assert(addr.type == ADDRESS_TYPE_OTHER);
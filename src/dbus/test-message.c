@@ -3,8 +3,14 @@
  */
 
 #include <c-macro.h>
+#include <c-string.h>
+#include <endian.h>
 #include <stdlib.h>
 #include "dbus/message.h"
+#include "dbus/protocol.h"
+
+#define TEST_N_FUZZ_ITERATIONS (100000)
+#define TEST_N_FUZZ_BUFFER (4096)
 
 static void test_setup(void) {
         _c_cleanup_(message_unrefp) Message *m1 = NULL, *m2, *m3;
@@ -61,8 +67,508 @@ static void test_size(void) {
         assert(r == MESSAGE_E_TOO_LARGE);
 }
 
+static void test_mapped(void) {
+        MessageHeader hdr = { .endian = 'l' };
+        MessageStats stats;
+        Message *m1, *m2;
+        int r;
+
+        /* verify large messages are backed by their own mapping */
+
+        hdr.n_body = htole32(MESSAGE_MAP_MIN - 8);
+        r = message_new_incoming(&m1, hdr);
+        assert(r == 0);
+        assert(!m1->n_mapped);
+
+        hdr.n_body = htole32(MESSAGE_MAP_MIN);
+        r = message_new_incoming(&m2, hdr);
+        assert(r == 0);
+        assert(m2->n_mapped >= sizeof(*m2) + m2->n_data);
+
+        /* the entire payload must be writable */
+        memset(m2->data, 0xff, m2->n_data);
+
+        message_get_stats(&stats);
+        assert(stats.n_mapped == 1);
+        assert(stats.n_mapped_bytes == m2->n_mapped);
+        assert(stats.n_mapped_total >= 1);
+
+        message_unref(m2);
+        message_unref(m1);
+
+        /* mappings are released with the message */
+
+        message_get_stats(&stats);
+        assert(stats.n_mapped == 0);
+        assert(stats.n_mapped_bytes == 0);
+        assert(stats.n_mapped_bytes_peak > 0);
+}
+
+typedef struct TestWriter {
+        bool big_endian;
+        size_t pos;
+        uint8_t data[TEST_N_FUZZ_BUFFER];
+} TestWriter;
+
+static void test_write_u8(TestWriter *w, uint8_t value) {
+        assert(w->pos < sizeof(w->data));
+        w->data[w->pos++] = value;
+}
+
+static void test_write_u32(TestWriter *w, uint32_t value) {
+        value = w->big_endian ? htobe32(value) : htole32(value);
+        assert(w->pos + sizeof(value) <= sizeof(w->data));
+        memcpy(w->data + w->pos, &value, sizeof(value));
+        w->pos += sizeof(value);
+}
+
+static void test_write_align(TestWriter *w, size_t alignment, uint8_t padding) {
+        while (w->pos % alignment)
+                test_write_u8(w, padding);
+}
+
+static void test_write_string(TestWriter *w, const char *str, size_t n_str, bool small) {
+        if (small) {
+                test_write_u8(w, n_str);
+        } else {
+                test_write_align(w, 4, 0);
+                test_write_u32(w, n_str);
+        }
+
+        assert(w->pos + n_str + 1 <= sizeof(w->data));
+        memcpy(w->data + w->pos, str, n_str);
+        w->pos += n_str;
+        test_write_u8(w, 0);
+}
+
+static void test_pick_string(const char **strp, size_t *np) {
+        static const char *strings[] = {
+                "",
+                "/",
+                "/org/example/Object",
+                "/org/freedesktop/DBus/Local",
+                "/org//example",
+                "/org/example/",
+                "org",
+                "org.example.Interface",
+                "org.freedesktop.DBus.Local",
+                "org..example",
+                "org.example.0Foo",
+                "Member",
+                "Member0",
+                "0Member",
+                ":1.7",
+                ":1.",
+                "org.example-name",
+                "\xff\xfe.example",
+                "org.example\0.Hidden",
+        };
+        static const size_t lengths[] = {
+                [17] = 10,
+                [18] = 19,
+        };
+        size_t i = rand() % C_ARRAY_SIZE(strings);
+
+        *strp = strings[i];
+        *np = (i < C_ARRAY_SIZE(lengths) && lengths[i]) ? lengths[i] : strlen(strings[i]);
+}
+
+static void test_fuzz_generate(TestWriter *le, TestWriter *be) {
+        static const char elements[] = "osugyb";
+        static const char *signatures[] = { "", "", "", "s", "ii", "a{sv}", "(", "v", "z" };
+        static const char expected[_DBUS_MESSAGE_FIELD_N] = {
+                [DBUS_MESSAGE_FIELD_PATH] = 'o',
+                [DBUS_MESSAGE_FIELD_INTERFACE] = 's',
+                [DBUS_MESSAGE_FIELD_MEMBER] = 's',
+                [DBUS_MESSAGE_FIELD_ERROR_NAME] = 's',
+                [DBUS_MESSAGE_FIELD_REPLY_SERIAL] = 'u',
+                [DBUS_MESSAGE_FIELD_DESTINATION] = 's',
+                [DBUS_MESSAGE_FIELD_SENDER] = 's',
+                [DBUS_MESSAGE_FIELD_SIGNATURE] = 'g',
+                [DBUS_MESSAGE_FIELD_UNIX_FDS] = 'u',
+        };
+        TestWriter *w, *writers[] = { le, be };
+        size_t i, n_fields, start, n_array;
+        uint8_t type, flags, version, field, padding;
+        uint32_t serial, value;
+        const char *str;
+        size_t n_str;
+        char element;
+        int delta, seed;
+
+        /*
+         * Generate a random header and write it once in little-endian and
+         * once in big-endian. All random decisions are taken once, and then
+         * replayed for both writers.
+         */
+
+        type = rand() % 6;
+        flags = rand() % 4;
+        version = (rand() % 16) ? 1 : 2;
+        serial = (rand() % 16) ? 1 + rand() % 1024 : 0;
+        n_fields = rand() % 8;
+        delta = (rand() % 32) ? 0 : (rand() % 7) - 3;
+        seed = rand();
+
+        for (i = 0; i < C_ARRAY_SIZE(writers); ++i) {
+                w = writers[i];
+                w->pos = 0;
+                memset(w->data, 0, sizeof(w->data));
+
+                test_write_u8(w, w->big_endian ? 'B' : 'l');
+                test_write_u8(w, type);
+                test_write_u8(w, flags);
+                test_write_u8(w, version);
+                test_write_u32(w, 0);
+                test_write_u32(w, serial);
+                test_write_u32(w, 0);
+                start = w->pos;
+
+                srand(seed);
+
+                for (size_t j = 0; j < n_fields; ++j) {
+                        padding = (rand() % 64) ? 0 : 1 + rand() % 255;
+                        test_write_align(w, 8, padding);
+
+                        field = (rand() % 8) ? rand() % _DBUS_MESSAGE_FIELD_N : rand() % 16;
+                        if (field < _DBUS_MESSAGE_FIELD_N && expected[field] && (rand() % 4))
+                                element = expected[field];
+                        else
+                                element = elements[rand() % strlen(elements)];
+
+                        test_write_u8(w, field);
+                        test_write_u8(w, 1);
+                        test_write_u8(w, element);
+                        test_write_u8(w, 0);
+
+                        switch (element) {
+                        case 'o':
+                        case 's':
+                                test_pick_string(&str, &n_str);
+                                test_write_string(w, str, n_str, false);
+                                break;
+                        case 'g':
+                                str = signatures[rand() % C_ARRAY_SIZE(signatures)];
+                                test_write_string(w, str, strlen(str), true);
+                                break;
+                        case 'u':
+                                value = rand() % 4;
+                                test_write_align(w, 4, 0);
+                                test_write_u32(w, value);
+                                break;
+                        case 'b':
+                                value = rand() % 3;
+                                test_write_align(w, 4, 0);
+                                test_write_u32(w, value);
+                                break;
+                        case 'y':
+                                test_write_u8(w, rand());
+                                break;
+                        }
+                }
+
+                n_array = w->pos - start;
+                if (delta < 0 && (size_t)-delta > n_array)
+                        n_array = 0;
+                else
+                        n_array += delta;
+
+                w->pos = 12;
+                test_write_u32(w, n_array);
+                w->pos = start + n_array;
+        }
+}
+
+static int test_fuzz_parse(TestWriter *w, Message **messagep) {
+        _c_cleanup_(message_unrefp) Message *message = NULL;
+        MessageHeader header;
+        int r;
+
+        memcpy(&header, w->data, sizeof(header));
+
+        r = message_new_incoming(&message, header);
+        assert(!r);
+        assert(message->n_data <= sizeof(w->data));
+
+        memcpy(message->data, w->data, message->n_data);
+        message->n_copied = message->n_data;
+
+        r = message_parse_metadata(message);
+
+        *messagep = message;
+        message = NULL;
+        return r;
+}
+
+static void test_fuzz_header(void) {
+        static TestWriter le = { .big_endian = false }, be = { .big_endian = true };
+        size_t i, n_accepted = 0;
+        int r_le, r_be;
+
+        /*
+         * Headers in native little-endian are handled by a specialized parser,
+         * big-endian headers always go through the generic parser. Verify
+         * that both accept and reject the exact same headers, and extract
+         * the same metadata.
+         */
+
+        srand(0xabcdef);
+
+        for (i = 0; i < TEST_N_FUZZ_ITERATIONS; ++i) {
+                _c_cleanup_(message_unrefp) Message *m_le = NULL, *m_be = NULL;
+
+                test_fuzz_generate(&le, &be);
+
+                r_le = test_fuzz_parse(&le, &m_le);
+                r_be = test_fuzz_parse(&be, &m_be);
+                assert(r_le == r_be);
+
+                if (r_le)
+                        continue;
+
+                ++n_accepted;
+
+                assert(m_le->metadata.header.type == m_be->metadata.header.type);
+                assert(m_le->metadata.header.flags == m_be->metadata.header.flags);
+                assert(m_le->metadata.header.version == m_be->metadata.header.version);
+                assert(m_le->metadata.header.serial == m_be->metadata.header.serial);
+                assert(m_le->metadata.fields.available == m_be->metadata.fields.available);
+                assert(c_string_equal(m_le->metadata.fields.path, m_be->metadata.fields.path));
+                assert(c_string_equal(m_le->metadata.fields.interface, m_be->metadata.fields.interface));
+                assert(c_string_equal(m_le->metadata.fields.member, m_be->metadata.fields.member));
+                assert(c_string_equal(m_le->metadata.fields.error_name, m_be->metadata.fields.error_name));
+                assert(m_le->metadata.fields.reply_serial == m_be->metadata.fields.reply_serial);
+                assert(c_string_equal(m_le->metadata.fields.destination, m_be->metadata.fields.destination));
+                assert(c_string_equal(m_le->metadata.fields.sender, m_be->metadata.fields.sender));
+                assert(c_string_equal(m_le->metadata.fields.signature, m_be->metadata.fields.signature));
+                assert(m_le->metadata.fields.unix_fds == m_be->metadata.fields.unix_fds);
+                assert(!m_le->original_sender == !m_be->original_sender);
+        }
+
+        /* make sure the fuzzer actually produces valid headers */
+        assert(n_accepted > 0);
+}
+
+static void test_write_field(TestWriter *w, uint8_t code, const char *type, const char *value) {
+        test_write_align(w, 8, 0);
+        test_write_u8(w, code);
+        test_write_string(w, type, strlen(type), true);
+        test_write_string(w, value, strlen(value), *type == 'g');
+}
+
+static void test_lazy_body(void) {
+        _c_cleanup_(message_unrefp) Message *message = NULL;
+        static TestWriter w = { .big_endian = false };
+        MessageHeader header;
+        size_t start;
+        int r;
+
+        /*
+         * Create a signal with signature "sus", where the last string lacks
+         * its zero-termination. Lazy parsing must succeed as long as the
+         * invalid argument is not requested, strict parsing must fail.
+         */
+
+        test_write_u8(&w, 'l');
+        test_write_u8(&w, DBUS_MESSAGE_TYPE_SIGNAL);
+        test_write_u8(&w, 0);
+        test_write_u8(&w, 1);
+        test_write_u32(&w, 0);
+        test_write_u32(&w, 1);
+        test_write_u32(&w, 0);
+
+        test_write_field(&w, DBUS_MESSAGE_FIELD_PATH, "o", "/org/example/Object");
+        test_write_field(&w, DBUS_MESSAGE_FIELD_INTERFACE, "s", "org.example.Interface");
+        test_write_field(&w, DBUS_MESSAGE_FIELD_MEMBER, "s", "Member");
+        test_write_field(&w, DBUS_MESSAGE_FIELD_SIGNATURE, "g", "sus");
+
+        start = w.pos;
+        w.pos = 12;
+        test_write_u32(&w, start - 16);
+        w.pos = start;
+
+        test_write_align(&w, 8, 0);
+        start = w.pos;
+        test_write_string(&w, "foo", 3, false);
+        test_write_u32(&w, 7);
+        test_write_string(&w, "bar", 3, false);
+        w.data[w.pos - 1] = 'x';
+
+        start = w.pos - start;
+        w.pos = 4;
+        test_write_u32(&w, start);
+
+        memcpy(&header, w.data, sizeof(header));
+
+        r = message_new_incoming(&message, header);
+        assert(!r);
+        memcpy(message->data, w.data, message->n_data);
+        message->n_copied = message->n_data;
+
+        r = message_parse_metadata_lazy(message, 0);
+        assert(!r);
+        assert(!message->parsed);
+        assert(message->metadata.n_args == 0);
+        assert(!message->metadata.args);
+        assert(c_string_equal(message->metadata.fields.signature, "sus"));
+
+        r = message_parse_metadata_lazy(message, 2);
+        assert(!r);
+        assert(message->metadata.n_args == 2);
+        assert(message->metadata.args[0].element == 's');
+        assert(c_string_equal(message->metadata.args[0].value, "foo"));
+
+        r = message_parse_metadata_lazy(message, 3);
+        assert(r == MESSAGE_E_INVALID_BODY);
+
+        r = message_parse_metadata(message);
+        assert(r == MESSAGE_E_INVALID_BODY);
+        assert(!message->parsed);
+}
+
+static void test_new_signal(Message **messagep, const char *signature, const char *arg0) {
+        static TestWriter w;
+        MessageHeader header;
+        size_t i, start;
+        int r;
+
+        /*
+         * Create a signal with the given signature, which must consist of 's'
+         * and 'u' only. The first argument is set to @arg0, any following
+         * string is empty, and each integer is set to its index.
+         */
+
+        w = (TestWriter){ .big_endian = false };
+
+        test_write_u8(&w, 'l');
+        test_write_u8(&w, DBUS_MESSAGE_TYPE_SIGNAL);
+        test_write_u8(&w, 0);
+        test_write_u8(&w, 1);
+        test_write_u32(&w, 0);
+        test_write_u32(&w, 1);
+        test_write_u32(&w, 0);
+
+        test_write_field(&w, DBUS_MESSAGE_FIELD_PATH, "o", "/org/example/Object");
+        test_write_field(&w, DBUS_MESSAGE_FIELD_INTERFACE, "s", "org.example.Interface");
+        test_write_field(&w, DBUS_MESSAGE_FIELD_MEMBER, "s", "Member");
+        test_write_field(&w, DBUS_MESSAGE_FIELD_SIGNATURE, "g", signature);
+
+        start = w.pos;
+        w.pos = 12;
+        test_write_u32(&w, start - 16);
+        w.pos = start;
+
+        test_write_align(&w, 8, 0);
+        start = w.pos;
+
+        for (i = 0; signature[i]; ++i) {
+                if (signature[i] == 's') {
+                        if (i)
+                                test_write_string(&w, "", 0, false);
+                        else
+                                test_write_string(&w, arg0, strlen(arg0), false);
+                } else {
+                        assert(signature[i] == 'u');
+                        test_write_align(&w, 4, 0);
+                        test_write_u32(&w, i);
+                }
+        }
+
+        start = w.pos - start;
+        w.pos = 4;
+        test_write_u32(&w, start);
+
+        memcpy(&header, w.data, sizeof(header));
+
+        r = message_new_incoming(messagep, header);
+        assert(!r);
+        memcpy((*messagep)->data, w.data, (*messagep)->n_data);
+        (*messagep)->n_copied = (*messagep)->n_data;
+}
+
+static void test_signature_cache(void) {
+        _c_cleanup_(message_unrefp) Message *m1 = NULL, *m2 = NULL, *m3 = NULL, *m4 = NULL;
+        char signature[72];
+        int r;
+
+        /*
+         * Parsed body-signatures are kept in a direct-mapped cache. "sus" and
+         * "suuusuu" hash to the same slot, so each lookup of one of them
+         * evicts the entry of the other. Verify that messages of either
+         * signature are parsed correctly, including a message whose entry was
+         * evicted between parsing its header and extracting its arguments.
+         */
+
+        test_new_signal(&m1, "sus", "foo");
+        test_new_signal(&m2, "suuusuu", "bar");
+
+        r = message_parse_metadata_lazy(m1, 0);
+        assert(!r);
+        assert(m1->metadata.n_args == 0);
+
+        r = message_parse_metadata_lazy(m2, 0);
+        assert(!r);
+
+        r = message_parse_metadata(m2);
+        assert(!r);
+        assert(m2->metadata.n_args >= 1);
+        assert(m2->metadata.args[0].element == 's');
+        assert(c_string_equal(m2->metadata.args[0].value, "bar"));
+
+        r = message_parse_metadata_lazy(m1, 1);
+        assert(!r);
+        assert(m1->metadata.n_args == 1);
+        assert(m1->metadata.args[0].element == 's');
+        assert(c_string_equal(m1->metadata.args[0].value, "foo"));
+
+        r = message_parse_metadata(m1);
+        assert(!r);
+        assert(m1->parsed);
+        assert(c_string_equal(m1->metadata.args[0].value, "foo"));
+
+        /*
+         * Only the first 64 arguments are tracked in the argument bitmap of a
+         * cache entry. Signatures with more arguments must still be parsed
+         * and verified, with the first argument still being extracted, and
+         * strings beyond the tracked range simply not being cached.
+         */
+
+        memset(signature, 'u', sizeof(signature) - 1);
+        signature[0] = 's';
+        signature[sizeof(signature) - 2] = 's';
+        signature[sizeof(signature) - 1] = 0;
+
+        test_new_signal(&m3, signature, "baz");
+
+        r = message_parse_metadata_lazy(m3, MESSAGE_N_ARGS_MAX);
+        assert(!r);
+        assert(m3->metadata.n_args == 1);
+        assert(c_string_equal(m3->metadata.args[0].value, "baz"));
+
+        r = message_parse_metadata(m3);
+        assert(!r);
+        assert(m3->parsed);
+        assert(c_string_equal(m3->metadata.args[0].value, "baz"));
+
+        memset(signature, 'u', sizeof(signature) - 1);
+        signature[sizeof(signature) - 2] = 's';
+
+        test_new_signal(&m4, signature, "");
+
+        r = message_parse_metadata(m4);
+        assert(!r);
+        assert(m4->parsed);
+        assert(m4->metadata.n_args == 0);
+}
+
 int main(int argc, char **argv) {
         test_setup();
         test_size();
+        test_mapped();
+        test_fuzz_header();
+        test_lazy_body();
+        test_signature_cache();
+
+        message_deinit_global();
         return 0;
 }
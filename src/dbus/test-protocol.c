@@ -0,0 +1,204 @@
+/*
+ * Test D-Bus Protocol Validators
+ */
+
+#include <c-macro.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dbus/protocol.h"
+
+#define TEST_N_FUZZ_ITERATIONS (200000)
+
+/*
+ * Byte-wise reference implementations of the validators. The vectorized
+ * validators must agree with them on any input.
+ */
+
+static bool test_is_word(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static bool test_is_digit(char c) {
+        return c >= '0' && c <= '9';
+}
+
+static bool test_reference_name(const char *name, size_t n_name, bool namespace) {
+        bool has_dot = false, dot = true, unique = false;
+        size_t i;
+
+        if (n_name > 255)
+                return false;
+
+        if (n_name > 0 && name[0] == ':') {
+                ++name;
+                --n_name;
+                unique = true;
+        }
+
+        for (i = 0; i < n_name; ++i) {
+                if (name[i] == '.') {
+                        if (dot)
+                                return false;
+
+                        has_dot = true;
+                        dot = true;
+                } else if (!(test_is_word(name[i]) ||
+                             (test_is_digit(name[i]) && (!dot || unique)) ||
+                             name[i] == '-')) {
+                        return false;
+                } else {
+                        dot = false;
+                }
+        }
+
+        return (has_dot || namespace) && !dot;
+}
+
+static bool test_reference_interface(const char *interface, size_t n_interface) {
+        bool has_dot = false, dot = true;
+        size_t i;
+
+        if (n_interface > 255)
+                return false;
+
+        for (i = 0; i < n_interface; ++i) {
+                if (interface[i] == '.') {
+                        if (dot)
+                                return false;
+
+                        has_dot = true;
+                        dot = true;
+                } else if (!(test_is_word(interface[i]) ||
+                             (test_is_digit(interface[i]) && !dot))) {
+                        return false;
+                } else {
+                        dot = false;
+                }
+        }
+
+        return has_dot && !dot;
+}
+
+static bool test_reference_member(const char *member, size_t n_member) {
+        size_t i;
+
+        if (n_member > 255 || n_member == 0)
+                return false;
+
+        for (i = 0; i < n_member; ++i)
+                if (!(test_is_word(member[i]) || (test_is_digit(member[i]) && i > 0)))
+                        return false;
+
+        return true;
+}
+
+static bool test_reference_path(const char *path, size_t n_path) {
+        size_t i;
+
+        if (n_path == 0 || path[0] != '/')
+                return false;
+
+        for (i = 1; i < n_path; ++i) {
+                if (path[i] == '/') {
+                        if (path[i - 1] == '/')
+                                return false;
+                } else if (!(test_is_word(path[i]) || test_is_digit(path[i]))) {
+                        return false;
+                }
+        }
+
+        return n_path == 1 || path[n_path - 1] != '/';
+}
+
+static void test_verify(const char *str, size_t n_str) {
+        assert(dbus_validate_name(str, n_str) == test_reference_name(str, n_str, false));
+        assert(dbus_validate_namespace(str, n_str) == test_reference_name(str, n_str, true));
+        assert(dbus_validate_interface(str, n_str) == test_reference_interface(str, n_str));
+        assert(dbus_validate_error_name(str, n_str) == test_reference_interface(str, n_str));
+        assert(dbus_validate_member(str, n_str) == test_reference_member(str, n_str));
+        assert(dbus_validate_path(str, n_str) == test_reference_path(str, n_str));
+}
+
+static void test_basic(void) {
+        assert(dbus_validate_name("org.example", strlen("org.example")));
+        assert(dbus_validate_name(":1.7", strlen(":1.7")));
+        assert(dbus_validate_name("org.ex-ample", strlen("org.ex-ample")));
+        assert(!dbus_validate_name("org", strlen("org")));
+        assert(!dbus_validate_name("org.0example", strlen("org.0example")));
+        assert(!dbus_validate_name("org..example", strlen("org..example")));
+        assert(!dbus_validate_name("org.example.", strlen("org.example.")));
+        assert(dbus_validate_namespace("org", strlen("org")));
+
+        assert(dbus_validate_interface("org.example.Foo0", strlen("org.example.Foo0")));
+        assert(!dbus_validate_interface("org.ex-ample", strlen("org.ex-ample")));
+
+        assert(dbus_validate_member("Member0", strlen("Member0")));
+        assert(!dbus_validate_member("0Member", strlen("0Member")));
+        assert(!dbus_validate_member("", 0));
+
+        assert(dbus_validate_path("/", 1));
+        assert(dbus_validate_path("/org/example/Object", strlen("/org/example/Object")));
+        assert(!dbus_validate_path("/org//example", strlen("/org//example")));
+        assert(!dbus_validate_path("/org/example/", strlen("/org/example/")));
+        assert(!dbus_validate_path("org", strlen("org")));
+        assert(!dbus_validate_path("/org\0", 5));
+}
+
+static void test_fuzz(void) {
+        static const char alphabet[] = "aZ_09.-/:\0\x7f\x80\xff@[`{";
+        char str[320];
+        size_t i, j, n;
+
+        /*
+         * Generate strings from a small alphabet of interesting characters,
+         * covering all class boundaries, so the generated strings are valid
+         * every now and then. Lengths cover all vector-chunk and tail sizes.
+         */
+
+        for (i = 0; i < TEST_N_FUZZ_ITERATIONS; ++i) {
+                n = rand() % sizeof(str);
+
+                for (j = 0; j < n; ++j) {
+                        if (rand() % 8)
+                                str[j] = "abcXYZ_0189"[rand() % 11];
+                        else
+                                str[j] = alphabet[rand() % (sizeof(alphabet) - 1)];
+                }
+
+                switch (rand() % 4) {
+                case 0:
+                        str[0] = '/';
+                        for (j = 1; j < n; j += 1 + rand() % 8)
+                                str[j] = '/';
+                        break;
+                case 1:
+                        for (j = 1; j < n; j += 1 + rand() % 8)
+                                str[j] = '.';
+                        break;
+                case 2:
+                        if (n)
+                                str[0] = ':';
+                        break;
+                }
+
+                test_verify(str, n);
+        }
+}
+
+int main(int argc, char **argv) {
+        unsigned int simd, selected;
+
+        srand(0xabcdef);
+
+        for (simd = 0; simd < _DBUS_PROTOCOL_SIMD_N; ++simd) {
+                selected = dbus_protocol_select_simd(simd);
+                if (selected != simd)
+                        continue;
+
+                test_basic();
+                test_fuzz();
+        }
+
+        dbus_protocol_select_simd(_DBUS_PROTOCOL_SIMD_N);
+        return 0;
+}
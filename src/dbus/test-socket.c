@@ -7,6 +7,7 @@
 #include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <unistd.h>
 #include "dbus/message.h"
 #include "dbus/socket.h"
 
@@ -91,9 +92,224 @@ static void test_message(void) {
         assert(memcmp(message1->header, message2->header, sizeof(header)) == 0);
 }
 
+static void test_line_message(void) {
+        _c_cleanup_(socket_deinit) Socket client = SOCKET_NULL(client), server = SOCKET_NULL(server);
+        _c_cleanup_(message_unrefp) Message *message1 = NULL, *message2 = NULL;
+        MessageHeader header = {
+                .endian = 'l',
+        };
+        const char *test = "TEST", *line;
+        size_t n_bytes;
+        int pair[2], r;
+
+        r = socketpair(AF_UNIX, SOCK_STREAM, 0, pair);
+        assert(r >= 0);
+
+        socket_init(&client, NULL, pair[0]);
+        socket_init(&server, NULL, pair[1]);
+
+        r = message_new_incoming(&message1, header);
+        assert(r == 0);
+
+        /* a line followed by a message is written as a single chunk */
+        r = socket_queue_line(&client, NULL, test, strlen(test));
+        assert(r == 0);
+
+        r = socket_queue(&client, NULL, message1);
+        assert(!r);
+
+        r = socket_dispatch(&client, EPOLLOUT);
+        assert(r == SOCKET_E_LOST_INTEREST);
+        r = socket_dispatch(&server, EPOLLIN);
+        assert(!r || r == SOCKET_E_PREEMPTED);
+
+        r = socket_dequeue_line(&server, &line, &n_bytes);
+        assert(!r && line);
+        assert(n_bytes == strlen(test));
+        assert(memcmp(test, line, n_bytes) == 0);
+
+        r = socket_dequeue(&server, &message2);
+        assert(!r && message2);
+
+        assert(memcmp(message1->header, message2->header, sizeof(header)) == 0);
+}
+
+static void test_cut_through_setup(Socket *in, Socket *out, int *inp, int *outp) {
+        int pair[2], r;
+
+        r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair);
+        assert(r >= 0);
+
+        socket_init(in, NULL, pair[1]);
+        in->in.cut_through = 64;
+        *inp = pair[0];
+
+        r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair);
+        assert(r >= 0);
+
+        socket_init(out, NULL, pair[0]);
+        *outp = pair[1];
+}
+
+static void test_cut_through(void) {
+        _c_cleanup_(socket_deinit) Socket in = SOCKET_NULL(in), out = SOCKET_NULL(out);
+        _c_cleanup_(message_unrefp) Message *message = NULL, *next = NULL;
+        MessageHeader header = {
+                .endian = 'l',
+                .n_body = htole32(256),
+        };
+        uint8_t data[sizeof(header) + 256], buffer[sizeof(data)];
+        int fd_in, fd_out, r;
+        size_t i;
+
+        memcpy(data, &header, sizeof(header));
+        for (i = sizeof(header); i < sizeof(data); ++i)
+                data[i] = i;
+
+        test_cut_through_setup(&in, &out, &fd_in, &fd_out);
+
+        /* the message is offered as soon as its header was received */
+        r = write(fd_in, data, 128);
+        assert(r == 128);
+        r = socket_dispatch(&in, EPOLLIN);
+        assert(!r || r == SOCKET_E_PREEMPTED);
+
+        r = socket_dequeue(&in, &message);
+        assert(!r && message);
+        assert(message->incomplete);
+        assert(message->n_copied == 128);
+
+        message->cut_through = true;
+        r = socket_queue(&out, NULL, message);
+        assert(!r);
+
+        /* only the received part is written, then it waits for more */
+        r = socket_dispatch(&out, EPOLLOUT);
+        assert(r == SOCKET_E_LOST_INTEREST);
+        r = read(fd_out, buffer, sizeof(buffer));
+        assert(r == 128);
+        assert(!memcmp(buffer, data, 128));
+
+        /* it is never handed out again, but completed in place */
+        r = socket_dequeue(&in, &next);
+        assert(!r && !next);
+
+        r = write(fd_in, data + 128, sizeof(data) - 128);
+        assert(r == sizeof(data) - 128);
+        r = socket_dispatch(&in, EPOLLIN);
+        assert(!r || r == SOCKET_E_PREEMPTED);
+
+        r = socket_dequeue(&in, &next);
+        assert(!r && !next);
+        assert(!message->incomplete);
+
+        r = socket_dispatch(&out, EPOLLOUT);
+        assert(r == SOCKET_E_LOST_INTEREST);
+        r = read(fd_out, buffer, sizeof(buffer));
+        assert(r == sizeof(data) - 128);
+        assert(!memcmp(buffer, data + 128, sizeof(data) - 128));
+
+        close(fd_out);
+        close(fd_in);
+}
+
+static void test_cut_through_abort(void) {
+        _c_cleanup_(socket_deinit) Socket in = SOCKET_NULL(in), out = SOCKET_NULL(out);
+        _c_cleanup_(message_unrefp) Message *message = NULL;
+        MessageHeader header = {
+                .endian = 'l',
+                .n_body = htole32(256),
+        };
+        uint8_t data[sizeof(header) + 256] = {}, buffer[sizeof(data)];
+        int fd_in, fd_out, r;
+
+        memcpy(data, &header, sizeof(header));
+
+        test_cut_through_setup(&in, &out, &fd_in, &fd_out);
+
+        r = write(fd_in, data, 128);
+        assert(r == 128);
+        r = socket_dispatch(&in, EPOLLIN);
+        assert(!r || r == SOCKET_E_PREEMPTED);
+
+        r = socket_dequeue(&in, &message);
+        assert(!r && message && message->incomplete);
+
+        message->cut_through = true;
+        r = socket_queue(&out, NULL, message);
+        assert(!r);
+
+        r = socket_dispatch(&out, EPOLLOUT);
+        assert(r == SOCKET_E_LOST_INTEREST);
+        r = read(fd_out, buffer, sizeof(buffer));
+        assert(r == 128);
+
+        /* the receiver got parts of the message, so it is disconnected */
+        socket_close(&in);
+        assert(message->aborted);
+
+        r = socket_dispatch(&out, EPOLLOUT);
+        assert(r == SOCKET_E_LOST_INTEREST);
+        assert(out.hup_out);
+        r = read(fd_out, buffer, sizeof(buffer));
+        assert(r == 0);
+
+        close(fd_out);
+        close(fd_in);
+}
+
+static void test_cut_through_drop(void) {
+        _c_cleanup_(socket_deinit) Socket in = SOCKET_NULL(in), out = SOCKET_NULL(out);
+        _c_cleanup_(message_unrefp) Message *message = NULL, *other = NULL;
+        MessageHeader header = {
+                .endian = 'l',
+                .n_body = htole32(256),
+        };
+        uint8_t data[sizeof(header) + 256] = {}, buffer[sizeof(data)];
+        int fd_in, fd_out, r;
+
+        memcpy(data, &header, sizeof(header));
+
+        test_cut_through_setup(&in, &out, &fd_in, &fd_out);
+
+        r = write(fd_in, data, 128);
+        assert(r == 128);
+        r = socket_dispatch(&in, EPOLLIN);
+        assert(!r || r == SOCKET_E_PREEMPTED);
+
+        r = socket_dequeue(&in, &message);
+        assert(!r && message && message->incomplete);
+
+        message->cut_through = true;
+        r = socket_queue(&out, NULL, message);
+        assert(!r);
+
+        r = message_new_incoming(&other, (MessageHeader){ .endian = 'l' });
+        assert(!r);
+        r = socket_queue(&out, NULL, other);
+        assert(!r);
+
+        /* nothing was written yet, so the aborted message is dropped */
+        socket_close(&in);
+        assert(message->aborted);
+
+        r = socket_dispatch(&out, EPOLLOUT);
+        assert(r == SOCKET_E_LOST_INTEREST);
+        assert(!out.hup_out);
+        r = read(fd_out, buffer, sizeof(buffer));
+        assert(r == sizeof(header));
+
+        close(fd_out);
+        close(fd_in);
+}
+
 int main(int argc, char **argv) {
         test_setup();
         test_line();
         test_message();
+        test_line_message();
+        test_cut_through();
+        test_cut_through_abort();
+        test_cut_through_drop();
         return 0;
 }
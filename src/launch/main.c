@@ -84,6 +84,7 @@ struct Manager {
         uint64_t max_bytes;
         uint64_t max_fds;
         uint64_t max_matches;
+        uint64_t reply_timeout;
 };
 
 /*
@@ -381,7 +382,8 @@ static noreturn void manager_run_child(Manager *manager, int fd_log, int fd_cont
              str_machine_id[33],
              str_max_bytes[C_DECIMAL_MAX(uint64_t)],
              str_max_fds[C_DECIMAL_MAX(uint64_t)],
-             str_max_matches[C_DECIMAL_MAX(uint64_t)];
+             str_max_matches[C_DECIMAL_MAX(uint64_t)],
+             str_reply_timeout[C_DECIMAL_MAX(uint64_t)];
         const char * const argv[] = {
                 "dbus-broker",
                 "--log",
@@ -396,6 +398,8 @@ static noreturn void manager_run_child(Manager *manager, int fd_log, int fd_cont
                 str_max_fds,
                 "--max-matches",
                 str_max_matches,
+                "--reply-timeout",
+                str_reply_timeout,
                 main_arg_audit ? "--audit" : NULL, /* note that this needs to be the last argument to work */
                 NULL,
         };
@@ -460,6 +464,9 @@ static noreturn void manager_run_child(Manager *manager, int fd_log, int fd_cont
         r = snprintf(str_max_matches, sizeof(str_max_matches), "%"PRIu64, manager->max_matches);
         assert(r < (ssize_t)sizeof(str_max_matches));
 
+        r = snprintf(str_reply_timeout, sizeof(str_reply_timeout), "%"PRIu64, manager->reply_timeout);
+        assert(r < (ssize_t)sizeof(str_reply_timeout));
+
         r = execve(main_arg_broker, (char * const *)argv, environ);
         r = error_origin(-errno);
 
@@ -1259,6 +1266,7 @@ static int manager_parse_config(Manager *manager, ConfigRoot **rootp, NSSCache *
         uint64_t max_connections_per_user = main_max_connections_per_user;
         uint64_t max_outgoing_unix_fds = main_max_outgoing_unix_fds;
         uint64_t max_outgoing_bytes = main_max_outgoing_bytes;
+        uint64_t reply_timeout = 0;
         const char *configfile;
         ConfigNode *cnode;
         int r;
@@ -1322,6 +1330,9 @@ static int manager_parse_config(Manager *manager, ConfigRoot **rootp, NSSCache *
                         case CONFIG_LIMIT_MAX_MATCH_RULES_PER_CONNECTION:
                                 max_match_rules_per_connection = cnode->limit.value;
                                 break;
+                        case CONFIG_LIMIT_REPLY_TIMEOUT:
+                                reply_timeout = cnode->limit.value;
+                                break;
                         }
 
                         break;
@@ -1335,18 +1346,30 @@ static int manager_parse_config(Manager *manager, ConfigRoot **rootp, NSSCache *
         manager->max_bytes = util_umul64_saturating(max_connections_per_user, max_outgoing_bytes);
         manager->max_fds = util_umul64_saturating(max_connections_per_user, max_outgoing_unix_fds);
         manager->max_matches = util_umul64_saturating(max_connections_per_user, max_match_rules_per_connection);
+        manager->reply_timeout = reply_timeout;
 
         return 0;
 }
 
 static int manager_load_policy(Manager *manager, ConfigRoot *root, Policy *policy) {
+        size_t n_records;
         int r;
 
         r = policy_import(policy, root);
         if (r)
                 return error_fold(r);
 
-        policy_optimize(policy);
+        n_records = policy_n_records(policy);
+
+        r = policy_optimize(policy);
+        if (r)
+                return error_fold(r);
+
+        log_append_here(&main_log, LOG_INFO, 0);
+        r = log_commitf(&main_log, "Loaded policy with %zu records, %zu after optimization.",
+                        n_records, policy_n_records(policy));
+        if (r)
+                return error_fold(r);
 
         return 0;
 }
@@ -1522,10 +1545,62 @@ static int bus_method_reload_config(sd_bus_message *message, void *userdata, sd_
         return sd_bus_reply_method_return(message, NULL);
 }
 
+static int bus_method_resolve_groups(sd_bus_message *message, void *userdata, sd_bus_error *error) {
+        _c_cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+        _c_cleanup_(c_freep) gid_t *gids = NULL;
+        struct passwd *passwd;
+        int r, n_gids, n_gids_previous;
+        uint32_t uid;
+        void *p;
+
+        r = sd_bus_message_read(message, "u", &uid);
+        if (r < 0)
+                return error_origin(r);
+
+        /*
+         * The broker asks for the auxiliary groups of a user only if the
+         * kernel cannot tell it via SO_PEERGROUPS. If they cannot be
+         * resolved, the broker refuses the connections of the user, since
+         * group policies would not apply to them otherwise.
+         */
+        passwd = getpwuid(uid);
+        if (!passwd)
+                return sd_bus_reply_method_errorf(message, "org.bus1.DBus.Controller.Error.ResolveFailed", "Cannot resolve user %"PRIu32, uid);
+
+        n_gids = 8;
+
+        do {
+                n_gids_previous = n_gids;
+                p = realloc(gids, n_gids * sizeof(*gids));
+                if (!p)
+                        return error_origin(-ENOMEM);
+
+                gids = p;
+                r = getgrouplist(passwd->pw_name, passwd->pw_gid, gids, &n_gids);
+                if (r < 0 && n_gids <= n_gids_previous)
+                        return sd_bus_reply_method_errorf(message, "org.bus1.DBus.Controller.Error.ResolveFailed", "Cannot resolve groups of user %"PRIu32, uid);
+        } while (r < 0);
+
+        r = sd_bus_message_new_method_return(message, &reply);
+        if (r < 0)
+                return error_origin(r);
+
+        r = sd_bus_message_append_array(reply, 'u', gids, n_gids * sizeof(*gids));
+        if (r < 0)
+                return error_origin(r);
+
+        r = sd_bus_send(NULL, reply, NULL);
+        if (r < 0)
+                return error_origin(r);
+
+        return 0;
+}
+
 const sd_bus_vtable manager_vtable[] = {
         SD_BUS_VTABLE_START(0),
 
         SD_BUS_METHOD("ReloadConfig", NULL, NULL, bus_method_reload_config, 0),
+        SD_BUS_METHOD("ResolveGroups", "u", "au", bus_method_resolve_groups, 0),
 
         SD_BUS_VTABLE_END
 };
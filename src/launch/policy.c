@@ -5,6 +5,7 @@
 #include <c-list.h>
 #include <c-macro.h>
 #include <c-rbtree.h>
+#include <c-string.h>
 #include <stdlib.h>
 #include <systemd/sd-bus.h>
 #include "dbus/protocol.h"
@@ -764,6 +765,295 @@ static void policy_optimize_connect(Policy *policy) {
         }
 }
 
+static bool policy_record_own_covers(PolicyRecord *record, PolicyRecord *other) {
+        return record->own.prefix == other->own.prefix &&
+               c_string_equal(record->own.name, other->own.name);
+}
+
+static bool policy_record_xmit_covers(PolicyRecord *record, PolicyRecord *other) {
+        /*
+         * A record covers another record, if it matches every message the
+         * other record matches. Any unset field matches everything, any set
+         * field must be equal in both records (or, in case of the fd-range,
+         * contain the range of the other record).
+         */
+
+        if (record->xmit.name && !c_string_equal(record->xmit.name, other->xmit.name))
+                return false;
+        if (record->xmit.path && !c_string_equal(record->xmit.path, other->xmit.path))
+                return false;
+        if (record->xmit.interface && !c_string_equal(record->xmit.interface, other->xmit.interface))
+                return false;
+        if (record->xmit.member && !c_string_equal(record->xmit.member, other->xmit.member))
+                return false;
+        if (record->xmit.type && record->xmit.type != other->xmit.type)
+                return false;
+        if (record->xmit.broadcast != UTIL_TRISTATE_UNSET && record->xmit.broadcast != other->xmit.broadcast)
+                return false;
+        if (record->xmit.min_fds > other->xmit.min_fds || record->xmit.max_fds < other->xmit.max_fds)
+                return false;
+
+        return true;
+}
+
+static bool policy_list_shadows(CList *list, PolicyRecord *record, bool (*covers)(PolicyRecord *, PolicyRecord *)) {
+        PolicyRecord *i_record;
+
+        if (!list)
+                return false;
+
+        c_list_for_each_entry(i_record, list, link)
+                if (i_record->priority > record->priority && covers(i_record, record))
+                        return true;
+
+        return false;
+}
+
+static void policy_list_unshadow(CList *list,
+                                 CList *default_list,
+                                 bool (*covers)(PolicyRecord *, PolicyRecord *)) {
+        PolicyRecord *i_record, *t_record;
+
+        /*
+         * Drop every record that is covered by a record of higher priority in
+         * the same list, or in the default list. Such a record can never be
+         * the highest priority match of a message, so it never decides a
+         * verdict. Since covering is transitive, the order in which records
+         * are dropped does not matter.
+         */
+        c_list_for_each_entry_safe(i_record, t_record, list, link)
+                if (policy_list_shadows(list, i_record, covers) ||
+                    policy_list_shadows(default_list, i_record, covers))
+                        policy_record_free(i_record);
+}
+
+static void policy_entries_unshadow(PolicyEntries *entries, PolicyEntries *default_entries) {
+        policy_list_unshadow(&entries->own_list,
+                             default_entries ? &default_entries->own_list : NULL,
+                             policy_record_own_covers);
+        policy_list_unshadow(&entries->send_list,
+                             default_entries ? &default_entries->send_list : NULL,
+                             policy_record_xmit_covers);
+        policy_list_unshadow(&entries->recv_list,
+                             default_entries ? &default_entries->recv_list : NULL,
+                             policy_record_xmit_covers);
+}
+
+typedef struct PolicyVerdicts PolicyVerdicts;
+
+/* sorted priorities of all records of one kind, per verdict */
+struct PolicyVerdicts {
+        uint64_t *priorities[2];
+        size_t n_priorities[2];
+};
+
+#define POLICY_VERDICTS_NULL {}
+
+static void policy_verdicts_deinit(PolicyVerdicts *verdicts) {
+        free(verdicts->priorities[1]);
+        free(verdicts->priorities[0]);
+        *verdicts = (PolicyVerdicts)POLICY_VERDICTS_NULL;
+}
+
+static int policy_verdicts_compare(const void *a, const void *b) {
+        uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+        return (x > y) - (x < y);
+}
+
+static void policy_verdicts_add_list(PolicyVerdicts *verdicts, CList *list, bool count) {
+        PolicyRecord *i_record;
+
+        c_list_for_each_entry(i_record, list, link) {
+                if (count)
+                        ++verdicts->n_priorities[i_record->verdict];
+                else
+                        verdicts->priorities[i_record->verdict][verdicts->n_priorities[i_record->verdict]++] = i_record->priority;
+        }
+}
+
+static void policy_verdicts_add(PolicyVerdicts *verdicts, Policy *policy, size_t offset, bool count) {
+        PolicyNode *i_node;
+
+        policy_verdicts_add_list(verdicts, (void *)&policy->default_entries + offset, count);
+        policy_verdicts_add_list(verdicts, (void *)&policy->at_console_entries + offset, count);
+        policy_verdicts_add_list(verdicts, (void *)&policy->no_console_entries + offset, count);
+
+        c_rbtree_for_each_entry(i_node, &policy->uid_tree, policy_node)
+                policy_verdicts_add_list(verdicts, (void *)&i_node->entries + offset, count);
+
+        c_rbtree_for_each_entry(i_node, &policy->gid_tree, policy_node)
+                policy_verdicts_add_list(verdicts, (void *)&i_node->entries + offset, count);
+}
+
+static int policy_verdicts_init(PolicyVerdicts *verdicts, Policy *policy, size_t offset) {
+        size_t i;
+
+        *verdicts = (PolicyVerdicts)POLICY_VERDICTS_NULL;
+
+        /*
+         * Collect the priorities of all records in the list at @offset of
+         * every entry of @policy, since a peer might be subject to any
+         * combination of them.
+         */
+        policy_verdicts_add(verdicts, policy, offset, true);
+
+        for (i = 0; i < C_ARRAY_SIZE(verdicts->priorities); ++i) {
+                verdicts->priorities[i] = malloc((verdicts->n_priorities[i] ?: 1) * sizeof(*verdicts->priorities[i]));
+                if (!verdicts->priorities[i]) {
+                        policy_verdicts_deinit(verdicts);
+                        return error_origin(-ENOMEM);
+                }
+
+                verdicts->n_priorities[i] = 0;
+        }
+
+        policy_verdicts_add(verdicts, policy, offset, false);
+
+        for (i = 0; i < C_ARRAY_SIZE(verdicts->priorities); ++i)
+                qsort(verdicts->priorities[i], verdicts->n_priorities[i], sizeof(*verdicts->priorities[i]), policy_verdicts_compare);
+
+        return 0;
+}
+
+static bool policy_verdicts_contain(PolicyVerdicts *verdicts, bool verdict, uint64_t lower, uint64_t upper) {
+        uint64_t *priorities = verdicts->priorities[verdict];
+        size_t from = 0, to = verdicts->n_priorities[verdict], i;
+
+        /* find the first priority above @lower, and check it is below @upper */
+        while (from < to) {
+                i = from + (to - from) / 2;
+                if (priorities[i] <= lower)
+                        from = i + 1;
+                else
+                        to = i;
+        }
+
+        return from < verdicts->n_priorities[verdict] && priorities[from] < upper;
+}
+
+static bool policy_list_subsumes(CList *list,
+                                 PolicyRecord *record,
+                                 bool (*covers)(PolicyRecord *, PolicyRecord *),
+                                 PolicyVerdicts *verdicts) {
+        PolicyRecord *i_record;
+
+        if (!list)
+                return false;
+
+        c_list_for_each_entry(i_record, list, link)
+                if (i_record->priority < record->priority &&
+                    i_record->verdict == record->verdict &&
+                    covers(i_record, record) &&
+                    !policy_verdicts_contain(verdicts, !record->verdict, i_record->priority, record->priority))
+                        return true;
+
+        return false;
+}
+
+static void policy_list_merge(CList *list,
+                              CList *default_list,
+                              bool (*covers)(PolicyRecord *, PolicyRecord *),
+                              PolicyVerdicts *verdicts) {
+        PolicyRecord *i_record, *t_record;
+
+        /*
+         * Drop every record that is covered by a record of lower priority
+         * with the same verdict, in the same list or in the default list, if
+         * no record with the opposite verdict has a priority in between. Any
+         * message the dropped record matched is then decided by a record of
+         * the same verdict. Records with the opposite verdict are collected
+         * from all entries, regardless of what they match, so this holds for
+         * any combination of batches a peer is subject to.
+         */
+        c_list_for_each_entry_safe(i_record, t_record, list, link)
+                if (policy_list_subsumes(list, i_record, covers, verdicts) ||
+                    policy_list_subsumes(default_list, i_record, covers, verdicts))
+                        policy_record_free(i_record);
+}
+
+static void policy_merge_list(Policy *policy,
+                              size_t offset,
+                              bool (*covers)(PolicyRecord *, PolicyRecord *),
+                              PolicyVerdicts *verdicts) {
+        CList *default_list = (void *)&policy->default_entries + offset;
+        PolicyNode *i_node;
+
+        policy_list_merge(default_list, NULL, covers, verdicts);
+        policy_list_merge((void *)&policy->at_console_entries + offset, default_list, covers, verdicts);
+        policy_list_merge((void *)&policy->no_console_entries + offset, default_list, covers, verdicts);
+
+        c_rbtree_for_each_entry(i_node, &policy->uid_tree, policy_node)
+                policy_list_merge((void *)&i_node->entries + offset, default_list, covers, verdicts);
+
+        c_rbtree_for_each_entry(i_node, &policy->gid_tree, policy_node)
+                policy_list_merge((void *)&i_node->entries + offset, default_list, covers, verdicts);
+}
+
+static int policy_optimize_merge(Policy *policy) {
+        static const struct {
+                size_t offset;
+                bool (*covers)(PolicyRecord *, PolicyRecord *);
+        } kinds[] = {
+                { offsetof(PolicyEntries, own_list), policy_record_own_covers },
+                { offsetof(PolicyEntries, send_list), policy_record_xmit_covers },
+                { offsetof(PolicyEntries, recv_list), policy_record_xmit_covers },
+        };
+        size_t i;
+        int r;
+
+        /*
+         * A record covered by a record of *lower* priority with the same
+         * verdict is merged into the latter, unless a record of any batch
+         * the peer might also be subject to has a priority in between and
+         * the opposite verdict. The priorities of those are looked up in a
+         * sorted array per kind, so this is not quadratic in the number of
+         * entries. Dropping records only ever removes priorities, so the
+         * arrays stay conservative while records are merged.
+         */
+
+        for (i = 0; i < C_ARRAY_SIZE(kinds); ++i) {
+                _c_cleanup_(policy_verdicts_deinit) PolicyVerdicts verdicts = POLICY_VERDICTS_NULL;
+
+                r = policy_verdicts_init(&verdicts, policy, kinds[i].offset);
+                if (r)
+                        return error_trace(r);
+
+                policy_merge_list(policy, kinds[i].offset, kinds[i].covers, &verdicts);
+        }
+
+        return 0;
+}
+
+static void policy_optimize_xmit(Policy *policy) {
+        PolicyNode *i_node;
+
+        /*
+         * The broker evaluates all OWN, SEND and RECEIVE records of a peer
+         * and picks the verdict of the highest priority match. The default
+         * records apply to every peer (they are either exported as default
+         * batch, or merged into each uid batch), hence any record that is
+         * covered by a default record of higher priority, or by a record of
+         * higher priority in its own list, is dead and can be dropped. This
+         * also takes care of duplicates, which merely differ in priority.
+         *
+         * Note that the default entries must be reduced first, so other
+         * entries are only compared against the remaining default records.
+         * Records covered by lower priority records are handled by
+         * policy_optimize_merge().
+         */
+
+        policy_entries_unshadow(&policy->default_entries, NULL);
+        policy_entries_unshadow(&policy->at_console_entries, &policy->default_entries);
+        policy_entries_unshadow(&policy->no_console_entries, &policy->default_entries);
+
+        c_rbtree_for_each_entry(i_node, &policy->uid_tree, policy_node)
+                policy_entries_unshadow(&i_node->entries, &policy->default_entries);
+
+        c_rbtree_for_each_entry(i_node, &policy->gid_tree, policy_node)
+                policy_entries_unshadow(&i_node->entries, &policy->default_entries);
+}
+
 static void policy_optimize_trim(Policy *policy) {
         PolicyNode *node, *t_node;
 
@@ -785,14 +1075,51 @@ static void policy_optimize_trim(Policy *policy) {
 /**
  * policy_optimize() - XXX
  */
-void policy_optimize(Policy *policy) {
-        /*
-         * XXX: There are many more optimizations possible. Lets figure out
-         *      which of those are worth it, and then implement them.
-         */
+int policy_optimize(Policy *policy) {
+        int r;
 
         policy_optimize_connect(policy);
+        policy_optimize_xmit(policy);
+
+        r = policy_optimize_merge(policy);
+        if (r)
+                return error_trace(r);
+
         policy_optimize_trim(policy);
+        return 0;
+}
+
+static size_t policy_entries_n_records(PolicyEntries *entries) {
+        return c_list_length(&entries->connect_list) +
+               c_list_length(&entries->own_list) +
+               c_list_length(&entries->send_list) +
+               c_list_length(&entries->recv_list);
+}
+
+/**
+ * policy_n_records() - count policy records
+ * @policy:             policy to operate on
+ *
+ * This counts all CONNECT, OWN, SEND and RECEIVE records in @policy. It is
+ * meant to report the effect of policy_optimize().
+ *
+ * Return: The number of records in @policy.
+ */
+size_t policy_n_records(Policy *policy) {
+        PolicyNode *i_node;
+        size_t n;
+
+        n = policy_entries_n_records(&policy->default_entries) +
+            policy_entries_n_records(&policy->at_console_entries) +
+            policy_entries_n_records(&policy->no_console_entries);
+
+        c_rbtree_for_each_entry(i_node, &policy->uid_tree, policy_node)
+                n += policy_entries_n_records(&i_node->entries);
+
+        c_rbtree_for_each_entry(i_node, &policy->gid_tree, policy_node)
+                n += policy_entries_n_records(&i_node->entries);
+
+        return n;
 }
 
 static int policy_export_connect(Policy *policy, CList *default_list, CList *specific_list, sd_bus_message *m) {
@@ -0,0 +1,286 @@
+/*
+ * Test Policy Converter
+ */
+
+#include <c-list.h>
+#include <c-macro.h>
+#include <c-rbtree.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "dbus/protocol.h"
+#include "launch/config.h"
+#include "launch/nss-cache.h"
+#include "launch/policy.h"
+#include "util/common.h"
+#include "util/dirwatch.h"
+
+#define TEST_N_SAMPLES_MAX (4096)
+
+static const char test_config_xml[] =
+        "<!DOCTYPE busconfig PUBLIC \"-//freedesktop//DTD D-Bus Bus Configuration 1.0//EN\"\n"
+        " \"http://www.freedesktop.org/standards/dbus/1.0/busconfig.dtd\">\n"
+        "<busconfig>\n"
+        "  <policy context=\"default\">\n"
+        /* a narrower record overridden by a broader one: dropped */
+        "    <allow send_interface=\"org.b.I\" send_member=\"N\"/>\n"
+        "    <deny send_interface=\"org.b.I\"/>\n"
+        /* a broader record overridden by narrower ones: kept */
+        "    <allow send_destination=\"org.a\"/>\n"
+        "    <deny send_destination=\"org.a\" send_interface=\"org.a.I\"/>\n"
+        "    <allow send_destination=\"org.a\" send_interface=\"org.a.I\" send_member=\"M\"/>\n"
+        /* duplicates: the first one of each is dropped */
+        "    <allow own=\"org.a\"/>\n"
+        "    <allow own=\"org.a\"/>\n"
+        "    <deny own_prefix=\"org.a\"/>\n"
+        "    <allow receive_sender=\"org.b\"/>\n"
+        "    <deny receive_sender=\"org.b\"/>\n"
+        /* a record covered by a lower priority one with the same verdict: merged */
+        "    <allow send_interface=\"org.c.I\"/>\n"
+        "    <allow send_interface=\"org.c.I\" send_member=\"M\"/>\n"
+        /* the same, but with an opposite verdict in between: kept */
+        "    <allow send_interface=\"org.d.I\"/>\n"
+        "    <deny send_interface=\"org.d.I\" send_member=\"N\"/>\n"
+        "    <allow send_interface=\"org.d.I\" send_member=\"M\"/>\n"
+        "  </policy>\n"
+        "  <policy user=\"0\">\n"
+        /* overridden by the mandatory policy: dropped */
+        "    <deny send_destination=\"org.b\"/>\n"
+        "    <allow send_destination=\"org.a\" send_interface=\"org.a.I\"/>\n"
+        "    <deny own=\"org.a.sub\"/>\n"
+        "  </policy>\n"
+        "  <policy group=\"0\">\n"
+        "    <allow send_interface=\"org.b.I\" send_member=\"M\"/>\n"
+        "    <allow send_interface=\"org.b.I\" send_member=\"M\"/>\n"
+        "    <allow receive_sender=\"org.b\" receive_member=\"N\"/>\n"
+        "  </policy>\n"
+        "  <policy context=\"mandatory\">\n"
+        "    <allow send_destination=\"org.b\"/>\n"
+        "    <deny send_destination=\"org.a\" send_type=\"signal\"/>\n"
+        "  </policy>\n"
+        "</busconfig>\n";
+
+static ConfigRoot *test_load(Policy *policy) {
+        _c_cleanup_(config_parser_deinit) ConfigParser parser = CONFIG_PARSER_NULL(parser);
+        _c_cleanup_(nss_cache_deinit) NSSCache nss_cache = NSS_CACHE_INIT;
+        _c_cleanup_(dirwatch_freep) Dirwatch *dirwatch = NULL;
+        char path[] = "/tmp/test-policy-XXXXXX";
+        ConfigRoot *root;
+        ssize_t l;
+        int r, fd;
+
+        fd = mkstemp(path);
+        assert(fd >= 0);
+
+        l = write(fd, test_config_xml, strlen(test_config_xml));
+        assert(l == (ssize_t)strlen(test_config_xml));
+        close(fd);
+
+        r = dirwatch_new(&dirwatch);
+        assert(!r);
+
+        config_parser_init(&parser);
+
+        r = config_parser_read(&parser, &root, path, &nss_cache, dirwatch);
+        assert(!r);
+
+        unlink(path);
+
+        r = policy_import(policy, root);
+        assert(!r);
+
+        /* the records reference strings of @root */
+        return root;
+}
+
+static PolicyNode *test_find_node(CRBTree *tree, uint32_t uidgid) {
+        PolicyNode *node;
+
+        c_rbtree_for_each_entry(node, tree, policy_node)
+                if (node->uidgid == uidgid)
+                        return node;
+
+        return NULL;
+}
+
+static bool test_match_string(const char *pattern, const char *value) {
+        return !pattern || (value && !strcmp(pattern, value));
+}
+
+static bool test_match_own(PolicyRecord *record, const char *name) {
+        size_t n;
+
+        if (!record->own.prefix)
+                return !strcmp(record->own.name, name);
+
+        n = strlen(record->own.name);
+        return !n || (!strncmp(record->own.name, name, n) && (name[n] == '.' || !name[n]));
+}
+
+static bool test_match_xmit(PolicyRecord *record,
+                            const char *name,
+                            const char *interface,
+                            const char *member,
+                            unsigned int type,
+                            bool broadcast,
+                            uint64_t n_fds) {
+        if (!test_match_string(record->xmit.name, name) ||
+            !test_match_string(record->xmit.path, "/") ||
+            !test_match_string(record->xmit.interface, interface) ||
+            !test_match_string(record->xmit.member, member))
+                return false;
+        if (record->xmit.type && record->xmit.type != type)
+                return false;
+        if (record->xmit.broadcast == UTIL_TRISTATE_YES && !broadcast)
+                return false;
+        if (record->xmit.broadcast == UTIL_TRISTATE_NO && broadcast)
+                return false;
+
+        return n_fds >= record->xmit.min_fds && n_fds <= record->xmit.max_fds;
+}
+
+/*
+ * Evaluate a list of records the way the broker does: the matching record with
+ * the highest priority decides. @top is updated if a better match is found.
+ */
+static void test_eval_own(CList *list, const char *name, PolicyRecord **top) {
+        PolicyRecord *record;
+
+        c_list_for_each_entry(record, list, link)
+                if ((!*top || record->priority > (*top)->priority) && test_match_own(record, name))
+                        *top = record;
+}
+
+static void test_eval_xmit(CList *list,
+                           const char *name,
+                           const char *interface,
+                           const char *member,
+                           unsigned int type,
+                           bool broadcast,
+                           uint64_t n_fds,
+                           PolicyRecord **top) {
+        PolicyRecord *record;
+
+        c_list_for_each_entry(record, list, link)
+                if ((!*top || record->priority > (*top)->priority) &&
+                    test_match_xmit(record, name, interface, member, type, broadcast, n_fds))
+                        *top = record;
+}
+
+static int test_verdict(PolicyRecord *top) {
+        return top ? top->verdict : -1;
+}
+
+/*
+ * Compute the verdict of every sampled transaction of every sampled peer, and
+ * store them in @verdicts. Each peer is subject to the default records, the
+ * records of its uid, and the records of each of its gids.
+ */
+static size_t test_sample(Policy *policy, int *verdicts) {
+        static const uint32_t uids[] = { 0, 1 };
+        static const uint32_t gids[] = { (uint32_t)-1, 0, 1 };
+        static const char *names[] = { NULL, "org.a", "org.a.sub", "org.b" };
+        static const char *interfaces[] = { NULL, "org.a.I", "org.b.I", "org.c.I", "org.d.I" };
+        static const char *members[] = { "M", "N" };
+        static const unsigned int types[] = { DBUS_MESSAGE_TYPE_METHOD_CALL, DBUS_MESSAGE_TYPE_SIGNAL };
+        size_t i_uid, i_gid, i_name, i_interface, i_member, i_type, i_broadcast, i_fds, n = 0;
+
+        for (i_uid = 0; i_uid < C_ARRAY_SIZE(uids); ++i_uid) {
+                for (i_gid = 0; i_gid < C_ARRAY_SIZE(gids); ++i_gid) {
+                        PolicyNode *nodes[2];
+                        size_t i;
+
+                        nodes[0] = test_find_node(&policy->uid_tree, uids[i_uid]);
+                        nodes[1] = test_find_node(&policy->gid_tree, gids[i_gid]);
+
+                        for (i_name = 1; i_name < C_ARRAY_SIZE(names); ++i_name) {
+                                PolicyRecord *top = NULL;
+
+                                test_eval_own(&policy->default_entries.own_list, names[i_name], &top);
+                                for (i = 0; i < C_ARRAY_SIZE(nodes); ++i)
+                                        if (nodes[i])
+                                                test_eval_own(&nodes[i]->entries.own_list, names[i_name], &top);
+
+                                assert(n < TEST_N_SAMPLES_MAX);
+                                verdicts[n++] = test_verdict(top);
+                        }
+
+                        for (i_name = 0; i_name < C_ARRAY_SIZE(names); ++i_name)
+                        for (i_interface = 0; i_interface < C_ARRAY_SIZE(interfaces); ++i_interface)
+                        for (i_member = 0; i_member < C_ARRAY_SIZE(members); ++i_member)
+                        for (i_type = 0; i_type < C_ARRAY_SIZE(types); ++i_type)
+                        for (i_broadcast = 0; i_broadcast < 2; ++i_broadcast)
+                        for (i_fds = 0; i_fds < 2; ++i_fds) {
+                                PolicyRecord *send = NULL, *recv = NULL;
+
+                                test_eval_xmit(&policy->default_entries.send_list,
+                                               names[i_name], interfaces[i_interface], members[i_member],
+                                               types[i_type], i_broadcast, i_fds, &send);
+                                test_eval_xmit(&policy->default_entries.recv_list,
+                                               names[i_name], interfaces[i_interface], members[i_member],
+                                               types[i_type], i_broadcast, i_fds, &recv);
+
+                                for (i = 0; i < C_ARRAY_SIZE(nodes); ++i) {
+                                        if (!nodes[i])
+                                                continue;
+
+                                        test_eval_xmit(&nodes[i]->entries.send_list,
+                                                       names[i_name], interfaces[i_interface], members[i_member],
+                                                       types[i_type], i_broadcast, i_fds, &send);
+                                        test_eval_xmit(&nodes[i]->entries.recv_list,
+                                                       names[i_name], interfaces[i_interface], members[i_member],
+                                                       types[i_type], i_broadcast, i_fds, &recv);
+                                }
+
+                                assert(n + 2 <= TEST_N_SAMPLES_MAX);
+                                verdicts[n++] = test_verdict(send);
+                                verdicts[n++] = test_verdict(recv);
+                        }
+                }
+        }
+
+        return n;
+}
+
+static void test_optimize(void) {
+        _c_cleanup_(config_root_freep) ConfigRoot *root = NULL;
+        _c_cleanup_(policy_deinit) Policy policy = POLICY_INIT(policy);
+        static int before[TEST_N_SAMPLES_MAX], after[TEST_N_SAMPLES_MAX];
+        size_t n_before, n_after, n_records;
+        PolicyNode *node;
+        int r;
+
+        root = test_load(&policy);
+
+        n_records = policy_n_records(&policy);
+        n_before = test_sample(&policy, before);
+
+        r = policy_optimize(&policy);
+        assert(!r);
+
+        /* exactly the shadowed records are gone */
+        assert(policy_n_records(&policy) < n_records);
+        assert(c_list_length(&policy.default_entries.send_list) == 10);
+        assert(c_list_length(&policy.default_entries.own_list) == 2);
+        assert(c_list_length(&policy.default_entries.recv_list) == 1);
+
+        node = test_find_node(&policy.uid_tree, 0);
+        assert(node);
+        assert(c_list_length(&node->entries.send_list) == 1);
+        assert(c_list_length(&node->entries.own_list) == 1);
+
+        node = test_find_node(&policy.gid_tree, 0);
+        assert(node);
+        assert(c_list_length(&node->entries.send_list) == 1);
+        assert(c_list_length(&node->entries.recv_list) == 1);
+
+        /* no verdict changed */
+        n_after = test_sample(&policy, after);
+        assert(n_after == n_before);
+        assert(!memcmp(before, after, n_before * sizeof(*before)));
+}
+
+int main(int argc, char **argv) {
+        test_optimize();
+        return 0;
+}
@@ -40,6 +40,26 @@
  *               You must explicitly clear events once you handled them. The
  *               kernel never tells us about falling edges, so we must detect
  *               them manually (usually via EAGAIN).
+ *
+ * Additionally, a DispatchContext provides one-shot timers via DispatchTimer.
+ * All timers of a context share a single timerfd, which is part of the
+ * epoll-set and dispatched like any other file. Timers are kept in a
+ * hierarchical timer wheel with millisecond ticks. Each level of the wheel
+ * has 64 slots, and each slot of a level spans all slots of the level below.
+ * A timer is put on the lowest level that covers its deadline, and is moved
+ * down a level whenever the tick reaches the slot it is linked on. Hence,
+ * arming and disarming a timer is O(1), regardless of the number of armed
+ * timers, and the timerfd is only reprogrammed if the next deadline moves.
+ * Deadlines beyond the range of the wheel are clamped and re-placed when
+ * their slot is reached.
+ *
+ * Lastly, a DispatchDefer schedules work to run once all files that are ready
+ * in the current dispatch round have been handled. Deferred work is run from a
+ * dispatch-file on an eventfd, which is always writable. Selecting its
+ * EPOLLOUT event links it into the ready-list like any other file, and keeps
+ * the dispatcher from blocking in epoll_wait(2) as long as any work is
+ * scheduled. Callbacks can re-schedule themselves to continue their work in
+ * the next round, after all other pending events were dispatched.
  */
 
 #include <c-list.h>
@@ -47,6 +67,9 @@
 #include <c-ref.h>
 #include <stdlib.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
 #include "util/dispatch.h"
 #include "util/error.h"
 
@@ -209,6 +232,327 @@ void dispatch_file_clear(DispatchFile *file, uint32_t mask) {
                 c_list_unlink(&file->ready_link);
 }
 
+static uint64_t dispatch_read_clock(void) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(CLOCK_MONOTONIC, &ts);
+        assert(r >= 0);
+
+        return ts.tv_sec * 1000ULL * 1000ULL * 1000ULL + ts.tv_nsec;
+}
+
+static void dispatch_context_place_timer(DispatchContext *ctx, DispatchTimer *timer, uint64_t deadline) {
+        uint64_t delta;
+        unsigned int level, shift;
+
+        assert(deadline >= ctx->timer_now);
+
+        delta = c_min(deadline - ctx->timer_now, (1ULL << (DISPATCH_TIMER_WHEEL_BITS * DISPATCH_TIMER_WHEEL_LEVELS)) - 1);
+        deadline = ctx->timer_now + delta;
+
+        for (level = 0; level < DISPATCH_TIMER_WHEEL_LEVELS - 1; ++level)
+                if (delta < (1ULL << (DISPATCH_TIMER_WHEEL_BITS * (level + 1))))
+                        break;
+
+        /*
+         * The slot of a timer on level @level is reached when the tick
+         * passes its deadline rounded down to the span of a slot on that
+         * level. Remember the earliest such event, so the timerfd can be
+         * programmed accordingly.
+         */
+        shift = level * DISPATCH_TIMER_WHEEL_BITS;
+        c_list_link_tail(&ctx->timer_wheel[level][(deadline >> shift) & (DISPATCH_TIMER_WHEEL_SLOTS - 1)], &timer->wheel_link);
+        ctx->timer_next = c_min(ctx->timer_next, (deadline >> shift) << shift);
+}
+
+static uint64_t dispatch_context_find_next(DispatchContext *ctx) {
+        uint64_t index, next = UINT64_MAX;
+        unsigned int level, shift, i;
+
+        if (!ctx->n_timers)
+                return UINT64_MAX;
+
+        for (level = 0; level < DISPATCH_TIMER_WHEEL_LEVELS; ++level) {
+                shift = level * DISPATCH_TIMER_WHEEL_BITS;
+                index = ctx->timer_now >> shift;
+
+                for (i = 1; i <= DISPATCH_TIMER_WHEEL_SLOTS; ++i) {
+                        if (!c_list_is_empty(&ctx->timer_wheel[level][(index + i) & (DISPATCH_TIMER_WHEEL_SLOTS - 1)])) {
+                                next = c_min(next, (index + i) << shift);
+                                break;
+                        }
+                }
+        }
+
+        return next;
+}
+
+static int dispatch_context_program(DispatchContext *ctx) {
+        struct itimerspec spec = {};
+        int r;
+
+        if (ctx->timer_next == ctx->timer_armed)
+                return 0;
+
+        if (ctx->timer_next != UINT64_MAX) {
+                spec.it_value.tv_sec = ctx->timer_next * DISPATCH_TIMER_TICK_NSEC / (1000ULL * 1000ULL * 1000ULL);
+                spec.it_value.tv_nsec = ctx->timer_next * DISPATCH_TIMER_TICK_NSEC % (1000ULL * 1000ULL * 1000ULL);
+        }
+
+        r = timerfd_settime(ctx->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+        if (r < 0)
+                return error_origin(-errno);
+
+        ctx->timer_armed = ctx->timer_next;
+        return 0;
+}
+
+static int dispatch_context_expire(DispatchContext *ctx, uint64_t tick) {
+        CList todo = (CList)C_LIST_INIT(todo);
+        DispatchTimer *timer;
+        unsigned int level, shift;
+        int r = 0;
+
+        ctx->timer_now = tick;
+
+        /* move the timers of all slots reached by @tick down the wheel */
+        for (level = DISPATCH_TIMER_WHEEL_LEVELS - 1; level > 0; --level) {
+                shift = level * DISPATCH_TIMER_WHEEL_BITS;
+                if (tick & ((1ULL << shift) - 1))
+                        continue;
+
+                c_list_swap(&todo, &ctx->timer_wheel[level][(tick >> shift) & (DISPATCH_TIMER_WHEEL_SLOTS - 1)]);
+
+                while ((timer = c_list_first_entry(&todo, DispatchTimer, wheel_link))) {
+                        c_list_unlink(&timer->wheel_link);
+                        dispatch_context_place_timer(ctx, timer, c_max(timer->deadline, tick));
+                }
+        }
+
+        /*
+         * Fire all timers on the current slot. Callbacks might arm and disarm
+         * timers arbitrarily, so detach the slot first and pick its entries
+         * one by one, just like dispatch_context_dispatch() does.
+         */
+        c_list_swap(&todo, &ctx->timer_wheel[0][tick & (DISPATCH_TIMER_WHEEL_SLOTS - 1)]);
+
+        while ((timer = c_list_first_entry(&todo, DispatchTimer, wheel_link))) {
+                c_list_unlink(&timer->wheel_link);
+
+                if (r) {
+                        /* retry on the next tick, in case the caller continues */
+                        dispatch_context_place_timer(ctx, timer, tick + 1);
+                        continue;
+                }
+
+                --ctx->n_timers;
+                r = timer->fn(timer);
+        }
+
+        return error_trace(r);
+}
+
+static int dispatch_context_dispatch_timers(DispatchFile *file) {
+        DispatchContext *ctx = c_container_of(file, DispatchContext, timer_file);
+        uint64_t expirations, now;
+        ssize_t l;
+        int r;
+
+        l = read(ctx->timer_fd, &expirations, sizeof(expirations));
+        if (l < 0) {
+                if (errno != EAGAIN)
+                        return error_origin(-errno);
+        } else {
+                assert(l == sizeof(expirations));
+        }
+
+        /* the timerfd is one-shot, it is no longer armed */
+        dispatch_file_clear(file, EPOLLIN);
+        ctx->timer_armed = UINT64_MAX;
+
+        now = dispatch_read_clock() / DISPATCH_TIMER_TICK_NSEC;
+
+        /*
+         * Nothing happens on the ticks between two events, so rather than
+         * walking the wheel tick by tick, jump from event to event.
+         */
+        while (ctx->timer_next <= now) {
+                r = dispatch_context_expire(ctx, ctx->timer_next);
+                ctx->timer_next = dispatch_context_find_next(ctx);
+                if (r)
+                        return error_trace(r);
+        }
+
+        ctx->timer_now = c_max(ctx->timer_now, now);
+
+        r = dispatch_context_program(ctx);
+        if (r)
+                return error_trace(r);
+
+        return 0;
+}
+
+/**
+ * dispatch_timer_init() - initialize dispatch timer
+ * @timer:              dispatch timer
+ * @ctx:                dispatch context
+ * @fn:                 callback function
+ *
+ * This initializes a new, disarmed dispatch-timer on the given context. Use
+ * dispatch_timer_arm() to arm it.
+ */
+void dispatch_timer_init(DispatchTimer *timer, DispatchContext *ctx, DispatchTimerFn fn) {
+        *timer = (DispatchTimer)DISPATCH_TIMER_NULL(*timer);
+        timer->context = ctx;
+        timer->fn = fn;
+}
+
+/**
+ * dispatch_timer_deinit() - deinitialize dispatch timer
+ * @timer:              dispatch timer
+ *
+ * This disarms the timer and puts it into a deinitialized state. It is safe
+ * to call this function multiple times.
+ */
+void dispatch_timer_deinit(DispatchTimer *timer) {
+        dispatch_timer_disarm(timer);
+        timer->fn = NULL;
+        timer->context = NULL;
+}
+
+/**
+ * dispatch_timer_arm() - arm dispatch timer
+ * @timer:              dispatch timer
+ * @timeout:            relative timeout in nanoseconds
+ *
+ * This arms @timer to fire once, @timeout nanoseconds from now, rounded up to
+ * the tick granularity of the dispatcher. If the timer was armed already, it
+ * is re-armed with the new timeout. Once the timer fires, it is disarmed and
+ * its callback is invoked from the dispatcher.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+int dispatch_timer_arm(DispatchTimer *timer, uint64_t timeout) {
+        DispatchContext *ctx = timer->context;
+        uint64_t now;
+
+        dispatch_timer_disarm(timer);
+
+        now = dispatch_read_clock();
+        timer->deadline = (now + timeout + DISPATCH_TIMER_TICK_NSEC - 1) / DISPATCH_TIMER_TICK_NSEC;
+        now /= DISPATCH_TIMER_TICK_NSEC;
+
+        /* if nothing is pending until now, the wheel can be advanced for free */
+        if (ctx->timer_next > now)
+                ctx->timer_now = c_max(ctx->timer_now, now);
+
+        dispatch_context_place_timer(ctx, timer, c_max(timer->deadline, ctx->timer_now + 1));
+        ++ctx->n_timers;
+
+        return error_trace(dispatch_context_program(ctx));
+}
+
+/**
+ * dispatch_timer_disarm() - disarm dispatch timer
+ * @timer:              dispatch timer
+ *
+ * This disarms @timer, if it is armed. Its callback will not be invoked until
+ * it is armed again.
+ */
+void dispatch_timer_disarm(DispatchTimer *timer) {
+        if (!dispatch_timer_is_armed(timer))
+                return;
+
+        c_list_unlink(&timer->wheel_link);
+        --timer->context->n_timers;
+}
+
+static int dispatch_context_dispatch_defers(DispatchFile *file) {
+        DispatchContext *ctx = c_container_of(file, DispatchContext, defer_file);
+        CList todo = (CList)C_LIST_INIT(todo);
+        DispatchDefer *defer;
+        int r = 0;
+
+        /*
+         * Run everything that was scheduled so far exactly once. Work that is
+         * re-scheduled by its callback ends up on the context again and is run
+         * in the next round.
+         */
+        c_list_swap(&todo, &ctx->defer_list);
+
+        while (!r && (defer = c_list_first_entry(&todo, DispatchDefer, defer_link))) {
+                c_list_unlink(&defer->defer_link);
+                r = defer->fn(defer);
+        }
+
+        c_list_splice(&ctx->defer_list, &todo);
+        if (c_list_is_empty(&ctx->defer_list))
+                dispatch_file_deselect(file, EPOLLOUT);
+
+        return error_trace(r);
+}
+
+/**
+ * dispatch_defer_init() - initialize deferred work
+ * @defer:              deferred work
+ * @ctx:                dispatch context
+ * @fn:                 callback function
+ *
+ * This initializes new, unscheduled deferred work on the given context. Use
+ * dispatch_defer_schedule() to schedule it.
+ */
+void dispatch_defer_init(DispatchDefer *defer, DispatchContext *ctx, DispatchDeferFn fn) {
+        *defer = (DispatchDefer)DISPATCH_DEFER_NULL(*defer);
+        defer->context = ctx;
+        defer->fn = fn;
+}
+
+/**
+ * dispatch_defer_deinit() - deinitialize deferred work
+ * @defer:              deferred work
+ *
+ * This cancels @defer and puts it into a deinitialized state. It is safe to
+ * call this function multiple times.
+ */
+void dispatch_defer_deinit(DispatchDefer *defer) {
+        dispatch_defer_cancel(defer);
+        defer->fn = NULL;
+        defer->context = NULL;
+}
+
+/**
+ * dispatch_defer_schedule() - schedule deferred work
+ * @defer:              deferred work
+ *
+ * This schedules the callback of @defer to be invoked once, after all files
+ * that are currently ready have been dispatched. If it is scheduled already,
+ * this is a no-op.
+ */
+void dispatch_defer_schedule(DispatchDefer *defer) {
+        if (dispatch_defer_is_scheduled(defer))
+                return;
+
+        c_list_link_tail(&defer->context->defer_list, &defer->defer_link);
+        dispatch_file_select(&defer->context->defer_file, EPOLLOUT);
+}
+
+/**
+ * dispatch_defer_cancel() - cancel deferred work
+ * @defer:              deferred work
+ *
+ * This cancels @defer, if it is scheduled. Its callback will not be invoked
+ * until it is scheduled again.
+ */
+void dispatch_defer_cancel(DispatchDefer *defer) {
+        if (!dispatch_defer_is_scheduled(defer))
+                return;
+
+        c_list_unlink(&defer->defer_link);
+        if (c_list_is_empty(&defer->context->defer_list))
+                dispatch_file_deselect(&defer->context->defer_file, EPOLLOUT);
+}
+
 /**
  * dispatch_context_init() - initialize dispatch context
  * @ctx:                dispatch context
@@ -218,12 +562,50 @@ void dispatch_file_clear(DispatchFile *file, uint32_t mask) {
  * Return: 0 on success, negative error code on failure.
  */
 int dispatch_context_init(DispatchContext *ctx) {
+        unsigned int level, i;
+        int r;
+
         *ctx = (DispatchContext)DISPATCH_CONTEXT_NULL(*ctx);
 
+        for (level = 0; level < DISPATCH_TIMER_WHEEL_LEVELS; ++level)
+                for (i = 0; i < DISPATCH_TIMER_WHEEL_SLOTS; ++i)
+                        c_list_init(&ctx->timer_wheel[level][i]);
+
+        ctx->timer_now = dispatch_read_clock() / DISPATCH_TIMER_TICK_NSEC;
+
         ctx->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
         if (ctx->epoll_fd < 0)
                 return error_origin(-errno);
 
+        ctx->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        if (ctx->timer_fd < 0)
+                return error_origin(-errno);
+
+        r = dispatch_file_init(&ctx->timer_file,
+                               ctx,
+                               dispatch_context_dispatch_timers,
+                               ctx->timer_fd,
+                               EPOLLIN,
+                               0);
+        if (r)
+                return error_fold(r);
+
+        dispatch_file_select(&ctx->timer_file, EPOLLIN);
+
+        ctx->defer_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (ctx->defer_fd < 0)
+                return error_origin(-errno);
+
+        /* an eventfd is always writable, so EPOLLOUT is never cleared */
+        r = dispatch_file_init(&ctx->defer_file,
+                               ctx,
+                               dispatch_context_dispatch_defers,
+                               ctx->defer_fd,
+                               EPOLLOUT,
+                               EPOLLOUT);
+        if (r)
+                return error_fold(r);
+
         return 0;
 }
 
@@ -232,15 +614,23 @@ int dispatch_context_init(DispatchContext *ctx) {
  * @ctx:                dispatch context
  *
  * This deinitializes a dispatch context. The caller must make sure no
- * dispatch-file is registered on it.
+ * dispatch-file is registered on it, no dispatch-timer is armed, and no work
+ * is scheduled on it.
  *
  * The context will be set into an deinitialized state afterwards. Hence, it is
  * safe to call this function multiple times.
  */
 void dispatch_context_deinit(DispatchContext *ctx) {
+        dispatch_file_deinit(&ctx->defer_file);
+        dispatch_file_deinit(&ctx->timer_file);
+
+        assert(c_list_is_empty(&ctx->defer_list));
+        assert(!ctx->n_timers);
         assert(!ctx->n_files);
         assert(c_list_is_empty(&ctx->ready_list));
 
+        ctx->defer_fd = c_close(ctx->defer_fd);
+        ctx->timer_fd = c_close(ctx->timer_fd);
         ctx->epoll_fd = c_close(ctx->epoll_fd);
 }
 
@@ -17,8 +17,12 @@ enum {
 };
 
 typedef struct DispatchContext DispatchContext;
+typedef struct DispatchDefer DispatchDefer;
 typedef struct DispatchFile DispatchFile;
+typedef struct DispatchTimer DispatchTimer;
 typedef int (*DispatchFn) (DispatchFile *file);
+typedef int (*DispatchDeferFn) (DispatchDefer *defer);
+typedef int (*DispatchTimerFn) (DispatchTimer *timer);
 
 /* files */
 
@@ -50,17 +54,79 @@ void dispatch_file_select(DispatchFile *file, uint32_t mask);
 void dispatch_file_deselect(DispatchFile *file, uint32_t mask);
 void dispatch_file_clear(DispatchFile *file, uint32_t mask);
 
+/* timers */
+
+#define DISPATCH_TIMER_TICK_NSEC (1000ULL * 1000ULL)
+#define DISPATCH_TIMER_WHEEL_BITS (6)
+#define DISPATCH_TIMER_WHEEL_SLOTS (1U << DISPATCH_TIMER_WHEEL_BITS)
+#define DISPATCH_TIMER_WHEEL_LEVELS (4)
+
+struct DispatchTimer {
+        DispatchContext *context;
+        CList wheel_link;
+        DispatchTimerFn fn;
+
+        uint64_t deadline;
+};
+
+#define DISPATCH_TIMER_NULL(_x) {                               \
+                .wheel_link = C_LIST_INIT((_x).wheel_link),     \
+        }
+
+void dispatch_timer_init(DispatchTimer *timer, DispatchContext *ctx, DispatchTimerFn fn);
+void dispatch_timer_deinit(DispatchTimer *timer);
+
+int dispatch_timer_arm(DispatchTimer *timer, uint64_t timeout);
+void dispatch_timer_disarm(DispatchTimer *timer);
+
+/* deferred work */
+
+struct DispatchDefer {
+        DispatchContext *context;
+        CList defer_link;
+        DispatchDeferFn fn;
+};
+
+#define DISPATCH_DEFER_NULL(_x) {                               \
+                .defer_link = C_LIST_INIT((_x).defer_link),     \
+        }
+
+void dispatch_defer_init(DispatchDefer *defer, DispatchContext *ctx, DispatchDeferFn fn);
+void dispatch_defer_deinit(DispatchDefer *defer);
+
+void dispatch_defer_schedule(DispatchDefer *defer);
+void dispatch_defer_cancel(DispatchDefer *defer);
+
 /* contexts */
 
 struct DispatchContext {
         CList ready_list;
         int epoll_fd;
         size_t n_files;
+
+        int timer_fd;
+        DispatchFile timer_file;
+        CList timer_wheel[DISPATCH_TIMER_WHEEL_LEVELS][DISPATCH_TIMER_WHEEL_SLOTS];
+        uint64_t timer_now;
+        uint64_t timer_next;
+        uint64_t timer_armed;
+        size_t n_timers;
+
+        int defer_fd;
+        DispatchFile defer_file;
+        CList defer_list;
 };
 
-#define DISPATCH_CONTEXT_NULL(_x) {                             \
-                .ready_list = C_LIST_INIT((_x).ready_list),     \
-                .epoll_fd = -1,                                 \
+#define DISPATCH_CONTEXT_NULL(_x) {                                     \
+                .ready_list = C_LIST_INIT((_x).ready_list),             \
+                .epoll_fd = -1,                                         \
+                .timer_fd = -1,                                         \
+                .timer_file = DISPATCH_FILE_NULL((_x).timer_file),      \
+                .timer_next = UINT64_MAX,                               \
+                .timer_armed = UINT64_MAX,                              \
+                .defer_fd = -1,                                         \
+                .defer_file = DISPATCH_FILE_NULL((_x).defer_file),      \
+                .defer_list = C_LIST_INIT((_x).defer_list),             \
         }
 
 int dispatch_context_init(DispatchContext *ctx);
@@ -74,3 +140,11 @@ int dispatch_context_dispatch(DispatchContext *ctx);
 static inline uint32_t dispatch_file_events(DispatchFile *file) {
         return file->events & file->user_mask;
 }
+
+static inline bool dispatch_timer_is_armed(DispatchTimer *timer) {
+        return c_list_is_linked(&timer->wheel_link);
+}
+
+static inline bool dispatch_defer_is_scheduled(DispatchDefer *defer) {
+        return c_list_is_linked(&defer->defer_link);
+}
@@ -20,6 +20,11 @@ const char *bus_selinux_policy_root(void) {
         return NULL;
 }
 
+int bus_selinux_id_init(BusSELinuxID **idp, const char *context) {
+        *idp = NULL;
+        return 0;
+}
+
 int bus_selinux_registry_new(BusSELinuxRegistry **registryp, const char *fallback_context) {
         *registryp = NULL;
         return 0;
@@ -44,8 +49,8 @@ int bus_selinux_check_own(BusSELinuxRegistry *registry,
 }
 
 int bus_selinux_check_send(BusSELinuxRegistry *registry,
-                           const char *context_sender,
-                           const char *context_receiver) {
+                           BusSELinuxID *id_sender,
+                           BusSELinuxID *id_receiver) {
         return 0;
 }
 
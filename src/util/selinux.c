@@ -12,9 +12,25 @@
 #include "util/error.h"
 #include "util/selinux.h"
 
+/*
+ * Class and permission values as set up by selinux_set_mapping(). They are
+ * resolved once at startup and remain valid across policy reloads, since
+ * libselinux maps them to the kernel values internally.
+ */
+enum {
+        _BUS_SELINUX_CLASS_INVALID,
+        BUS_SELINUX_CLASS_DBUS,
+};
+
+enum {
+        BUS_SELINUX_PERM_ACQUIRE_SVC    = 1U << 0,
+        BUS_SELINUX_PERM_SEND_MSG       = 1U << 1,
+};
+
 struct BusSELinuxRegistry {
         _Atomic unsigned long n_refs;
         const char *fallback_context;
+        BusSELinuxID *fallback_id;
         CRBTree names;
 };
 
@@ -26,6 +42,11 @@ struct BusSELinuxName {
 
 typedef struct BusSELinuxName BusSELinuxName;
 
+static struct security_class_mapping bus_selinux_map[] = {
+        { "dbus", { "acquire_svc", "send_msg", NULL } },
+        { NULL },
+};
+
 static bool bus_selinux_avc_open;
 
 /** bus_selinux_is_enabled() - checks if SELinux is currently enabled
@@ -48,6 +69,40 @@ const char *bus_selinux_policy_root(void) {
         return selinux_policy_root();
 }
 
+/**
+ * bus_selinux_id_init() - resolve security context to SELinux ID
+ * @idp:                output argument for the ID
+ * @context:            security context to resolve
+ *
+ * This resolves @context to its SID in the userspace AVC. SIDs are interned,
+ * so equal contexts resolve to the same ID, and IDs stay valid until
+ * bus_selinux_deinit_global() is called. They are not affected by policy
+ * reloads. IDs are meant to be resolved once, when a peer connects, and then
+ * be used for all further access checks of that peer.
+ *
+ * If SELinux is disabled, NULL is returned in @idp.
+ *
+ * Return: 0 on success, or a negative error code on failure.
+ */
+int bus_selinux_id_init(BusSELinuxID **idp, const char *context) {
+        security_id_t sid;
+        int r;
+
+        if (!is_selinux_enabled()) {
+                *idp = NULL;
+                return 0;
+        }
+
+        assert(bus_selinux_avc_open);
+
+        r = avc_context_to_sid(context, &sid);
+        if (r < 0)
+                return error_origin(-errno);
+
+        *idp = (BusSELinuxID *)sid;
+        return 0;
+}
+
 static BusSELinuxName *bus_selinux_name_free(BusSELinuxName *name) {
         if (!name)
                 return NULL;
@@ -97,6 +152,7 @@ static int bus_selinux_name_new(const char *name, const char *context, CRBTree *
 int bus_selinux_registry_new(BusSELinuxRegistry **registryp, const char *fallback_context) {
         _c_cleanup_(bus_selinux_registry_unrefp) BusSELinuxRegistry *registry = NULL;
         size_t n_fallback_context = strlen(fallback_context) + 1;
+        int r;
 
         registry = malloc(sizeof(*registry) + n_fallback_context);
         if (!registry)
@@ -104,9 +160,14 @@ int bus_selinux_registry_new(BusSELinuxRegistry **registryp, const char *fallbac
 
         registry->n_refs = C_REF_INIT;
         registry->fallback_context = (const char *)(registry + 1);
+        registry->fallback_id = NULL;
         registry->names = (CRBTree)C_RBTREE_INIT;
         memcpy((char *)registry->fallback_context, fallback_context, n_fallback_context);
 
+        r = bus_selinux_id_init(&registry->fallback_id, registry->fallback_context);
+        if (r)
+                return error_trace(r);
+
         *registryp = registry;
         registry = NULL;
         return 0;
@@ -241,12 +302,18 @@ int bus_selinux_check_own(BusSELinuxRegistry *registry,
 /**
  * bus_selinux_check_send() - check if the given transaction is allowed
  * @registry:           SELinux registry to operate on
- * @sender_context:     security context of the sender
- * @receiver_context:   security context of the receiver, or NULL
+ * @id_sender:          SELinux ID of the sender
+ * @id_receiver:        SELinux ID of the receiver, or NULL
  *
- * Check if the given sender context is allowed to send a message to the
- * given receiver context. If the receiver context is given as NULL, the
- * per-registry fallback context is used instead.
+ * Check if the given sender is allowed to send a message to the given
+ * receiver. If the receiver ID is given as NULL, the ID of the per-registry
+ * fallback context is used instead.
+ *
+ * This is called for every message, and every receiver of a broadcast, hence
+ * the IDs are resolved when peers connect, and the query goes straight to the
+ * userspace AVC. The AVC caches verdicts itself and takes care of flushing
+ * them on policy loads and enforcing mode changes. Unlike any cache of our
+ * own, it also audits denials and honors permissive mode.
  *
  * The contexts are pinned when peers connect, and as such could in principle
  * become invalid in case a new policy is loaded that does not know the
@@ -257,20 +324,21 @@ int bus_selinux_check_own(BusSELinuxRegistry *registry,
  *         or a negative error code on failure.
  */
 int bus_selinux_check_send(BusSELinuxRegistry *registry,
-                           const char *sender_context,
-                           const char *receiver_context) {
+                           BusSELinuxID *id_sender,
+                           BusSELinuxID *id_receiver) {
+        security_id_t sid_sender = (security_id_t)id_sender;
+        security_id_t sid_receiver = (security_id_t)(id_receiver ?: registry->fallback_id);
         int r;
 
         if (!is_selinux_enabled())
                 return 0;
 
-        receiver_context = receiver_context ?: registry->fallback_context;
-
-        r = selinux_check_access(sender_context,
-                                 receiver_context,
-                                 "dbus",
-                                 "send_msg",
-                                 NULL);
+        r = avc_has_perm(sid_sender,
+                         sid_receiver,
+                         BUS_SELINUX_CLASS_DBUS,
+                         BUS_SELINUX_PERM_SEND_MSG,
+                         NULL,
+                         NULL);
         if (r < 0) {
                 /*
                  * Treat unknown contexts (possibly due to policy reload)
@@ -321,6 +389,10 @@ int bus_selinux_init_global(void) {
                 return 0;
 
         if (!bus_selinux_avc_open) {
+                r = selinux_set_mapping(bus_selinux_map);
+                if (r < 0)
+                        return error_origin(-errno);
+
                 r = avc_open(NULL, 0);
                 if (r)
                         return error_origin(-errno);
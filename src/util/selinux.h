@@ -7,6 +7,7 @@
 #include <c-macro.h>
 #include <stdlib.h>
 
+typedef struct BusSELinuxID BusSELinuxID;
 typedef struct BusSELinuxRegistry BusSELinuxRegistry;
 
 enum {
@@ -18,6 +19,8 @@ enum {
 bool bus_selinux_is_enabled(void);
 const char *bus_selinux_policy_root(void);
 
+int bus_selinux_id_init(BusSELinuxID **idp, const char *context);
+
 int bus_selinux_registry_new(BusSELinuxRegistry **registryp, const char *fallback_context);
 BusSELinuxRegistry *bus_selinux_registry_ref(BusSELinuxRegistry *registry);
 BusSELinuxRegistry *bus_selinux_registry_unref(BusSELinuxRegistry *registry);
@@ -30,8 +33,8 @@ int bus_selinux_check_own(BusSELinuxRegistry *registry,
                           const char *context_owner,
                           const char *name);
 int bus_selinux_check_send(BusSELinuxRegistry *registry,
-                           const char *context_sender,
-                           const char *context_receiver);
+                           BusSELinuxID *id_sender,
+                           BusSELinuxID *id_receiver);
 
 int bus_selinux_init_global(void);
 void bus_selinux_deinit_global(void);
@@ -3,12 +3,10 @@
  */
 
 #include <c-macro.h>
-#include <grp.h>
-#include <pwd.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <sys/socket.h>
 #include "util/error.h"
-#include "util/log.h"
 #include "util/sockopt.h"
 
 int sockopt_get_peersec(int fd, char **labelp, size_t *lenp) {
@@ -57,10 +55,29 @@ int sockopt_get_peersec(int fd, char **labelp, size_t *lenp) {
         return 0;
 }
 
-int sockopt_get_peergroups(int fd, Log *log, uid_t uid, gid_t gid, gid_t **gidsp, size_t *n_gidsp) {
+/**
+ * sockopt_get_peergroups() - query auxiliary groups of a peer
+ * @fd:                 socket to query
+ * @gid:                primary gid of the peer
+ * @gidsp:              output argument for the group array, or NULL
+ * @n_gidsp:            output argument for the number of groups, or NULL
+ *
+ * This queries the groups of the peer of @fd, the primary group @gid being
+ * the first entry. If @n_gidsp is non-NULL, its value on entry is taken as
+ * a hint for the number of groups to expect, so callers that already know a
+ * similar peer can avoid retrying the query with a bigger buffer.
+ *
+ * Return: 0 on success, SOCKOPT_E_UNSUPPORTED if the kernel does not support
+ *         SO_PEERGROUPS, negative error code on failure.
+ */
+int sockopt_get_peergroups(int fd, gid_t gid, gid_t **gidsp, size_t *n_gidsp) {
         _c_cleanup_(c_freep) gid_t *gids = NULL;
-        int r, n_gids = 64;
+        socklen_t socklen = 64 * sizeof(*gids);
         void *tmp;
+        int r;
+
+        if (n_gidsp && *n_gidsp > 64 && *n_gidsp <= NGROUPS_MAX)
+                socklen = *n_gidsp * sizeof(*gids);
 
         /*
          * For compatibility to dbus-daemon(1), we need to know the auxiliary
@@ -76,98 +93,37 @@ int sockopt_get_peergroups(int fd, Log *log, uid_t uid, gid_t gid, gid_t **gidsp
          *
          *         net: introduce SO_PEERGROUPS getsockopt
          *
-         * You are highly recommended to run >=linux-4.13.
+         * You are highly recommended to run >=linux-4.13. On older kernels,
+         * the caller has to resolve the groups through the user database.
+         * Since that might block, it is never done here.
          */
-        {
-                socklen_t socklen = n_gids * sizeof(*gids);
+        gids = malloc(sizeof(gid) + socklen);
+        if (!gids)
+                return error_origin(-ENOMEM);
+        gids[0] = gid;
 
-                gids = malloc(sizeof(gid) + socklen);
-                if (!gids)
+        r = getsockopt(fd, SOL_SOCKET, SO_PEERGROUPS, gids + 1, &socklen);
+        if (r < 0 && errno == ERANGE) {
+                tmp = realloc(gids, sizeof(gid) + socklen);
+                if (!tmp)
                         return error_origin(-ENOMEM);
+                gids = tmp;
                 gids[0] = gid;
 
                 r = getsockopt(fd, SOL_SOCKET, SO_PEERGROUPS, gids + 1, &socklen);
-                if (r < 0 && errno == ERANGE) {
-                        tmp = realloc(gids, sizeof(gid) + socklen);
-                        if (!tmp)
-                                return error_origin(-ENOMEM);
-                        gids = tmp;
-                        gids[0] = gid;
-
-                        r = getsockopt(fd, SOL_SOCKET, SO_PEERGROUPS, gids + 1, &socklen);
-                }
-                if (r < 0 && errno != ENOPROTOOPT) {
-                        return error_origin(-errno);
-                } else if (r >= 0) {
-                        if (gidsp) {
-                                *gidsp = gids;
-                                gids = NULL;
-                        }
-                        if (n_gidsp)
-                                *n_gidsp = 1 + socklen / sizeof(*gids);
-                        return 0;
-                }
-
-                /* fallthrough */
         }
+        if (r < 0) {
+                if (errno == ENOPROTOOPT)
+                        return SOCKOPT_E_UNSUPPORTED;
 
-        /*
-         * If we end up here, then SO_PEERGROUPS did not work. This is not safe
-         * and you really better update your kernel to support SO_PEERGROUPS.
-         * Warn loudly before continuing with the fallback.
-         */
-        {
-                static bool warned;
-
-                if (!warned) {
-                        warned = true;
-                        log_append_here(log, LOG_ERR, 0);
-                        log_commitf(log, "Falling back to resolving auxiliary "
-                                         "groups using nss, this is racy and "
-                                         "may cause deadlocks. Update to a "
-                                         "kernel with SO_PEERGROUPS "
-                                         "support.\n");
-                }
+                return error_origin(-errno);
         }
 
-        /*
-         * If SO_PEERGROUPS is not available, we fall back to getgrouplist(3),
-         * which queries the user database. This is racy, incomplete, and in no
-         * way consistent with the credentials associated with the used
-         * resources. However, it is what was historically used, so we will
-         * keep it for some more time.
-         *
-         * XXX: At what point can we drop this? We keep it for now, but we
-         *      should at some point make a specific kernel version a
-         *      hard-requirement.
-         */
-        {
-                struct passwd *passwd;
-                int n_gids_previous;
-
-                passwd = getpwuid(uid);
-                if (!passwd)
-                        return error_origin(-errno);
-
-                do {
-                        n_gids_previous = n_gids;
-                        tmp = realloc(gids, sizeof(*gids) * n_gids);
-                        if (!tmp)
-                                return error_origin(-ENOMEM);
-
-                        gids = tmp;
-                        r = getgrouplist(passwd->pw_name, passwd->pw_gid, gids, &n_gids);
-                        if (r == -1 && n_gids <= n_gids_previous)
-                                return error_origin(-ENOTRECOVERABLE);
-                } while (r == -1);
-
-                if (gidsp) {
-                        *gidsp = gids;
-                        gids = NULL;
-                }
-                if (n_gidsp)
-                        *n_gidsp = n_gids;
+        if (gidsp) {
+                *gidsp = gids;
+                gids = NULL;
         }
-
+        if (n_gidsp)
+                *n_gidsp = 1 + socklen / sizeof(*gids);
         return 0;
 }
@@ -7,7 +7,11 @@
 #include <c-macro.h>
 #include <stdlib.h>
 
-typedef struct Log Log;
+enum {
+        _SOCKOPT_E_SUCCESS,
+
+        SOCKOPT_E_UNSUPPORTED,
+};
 
 int sockopt_get_peersec(int fd, char **labelp, size_t *lenp);
-int sockopt_get_peergroups(int fd, Log *log, uid_t uid, gid_t gid, gid_t **gidsp, size_t *n_gidsp);
+int sockopt_get_peergroups(int fd, gid_t gid, gid_t **gidsp, size_t *n_gidsp);
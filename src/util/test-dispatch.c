@@ -8,8 +8,26 @@
 #include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <time.h>
 #include "util/dispatch.h"
 
+#define TEST_N_TIMERS (512)
+
+typedef struct TestDefer TestDefer;
+typedef struct TestTimer TestTimer;
+
+struct TestDefer {
+        DispatchDefer defer;
+        unsigned int n_runs;
+        unsigned int n_left;
+};
+
+struct TestTimer {
+        DispatchTimer timer;
+        uint64_t deadline;
+        unsigned int n_fired;
+};
+
 static void q_assert(int s, bool has_in, bool has_out) {
         int r, v;
 
@@ -206,8 +224,152 @@ static void test_uds_edge(unsigned int run) {
         c_close(s[0]);
 }
 
+static uint64_t test_read_clock(void) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(CLOCK_MONOTONIC, &ts);
+        assert(r >= 0);
+
+        return ts.tv_sec * 1000ULL * 1000ULL * 1000ULL + ts.tv_nsec;
+}
+
+static uint64_t test_last_deadline;
+
+static int test_timer_fn(DispatchTimer *timer) {
+        TestTimer *t = c_container_of(timer, TestTimer, timer);
+
+        /* timers must never fire early, and must fire in order of their tick */
+        assert(test_read_clock() >= t->deadline);
+        assert(t->deadline / DISPATCH_TIMER_TICK_NSEC + 1 >= test_last_deadline / DISPATCH_TIMER_TICK_NSEC);
+        assert(!dispatch_timer_is_armed(timer));
+
+        test_last_deadline = t->deadline;
+        ++t->n_fired;
+        return 0;
+}
+
+static void test_timer_arm(TestTimer *t, uint64_t timeout) {
+        int r;
+
+        t->deadline = test_read_clock() + timeout;
+        r = dispatch_timer_arm(&t->timer, timeout);
+        assert(!r);
+}
+
+static void test_timers(void) {
+        _c_cleanup_(dispatch_context_deinit) DispatchContext c = DISPATCH_CONTEXT_NULL(c);
+        static TestTimer timers[TEST_N_TIMERS];
+        TestTimer far = {};
+        size_t i, n_fired;
+        int r;
+
+        r = dispatch_context_init(&c);
+        assert(!r);
+
+        /*
+         * Arm timers with timeouts spread over the first two levels of the
+         * wheel, some of them twice, and one far in the future. Then disarm
+         * every eighth of them, and verify all others fire exactly once.
+         */
+
+        for (i = 0; i < TEST_N_TIMERS; ++i) {
+                dispatch_timer_init(&timers[i].timer, &c, test_timer_fn);
+                test_timer_arm(&timers[i], (rand() % 300) * 1000ULL * 1000ULL + rand() % 1000);
+                if (!(i % 3))
+                        test_timer_arm(&timers[i], (rand() % 300) * 1000ULL * 1000ULL);
+        }
+
+        dispatch_timer_init(&far.timer, &c, test_timer_fn);
+        test_timer_arm(&far, 3600ULL * 1000ULL * 1000ULL * 1000ULL);
+
+        for (i = 0; i < TEST_N_TIMERS; i += 8)
+                dispatch_timer_disarm(&timers[i].timer);
+
+        do {
+                r = dispatch_context_dispatch(&c);
+                assert(!r);
+
+                for (n_fired = 0, i = 0; i < TEST_N_TIMERS; ++i)
+                        n_fired += timers[i].n_fired;
+        } while (n_fired < TEST_N_TIMERS - TEST_N_TIMERS / 8);
+
+        for (i = 0; i < TEST_N_TIMERS; ++i) {
+                assert(timers[i].n_fired == !!(i % 8));
+                assert(!dispatch_timer_is_armed(&timers[i].timer));
+                dispatch_timer_deinit(&timers[i].timer);
+        }
+
+        assert(dispatch_timer_is_armed(&far.timer));
+        assert(!far.n_fired);
+        dispatch_timer_deinit(&far.timer);
+}
+
+static int test_defer_fn(DispatchDefer *defer) {
+        TestDefer *t = c_container_of(defer, TestDefer, defer);
+
+        assert(!dispatch_defer_is_scheduled(defer));
+
+        ++t->n_runs;
+        if (t->n_left && --t->n_left)
+                dispatch_defer_schedule(defer);
+
+        return 0;
+}
+
+static void test_defer(void) {
+        _c_cleanup_(dispatch_context_deinit) DispatchContext c = DISPATCH_CONTEXT_NULL(c);
+        TestDefer d1 = {}, d2 = {}, d3 = {};
+        size_t i;
+        int r;
+
+        r = dispatch_context_init(&c);
+        assert(!r);
+
+        dispatch_defer_init(&d1.defer, &c, test_defer_fn);
+        dispatch_defer_init(&d2.defer, &c, test_defer_fn);
+        dispatch_defer_init(&d3.defer, &c, test_defer_fn);
+
+        /* nothing is scheduled, so the dispatcher must not spin */
+        r = dispatch_context_poll(&c, 0);
+        assert(!r);
+        assert(c_list_is_empty(&c.ready_list));
+
+        /*
+         * Schedule one-shot work twice, work that re-schedules itself for
+         * three rounds, and work that is canceled again. Every dispatch round
+         * must run everything that is scheduled exactly once.
+         */
+
+        dispatch_defer_schedule(&d1.defer);
+        dispatch_defer_schedule(&d1.defer);
+        d2.n_left = 3;
+        dispatch_defer_schedule(&d2.defer);
+        dispatch_defer_schedule(&d3.defer);
+        dispatch_defer_cancel(&d3.defer);
+
+        for (i = 1; i <= 3; ++i) {
+                r = dispatch_context_dispatch(&c);
+                assert(!r);
+
+                assert(d1.n_runs == 1);
+                assert(d2.n_runs == i);
+                assert(!d3.n_runs);
+        }
+
+        assert(!dispatch_defer_is_scheduled(&d1.defer));
+        assert(!dispatch_defer_is_scheduled(&d2.defer));
+        assert(c_list_is_empty(&c.ready_list));
+
+        dispatch_defer_deinit(&d3.defer);
+        dispatch_defer_deinit(&d2.defer);
+        dispatch_defer_deinit(&d1.defer);
+}
+
 int main(int argc, char **argv) {
         test_uds_edge(0);
         test_uds_edge(1);
+        test_timers();
+        test_defer();
         return 0;
 }
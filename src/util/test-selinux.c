@@ -0,0 +1,117 @@
+/*
+ * Test SELinux Handling
+ *
+ * This needs SELinux to be enabled, and the privileges to change the
+ * enforcing mode. Otherwise, the test is skipped.
+ */
+
+#include <c-macro.h>
+#include <selinux/selinux.h>
+#include <stdlib.h>
+#include "util/selinux.h"
+
+static bool test_policy_denies(const char *context_sender, const char *context_receiver) {
+        struct av_decision avd;
+        security_class_t class;
+        access_vector_t perm;
+        int r;
+
+        class = string_to_security_class("dbus");
+        assert(class);
+        perm = string_to_av_perm(class, "send_msg");
+        assert(perm);
+
+        r = security_compute_av(context_sender, context_receiver, class, perm, &avd);
+        assert(r >= 0);
+
+        return !(avd.allowed & perm);
+}
+
+static void test_setenforce(int enforce) {
+        int r;
+
+        r = security_setenforce(enforce);
+        assert(r >= 0);
+
+        /* this is what the AVC polls to notice the change */
+        r = selinux_status_updated();
+        assert(r >= 0);
+}
+
+/*
+ * Send checks go to the userspace AVC, which caches verdicts. Verify that no
+ * stale verdict survives a change of the enforcing mode, and that denials in
+ * permissive mode are reported as allowed.
+ */
+static int test_status_update(void) {
+        _c_cleanup_(bus_selinux_registry_unrefp) BusSELinuxRegistry *registry = NULL;
+        _c_cleanup_(c_freep) char *context_sender = NULL, *context_receiver = NULL;
+        BusSELinuxID *id_sender, *id_receiver;
+        int r, enforce;
+
+        enforce = security_getenforce();
+        assert(enforce >= 0);
+
+        r = security_setenforce(enforce);
+        if (r < 0) {
+                assert(errno == EPERM || errno == EACCES);
+                return 77;
+        }
+
+        r = selinux_status_open(true);
+        assert(r >= 0);
+
+        r = getcon(&context_sender);
+        assert(r >= 0);
+
+        r = security_get_initial_context("unlabeled", &context_receiver);
+        assert(r >= 0);
+
+        r = bus_selinux_init_global();
+        assert(!r);
+
+        /* we need a pair the policy denies, otherwise there is nothing to flush */
+        if (!test_policy_denies(context_sender, context_receiver)) {
+                bus_selinux_deinit_global();
+                selinux_status_close();
+                return 77;
+        }
+
+        r = bus_selinux_registry_new(&registry, context_sender);
+        assert(!r);
+
+        r = bus_selinux_id_init(&id_sender, context_sender);
+        assert(!r);
+        r = bus_selinux_id_init(&id_receiver, context_receiver);
+        assert(!r);
+
+        test_setenforce(1);
+
+        r = bus_selinux_check_send(registry, id_sender, id_receiver);
+        assert(r == SELINUX_E_DENIED);
+
+        test_setenforce(0);
+
+        r = bus_selinux_check_send(registry, id_sender, id_receiver);
+        assert(!r);
+
+        test_setenforce(1);
+
+        r = bus_selinux_check_send(registry, id_sender, id_receiver);
+        assert(r == SELINUX_E_DENIED);
+
+        test_setenforce(enforce);
+
+        registry = bus_selinux_registry_unref(registry);
+        bus_selinux_deinit_global();
+        selinux_status_close();
+
+        return 0;
+}
+
+int main(int argc, char **argv) {
+        if (!bus_selinux_is_enabled())
+                return 77;
+
+        return test_status_update();
+}
@@ -90,8 +90,130 @@ static void test_quota(void) {
         user_registry_deinit(&registry);
 }
 
+static void test_cache(void) {
+        UserRegistry registry;
+        User *entry1, *entry2, *entry3;
+        UserCharge charge1, charge2, charge3, charge4;
+        UserCache cache = USER_CACHE_INIT;
+        int r;
+
+        r = user_registry_init(&registry, NULL, _USER_SLOT_N, (unsigned int[]){ 1024, 1024, 1024, 1024, 1024 });
+        assert(!r);
+
+        r = user_registry_ref_user(&registry, &entry1, 1);
+        assert(r == 0);
+
+        r = user_registry_ref_user(&registry, &entry2, 2);
+        assert(r == 0);
+
+        r = user_registry_ref_user(&registry, &entry3, 3);
+        assert(r == 0);
+
+        user_charge_init(&charge1);
+        user_charge_init(&charge2);
+        user_charge_init(&charge3);
+        user_charge_init(&charge4);
+
+        /* charges through the cache share the usage object */
+        r = user_charge_cached(entry1, &charge2, &cache, entry2, USER_SLOT_BYTES, 256);
+        assert(!r);
+        r = user_charge_cached(entry1, &charge3, &cache, entry2, USER_SLOT_FDS, 1);
+        assert(!r);
+        assert(charge3.usage == charge2.usage);
+        assert(cache.usage == charge2.usage);
+        assert(entry1->n_usages == 1);
+
+        /* and so do uncached charges of the same actor */
+        r = user_charge(entry1, &charge4, entry2, USER_SLOT_BYTES, 256);
+        assert(!r);
+        assert(charge4.usage == charge2.usage);
+        assert(entry1->n_usages == 1);
+
+        /* the quota spans all of them, so the first actor has 512 bytes */
+        r = user_charge_cached(entry1, &charge2, &cache, entry2, USER_SLOT_BYTES, 1);
+        assert(r == USER_E_QUOTA);
+
+        /* a cached, but otherwise idle, actor does not count against quotas */
+        user_charge_deinit(&charge4);
+        user_charge_deinit(&charge3);
+        user_charge_deinit(&charge2);
+        assert(cache.usage);
+        assert(entry1->n_usages == 0);
+
+        r = user_charge(entry1, &charge1, entry3, USER_SLOT_BYTES, 513);
+        assert(r == USER_E_QUOTA);
+        r = user_charge(entry1, &charge1, entry3, USER_SLOT_BYTES, 512);
+        assert(!r);
+        user_charge_deinit(&charge1);
+
+        /* switching actors replaces the cached usage */
+        r = user_charge_cached(entry1, &charge3, &cache, entry3, USER_SLOT_BYTES, 1);
+        assert(!r);
+        assert(cache.usage == charge3.usage);
+        user_charge_deinit(&charge3);
+
+        /* self-charges can be cached as well */
+        r = user_charge_cached(entry1, &charge1, &cache, NULL, USER_SLOT_BYTES, 1024);
+        assert(!r);
+        assert(cache.usage == charge1.usage);
+        user_charge_deinit(&charge1);
+
+        user_cache_deinit(&cache);
+        user_unref(entry3);
+        user_unref(entry2);
+        user_unref(entry1);
+        user_registry_deinit(&registry);
+}
+
+static void test_many(void) {
+        UserRegistry registry;
+        User *user, *actors[64];
+        UserCharge charges[64];
+        size_t i;
+        int r;
+
+        /* exercise the usage table across several resizes */
+
+        r = user_registry_init(&registry, NULL, _USER_SLOT_N, (unsigned int[]){ 1U << 20, 1U << 20, 1U << 20, 1U << 20 });
+        assert(!r);
+
+        r = user_registry_ref_user(&registry, &user, 0);
+        assert(!r);
+
+        for (i = 0; i < C_ARRAY_SIZE(actors); ++i) {
+                r = user_registry_ref_user(&registry, &actors[i], i * 65536 + 1);
+                assert(!r);
+
+                user_charge_init(&charges[i]);
+                r = user_charge(user, &charges[i], actors[i], USER_SLOT_OBJECTS, 1);
+                assert(!r);
+                assert(user->n_usages == i + 1);
+        }
+
+        for (i = 0; i < C_ARRAY_SIZE(actors); ++i) {
+                r = user_charge(user, &charges[i], actors[i], USER_SLOT_OBJECTS, 1);
+                assert(!r);
+                assert(charges[i].charge == 2);
+        }
+
+        for (i = 0; i < C_ARRAY_SIZE(actors); i += 2)
+                user_charge_deinit(&charges[i]);
+        assert(user->n_usages == C_ARRAY_SIZE(actors) / 2);
+
+        for (i = 1; i < C_ARRAY_SIZE(actors); i += 2)
+                user_charge_deinit(&charges[i]);
+        assert(user->n_usages == 0);
+
+        for (i = 0; i < C_ARRAY_SIZE(actors); ++i)
+                user_unref(actors[i]);
+        user_unref(user);
+        user_registry_deinit(&registry);
+}
+
 int main(int argc, char **argv) {
         test_setup();
         test_quota();
+        test_cache();
+        test_many();
         return 0;
 }
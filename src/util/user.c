@@ -20,8 +20,15 @@
  * each remote UID is between 1/n and 1/n^2 of the total amount of resources
  * available to the local UID, where n is the number of UIDs consuming a share
  * of the local UID's resources at the time of accounting.
+ *
+ * Every queued message is charged on its receiver, on behalf of its sender.
+ * Hence, the usage of each remote UID is kept in a hash table on the user,
+ * and callers on the hot path keep a cache of the usage object they charged
+ * last. A peer usually receives from the same few senders over and over, so
+ * most charges boil down to a pointer comparison and some arithmetic.
  */
 
+#include <c-list.h>
 #include <c-macro.h>
 #include <c-ref.h>
 #include <stdlib.h>
@@ -31,24 +38,80 @@
 #include "util/user.h"
 
 struct UserUsage {
-        _Atomic unsigned long n_refs;
         User *user;
         uid_t uid;
-        CRBNode user_node;
+        CList user_link;
+        unsigned long n_charges;
+        unsigned long n_caches;
 
         bool logged : 1;
 
         unsigned int slots[];
 };
 
-static void user_usage_link(UserUsage *usage, CRBNode *parent, CRBNode **slot) {
-        ++usage->user->n_usages;
-        c_rbtree_add(&usage->user->usage_tree, parent, slot, &usage->user_node);
+static size_t user_usage_hash(uid_t uid) {
+        uint64_t hash = (uint64_t)uid * 0x9e3779b97f4a7c15ULL;
+
+        hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+        return hash ^ (hash >> 31);
+}
+
+static int user_resize_usages(User *user, size_t n_buckets) {
+        UserUsage *usage, *safe;
+        CList *buckets;
+        size_t i;
+
+        buckets = malloc(n_buckets * sizeof(*buckets));
+        if (!buckets)
+                return error_origin(-ENOMEM);
+
+        for (i = 0; i < n_buckets; ++i)
+                c_list_init(&buckets[i]);
+
+        for (i = 0; i < user->n_usage_buckets; ++i)
+                c_list_for_each_entry_safe(usage, safe, &user->usage_buckets[i], user_link)
+                        c_list_link_tail(&buckets[user_usage_hash(usage->uid) & (n_buckets - 1)], &usage->user_link);
+
+        free(user->usage_buckets);
+        user->usage_buckets = buckets;
+        user->n_usage_buckets = n_buckets;
+
+        return 0;
+}
+
+static UserUsage *user_find_usage(User *user, uid_t uid) {
+        UserUsage *usage;
+
+        if (!user->n_usage_entries)
+                return NULL;
+
+        c_list_for_each_entry(usage, &user->usage_buckets[user_usage_hash(uid) & (user->n_usage_buckets - 1)], user_link)
+                if (usage->uid == uid)
+                        return usage;
+
+        return NULL;
+}
+
+static int user_usage_link(UserUsage *usage) {
+        User *user = usage->user;
+        int r;
+
+        if (user->n_usage_entries >= user->n_usage_buckets) {
+                r = user_resize_usages(user, user->n_usage_buckets ? user->n_usage_buckets * 2 : USER_USAGE_BUCKETS_MIN);
+                if (r)
+                        return error_trace(r);
+        }
+
+        c_list_link_tail(&user->usage_buckets[user_usage_hash(usage->uid) & (user->n_usage_buckets - 1)], &usage->user_link);
+        ++user->n_usage_entries;
+
+        return 0;
 }
 
 static void user_usage_unlink(UserUsage *usage) {
-        c_rbnode_unlink(&usage->user_node);
-        --usage->user->n_usages;
+        c_list_unlink(&usage->user_link);
+        --usage->user->n_usage_entries;
 }
 
 static int user_usage_new(UserUsage **usagep, User *user, uid_t uid) {
@@ -58,17 +121,15 @@ static int user_usage_new(UserUsage **usagep, User *user, uid_t uid) {
         if (!usage)
                 return error_origin(-ENOMEM);
 
-        usage->n_refs = C_REF_INIT;
         usage->user = user;
         usage->uid = uid;
-        usage->user_node = (CRBNode)C_RBNODE_INIT(usage->user_node);
+        usage->user_link = (CList)C_LIST_INIT(usage->user_link);
 
         *usagep = usage;
         return 0;
 }
 
-static void user_usage_free(_Atomic unsigned long *n_refs, void *userdata) {
-        UserUsage *usage = c_container_of(n_refs, UserUsage, n_refs);
+static void user_usage_free(UserUsage *usage) {
         size_t i;
 
         for (i = 0; i < usage->user->registry->n_slots; ++i)
@@ -78,30 +139,31 @@ static void user_usage_free(_Atomic unsigned long *n_refs, void *userdata) {
         free(usage);
 }
 
-static UserUsage *user_usage_ref(UserUsage *usage) {
-        if (usage)
-                c_ref_inc(&usage->n_refs);
-        return usage;
-}
-
-static UserUsage *user_usage_unref(UserUsage *usage) {
-        if (usage)
-                c_ref_dec(&usage->n_refs, user_usage_free, NULL);
-        return NULL;
+/*
+ * A usage object lives as long as it is pinned by a charge object or by a
+ * cache. Only the former count as actors on the user, though, so caching a
+ * usage never affects the quotas of anyone.
+ */
+static void user_usage_might_free(UserUsage *usage) {
+        if (!usage->n_charges && !usage->n_caches)
+                user_usage_free(usage);
 }
 
-C_DEFINE_CLEANUP(UserUsage *, user_usage_unref);
+static void user_usage_attach(UserUsage *usage, UserCharge *charge, size_t slot) {
+        if (!usage->n_charges++)
+                ++usage->user->n_usages;
 
-static int user_usage_compare(CRBTree *tree, void *k, CRBNode *rb) {
-        UserUsage *usage = c_container_of(rb, UserUsage, user_node);
-        uid_t uid = *(uid_t*)k;
+        charge->usage = usage;
+        charge->slot = slot;
+}
 
-        if (uid < usage->uid)
-                return -1;
-        if (uid > usage->uid)
-                return 1;
+static void user_usage_detach(UserUsage *usage) {
+        if (!--usage->n_charges) {
+                --usage->user->n_usages;
+                usage->logged = false;
+        }
 
-        return 0;
+        user_usage_might_free(usage);
 }
 
 /**
@@ -127,7 +189,8 @@ void user_charge_deinit(UserCharge *charge) {
                 charge->usage->user->slots[charge->slot].n += charge->charge;
                 charge->usage->slots[charge->slot] -= charge->charge;
 
-                charge->usage = user_usage_unref(charge->usage);
+                user_usage_detach(charge->usage);
+                charge->usage = NULL;
                 charge->slot = 0;
                 charge->charge = 0;
         } else {
@@ -165,7 +228,6 @@ static int user_new(User **userp, UserRegistry *registry, uid_t uid) {
         user->registry = registry;
         user->uid = uid;
         user->registry_node = (CRBNode)C_RBNODE_INIT(user->registry_node);
-        user->usage_tree = (CRBTree)C_RBTREE_INIT;
 
         for (i = 0; i < registry->n_slots; ++i) {
                 user->slots[i].max = registry->maxima[i];
@@ -180,31 +242,37 @@ void user_free(_Atomic unsigned long *n_refs, void *userdata) {
         User *user = c_container_of(n_refs, User, n_refs);
         size_t i;
 
-        assert(c_rbtree_is_empty(&user->usage_tree));
+        assert(user->n_usage_entries == 0);
         assert(user->n_usages == 0);
 
         for (i = 0; i < user->registry->n_slots; ++i)
                 assert(user->slots[i].n == user->slots[i].max);
 
         user_unlink(user);
+        free(user->usage_buckets);
         free(user);
 }
 
-static int user_ref_usage(User *user, UserUsage **usagep, User *actor) {
+/*
+ * Look up the usage object of @uid on @user, creating it if needed. The
+ * returned object is not pinned, so the caller must attach it to a charge or
+ * cache before anything else can release it.
+ */
+static int user_get_usage(User *user, UserUsage **usagep, uid_t uid) {
         UserUsage *usage;
-        CRBNode **slot, *parent;
         int r;
 
-        slot = c_rbtree_find_slot(&user->usage_tree, user_usage_compare, &actor->uid, &parent);
-        if (slot) {
-                r = user_usage_new(&usage, user, actor->uid);
+        usage = user_find_usage(user, uid);
+        if (!usage) {
+                r = user_usage_new(&usage, user, uid);
                 if (r)
-                        return r;
+                        return error_trace(r);
 
-                user_usage_link(usage, parent, slot);
-        } else {
-                usage = c_container_of(parent, UserUsage, user_node);
-                user_usage_ref(usage);
+                r = user_usage_link(usage);
+                if (r) {
+                        free(usage);
+                        return error_trace(r);
+                }
         }
 
         *usagep = usage;
@@ -267,8 +335,31 @@ static int user_charge_commit_log(Log *log, User *user, UserCharge *charge, User
  * Return: 0 on success, error code on failure.
  */
 int user_charge(User *user, UserCharge *charge, User *actor, size_t slot, unsigned int amount) {
-        _c_cleanup_(user_usage_unrefp) UserUsage *usage = NULL;
+        return user_charge_cached(user, charge, NULL, actor, slot, amount);
+}
+
+/**
+ * user_charge_cached() - charge a user object through a cache
+ * @user:       user object to charge
+ * @charge:     charge object used to record the charge
+ * @cache:      cache of the last usage object, or NULL
+ * @actor:      user object charged on behalf of, or NULL
+ * @slot:       slot to charge
+ * @amount:     charge amount
+ *
+ * This is the same as user_charge(), but remembers the usage object of
+ * @user + @actor in @cache, so the next fresh charge of the same combination
+ * skips the lookup. Callers that repeatedly charge the same user, like the
+ * output queue of a peer, should keep a cache around. The cache does not
+ * affect any quota.
+ *
+ * If @cache is NULL, this behaves exactly like user_charge().
+ *
+ * Return: 0 on success, error code on failure.
+ */
+int user_charge_cached(User *user, UserCharge *charge, UserCache *cache, User *actor, size_t slot, unsigned int amount) {
         unsigned int *user_slot, *usage_slot;
+        UserUsage *usage;
         int r;
 
         /* no charge, no work */
@@ -287,16 +378,25 @@ int user_charge(User *user, UserCharge *charge, User *actor, size_t slot, unsign
                 assert(user == charge->usage->user);
                 assert(actor->uid == charge->usage->uid);
                 assert(slot == charge->slot);
-                usage = user_usage_ref(charge->usage);
+        } else if (cache && cache->usage && cache->usage->user == user && cache->usage->uid == actor->uid) {
+                user_usage_attach(cache->usage, charge, slot);
         } else {
-                r = user_ref_usage(user, &usage, actor);
+                r = user_get_usage(user, &usage, actor->uid);
                 if (r)
                         return error_trace(r);
+
+                user_usage_attach(usage, charge, slot);
+
+                if (cache) {
+                        user_cache_deinit(cache);
+                        ++usage->n_caches;
+                        cache->usage = usage;
+                }
         }
 
         assert(slot < user->registry->n_slots);
         user_slot = &user->slots[slot].n;
-        usage_slot = &usage->slots[slot];
+        usage_slot = &charge->usage->slots[slot];
 
         if (user == actor) {
                 /* never apply quotas on self-charge */
@@ -316,20 +416,8 @@ int user_charge(User *user, UserCharge *charge, User *actor, size_t slot, unsign
         *usage_slot += amount;
         charge->charge += amount;
 
-        if (!charge->usage) {
-                charge->slot = slot;
-                charge->usage = usage;
-                usage = NULL;
-        }
-
         return 0;
 quota:
-        if (!charge->usage) {
-                charge->slot = slot;
-                charge->usage = usage;
-                usage = NULL;
-        }
-
         r = user_charge_commit_log(user->registry->log, user, charge, actor, slot, amount);
         if (r)
                 return error_trace(r);
@@ -337,6 +425,31 @@ quota:
         return USER_E_QUOTA;
 }
 
+/**
+ * user_cache_init() - initialize cache object
+ * @cache:      cache object to initialize
+ *
+ * This initializes a new, empty cache object.
+ */
+void user_cache_init(UserCache *cache) {
+        *cache = (UserCache)USER_CACHE_INIT;
+}
+
+/**
+ * user_cache_deinit() - destroy cache object
+ * @cache:      cache object to destroy
+ *
+ * This releases the usage object cached in @cache, if any, and re-initializes
+ * the cache. A cache must be released before the user it was used on.
+ */
+void user_cache_deinit(UserCache *cache) {
+        if (cache->usage) {
+                --cache->usage->n_caches;
+                user_usage_might_free(cache->usage);
+                cache->usage = NULL;
+        }
+}
+
 static int user_compare(CRBTree *tree, void *k, CRBNode *rb) {
         User *user = c_container_of(rb, User, registry_node);
         uid_t uid = *(uid_t*)k;
@@ -4,6 +4,7 @@
  * User Accounting
  */
 
+#include <c-list.h>
 #include <c-macro.h>
 #include <c-rbtree.h>
 #include <c-ref.h>
@@ -11,11 +12,14 @@
 #include <sys/types.h>
 
 typedef struct Log Log;
+typedef struct UserCache UserCache;
 typedef struct UserCharge UserCharge;
 typedef struct UserUsage UserUsage;
 typedef struct User User;
 typedef struct UserRegistry UserRegistry;
 
+#define USER_USAGE_BUCKETS_MIN (8)
+
 /* XXX: move this to some global broker header file */
 enum {
         USER_SLOT_BYTES,
@@ -59,6 +63,17 @@ struct UserCharge {
 void user_charge_init(UserCharge *charge);
 void user_charge_deinit(UserCharge *charge);
 
+/* cache */
+
+struct UserCache {
+        UserUsage *usage;
+};
+
+#define USER_CACHE_INIT {}
+
+void user_cache_init(UserCache *cache);
+void user_cache_deinit(UserCache *cache);
+
 /* user */
 
 struct User {
@@ -67,7 +82,9 @@ struct User {
         uid_t uid;
         CRBNode registry_node;
 
-        CRBTree usage_tree;
+        CList *usage_buckets;
+        size_t n_usage_buckets;
+        size_t n_usage_entries;
         unsigned int n_usages;
 
         struct {
@@ -78,6 +95,7 @@ struct User {
 
 void user_free(_Atomic unsigned long *n_refs, void *userdata);
 int user_charge(User *user, UserCharge *charge, User *actor, size_t slot, unsigned int amount);
+int user_charge_cached(User *user, UserCharge *charge, UserCache *cache, User *actor, size_t slot, unsigned int amount);
 
 /* registry */
 
@@ -6,11 +6,15 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/resource.h>
 #include "util/metrics.h"
 #include "util-broker.h"
 #include "util-message.h"
 
 #define TEST_N_ITERATIONS 500
+#define TEST_N_UID_RANGES 512
+#define TEST_N_DISCONNECT_ITERATIONS 5
+#define TEST_N_STORM_ITERATIONS 5
 
 static void test_connect_blocking_fd(Broker *broker, int *fdp) {
         _c_cleanup_(c_closep) int fd = -1;
@@ -26,13 +30,18 @@ static void test_connect_blocking_fd(Broker *broker, int *fdp) {
         fd = -1;
 }
 
-static void test_connect_one(Metrics *metrics, void *input, ssize_t n_input, ssize_t n_output) {
+static void test_connect_one(Metrics *metrics,
+                             unsigned int n_uid_ranges,
+                             void *input,
+                             ssize_t n_input,
+                             ssize_t n_output) {
         _c_cleanup_(util_broker_freep) Broker *broker = NULL;
         char output[n_output];
         ssize_t len;
         int fd;
 
         util_broker_new(&broker);
+        broker->n_uid_ranges = n_uid_ranges;
         util_broker_spawn(broker);
         util_broker_settle(broker);
 
@@ -61,7 +70,7 @@ static void test_sasl(void) {
         test_message_append_sasl(&buf, &n_buf);
 
         for (unsigned int i = 0; i < TEST_N_ITERATIONS; ++i)
-                test_connect_one(&metrics, buf, n_buf, 58);
+                test_connect_one(&metrics, 0, buf, n_buf, 58);
 
         fprintf(stderr, "SASL transaction completed in %"PRIu64" (+/- %.0f) us\n",
                 metrics.average / 1000, metrics_read_standard_deviation(&metrics) / 1000);
@@ -76,12 +85,28 @@ static void test_hello(void) {
         test_message_append_hello(&buf, &n_buf);
 
         for (unsigned int i = 0; i < TEST_N_ITERATIONS; ++i)
-                test_connect_one(&metrics, buf, n_buf, 316);
+                test_connect_one(&metrics, 0, buf, n_buf, 316);
 
         fprintf(stderr, "SASL + Hello transaction completed in %"PRIu64" (+/- %.0f) us\n",
                 metrics.average / 1000, metrics_read_standard_deviation(&metrics) / 1000);
 }
 
+static void test_hello_uid_ranges(void) {
+        _c_cleanup_(metrics_deinit) Metrics metrics = METRICS_INIT(CLOCK_MONOTONIC_RAW);
+        _c_cleanup_(c_freep) void *buf = NULL;
+        size_t n_buf = 0;
+
+        test_message_append_sasl(&buf, &n_buf);
+        test_message_append_hello(&buf, &n_buf);
+
+        for (unsigned int i = 0; i < TEST_N_ITERATIONS; ++i)
+                test_connect_one(&metrics, TEST_N_UID_RANGES, buf, n_buf, 316);
+
+        fprintf(stderr, "SASL + Hello transaction with %u uid-range policies (%u matching) completed in %"PRIu64" (+/- %.0f) us\n",
+                TEST_N_UID_RANGES, (TEST_N_UID_RANGES + 1) / 2,
+                metrics.average / 1000, metrics_read_standard_deviation(&metrics) / 1000);
+}
+
 static void test_transaction(void) {
         _c_cleanup_(metrics_deinit) Metrics metrics = METRICS_INIT(CLOCK_MONOTONIC_RAW);
         _c_cleanup_(c_freep) void *buf = NULL;
@@ -92,14 +117,180 @@ static void test_transaction(void) {
         test_message_append_signal(&buf, &n_buf, 1, 1);
 
         for (unsigned int i = 0; i < TEST_N_ITERATIONS; ++i)
-                test_connect_one(&metrics, buf, n_buf, 436);
+                test_connect_one(&metrics, 0, buf, n_buf, 436);
 
         fprintf(stderr, "SASL + Hello + message transaction completed in %"PRIu64" (+/- %.0f) us\n",
                 metrics.average / 1000, metrics_read_standard_deviation(&metrics) / 1000);
 }
 
+static bool test_raise_nofile(unsigned int n_fds) {
+        struct rlimit rlimit;
+        int r;
+
+        r = getrlimit(RLIMIT_NOFILE, &rlimit);
+        assert(r >= 0);
+        rlimit.rlim_cur = rlimit.rlim_max;
+        r = setrlimit(RLIMIT_NOFILE, &rlimit);
+        assert(r >= 0);
+
+        return rlimit.rlim_cur == RLIM_INFINITY || rlimit.rlim_cur >= n_fds;
+}
+
+static void test_storm_one(Metrics *metrics, unsigned int n_peers, void *input, ssize_t n_input) {
+        _c_cleanup_(util_broker_freep) Broker *broker = NULL;
+        _c_cleanup_(c_freep) int *fds = NULL;
+        uint8_t output[316];
+        ssize_t len;
+
+        util_broker_new(&broker);
+        util_broker_spawn(broker);
+        util_broker_settle(broker);
+
+        fds = calloc(n_peers, sizeof(*fds));
+        assert(fds);
+
+        /*
+         * Connect all peers at once and pipeline SASL and Hello() on each, the
+         * way clients do when a session starts. Only then collect the replies,
+         * so the broker sees a backlog of pending connections.
+         */
+        metrics_sample_start(metrics);
+
+        for (unsigned int i = 0; i < n_peers; ++i) {
+                test_connect_blocking_fd(broker, &fds[i]);
+
+                len = write(fds[i], input, n_input);
+                assert(len == (ssize_t)n_input);
+        }
+
+        for (unsigned int i = 0; i < n_peers; ++i) {
+                len = recv(fds[i], output, sizeof(output), MSG_WAITALL);
+                assert(len == (ssize_t)sizeof(output));
+        }
+
+        metrics_sample_end(metrics);
+
+        for (unsigned int i = 0; i < n_peers; ++i)
+                fds[i] = c_close(fds[i]);
+
+        util_broker_terminate(broker);
+}
+
+static void test_storm(void) {
+        static const unsigned int n_peers[] = { 100, 1000 };
+        _c_cleanup_(c_freep) void *buf = NULL;
+        size_t n_buf = 0;
+
+        test_message_append_sasl(&buf, &n_buf);
+        test_message_append_hello(&buf, &n_buf);
+
+        for (unsigned int j = 0; j < C_ARRAY_SIZE(n_peers); ++j) {
+                _c_cleanup_(metrics_deinit) Metrics metrics = METRICS_INIT(CLOCK_MONOTONIC_RAW);
+
+                if (!test_raise_nofile(2 * n_peers[j] + 128)) {
+                        fprintf(stderr, "Skipping storm of %u connections, file descriptor limit too low\n", n_peers[j]);
+                        continue;
+                }
+
+                for (unsigned int i = 0; i < TEST_N_STORM_ITERATIONS; ++i)
+                        test_storm_one(&metrics, n_peers[j], buf, n_buf);
+
+                fprintf(stderr, "Storm of %u SASL + Hello transactions completed in %"PRIu64" (+/- %.0f) us, %.0f connects/s\n",
+                        n_peers[j], metrics.average / 1000, metrics_read_standard_deviation(&metrics) / 1000,
+                        n_peers[j] * 1e9 / metrics.average);
+        }
+}
+
+static void test_disconnect_one(Metrics *metrics, unsigned int n_peers) {
+        _c_cleanup_(util_broker_freep) Broker *broker = NULL;
+        _c_cleanup_(c_closep) int fd = -1;
+        _c_cleanup_(c_freep) void *hello = NULL, *buf = NULL;
+        _c_cleanup_(c_freep) sd_bus **buses = NULL;
+        size_t n_hello = 0, n_buf = 0;
+        uint8_t output[316];
+        ssize_t len;
+        int r;
+
+        test_message_append_sasl(&hello, &n_hello);
+        test_message_append_hello(&hello, &n_hello);
+        test_message_append_ping(&buf, &n_buf, 1, 1, 1);
+        test_message_append_pong(&buf, &n_buf, 2, 1, 1, 1);
+        assert(n_buf <= sizeof(output));
+
+        util_broker_new(&broker);
+        util_broker_spawn(broker);
+        util_broker_settle(broker);
+
+        test_connect_blocking_fd(broker, &fd);
+
+        len = write(fd, hello, n_hello);
+        assert(len == (ssize_t)n_hello);
+
+        len = recv(fd, output, 316, MSG_WAITALL);
+        assert(len == 316);
+
+        /*
+         * Every peer subscribes to all NameOwnerChanged signals, as most
+         * clients watching some names effectively do. Hence, each peer that
+         * leaves would be announced to all others.
+         */
+        buses = calloc(n_peers, sizeof(*buses));
+        assert(buses);
+
+        for (unsigned int i = 0; i < n_peers; ++i) {
+                util_broker_connect(broker, &buses[i]);
+
+                r = sd_bus_call_method(buses[i], "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                                       "AddMatch", NULL, NULL,
+                                       "s", "type='signal',sender='org.freedesktop.DBus',member='NameOwnerChanged'");
+                assert(r >= 0);
+        }
+
+        /*
+         * Hang up all peers at once, then measure how long it takes until a
+         * transaction of the remaining peer gets through.
+         */
+        metrics_sample_start(metrics);
+
+        for (unsigned int i = 0; i < n_peers; ++i)
+                buses[i] = sd_bus_flush_close_unref(buses[i]);
+
+        len = write(fd, buf, n_buf);
+        assert(len == (ssize_t)n_buf);
+
+        len = recv(fd, output, n_buf, MSG_WAITALL);
+        assert(len == (ssize_t)n_buf);
+
+        metrics_sample_end(metrics);
+
+        util_broker_terminate(broker);
+}
+
+static void test_disconnect(void) {
+        static const unsigned int n_peers[] = { 1000, 5000 };
+
+        for (unsigned int j = 0; j < C_ARRAY_SIZE(n_peers); ++j) {
+                _c_cleanup_(metrics_deinit) Metrics metrics = METRICS_INIT(CLOCK_MONOTONIC_RAW);
+
+                /* every peer needs a file descriptor on both ends */
+                if (!test_raise_nofile(2 * n_peers[j] + 128)) {
+                        fprintf(stderr, "Skipping disconnect of %u peers, file descriptor limit too low\n", n_peers[j]);
+                        continue;
+                }
+
+                for (unsigned int i = 0; i < TEST_N_DISCONNECT_ITERATIONS; ++i)
+                        test_disconnect_one(&metrics, n_peers[j]);
+
+                fprintf(stderr, "Message transaction right after %u peers disconnected completed in %"PRIu64" (+/- %.0f) us\n",
+                        n_peers[j], metrics.average / 1000, metrics_read_standard_deviation(&metrics) / 1000);
+        }
+}
+
 int main(int argc, char **argv) {
         test_sasl();
         test_hello();
+        test_hello_uid_ranges();
         test_transaction();
+        test_storm();
+        test_disconnect();
 }
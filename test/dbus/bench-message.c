@@ -5,12 +5,14 @@
 #include <c-macro.h>
 #include <math.h>
 #include <stdlib.h>
+#include <sys/resource.h>
 #include "util/metrics.h"
 #include "util-broker.h"
 #include "util-message.h"
 #include "dbus/protocol.h"
 
 #define TEST_N_ITERATIONS 500
+#define TEST_N_PEERS_MAX 50000
 
 static void test_connect_blocking_fd(Broker *broker, int *fdp) {
         _c_cleanup_(c_closep) int fd = -1;
@@ -137,6 +139,98 @@ static void test_replies(void) {
         }
 }
 
+static void test_rpc(void) {
+        for (unsigned int j = 0; j <= 8; ++j) {
+                _c_cleanup_(metrics_deinit) Metrics metrics = METRICS_INIT(CLOCK_MONOTONIC_RAW);
+                _c_cleanup_(c_freep) void *buf = NULL;
+                size_t n_buf = 0;
+
+                /*
+                 * Issue a window of method calls, followed by the replies to
+                 * all of them. Every call inserts a slot into the reply
+                 * registry, and every reply looks it up and removes it again.
+                 */
+
+                for (unsigned int i = 1; i <= (1U << j); ++i)
+                        test_message_append_ping(&buf, &n_buf, i, 1, 1);
+                for (unsigned int i = 1; i <= (1U << j); ++i)
+                        test_message_append_pong(&buf, &n_buf, (1U << j) + i, i, 1, 1);
+
+                test_message_transaction(&metrics, 0, 0, buf, n_buf, n_buf);
+
+                fprintf(stderr, "%u pipelined method calls and replies completed at %.0f transactions/s\n",
+                        1 << j, metrics.average ? (1U << j) * 1000000000.0 / metrics.average : 0);
+        }
+}
+
+static void test_peers(void) {
+        static const unsigned int n_peers[] = { 0, 1000, 10000, TEST_N_PEERS_MAX };
+        struct rlimit rlimit;
+        int r;
+
+        /*
+         * Every idle peer needs a file descriptor on both ends, so raise the
+         * limit as far as possible. The broker inherits it.
+         */
+        r = getrlimit(RLIMIT_NOFILE, &rlimit);
+        assert(r >= 0);
+        rlimit.rlim_cur = rlimit.rlim_max;
+        r = setrlimit(RLIMIT_NOFILE, &rlimit);
+        assert(r >= 0);
+
+        for (unsigned int j = 0; j < C_ARRAY_SIZE(n_peers); ++j) {
+                _c_cleanup_(metrics_deinit) Metrics metrics = METRICS_INIT(CLOCK_MONOTONIC_RAW);
+                _c_cleanup_(util_broker_freep) Broker *broker = NULL;
+                _c_cleanup_(c_closep) int fd1 = -1;
+                _c_cleanup_(c_freep) void *buf = NULL;
+                _c_cleanup_(c_freep) int *fds = NULL;
+                size_t n_buf = 0;
+                uint8_t output[256];
+                ssize_t len;
+
+                if (rlimit.rlim_cur != RLIM_INFINITY && rlimit.rlim_cur < 2 * n_peers[j] + 128) {
+                        fprintf(stderr, "Skipping message transaction with %u idle peers, file descriptor limit too low\n", n_peers[j]);
+                        continue;
+                }
+
+                test_message_append_ping(&buf, &n_buf, 1, 1, 1);
+                test_message_append_pong(&buf, &n_buf, 2, 1, 1, 1);
+                assert(n_buf <= sizeof(output));
+
+                util_broker_new(&broker);
+                util_broker_spawn(broker);
+                util_broker_settle(broker);
+
+                test_connect_blocking_fd(broker, &fd1);
+
+                fds = calloc(n_peers[j] ?: 1, sizeof(*fds));
+                assert(fds);
+
+                for (unsigned int i = 0; i < n_peers[j]; ++i)
+                        test_connect_blocking_fd(broker, &fds[i]);
+
+                for (unsigned int i = 0; i < TEST_N_ITERATIONS; ++i) {
+                        metrics_sample_start(&metrics);
+
+                        len = write(fd1, buf, n_buf);
+                        assert(len == (ssize_t)n_buf);
+
+                        len = recv(fd1, output, n_buf, MSG_WAITALL);
+                        assert(len == (ssize_t)n_buf);
+
+                        metrics_sample_end(&metrics);
+                }
+
+                for (unsigned int i = 0; i < n_peers[j]; ++i)
+                        c_close(fds[i]);
+
+                fprintf(stderr, "Message transaction with %u idle peers on the bus completed in %"PRIu64" (+/- %.0f) us\n",
+                        n_peers[j], metrics.average / 1000, metrics_read_standard_deviation(&metrics) / 1000);
+
+                util_broker_terminate(broker);
+        }
+}
+
 static void test_pipelining(void) {
         for (unsigned int j = 0; j <= 8; ++j) {
                 _c_cleanup_(metrics_deinit) Metrics metrics = METRICS_INIT(CLOCK_MONOTONIC_RAW);
@@ -155,8 +249,77 @@ static void test_pipelining(void) {
         }
 }
 
+static size_t test_read_rss(pid_t pid) {
+        _c_cleanup_(c_fclosep) FILE *f = NULL;
+        char path[64], line[256];
+        size_t rss = 0;
+        int r;
+
+        r = snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+        assert(r > 0 && r < (int)sizeof(path));
+
+        f = fopen(path, "re");
+        assert(f);
+
+        while (fgets(line, sizeof(line), f))
+                if (sscanf(line, "VmRSS: %zu kB", &rss) == 1)
+                        break;
+
+        return rss * 1024;
+}
+
+static void test_queue_footprint(void) {
+        for (unsigned int j = 10; j <= 16; j += 2) {
+                _c_cleanup_(util_broker_freep) Broker *broker = NULL;
+                _c_cleanup_(c_closep) int fd1 = -1, fd2 = -1;
+                _c_cleanup_(c_freep) void *signal = NULL, *ping = NULL;
+                size_t n_signal = 0, n_ping = 0, rss_before, rss_after;
+                uint8_t reply[136];
+                ssize_t len;
+
+                util_broker_new(&broker);
+                util_broker_spawn(broker);
+                util_broker_settle(broker);
+
+                test_connect_blocking_fd(broker, &fd1);
+                test_connect_blocking_fd(broker, &fd2);
+
+                test_message_append_signal(&signal, &n_signal, 1, 2);
+                test_message_append_ping(&ping, &n_ping, 1, 1, 1);
+
+                rss_before = test_read_rss(broker->child_pid);
+
+                /*
+                 * Queue unicast signals on the second peer, which never reads
+                 * them, and then round-trip a ping on the first peer, to make
+                 * sure the broker processed all of them.
+                 */
+
+                for (unsigned int i = 0; i < (1U << j); ++i) {
+                        len = write(fd1, signal, n_signal);
+                        assert(len == (ssize_t)n_signal);
+                }
+
+                len = write(fd1, ping, n_ping);
+                assert(len == (ssize_t)n_ping);
+
+                len = recv(fd1, reply, sizeof(reply), MSG_WAITALL);
+                assert(len == (ssize_t)sizeof(reply));
+
+                rss_after = test_read_rss(broker->child_pid);
+
+                fprintf(stderr, "%u queued unicast messages of %zu bytes use %zu bytes of broker memory each\n",
+                        1U << j, n_signal, (rss_after > rss_before) ? (rss_after - rss_before) / (1U << j) : 0);
+
+                util_broker_terminate(broker);
+        }
+}
+
 int main(int argc, char **argv) {
         test_broadcast();
         test_replies();
+        test_rpc();
+        test_peers();
         test_pipelining();
+        test_queue_footprint();
 }
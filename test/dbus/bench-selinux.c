@@ -0,0 +1,164 @@
+/*
+ * SELinux Benchmarks
+ *
+ * Every unicast, and every receiver of a broadcast, is subject to a SELinux
+ * send check, which is answered by the userspace AVC of the broker. This
+ * measures the cost of those checks with SELinux in permissive mode, where
+ * denials are audited rather than enforced. If SELinux is enforcing, it is
+ * switched to permissive mode for the duration of the benchmark, if we are
+ * privileged to do so, otherwise the benchmark is skipped.
+ */
+
+#include <c-macro.h>
+#include <selinux/selinux.h>
+#include <stdlib.h>
+#include "util/metrics.h"
+#include "util-broker.h"
+#include "util-message.h"
+
+#define TEST_N_ITERATIONS 500
+
+static void test_connect_blocking_fd(Broker *broker, int *fdp) {
+        _c_cleanup_(c_closep) int fd = -1;
+        _c_cleanup_(c_freep) void *hello = NULL;
+        size_t n_hello = 0;
+        uint8_t reply[316];
+        ssize_t len;
+        int r;
+
+        test_message_append_sasl(&hello, &n_hello);
+        test_message_append_hello(&hello, &n_hello);
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        assert(fd >= 0);
+
+        r = connect(fd, (struct sockaddr *)&broker->address, broker->n_address);
+        assert(r >= 0);
+
+        len = write(fd, hello, n_hello);
+        assert(len == (ssize_t)n_hello);
+
+        len = recv(fd, reply, sizeof(reply), MSG_WAITALL);
+        assert(len == (ssize_t)sizeof(reply));
+
+        *fdp = fd;
+        fd = -1;
+}
+
+static void test_unicast(void) {
+        _c_cleanup_(metrics_deinit) Metrics metrics = METRICS_INIT(CLOCK_MONOTONIC_RAW);
+        _c_cleanup_(util_broker_freep) Broker *broker = NULL;
+        _c_cleanup_(c_closep) int fd = -1;
+        _c_cleanup_(c_freep) void *buf = NULL;
+        size_t n_buf = 0;
+        uint8_t output[256];
+        ssize_t len;
+
+        test_message_append_ping(&buf, &n_buf, 1, 1, 1);
+        test_message_append_pong(&buf, &n_buf, 2, 1, 1, 1);
+        assert(n_buf <= sizeof(output));
+
+        util_broker_new(&broker);
+        util_broker_spawn(broker);
+        util_broker_settle(broker);
+
+        test_connect_blocking_fd(broker, &fd);
+
+        for (unsigned int i = 0; i < TEST_N_ITERATIONS; ++i) {
+                metrics_sample_start(&metrics);
+
+                len = write(fd, buf, n_buf);
+                assert(len == (ssize_t)n_buf);
+
+                len = recv(fd, output, n_buf, MSG_WAITALL);
+                assert(len == (ssize_t)n_buf);
+
+                metrics_sample_end(&metrics);
+        }
+
+        fprintf(stderr, "Message transaction with SELinux in permissive mode completed in %"PRIu64" (+/- %.0f) us\n",
+                metrics.average / 1000, metrics_read_standard_deviation(&metrics) / 1000);
+
+        util_broker_terminate(broker);
+}
+
+static void test_broadcast(void) {
+        for (unsigned int j = 0; j <= 6; ++j) {
+                _c_cleanup_(metrics_deinit) Metrics metrics = METRICS_INIT(CLOCK_MONOTONIC_RAW);
+                _c_cleanup_(util_broker_freep) Broker *broker = NULL;
+                _c_cleanup_(c_closep) int fd = -1;
+                _c_cleanup_(c_freep) void *buf = NULL;
+                sd_bus *buses[1 << j];
+                size_t n_buf = 0;
+                uint8_t output[120];
+                ssize_t len;
+                int r;
+
+                test_message_append_broadcast(&buf, &n_buf, 1);
+                test_message_append_signal(&buf, &n_buf, 1, 1);
+
+                util_broker_new(&broker);
+                util_broker_spawn(broker);
+                util_broker_settle(broker);
+
+                test_connect_blocking_fd(broker, &fd);
+
+                /* every receiver matches the broadcast, and is checked on its own */
+                for (unsigned int i = 0; i < (1U << j); ++i) {
+                        util_broker_connect(broker, &buses[i]);
+
+                        r = sd_bus_call_method(buses[i], "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                                               "AddMatch", NULL, NULL,
+                                               "s", "path=/org/example/Foo");
+                        assert(r >= 0);
+                }
+
+                for (unsigned int i = 0; i < TEST_N_ITERATIONS; ++i) {
+                        metrics_sample_start(&metrics);
+
+                        len = write(fd, buf, n_buf);
+                        assert(len == (ssize_t)n_buf);
+
+                        len = recv(fd, output, sizeof(output), MSG_WAITALL);
+                        assert(len == (ssize_t)sizeof(output));
+
+                        metrics_sample_end(&metrics);
+                }
+
+                for (unsigned int i = 0; i < (1U << j); ++i)
+                        sd_bus_unref(buses[i]);
+
+                fprintf(stderr, "Broadcast emission to %u matches with SELinux in permissive mode + message transaction completed in %"PRIu64" (+/- %.0f) us\n",
+                        1 << j, metrics.average / 1000, metrics_read_standard_deviation(&metrics) / 1000);
+
+                util_broker_terminate(broker);
+        }
+}
+
+int main(int argc, char **argv) {
+        int r, enforce;
+
+        if (!is_selinux_enabled())
+                return 77;
+
+        enforce = security_getenforce();
+        assert(enforce >= 0);
+
+        if (enforce) {
+                r = security_setenforce(0);
+                if (r < 0) {
+                        fprintf(stderr, "Skipping SELinux benchmarks, cannot switch to permissive mode\n");
+                        return 77;
+                }
+        }
+
+        test_unicast();
+        test_broadcast();
+
+        if (enforce) {
+                r = security_setenforce(enforce);
+                assert(r >= 0);
+        }
+
+        return 0;
+}
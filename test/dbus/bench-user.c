@@ -0,0 +1,90 @@
+/*
+ * User Accounting Benchmarks
+ */
+
+#include <c-macro.h>
+#include <stdlib.h>
+#include "util/metrics.h"
+#include "util/user.h"
+
+#define TEST_N_ITERATIONS 1000
+#define TEST_N_CHARGES 1024
+#define TEST_N_ACTORS_MAX 256
+
+static void test_charge_one(size_t n_actors, bool cached) {
+        _c_cleanup_(metrics_deinit) Metrics metrics = METRICS_INIT(CLOCK_MONOTONIC_RAW);
+        UserCharge charges[TEST_N_CHARGES][2];
+        User *user, *actors[TEST_N_ACTORS_MAX];
+        UserCache cache = USER_CACHE_INIT;
+        UserRegistry registry;
+        size_t i, j;
+        int r;
+
+        assert(n_actors <= TEST_N_ACTORS_MAX);
+
+        r = user_registry_init(&registry, NULL, _USER_SLOT_N, (unsigned int[]){ 1U << 30, 1U << 30, 1U << 30, 1U << 30 });
+        assert(!r);
+
+        r = user_registry_ref_user(&registry, &user, 0);
+        assert(!r);
+
+        for (i = 0; i < n_actors; ++i) {
+                r = user_registry_ref_user(&registry, &actors[i], i + 1);
+                assert(!r);
+        }
+
+        /*
+         * Charge a message worth of bytes and FDs on behalf of a sender, the
+         * same way a socket does for each queued message. Senders are picked
+         * round-robin in runs of 16 messages, and each batch is released again
+         * in one go, so the usage objects of the senders stay alive.
+         */
+        for (i = 0; i < TEST_N_ITERATIONS; ++i) {
+                metrics_sample_start(&metrics);
+
+                for (j = 0; j < TEST_N_CHARGES; ++j) {
+                        User *actor = actors[(j / 16) % n_actors];
+
+                        user_charge_init(&charges[j][0]);
+                        user_charge_init(&charges[j][1]);
+
+                        r = user_charge_cached(user, &charges[j][0], cached ? &cache : NULL, actor, USER_SLOT_BYTES, 128);
+                        assert(!r);
+                        r = user_charge_cached(user, &charges[j][1], cached ? &cache : NULL, actor, USER_SLOT_FDS, 1);
+                        assert(!r);
+                }
+
+                for (j = 0; j < TEST_N_CHARGES; ++j) {
+                        user_charge_deinit(&charges[j][1]);
+                        user_charge_deinit(&charges[j][0]);
+                }
+
+                metrics_sample_end(&metrics);
+        }
+
+        fprintf(stderr, "%u message charges from %zu %s completed in %"PRIu64" (+/- %.0f) ns%s\n",
+                TEST_N_CHARGES, n_actors, n_actors == 1 ? "actor" : "actors",
+                metrics.average, metrics_read_standard_deviation(&metrics),
+                cached ? " (cached)" : "");
+
+        user_cache_deinit(&cache);
+        for (i = 0; i < n_actors; ++i)
+                user_unref(actors[i]);
+        user_unref(user);
+        user_registry_deinit(&registry);
+}
+
+static void test_charge(void) {
+        static const size_t n_actors[] = { 1, 16, TEST_N_ACTORS_MAX };
+        size_t i;
+
+        for (i = 0; i < C_ARRAY_SIZE(n_actors); ++i) {
+                test_charge_one(n_actors[i], false);
+                test_charge_one(n_actors[i], true);
+        }
+}
+
+int main(int argc, char **argv) {
+        test_charge();
+        return 0;
+}
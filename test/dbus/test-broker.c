@@ -3,7 +3,10 @@
  */
 
 #include <c-macro.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "util-broker.h"
 
 static void test_dummy(void) {
@@ -153,11 +156,572 @@ static void test_ping_pong(void) {
         util_broker_terminate(broker);
 }
 
+static void test_reply_timeout(void) {
+        _c_cleanup_(util_broker_freep) Broker *broker = NULL;
+        _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *server = NULL, *client = NULL;
+        _c_cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+        const char *unique = NULL;
+        int r;
+
+        /*
+         * Call a method on a peer that never dispatches its messages, and
+         * verify the broker answers with NoReply once the reply timeout
+         * elapsed, rather than keeping the call pending forever.
+         */
+
+        util_broker_new(&broker);
+        broker->reply_timeout = 100;
+        util_broker_spawn(broker);
+
+        util_broker_connect(broker, &server);
+        util_broker_connect(broker, &client);
+
+        r = sd_bus_get_unique_name(server, &unique);
+        assert(!r);
+
+        r = sd_bus_call_method(client,
+                               unique,
+                               "/org/example/Foo",
+                               "org.example.Foo",
+                               "Bar",
+                               &error,
+                               NULL,
+                               NULL);
+        assert(r < 0);
+        assert(sd_bus_error_has_name(&error, "org.freedesktop.DBus.Error.NoReply"));
+
+        util_broker_terminate(broker);
+}
+
+#define TEST_FLOW_N_SIGNALS (256)
+#define TEST_FLOW_SIZE (16 * 1024)
+
+static int test_flow_control_client_fn(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        uint8_t type;
+        int r;
+
+        /* none of the signals must be refused */
+        r = sd_bus_message_get_type(m, &type);
+        assert(r >= 0);
+        assert(type != SD_BUS_MESSAGE_METHOD_ERROR);
+
+        return 0;
+}
+
+static int test_flow_control_server_fn(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        size_t *n_signals = userdata;
+
+        if (sd_bus_message_is_signal(m, "org.example.Foo", "Bar") &&
+            ++*n_signals == TEST_FLOW_N_SIGNALS)
+                return sd_event_exit(sd_bus_get_event(sd_bus_message_get_bus(m)), 0);
+
+        return 0;
+}
+
+static int test_flow_control_timer_fn(sd_event_source *source, uint64_t usec, void *userdata) {
+        sd_bus *server = userdata;
+        int r;
+
+        /* start reading, so the broker can drain the queue of the server */
+        r = sd_bus_attach_event(server, sd_event_source_get_event(source), SD_EVENT_PRIORITY_NORMAL);
+        assert(r >= 0);
+
+        return 0;
+}
+
+static void test_flow_control(void) {
+        _c_cleanup_(util_broker_freep) Broker *broker = NULL;
+        _c_cleanup_(sd_event_unrefp) sd_event *event = NULL;
+        _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *server = NULL, *client = NULL;
+        static uint8_t payload[TEST_FLOW_SIZE];
+        const char *unique = NULL;
+        size_t i, n_signals = 0;
+        uint64_t now;
+        int r;
+
+        /*
+         * Send a lot more data to a peer than its quota allows, while it does
+         * not read. With flow-control, the broker must hold back the sender
+         * rather than refusing its messages, and deliver all of them once the
+         * receiver starts reading.
+         */
+
+        if (getenv("DBUS_BROKER_TEST_DAEMON"))
+                return;
+
+        util_broker_new(&broker);
+        broker->max_bytes = 1024 * 1024;
+        broker->flow_control = true;
+        util_broker_spawn(broker);
+
+        r = sd_event_new(&event);
+        assert(r >= 0);
+
+        util_broker_connect(broker, &server);
+        util_broker_connect(broker, &client);
+
+        r = sd_bus_get_unique_name(server, &unique);
+        assert(r >= 0);
+
+        r = sd_bus_add_filter(server, NULL, test_flow_control_server_fn, &n_signals);
+        assert(r >= 0);
+
+        r = sd_bus_add_filter(client, NULL, test_flow_control_client_fn, NULL);
+        assert(r >= 0);
+
+        r = sd_bus_attach_event(client, event, SD_EVENT_PRIORITY_NORMAL);
+        assert(r >= 0);
+
+        for (i = 0; i < TEST_FLOW_N_SIGNALS; ++i) {
+                _c_cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+
+                r = sd_bus_message_new_signal(client, &m, "/org/example/Foo", "org.example.Foo", "Bar");
+                assert(r >= 0);
+
+                r = sd_bus_message_set_destination(m, unique);
+                assert(r >= 0);
+
+                r = sd_bus_message_append_array(m, 'y', payload, sizeof(payload));
+                assert(r >= 0);
+
+                r = sd_bus_send(client, m, NULL);
+                assert(r >= 0);
+        }
+
+        r = sd_event_now(event, CLOCK_MONOTONIC, &now);
+        assert(r >= 0);
+
+        r = sd_event_add_time(event, NULL, CLOCK_MONOTONIC, now + 200 * 1000, 0, test_flow_control_timer_fn, server);
+        assert(r >= 0);
+
+        r = sd_event_loop(event);
+        assert(r >= 0);
+        assert(n_signals == TEST_FLOW_N_SIGNALS);
+
+        util_broker_terminate(broker);
+}
+
+#define TEST_FLOW_UID (65534)
+
+static void test_flow_control_connect_as(Broker *broker, uid_t uid, sd_bus **busp) {
+        int r;
+
+        /*
+         * The broker accounts peers on the effective uid they connected with.
+         * Peers of distinct users do not share a quota, so one can run out of
+         * quota on the other without the whole user being exhausted.
+         */
+        r = setresuid(-1, uid, -1);
+        assert(!r);
+
+        util_broker_connect(broker, busp);
+
+        r = setresuid(-1, 0, -1);
+        assert(!r);
+}
+
+static void test_flow_control_flood(sd_bus *bus, sd_bus *receiver, sd_bus_message_handler_t fn, void *userdata) {
+        static uint8_t payload[TEST_FLOW_SIZE];
+        const char *unique = NULL;
+        size_t i;
+        int r;
+
+        r = sd_bus_get_unique_name(receiver, &unique);
+        assert(r >= 0);
+
+        for (i = 0; i < TEST_FLOW_N_SIGNALS; ++i) {
+                _c_cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+
+                r = sd_bus_message_new_method_call(bus, &m, unique, "/org/example/Foo", "org.example.Foo", "Bar");
+                assert(r >= 0);
+
+                r = sd_bus_message_append_array(m, 'y', payload, sizeof(payload));
+                assert(r >= 0);
+
+                r = sd_bus_call_async(bus, NULL, m, fn, userdata, 0);
+                assert(r >= 0);
+        }
+}
+
+typedef struct TestFlowCycle {
+        size_t n_replies;
+        size_t n_exceeded;
+} TestFlowCycle;
+
+static int test_flow_control_cycle_fn(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        TestFlowCycle *cycle = userdata;
+
+        /* calls that made it are refused by sd-bus, since nobody implements them */
+        if (sd_bus_message_is_method_error(m, "org.freedesktop.DBus.Error.LimitsExceeded"))
+                ++cycle->n_exceeded;
+
+        if (++cycle->n_replies == 2 * TEST_FLOW_N_SIGNALS)
+                return sd_event_exit(sd_bus_get_event(sd_bus_message_get_bus(m)), 0);
+
+        return 0;
+}
+
+static void test_flow_control_cycle(void) {
+        _c_cleanup_(util_broker_freep) Broker *broker = NULL;
+        _c_cleanup_(sd_event_unrefp) sd_event *event = NULL;
+        _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *a = NULL, *b = NULL;
+        TestFlowCycle cycle = {};
+        uint64_t now;
+        int r;
+
+        /*
+         * Let two peers flood each other with method calls, while neither
+         * reads. Once the first one is held back on the other, the other
+         * must not be held back on the first in turn, since neither would
+         * ever be resumed. Its calls must be refused with LimitsExceeded
+         * instead. Then both start reading, and every call is answered.
+         *
+         * This needs a second user, so only run it as root.
+         */
+
+        if (getenv("DBUS_BROKER_TEST_DAEMON") || geteuid() != 0)
+                return;
+
+        util_broker_new(&broker);
+        broker->max_bytes = 1024 * 1024;
+        broker->flow_control = true;
+        util_broker_spawn(broker);
+
+        r = sd_event_new(&event);
+        assert(r >= 0);
+
+        util_broker_connect(broker, &a);
+        test_flow_control_connect_as(broker, TEST_FLOW_UID, &b);
+
+        test_flow_control_flood(a, b, test_flow_control_cycle_fn, &cycle);
+        test_flow_control_flood(b, a, test_flow_control_cycle_fn, &cycle);
+
+        r = sd_event_now(event, CLOCK_MONOTONIC, &now);
+        assert(r >= 0);
+
+        r = sd_event_add_time(event, NULL, CLOCK_MONOTONIC, now + 200 * 1000, 0, test_flow_control_timer_fn, a);
+        assert(r >= 0);
+
+        r = sd_event_add_time(event, NULL, CLOCK_MONOTONIC, now + 200 * 1000, 0, test_flow_control_timer_fn, b);
+        assert(r >= 0);
+
+        r = sd_event_loop(event);
+        assert(r >= 0);
+        assert(cycle.n_replies == 2 * TEST_FLOW_N_SIGNALS);
+        assert(cycle.n_exceeded > 0);
+
+        util_broker_terminate(broker);
+}
+
+static int test_flow_control_disconnect_fn(sd_event_source *source, uint64_t usec, void *userdata) {
+        sd_bus **buses = userdata;
+        int r;
+
+        /*
+         * Disconnect the receiver, while the sender is held back on it. The
+         * sender must be resumed right away, and only then gets to the call
+         * queued behind its signals.
+         */
+        sd_bus_close(buses[1]);
+
+        r = sd_bus_call_method_async(buses[0],
+                                     NULL,
+                                     "org.freedesktop.DBus",
+                                     "/org/freedesktop/DBus",
+                                     "org.freedesktop.DBus",
+                                     "GetId",
+                                     test_ping_pong_fn,
+                                     sd_event_source_get_event(source),
+                                     NULL);
+        assert(r >= 0);
+
+        return 0;
+}
+
+static void test_flow_control_disconnect(void) {
+        _c_cleanup_(util_broker_freep) Broker *broker = NULL;
+        _c_cleanup_(sd_event_unrefp) sd_event *event = NULL;
+        _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *server = NULL, *client = NULL;
+        static uint8_t payload[TEST_FLOW_SIZE];
+        const char *unique = NULL;
+        uint64_t now;
+        size_t i;
+        int r;
+
+        /*
+         * Hold back a sender on a receiver that never reads, and then
+         * disconnect the receiver. The sender must continue, rather than
+         * wait for a queue that is never going to drain.
+         *
+         * This needs a second user, so only run it as root.
+         */
+
+        if (getenv("DBUS_BROKER_TEST_DAEMON") || geteuid() != 0)
+                return;
+
+        util_broker_new(&broker);
+        broker->max_bytes = 1024 * 1024;
+        broker->flow_control = true;
+        util_broker_spawn(broker);
+
+        r = sd_event_new(&event);
+        assert(r >= 0);
+
+        test_flow_control_connect_as(broker, TEST_FLOW_UID, &server);
+        util_broker_connect(broker, &client);
+
+        r = sd_bus_get_unique_name(server, &unique);
+        assert(r >= 0);
+
+        r = sd_bus_attach_event(client, event, SD_EVENT_PRIORITY_NORMAL);
+        assert(r >= 0);
+
+        for (i = 0; i < TEST_FLOW_N_SIGNALS; ++i) {
+                _c_cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+
+                r = sd_bus_message_new_signal(client, &m, "/org/example/Foo", "org.example.Foo", "Bar");
+                assert(r >= 0);
+
+                r = sd_bus_message_set_destination(m, unique);
+                assert(r >= 0);
+
+                r = sd_bus_message_append_array(m, 'y', payload, sizeof(payload));
+                assert(r >= 0);
+
+                r = sd_bus_send(client, m, NULL);
+                assert(r >= 0);
+        }
+
+        r = sd_event_now(event, CLOCK_MONOTONIC, &now);
+        assert(r >= 0);
+
+        r = sd_event_add_time(event, NULL, CLOCK_MONOTONIC, now + 200 * 1000, 0,
+                              test_flow_control_disconnect_fn, (sd_bus *[]){ client, server });
+        assert(r >= 0);
+
+        r = sd_event_loop(event);
+        assert(r >= 0);
+
+        util_broker_terminate(broker);
+}
+
+#define TEST_OVERFLOW_N_KEYS (4)
+
+typedef struct TestOverflow {
+        const char *mode;
+        const char *name;
+        bool disconnected;
+        bool name_owner_changed;
+        size_t n_signals;
+        int64_t seq;
+        int64_t seqs[TEST_OVERFLOW_N_KEYS];
+} TestOverflow;
+
+static int test_broadcast_overflow_server_fn(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        TestOverflow *overflow = userdata;
+        const char *key, *name;
+        uint32_t seq;
+        int r;
+
+        if (sd_bus_message_is_signal(m, "org.freedesktop.DBus.Local", "Disconnected")) {
+                overflow->disconnected = true;
+                return sd_event_exit(sd_bus_get_event(sd_bus_message_get_bus(m)), 0);
+        }
+
+        if (sd_bus_message_is_signal(m, "org.freedesktop.DBus", "NameOwnerChanged")) {
+                r = sd_bus_message_read(m, "s", &name);
+                assert(r >= 0);
+
+                if (!strcmp(name, overflow->name))
+                        overflow->name_owner_changed = true;
+
+                return 0;
+        }
+
+        if (!sd_bus_message_is_signal(m, "org.example.Foo", "Bar"))
+                return 0;
+
+        r = sd_bus_message_read(m, "su", &key, &seq);
+        assert(r >= 0);
+
+        /* signals are never reordered */
+        assert((int64_t)seq > overflow->seq);
+        overflow->seq = seq;
+        ++overflow->n_signals;
+
+        if (!strcmp(overflow->mode, "coalesce"))
+                overflow->seqs[strtoul(key, NULL, 10)] = seq;
+
+        if (seq == TEST_FLOW_N_SIGNALS - 1)
+                return sd_event_exit(sd_bus_get_event(sd_bus_message_get_bus(m)), 0);
+
+        return 0;
+}
+
+static void test_broadcast_overflow_stats(sd_bus *bus, uint64_t *n_coalescedp, uint64_t *n_droppedp) {
+        _c_cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+        const char *key;
+        uint64_t value;
+        size_t n_found = 0;
+        int r;
+
+        r = sd_bus_call_method(bus, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus.Debug.Stats",
+                               "GetStats", NULL, &reply,
+                               "");
+        assert(r >= 0);
+
+        r = sd_bus_message_enter_container(reply, 'a', "{sv}");
+        assert(r >= 0);
+
+        while ((r = sd_bus_message_enter_container(reply, 'e', "sv")) > 0) {
+                r = sd_bus_message_read(reply, "s", &key);
+                assert(r >= 0);
+
+                r = sd_bus_message_read(reply, "v", "t", &value);
+                assert(r >= 0);
+
+                if (!strcmp(key, "CoalescedSignals")) {
+                        *n_coalescedp = value;
+                        ++n_found;
+                } else if (!strcmp(key, "DroppedSignals")) {
+                        *n_droppedp = value;
+                        ++n_found;
+                }
+
+                r = sd_bus_message_exit_container(reply);
+                assert(r >= 0);
+        }
+        assert(r >= 0);
+        assert(n_found == 2);
+
+        r = sd_bus_message_exit_container(reply);
+        assert(r >= 0);
+}
+
+static void test_broadcast_overflow_mode(const char *mode) {
+        _c_cleanup_(util_broker_freep) Broker *broker = NULL;
+        _c_cleanup_(sd_event_unrefp) sd_event *event = NULL;
+        _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *server = NULL, *client = NULL, *other = NULL;
+        static uint8_t payload[TEST_FLOW_SIZE];
+        TestOverflow overflow = { .mode = mode, .seq = -1 };
+        uint64_t now, n_coalesced, n_dropped;
+        size_t i;
+        int r;
+
+        /*
+         * Broadcast a lot more signals to a subscriber than its quota allows,
+         * while it does not read. Depending on the mode, the broker must
+         * either disconnect it, or make room by removing queued signals. The
+         * newest signal of each kind must always make it, and so must the
+         * signals of the driver.
+         */
+
+        util_broker_new(&broker);
+        broker->max_bytes = 1024 * 1024;
+        broker->broadcast_overflow = mode;
+        util_broker_spawn(broker);
+
+        r = sd_event_new(&event);
+        assert(r >= 0);
+
+        util_broker_connect(broker, &server);
+        util_broker_connect(broker, &client);
+
+        r = sd_bus_add_match(server, NULL, "type='signal',interface='org.example.Foo'", NULL, NULL);
+        assert(r >= 0);
+
+        r = sd_bus_add_match(server, NULL, "type='signal',sender='org.freedesktop.DBus',member='NameOwnerChanged'", NULL, NULL);
+        assert(r >= 0);
+
+        /* queue a driver signal on the server, before it runs out of quota */
+        util_broker_connect(broker, &other);
+
+        r = sd_bus_get_unique_name(other, &overflow.name);
+        assert(r >= 0);
+
+        r = sd_bus_add_filter(server, NULL, test_broadcast_overflow_server_fn, &overflow);
+        assert(r >= 0);
+
+        r = sd_bus_attach_event(client, event, SD_EVENT_PRIORITY_NORMAL);
+        assert(r >= 0);
+
+        for (i = 0; i < TEST_FLOW_N_SIGNALS; ++i) {
+                _c_cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+                char key[32];
+
+                /* in coalesce mode, signals of the same key supersede each other */
+                if (!strcmp(mode, "coalesce"))
+                        snprintf(key, sizeof(key), "%zu", i % TEST_OVERFLOW_N_KEYS);
+                else
+                        snprintf(key, sizeof(key), "%zu", i);
+
+                r = sd_bus_message_new_signal(client, &m, "/org/example/Foo", "org.example.Foo", "Bar");
+                assert(r >= 0);
+
+                r = sd_bus_message_append(m, "su", key, (uint32_t)i);
+                assert(r >= 0);
+
+                r = sd_bus_message_append_array(m, 'y', payload, sizeof(payload));
+                assert(r >= 0);
+
+                r = sd_bus_send(client, m, NULL);
+                assert(r >= 0);
+        }
+
+        r = sd_event_now(event, CLOCK_MONOTONIC, &now);
+        assert(r >= 0);
+
+        r = sd_event_add_time(event, NULL, CLOCK_MONOTONIC, now + 200 * 1000, 0, test_flow_control_timer_fn, server);
+        assert(r >= 0);
+
+        r = sd_event_loop(event);
+        assert(r >= 0);
+
+        /* the driver signal was queued first, so it arrives either way */
+        assert(overflow.name_owner_changed);
+        assert(overflow.n_signals < TEST_FLOW_N_SIGNALS);
+
+        test_broadcast_overflow_stats(other, &n_coalesced, &n_dropped);
+
+        if (!strcmp(mode, "disconnect")) {
+                assert(overflow.disconnected);
+                assert(!n_coalesced && !n_dropped);
+        } else if (!strcmp(mode, "coalesce")) {
+                assert(!overflow.disconnected);
+                assert(n_coalesced && !n_dropped);
+
+                /* only older signals of the same key were removed */
+                assert(n_coalesced + overflow.n_signals == TEST_FLOW_N_SIGNALS);
+                for (i = 0; i < TEST_OVERFLOW_N_KEYS; ++i)
+                        assert(overflow.seqs[i] == (int64_t)(TEST_FLOW_N_SIGNALS - TEST_OVERFLOW_N_KEYS + i));
+        } else {
+                assert(!overflow.disconnected);
+                assert(!n_coalesced && n_dropped);
+                assert(n_dropped + overflow.n_signals == TEST_FLOW_N_SIGNALS);
+        }
+
+        util_broker_terminate(broker);
+}
+
+static void test_broadcast_overflow(void) {
+        if (getenv("DBUS_BROKER_TEST_DAEMON"))
+                return;
+
+        test_broadcast_overflow_mode("disconnect");
+        test_broadcast_overflow_mode("coalesce");
+        test_broadcast_overflow_mode("drop");
+}
+
 int main(int argc, char **argv) {
         test_dummy();
         test_connect();
         test_self_ping();
         test_ping_pong();
+        test_reply_timeout();
+        test_flow_control();
+        test_flow_control_cycle();
+        test_flow_control_disconnect();
+        test_broadcast_overflow();
 
         return 0;
 }
@@ -985,6 +985,31 @@ static void test_list_names(void) {
                                        "ReleaseName", NULL, NULL,
                                        "s", "com.example.foo");
                 assert(r >= 0);
+
+                /* list names again, the released name must be gone */
+                reply = sd_bus_message_unref(reply);
+                r = sd_bus_call_method(bus, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                                       "ListNames", NULL, &reply,
+                                       "");
+                assert(r >= 0);
+                r = sd_bus_message_enter_container(reply, 'a', "s");
+                assert(r >= 0);
+
+                found_driver_name = found_unique_name = false;
+                while (!sd_bus_message_at_end(reply, false)) {
+                        r = sd_bus_message_read(reply, "s", &name);
+                        assert(r >= 0);
+                        assert(strcmp(name, "com.example.foo"));
+                        if (!strcmp(name, "org.freedesktop.DBus"))
+                                found_driver_name = true;
+                        else if (!strcmp(name, unique_name))
+                                found_unique_name = true;
+                }
+
+                r = sd_bus_message_exit_container(reply);
+                assert(r >= 0);
+
+                assert(found_driver_name && found_unique_name);
         }
 
         util_broker_terminate(broker);
@@ -2063,6 +2088,57 @@ static void test_get_id(void) {
         util_broker_terminate(broker);
 }
 
+static void test_get_stats(void) {
+        _c_cleanup_(util_broker_freep) Broker *broker = NULL;
+        int r;
+
+        util_broker_new(&broker);
+        util_broker_spawn(broker);
+
+        /* get the statistics and verify the large-message counters exist */
+        {
+                _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus = NULL;
+                _c_cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+                const char *key;
+                uint64_t value;
+                size_t n_large = 0;
+
+                util_broker_connect(broker, &bus);
+
+                r = sd_bus_call_method(bus, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus.Debug.Stats",
+                                       "GetStats", NULL, &reply,
+                                       "");
+                assert(r >= 0);
+
+                r = sd_bus_message_enter_container(reply, 'a', "{sv}");
+                assert(r >= 0);
+
+                while ((r = sd_bus_message_enter_container(reply, 'e', "sv")) > 0) {
+                        r = sd_bus_message_read(reply, "s", &key);
+                        assert(r >= 0);
+
+                        r = sd_bus_message_read(reply, "v", "t", &value);
+                        assert(r >= 0);
+
+                        if (!strcmp(key, "LargeMessages") ||
+                            !strcmp(key, "LargeMessageBytes") ||
+                            !strcmp(key, "PeakLargeMessageBytes") ||
+                            !strcmp(key, "TotalLargeMessages"))
+                                ++n_large;
+
+                        r = sd_bus_message_exit_container(reply);
+                        assert(r >= 0);
+                }
+                assert(r >= 0);
+                assert(n_large == 4);
+
+                r = sd_bus_message_exit_container(reply);
+                assert(r >= 0);
+        }
+
+        util_broker_terminate(broker);
+}
+
 static void test_introspect(void) {
         _c_cleanup_(util_broker_freep) Broker *broker = NULL;
         int r;
@@ -2492,6 +2568,7 @@ int main(int argc, char **argv) {
         test_get_adt_audit_session_data();
         test_get_id();
         test_reload_config();
+        test_get_stats();
         test_introspect();
         test_become_monitor();
         test_ping();
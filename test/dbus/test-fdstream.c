@@ -150,7 +150,9 @@ static int test_fd_stream_fn(DispatchFile *file) {
                         assert(m->metadata.fields.unix_fds == fdlist_count(m->fds));
 
                         if (m->metadata.fields.reply_serial == 1) {
-
+                                r = message_parse_metadata_lazy(m, 1);
+                                assert(!r);
+                                assert(m->metadata.n_args == 1);
                                 assert(!strcmp(m->metadata.args[0].value, ":1.0"));
                                 assert(!m->metadata.fields.unix_fds);
                                 ++test_fd_stream_got;
@@ -58,7 +58,7 @@ static int util_event_sigchld(sd_event_source *source, const siginfo_t *si, void
                 "a(ss)"                                                         \
                 "b"
 
-static int util_append_policy(sd_bus_message *m) {
+static int util_append_policy(sd_bus_message *m, unsigned int n_uid_ranges) {
         int r;
 
         r = sd_bus_message_open_container(m, 'v', "(" POLICY_T ")");
@@ -112,6 +112,36 @@ static int util_append_policy(sd_bus_message *m) {
                 r = sd_bus_message_open_container(m, 'a', "(buu(" POLICY_T_BATCH "))");
                 assert(r >= 0);
 
+                /*
+                 * Optional uid-ranges: every other range is a container
+                 * uid-map spanning 65536 uids above 100000, the others are
+                 * nested ranges around the uid of the test, so connecting
+                 * peers match half of them. They carry no rules, hence do
+                 * not alter the default policy.
+                 */
+                for (unsigned int i = 0; i < n_uid_ranges; ++i) {
+                        uint32_t uid = getuid(), start, end;
+
+                        if (i % 2) {
+                                start = 100000 + i * 65536;
+                                end = start + 65536 - 1;
+                        } else {
+                                start = (uid > i) ? uid - i : 0;
+                                end = uid + i;
+                        }
+
+                        r = sd_bus_message_append(m,
+                                                  "(buu(" POLICY_T_BATCH "))",
+                                                  false,
+                                                  start,
+                                                  end,
+                                                  false, UINT64_C(0),
+                                                  0,
+                                                  0,
+                                                  0);
+                        assert(r >= 0);
+                }
+
                 r = sd_bus_message_close_container(m);
                 assert(r >= 0);
         }
@@ -155,7 +185,7 @@ static int util_method_reload_config(sd_bus_message *message, void *userdata, sd
                                            "SetPolicy");
         assert(r >= 0);
 
-        r = util_append_policy(message2);
+        r = util_append_policy(message2, (uintptr_t)userdata);
         assert(r >= 0);
 
         r = sd_bus_call(bus, message2, -1, NULL, NULL);
@@ -172,10 +202,12 @@ const sd_bus_vtable util_vtable[] = {
         SD_BUS_VTABLE_END
 };
 
-void util_fork_broker(sd_bus **busp, sd_event *event, int listener_fd, pid_t *pidp) {
+void util_fork_broker(sd_bus **busp, sd_event *event, Broker *broker, pid_t *pidp) {
         _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus = NULL;
         _c_cleanup_(sd_bus_message_unrefp) sd_bus_message *message = NULL;
-        _c_cleanup_(c_freep) char *fdstr = NULL;
+        _c_cleanup_(c_freep) char *fdstr = NULL, *timeoutstr = NULL, *bytesstr = NULL;
+        const char *argv[16];
+        size_t n_argv = 0;
         int r, pair[2];
         pid_t pid;
 
@@ -196,15 +228,36 @@ void util_fork_broker(sd_bus **busp, sd_event *event, int listener_fd, pid_t *pi
                 r = asprintf(&fdstr, "%d", pair[1]);
                 assert(r >= 0);
 
-                r = execl("./src/dbus-broker",
-                          "./src/dbus-broker",
-                          "--controller", fdstr,
-                          "--machine-id", "0123456789abcdef0123456789abcdef",
-                          "--max-matches", "1000000",
-                          "--max-objects", "1000000",
-                          "--max-bytes", "1000000000",
-                          (char *)NULL);
-                /* execl(2) only returns on error */
+                r = asprintf(&timeoutstr, "%"PRIu64, broker->reply_timeout);
+                assert(r >= 0);
+
+                r = asprintf(&bytesstr, "%"PRIu64, broker->max_bytes ?: 1000000000);
+                assert(r >= 0);
+
+                argv[n_argv++] = "./src/dbus-broker";
+                argv[n_argv++] = "--controller";
+                argv[n_argv++] = fdstr;
+                argv[n_argv++] = "--machine-id";
+                argv[n_argv++] = "0123456789abcdef0123456789abcdef";
+                argv[n_argv++] = "--max-matches";
+                argv[n_argv++] = "1000000";
+                argv[n_argv++] = "--max-objects";
+                argv[n_argv++] = "1000000";
+                argv[n_argv++] = "--max-bytes";
+                argv[n_argv++] = bytesstr;
+                argv[n_argv++] = "--reply-timeout";
+                argv[n_argv++] = timeoutstr;
+                if (broker->flow_control)
+                        argv[n_argv++] = "--flow-control";
+                if (broker->broadcast_overflow) {
+                        argv[n_argv++] = "--broadcast-overflow";
+                        argv[n_argv++] = broker->broadcast_overflow;
+                }
+                argv[n_argv++] = NULL;
+                assert(n_argv <= C_ARRAY_SIZE(argv));
+
+                r = execv(argv[0], (char **)argv);
+                /* execv(3) only returns on error */
                 assert(r >= 0);
                 abort();
         }
@@ -226,7 +279,7 @@ void util_fork_broker(sd_bus **busp, sd_event *event, int listener_fd, pid_t *pi
         r = sd_bus_attach_event(bus, event, SD_EVENT_PRIORITY_NORMAL);
         assert(r >= 0);
 
-        r = sd_bus_add_object_vtable(bus, NULL, "/org/bus1/DBus/Controller", "org.bus1.DBus.Controller", util_vtable, NULL);
+        r = sd_bus_add_object_vtable(bus, NULL, "/org/bus1/DBus/Controller", "org.bus1.DBus.Controller", util_vtable, (void *)(uintptr_t)broker->n_uid_ranges);
         assert(r >= 0);
 
         r = sd_bus_start(bus);
@@ -243,10 +296,10 @@ void util_fork_broker(sd_bus **busp, sd_event *event, int listener_fd, pid_t *pi
         r = sd_bus_message_append(message,
                                   "oh",
                                   "/org/bus1/DBus/Listener/0",
-                                  listener_fd);
+                                  broker->listener_fd);
         assert(r >= 0);
 
-        r = util_append_policy(message);
+        r = util_append_policy(message, broker->n_uid_ranges);
         assert(r >= 0);
 
         r = sd_bus_call(bus, message, -1, NULL, NULL);
@@ -256,7 +309,7 @@ void util_fork_broker(sd_bus **busp, sd_event *event, int listener_fd, pid_t *pi
         bus = NULL;
 }
 
-void util_fork_daemon(sd_event *event, int pipe_fd, pid_t *pidp) {
+void util_fork_daemon(sd_event *event, int pipe_fd, uint64_t reply_timeout, pid_t *pidp) {
         static const char *config =
                 "<!DOCTYPE busconfig PUBLIC "
                 "\"-//freedesktop//DTD D-Bus Bus Configuration 1.0//EN\" "
@@ -277,8 +330,9 @@ void util_fork_daemon(sd_event *event, int pipe_fd, pid_t *pidp) {
                 "  <limit name=\"max_names_per_connection\">1000000</limit>\n"
                 "  <limit name=\"max_match_rules_per_connection\">1000000</limit>\n"
                 "  <limit name=\"max_replies_per_connection\">1000000</limit>\n"
+                "%s"
                 "</busconfig>\n";
-        _c_cleanup_(c_freep) char *fdstr = NULL, *path = NULL;
+        _c_cleanup_(c_freep) char *fdstr = NULL, *path = NULL, *limit = NULL, *text = NULL;
         const char *bin;
         ssize_t n;
         int r, fd;
@@ -298,11 +352,20 @@ void util_fork_daemon(sd_event *event, int pipe_fd, pid_t *pidp) {
                 r = fcntl(pipe_fd, F_SETFD, r & ~FD_CLOEXEC);
                 assert(r >= 0);
 
+                /* only limit the reply timeout if requested, like the broker */
+                if (reply_timeout)
+                        r = asprintf(&limit, "  <limit name=\"reply_timeout\">%"PRIu64"</limit>\n", reply_timeout);
+                else
+                        r = asprintf(&limit, "%s", "");
+                assert(r >= 0);
+                r = asprintf(&text, config, limit);
+                assert(r >= 0);
+
                 /* write config into memfd (don't set MFD_CLOEXEC) */
                 fd = c_syscall_memfd_create("dbus-daemon-config-file", 0);
                 assert(fd >= 0);
-                n = write(fd, config, strlen(config));
-                assert(n == (ssize_t)strlen(config));
+                n = write(fd, text, strlen(text));
+                assert(n == (ssize_t)strlen(text));
 
                 /* prepare argv parameters */
                 r = asprintf(&path, "--config-file=/proc/self/fd/%d", fd);
@@ -381,13 +444,13 @@ static void *util_broker_thread(void *userdata) {
         assert(r >= 0);
 
         if (broker->listener_fd >= 0) {
-                util_fork_broker(&bus, event, broker->listener_fd, &broker->child_pid);
+                util_fork_broker(&bus, event, broker, &broker->child_pid);
                 /* dbus-broker reports its controller in GetConnectionUnixProcessID */
                 broker->pid = getpid();
                 broker->listener_fd = c_close(broker->listener_fd);
         } else {
                 assert(broker->listener_fd < 0);
-                util_fork_daemon(event, broker->pipe_fds[1], &broker->child_pid);
+                util_fork_daemon(event, broker->pipe_fds[1], broker->reply_timeout, &broker->child_pid);
                 /* dbus-daemon reports itself in GetConnectionUnixProcessID */
                 broker->pid = broker->child_pid;
         }
@@ -23,6 +23,11 @@ struct Broker {
         int pipe_fds[2];
         pid_t pid;
         pid_t child_pid;
+        unsigned int n_uid_ranges;
+        uint64_t reply_timeout;
+        uint64_t max_bytes;
+        bool flow_control;
+        const char *broadcast_overflow;
 };
 
 #define BROKER_NULL {                                                           \
@@ -36,8 +41,8 @@ struct Broker {
 /* misc */
 
 void util_event_new(sd_event **eventp);
-void util_fork_broker(sd_bus **busp, sd_event *event, int listener_fd, pid_t *pidp);
-void util_fork_daemon(sd_event *event, int pipe_fd, pid_t *pidp);
+void util_fork_broker(sd_bus **busp, sd_event *event, Broker *broker, pid_t *pidp);
+void util_fork_daemon(sd_event *event, int pipe_fd, uint64_t reply_timeout, pid_t *pidp);
 
 /* broker */
 